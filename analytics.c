@@ -0,0 +1,163 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Conversation timing analytics
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "analytics.h"
+
+/* How much of a GA word the caller has typed */
+enum ga_state {
+	GA_BOUNDARY = 0,			/*!< At the start of a word */
+	GA_G,
+	GA_GA,
+	GA_OTHER,					/*!< In some other word */
+};
+
+void analytics_init(struct analytics *a)
+{
+	memset(a, 0, sizeof(*a));
+	a->last_side = -1;
+}
+
+static void timing_add(struct analytics_timing *t, uint64_t ms)
+{
+	t->count++;
+	t->total_ms += ms;
+	if (ms > t->max_ms) {
+		t->max_ms = ms;
+	}
+}
+
+/*! \brief Track GA (as a whole word) in what the caller types */
+static void ga_char(struct analytics *a, char c, uint64_t now_ms)
+{
+	if (!isalnum((unsigned char) c)) {
+		if (a->ga_state == GA_GA && !a->ga_pending) {
+			a->ga_pending = 1;
+		}
+		a->ga_state = GA_BOUNDARY;
+	} else if (a->ga_state == GA_BOUNDARY && toupper(c) == 'G') {
+		a->ga_state = GA_G;
+	} else if (a->ga_state == GA_G && toupper(c) == 'A') {
+		a->ga_state = GA_GA;
+		if (!a->ga_pending) {
+			a->ga_ms = now_ms;
+		}
+	} else {
+		a->ga_state = GA_OTHER;
+	}
+}
+
+void analytics_text(struct analytics *a, enum analytics_side side, const char *text, size_t len, uint64_t now_ms)
+{
+	struct analytics_side_stats *s = &a->stats.side[side];
+	uint64_t gap;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (a->last_side < 0) {
+			a->first_ms = now_ms;
+			a->stats.sessions = 1;
+			s->turns++;
+		} else {
+			gap = now_ms - a->last_ms;
+			if (gap >= ANALYTICS_IDLE_MS) {
+				timing_add(&a->stats.idle, gap);
+			}
+			if (a->last_side != (int) side) {
+				s->turns++;
+				timing_add(&s->turn_gap, gap);
+			} else if (gap < ANALYTICS_IDLE_MS) {
+				s->typing_ms += gap;
+			}
+		}
+		if (side == SIDE_TTY) {
+			ga_char(a, text[i], now_ms);
+		} else if (a->ga_pending || a->ga_state == GA_GA) {
+			/* The operator started answering (maybe before the caller finished the line) */
+			timing_add(&a->stats.ga_reply, now_ms - a->ga_ms);
+			a->ga_pending = 0;
+			a->ga_state = GA_BOUNDARY;
+		}
+		s->chars++;
+		a->last_side = (int) side;
+		a->last_ms = now_ms;
+	}
+	a->stats.duration_ms = a->last_ms - a->first_ms;
+}
+
+static void timing_merge(struct analytics_timing *total, const struct analytics_timing *t)
+{
+	total->count += t->count;
+	total->total_ms += t->total_ms;
+	if (t->max_ms > total->max_ms) {
+		total->max_ms = t->max_ms;
+	}
+}
+
+void analytics_merge(struct analytics_stats *total, const struct analytics_stats *stats)
+{
+	int i;
+
+	total->sessions += stats->sessions;
+	total->duration_ms += stats->duration_ms;
+	for (i = 0; i < 2; i++) {
+		total->side[i].chars += stats->side[i].chars;
+		total->side[i].turns += stats->side[i].turns;
+		total->side[i].typing_ms += stats->side[i].typing_ms;
+		timing_merge(&total->side[i].turn_gap, &stats->side[i].turn_gap);
+	}
+	timing_merge(&total->idle, &stats->idle);
+	timing_merge(&total->ga_reply, &stats->ga_reply);
+}
+
+static unsigned long cpm(const struct analytics_side_stats *s)
+{
+	return s->typing_ms ? (unsigned long) (s->chars * 60000ULL / s->typing_ms) : 0;
+}
+
+static unsigned long avg_ms(const struct analytics_timing *t)
+{
+	return t->count ? (unsigned long) (t->total_ms / t->count) : 0;
+}
+
+int analytics_format(const struct analytics_stats *stats, char *buf, size_t len)
+{
+	const struct analytics_side_stats *tty = &stats->side[SIDE_TTY], *ca = &stats->side[SIDE_CA];
+
+	return snprintf(buf, len, "sessions=%lu duration_s=%lu"
+		" tty_chars=%lu tty_cpm=%lu tty_turns=%lu tty_gap_avg_ms=%lu tty_gap_max_ms=%lu"
+		" ca_chars=%lu ca_cpm=%lu ca_turns=%lu ca_gap_avg_ms=%lu ca_gap_max_ms=%lu"
+		" ga_replies=%lu ga_reply_avg_ms=%lu ga_reply_max_ms=%lu idle=%lu idle_s=%lu",
+		stats->sessions, (unsigned long) (stats->duration_ms / 1000),
+		tty->chars, cpm(tty), tty->turns, avg_ms(&tty->turn_gap), (unsigned long) tty->turn_gap.max_ms,
+		ca->chars, cpm(ca), ca->turns, avg_ms(&ca->turn_gap), (unsigned long) ca->turn_gap.max_ms,
+		stats->ga_reply.count, avg_ms(&stats->ga_reply), (unsigned long) stats->ga_reply.max_ms,
+		stats->idle.count, (unsigned long) (stats->idle.total_ms / 1000));
+}
@@ -0,0 +1,99 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Conversation timing analytics
+ *
+ * Computed as text goes by, in constant time and space per character:
+ * how fast each side types, how long each side takes to start typing once
+ * the other stops (turn gaps), idle periods, and how long the operator takes
+ * to start answering once the caller types GA (go ahead).
+ *
+ * Timing is per character, so it is only meaningful for sessions with
+ * per-character RX (i.e. ones someone is conversing on, not only recording).
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \brief A gap at least this long is idle, rather than typing */
+#define ANALYTICS_IDLE_MS 10000
+
+enum analytics_side {
+	SIDE_TTY = 0,				/*!< The caller (received) */
+	SIDE_CA,					/*!< The operator (sent) */
+};
+
+/*! \brief A duration, summarized */
+struct analytics_timing {
+	unsigned long count;
+	uint64_t total_ms;
+	uint64_t max_ms;
+};
+
+struct analytics_side_stats {
+	unsigned long chars;
+	unsigned long turns;
+	uint64_t typing_ms;			/*!< Between characters of the same turn, not counting idle gaps */
+	struct analytics_timing turn_gap;	/*!< From the other side's last character to this side's first */
+};
+
+struct analytics_stats {
+	unsigned long sessions;		/*!< Sessions with any text */
+	uint64_t duration_ms;		/*!< From the first character to the last */
+	struct analytics_side_stats side[2];
+	struct analytics_timing idle;		/*!< Gaps of at least ANALYTICS_IDLE_MS */
+	struct analytics_timing ga_reply;	/*!< From the caller's GA to the operator's first character */
+};
+
+/*! \brief Analytics for a conversation in progress */
+struct analytics {
+	struct analytics_stats stats;
+	uint64_t first_ms;
+	uint64_t last_ms;
+	int last_side;				/*!< -1 before any text */
+	int ga_state;				/*!< How much of a GA word the caller has typed */
+	int ga_pending;				/*!< The caller typed GA, and the operator hasn't started answering */
+	uint64_t ga_ms;
+};
+
+void analytics_init(struct analytics *a);
+
+/*!
+ * \brief Account for text from one side
+ * \param a
+ * \param side
+ * \param text
+ * \param len
+ * \param now_ms Monotonic time, in ms
+ */
+void analytics_text(struct analytics *a, enum analytics_side side, const char *text, size_t len, uint64_t now_ms);
+
+/*! \brief Add a conversation's stats (or a total) to a total */
+void analytics_merge(struct analytics_stats *total, const struct analytics_stats *stats);
+
+/*!
+ * \brief Format stats as one line of name=value pairs, e.g. for a transcript
+ * \return Length, as snprintf
+ */
+int analytics_format(const struct analytics_stats *stats, char *buf, size_t len);
@@ -86,84 +86,174 @@
 #include <cami/cami.h>
 #include <cami/cami_actions.h>
 
+#include "asttyspy.h"
+#include "session.h"
+#include "record.h"
+#include "rtt.h"
+#include "relay.h"
+#include "sipmsg.h"
+#include "campaign.h"
+#include "broadcast.h"
+#include "viewer.h"
+#include "webconsole.h"
+#include "complete.h"
+#include "analytics.h"
+#include "vclock.h"
+#include "trace.h"
+#include "stall.h"
+#include "chanmeta.h"
+#include "probes.h"
+
 #define TTY_MENU_OPTS "ESC +" \
 	" [H] Help" \
 	" [Q] Quit" \
 	" [1] Dial Number" \
 	" [2] Hangup" \
 	" [4] Send Greeting" \
+	" [5] Broadcast" \
+	" [6] Timing" \
+	" [7] Sessions" \
 	" [8] Clear Screen" \
+	"\n" \
+	"TAB accepts a suggestion" \
 	"\n"
 
-#define TTY_RX_OPTIONS "b(1)s"
 #define TERM_CLEAR "\e[1;1H\e[2J"
 #define KEY_ESCAPE 27
+#define KEY_TAB 9
 
 static pthread_mutex_t ttymutex = PTHREAD_MUTEX_INITIALIZER;
-static char ttychan[256] = "";
+char ttychan[256] = "";
 static struct termios origterm, ttyterm;
 
 /* Internal flags */
-static int new_channel = 0;
+int new_channel = 0;
 static int our_turn = 0;
-static int tty_active = 0;
+int tty_active = 0;
+static char suggestion[COMPLETE_MAX_PHRASE + 1] = ""; /* Shown (dimmed) after the cursor */
+static char channel_filter[64] = ""; /* Only list channels whose metadata contains this */
 
 /* Options */
-static int always_refresh = 0;
+int always_refresh = 0;
+struct rtt_gateway *rtt_gateway = NULL;
+struct msg_gateway *msg_gateway = NULL;
+struct completer *completer = NULL;
+
+/*! \brief Erase the suggestion, if one is shown. Must be called with ttymutex held. */
+static void hide_suggestion(void)
+{
+	if (suggestion[0]) {
+		printf("\e[K"); /* The cursor is still where it was before the suggestion */
+		suggestion[0] = '\0';
+	}
+}
+
+/*! \brief CPU time used by this thread so far */
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
 
 /*! \brief Callback function executing asynchronously when new events are available */
-static void ami_callback(struct ami_session *ami, struct ami_event *event)
+void ami_callback(struct ami_session *ami, struct ami_event *event)
 {
-	const char *msg, *channel, *eventname = ami_keyvalue(event, "Event");
+	const char *msg = NULL, *channel = NULL, *eventname;
+	uint64_t tstart, tparse, tdispatch, trender, tflush, cpu_start;
+	struct stall_sample stall;
 
 	(void) ami;
 
-	if (tty_active == 1 && (!strcmp(eventname, "Newchannel") || !strcmp(eventname, "Hangup") || !strcmp(eventname, "DeviceStateChange"))) {
-		new_channel = 1; /* Keep track of any changes in the channels that exist. */
-		goto cleanup;
-	} else if (tty_active < 2) {
-		goto cleanup; /* TTY isn't even active yet */
-	} else if (strcmp(eventname, "TddRxMsg")) {
+	cpu_start = thread_cpu_ns();
+	stall_begin(&stall);
+	tstart = trace_begin();
+	tparse = trace_begin();
+	eventname = ami_keyvalue(event, "Event");
+	trace_end("parse", tparse, NULL);
+	stall_mark(&stall, STALL_PARSE);
+	ASTTYSPY_PROBE1(event__arrive, eventname);
+
+	tdispatch = trace_begin();
+	if (!strcmp(eventname, "TddRxMsg")) {
+		channel = ami_keyvalue(event, "Channel");
+		msg = ami_keyvalue(event, "Message");
+		relay_rx(channel, msg);
+		campaign_rx(channel, msg);
+		if (session_rx(channel, msg) || tty_active < 2 || strcmp(channel, ttychan)) {
+			goto cleanup; /* Not our channel, or only being recorded */
+		}
+	} else {
+		chanmeta_event(event, eventname); /* First, so it's there for anything that starts because of this event */
+		if (!strcmp(eventname, "Newchannel") || !strcmp(eventname, "Hangup") || !strcmp(eventname, "DeviceStateChange")) {
+			if (tty_active == 1) {
+				new_channel = 1; /* Keep track of any changes in the channels that exist. */
+			}
+			if (!strcmp(eventname, "Newchannel")) {
+				recorder_channel_created(ami_keyvalue(event, "Channel"));
+			} else if (!strcmp(eventname, "Hangup")) {
+				session_hangup(ami_keyvalue(event, "Channel"));
+				relay_hangup(ami_keyvalue(event, "Channel"));
+				webconsole_hangup(ami_keyvalue(event, "Channel"));
+				campaign_event(event);
+			}
+		} else if (!strcmp(eventname, "OriginateResponse")) {
+			campaign_event(event);
+		} else if (!strcmp(eventname, "UserEvent") && msg_gateway) {
+			msg_gateway_event(msg_gateway, event); /* Doesn't block */
+		}
 		goto cleanup; /* Don't care about non-TTY stuff */
 	}
-
-	channel = ami_keyvalue(event, "Channel");
-	if (strcmp(channel, ttychan)) {
-		goto cleanup; /* Not our channel */
-	}
+	trace_end("dispatch", tdispatch, channel);
+	stall_mark(&stall, STALL_DISPATCH);
 
 	/* Okay, this is actually for us. */
-	msg = ami_keyvalue(event, "Message");
+	ASTTYSPY_PROBE2(rx__message, channel, msg);
 	pthread_mutex_lock(&ttymutex);
+	stall_mark(&stall, STALL_LOCK);
+	trender = trace_begin();
+	hide_suggestion();
 	if (our_turn) {
 		printf("\nTTY: "); /* We changed who was typing. */
 		our_turn = 0;
 	}
-	if (!strcmp(msg, "\\n")) { /* Convert text '\n' to actual newline */
-		printf("\n");
-	} else {
+	{
 		char *msgdup = strdup(msg);
 		if (msgdup) {
-			char *c = msgdup;
-			/* Replace _ with space */
-			while (*c) {
-				if (*c == '_') {
-					*c = ' ';
-				}
-				c++;
-			}
+			tty_unescape(msgdup); /* Replace _ with space, and convert text '\n' to actual newline */
 			printf("%s", msgdup);
+			if (rtt_gateway) {
+				rtt_gateway_text(rtt_gateway, msgdup); /* Doesn't block */
+			}
+			if (msg_gateway) {
+				msg_gateway_text(msg_gateway, msgdup); /* Doesn't block */
+			}
 			free(msgdup);
 		}
 	}
+	trace_end("render", trender, channel);
+	stall_mark(&stall, STALL_RENDER);
+	tflush = trace_begin();
 	fflush(stdout);
+	trace_end("flush", tflush, channel);
+	stall_mark(&stall, STALL_FLUSH);
+	ASTTYSPY_PROBE1(output__flush, channel);
 	pthread_mutex_unlock(&ttymutex);
 
 cleanup:
+	if (!channel) {
+		stall_mark(&stall, STALL_DISPATCH); /* Not a TTY event, so everything went to dispatching it */
+	}
+	stall_end(&stall, 0, eventname, channel, msg);
+	if (channel) {
+		session_charge(channel, thread_cpu_ns() - cpu_start); /* Before freeing the event, which the name is in */
+	}
 	ami_event_free(event); /* Free event when done with it */
+	trace_end("ami_event", tstart, channel);
 }
 
-static void simple_disconnect_callback(struct ami_session *ami)
+void simple_disconnect_callback(struct ami_session *ami)
 {
 	/* Start with a newline, since we don't know where we were. */
 	(void) ami;
@@ -181,7 +271,7 @@ static int wait_for_input(int timeout)
 	pfd.events = POLLIN;
 
 	for (;;) {
-		res = poll(&pfd, 1, timeout);
+		res = vclock_poll(&pfd, 1, timeout);
 		if (res < 0) {
 			if (errno == EINTR) {
 				continue;
@@ -198,57 +288,230 @@ static int wait_for_input(int timeout)
 
 #define IS_DTMF(x) (isdigit(x) || (x >= 'A' && x <= 'D') || x == '*' || x == '#')
 
-static int send_dtmf(struct ami_session *ami, char digit)
+int send_dtmf(struct ami_session *ami, char digit)
 {
-	int res = ami_action_response_result(ami, ami_action(ami, "PlayDTMF", "Channel:%s\r\nDigit:%c", ttychan, digit));
+	int res;
+	uint64_t tstart = trace_begin();
+	struct stall_sample stall;
+	char detail[2] = { digit, '\0' };
+
+	stall_begin(&stall);
+	ASTTYSPY_PROBE2(dtmf__submit, ttychan, digit);
+	res = ami_action_response_result(ami, ami_action(ami, "PlayDTMF", "Channel:%s\r\nDigit:%c", ttychan, digit));
+	ASTTYSPY_PROBE3(dtmf__complete, ttychan, digit, res);
+	trace_end("PlayDTMF", tstart, ttychan);
+	stall_mark(&stall, STALL_AMI);
+	stall_end(&stall, 1, "PlayDTMF", ttychan, detail);
 	return res;
 }
 
-static int send_msg(struct ami_session *ami, const char *typed)
+char *tdd_escape(const char *text, size_t *len)
 {
-	int res;
-	char *tmp, *ttymsg = strdup(typed);
+	const char *in;
+	char *tmp, *ttymsg = malloc(2 * strlen(text) + 1);
 
 	if (!ttymsg) {
-		return -1;
+		return NULL;
 	}
 
-	pthread_mutex_lock(&ttymutex);
-
-	/* Replace spaces with _ for AMI, since it ignores whitespace. */
+	/* Replace spaces with _ for AMI, since it ignores whitespace, and escape newlines (the reverse of tty_unescape). */
 	tmp = ttymsg;
-	while (*tmp) {
-		if (*tmp == ' ') {
-			*tmp = '_';
+	for (in = text; *in; in++) {
+		if (*in == ' ') {
+			*tmp++ = '_';
+		} else if (*in == '\n') {
+			*tmp++ = '\\';
+			*tmp++ = 'n';
+		} else {
+			*tmp++ = *in;
 		}
-		tmp++;
 	}
+	*tmp = '\0';
+	*len = (size_t) (tmp - ttymsg);
+	return ttymsg;
+}
 
-	res = ami_action_response_result(ami, ami_action(ami, "TddTx", "Channel:%s\r\nMessage:%s", ttychan, ttymsg));
+int tdd_tx_escaped(struct ami_session *ami, const char *channel, const char *escaped, size_t len, const char *text)
+{
+	int res;
+	uint64_t tstart = trace_begin();
+	struct stall_sample stall;
+
+	stall_begin(&stall);
+	ASTTYSPY_PROBE2(tx__submit, channel, len);
+	res = ami_action_response_result(ami, ami_action(ami, "TddTx", "Channel:%s\r\nMessage:%s", channel, escaped));
+	ASTTYSPY_PROBE3(tx__complete, channel, len, res);
+	trace_end("TddTx", tstart, channel);
+	stall_mark(&stall, STALL_AMI);
+	stall_end(&stall, 1, "TddTx", channel, escaped);
+	if (!res) {
+		session_tx(channel, text);
+	}
+	return res;
+}
+
+int tdd_tx(struct ami_session *ami, const char *channel, const char *text)
+{
+	int res;
+	size_t len;
+	char *ttymsg = tdd_escape(text, &len);
+
+	if (!ttymsg) {
+		return -1;
+	}
+	res = tdd_tx_escaped(ami, channel, ttymsg, len, text);
+	free(ttymsg);
+	return res;
+}
+
+int send_msg(struct ami_session *ami, const char *typed)
+{
+	int res;
+	uint64_t trender, tflush;
+
+	pthread_mutex_lock(&ttymutex);
+	res = tdd_tx(ami, ttychan, typed);
+
+	trender = trace_begin();
+	hide_suggestion();
 	if (!res && !our_turn) {
 		printf("\nCA : "); /* We changed who was typing. */
 		our_turn = 1;
 	}
 
 	printf("%s", typed); /* Echo original input */
+	trace_end("render", trender, ttychan);
 	pthread_mutex_unlock(&ttymutex);
 
 	if (res) {
 		fprintf(stderr, "\n*** CALL DISCONNECTED ***\n");
 	} else {
+		tflush = trace_begin();
 		fflush(stdout);
+		trace_end("flush", tflush, ttychan);
+		ASTTYSPY_PROBE1(output__flush, ttychan);
 	}
-
-	free(ttymsg);
 	return res;
 }
 
+/*! \brief Prompt for a message, and send it to every TTY session (or those matching a pattern) */
+static int prompt_broadcast(struct ami_session *ami)
+{
+	struct broadcast_result result;
+	char pattern[128], msg[256];
+	int res;
+
+	printf("\nBROADCAST TO (Enter for all): ");
+	fflush(stdout);
+	tcsetattr(STDIN_FILENO, TCSANOW, &origterm); /* Read with buffering and echo */
+	res = !fgets(pattern, sizeof(pattern), stdin);
+	if (!res) {
+		printf("MSG: ");
+		fflush(stdout);
+		res = !fgets(msg, sizeof(msg), stdin);
+	}
+	tcsetattr(STDIN_FILENO, TCSANOW, &ttyterm); /* Disable input buffering again. */
+	if (res) {
+		return -1; /* Disconnect */
+	}
+	pattern[strcspn(pattern, "\r\n")] = '\0';
+	msg[strcspn(msg, "\r")] = '\0'; /* Keep the newline, so the notice ends the line */
+	if (!strcmp(msg, "\n") || !*msg) {
+		return 0;
+	}
+
+	if (broadcast(ami, *pattern ? pattern : NULL, msg, &result)) {
+		printf("Broadcast failed\n");
+	} else {
+		printf("Broadcast to %d channel%s: %d acknowledged, %d failed, first after %.1f ms, last after %.1f ms\n",
+			result.channels, result.channels == 1 ? "" : "s", result.acknowledged, result.failed,
+			(double) result.first_ack_us / 1000.0, (double) result.last_ack_us / 1000.0);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/*! \brief Show what completion suggests for the rest of the phrase or word, without moving the cursor */
+static void show_suggestion(void)
+{
+	const char *rest;
+	size_t len;
+
+	pthread_mutex_lock(&ttymutex);
+	hide_suggestion();
+	rest = completer_suggest(completer, &len);
+	if (rest) {
+		memcpy(suggestion, rest, len);
+		suggestion[len] = '\0';
+		printf("\e[2m%s\e[0m\e[%luD", suggestion, (unsigned long) len);
+	}
+	fflush(stdout);
+	pthread_mutex_unlock(&ttymutex);
+}
+
+/*! \brief Send what the operator typed (or a macro or suggestion), and keep track of it for completion */
+static int send_typed(struct ami_session *ami, const char *typed)
+{
+	const char *s;
+
+	if (send_msg(ami, typed)) {
+		return -1;
+	}
+	if (completer) {
+		for (s = typed; *s; s++) {
+			completer_typed(completer, *s);
+		}
+		show_suggestion();
+	}
+	return 0;
+}
+
+/*! \brief Show the timing analytics of this conversation, and of every session */
+static void show_timing(void)
+{
+	struct analytics_stats stats;
+	char buf[512];
+
+	pthread_mutex_lock(&ttymutex);
+	hide_suggestion();
+	if (!session_analytics(ttychan, &stats)) {
+		analytics_format(&stats, buf, sizeof(buf));
+		printf("\nTiming, this call: %s\n", buf);
+	}
+	sessions_report(stdout);
+	fflush(stdout);
+	pthread_mutex_unlock(&ttymutex);
+}
+
+/*! \brief Show what each session has cost so far, most expensive first */
+static void show_sessions(void)
+{
+	struct session_cost *costs;
+	int i, n = session_costs(&costs);
+
+	if (n < 0) {
+		return;
+	}
+	pthread_mutex_lock(&ttymutex);
+	hide_suggestion();
+	printf("\nSessions: %d, by CPU time\n", n);
+	printf("  %-40s %10s %8s %9s %8s %8s %7s\n", "Channel", "CPU ms", "Events", "Memory", "Queued", "History", "Viewers");
+	for (i = 0; i < n; i++) {
+		printf("%c %-40s %10.3f %8lu %9lu %8lu %8lu %7d\n", strcmp(costs[i].channel, ttychan) ? ' ' : '*', costs[i].channel,
+			(double) costs[i].cpu_ns / 1e6, costs[i].events, (unsigned long) costs[i].bytes, (unsigned long) costs[i].queued,
+			(unsigned long) costs[i].history, costs[i].viewers);
+	}
+	fflush(stdout);
+	pthread_mutex_unlock(&ttymutex);
+	free(costs);
+}
+
 static int handle_input(struct ami_session *ami)
 {
 	struct pollfd pfd;
 	int res;
 	int esc_mode, dtmf_mode = 0, got_escape = 0;
-	char dialnum[64];
+	char dialnum[64], rest[sizeof(suggestion)];
 
 	/* Wait for input. */
 	pfd.fd = STDIN_FILENO;
@@ -256,7 +519,7 @@ static int handle_input(struct ami_session *ami)
 
 	for (;;) {
 		/* This thread will block forever on input. */
-		res = poll(&pfd, 1, -1);
+		res = vclock_poll(&pfd, 1, -1);
 		if (res < 0) {
 			if (errno == EINTR) {
 				continue;
@@ -265,7 +528,11 @@ static int handle_input(struct ami_session *ami)
 		} else if (pfd.revents) {
 			/* Got some input. */
 			char tmpbuf[2];
-			int num_read = read(STDIN_FILENO, tmpbuf, 1); /* Only read one char. */
+			int num_read;
+			uint64_t tread = trace_begin();
+
+			num_read = read(STDIN_FILENO, tmpbuf, 1); /* Only read one char. */
+			trace_end("key_read", tread, NULL);
 
 			if (num_read < 1) {
 				break; /* Disconnect */
@@ -313,7 +580,7 @@ static int handle_input(struct ami_session *ami)
 								if (send_dtmf(ami, *current_digit)) {
 									return -1;
 								}
-								usleep(100000); /* Wait 100ms */
+								vclock_sleep_ms(100); /* Wait 100ms */
 							}
 							current_digit++;
 						}
@@ -321,10 +588,21 @@ static int handle_input(struct ami_session *ami)
 					case '2': /* Disconnect (start over) */
 						return 0;
 					case '4': /* Send greeting memo */
-						if (send_msg(ami, "HELLO GA")) {
+						if (send_typed(ami, "HELLO GA")) {
+							return -1;
+						}
+						break;
+					case '5': /* Broadcast to all TTY sessions */
+						if (prompt_broadcast(ami)) {
 							return -1;
 						}
 						break;
+					case '6': /* Timing analytics */
+						show_timing();
+						break;
+					case '7': /* What each session costs */
+						show_sessions();
+						break;
 					case '8': /* Clear */
 						printf(TERM_CLEAR);
 						fflush(stdout);
@@ -344,9 +622,20 @@ static int handle_input(struct ami_session *ami)
 				continue;
 			}
 
+			if (tmpbuf[0] == KEY_TAB) {
+				/* Accept the suggestion, sent all at once */
+				pthread_mutex_lock(&ttymutex);
+				strcpy(rest, suggestion);
+				pthread_mutex_unlock(&ttymutex);
+				if (rest[0] && send_typed(ami, rest)) {
+					return -1;
+				}
+				continue;
+			}
+
 			assert(num_read == 1);
 			tmpbuf[1] = '\0'; /* Null terminate for string printing */
-			if (send_msg(ami, tmpbuf)) {
+			if (send_typed(ami, tmpbuf)) {
 				return -1;
 			}
 		}
@@ -354,32 +643,69 @@ static int handle_input(struct ami_session *ami)
 	return -1;
 }
 
-static struct ami_response *print_channels(struct ami_session *ami, int *iptr)
+/*! \brief CPU time spent on a channel's session, for the channel list */
+static const char *session_cpu(const struct session_cost *costs, int num_costs, const char *channel, char *buf, size_t len)
 {
-	int i = *iptr;
+	int i;
+
+	for (i = 0; i < num_costs; i++) {
+		if (!strcmp(costs[i].channel, channel)) {
+			snprintf(buf, len, "%.1f", (double) costs[i].cpu_ns / 1e6);
+			return buf;
+		}
+	}
+	return "-";
+}
+
+struct ami_response *print_channels(struct ami_session *ami, int *iptr)
+{
+	int i = *iptr, num_costs, shown = 0;
 	struct ami_response *resp;
+	struct session_cost *costs;
+	struct chan_meta meta;
+	const char *channel;
+	char cpu[16];
 
 	resp = ami_action_show_channels(ami);
 	if (!resp) {
 		fprintf(stderr, "Failed to get channel list\n");
 		return NULL;
 	}
+	num_costs = session_costs(&costs); /* Channels that already have a session (being recorded, or watched elsewhere) */
 	/* Got a response to our action */
-#define AMI_CHAN_FORMAT_HDR "%4s | %-40s | %8s | %15s | %15s\n"
-#define AMI_CHAN_FORMAT_MSG "%4d | %-40s | %8s | %15s | %15s\n"
+#define AMI_CHAN_FORMAT_HDR "%4s | %-40s | %8s | %15s | %15s | %12s | %10s\n"
+#define AMI_CHAN_FORMAT_MSG "%4d | %-40s | %8s | %15s | %15s | %12s | %10s\n"
 
 	/* The first "event" is simply the fields in the response itself (so ignore it). */
 	/* The last event is simply "CoreShowChannelsComplete", for this action response (so ignore it). */
-	printf("Channels: %d\n", resp->size - 2);
-	printf(AMI_CHAN_FORMAT_HDR, "#", "Channel", "Duration", "Caller ID", "Called No.");
+	printf(AMI_CHAN_FORMAT_HDR, "#", "Channel", "Duration", "Caller ID", "Called No.", "DID", "TTY CPU ms");
 	for (i = 1; i < resp->size - 1; i++) {
+		channel = ami_keyvalue(resp->events[i], "Channel");
+		chanmeta_event(resp->events[i], "CoreShowChannel"); /* For channels from before we connected */
+		if (channel_filter[0] && !chanmeta_match(channel, channel_filter)) {
+			continue; /* Keep the numbering, so the number picked is still the event's index */
+		}
+		if (chanmeta_get(channel, &meta)) {
+			meta.exten[0] = '\0';
+		}
 		printf(AMI_CHAN_FORMAT_MSG,
 			i,
-			ami_keyvalue(resp->events[i], "Channel"),
+			channel,
 			ami_keyvalue(resp->events[i], "Duration"),
 			ami_keyvalue(resp->events[i], "CallerIDNum"),
-			ami_keyvalue(resp->events[i], "ConnectedLineNum")
+			ami_keyvalue(resp->events[i], "ConnectedLineNum"),
+			meta.exten,
+			session_cpu(costs, num_costs, channel, cpu, sizeof(cpu))
 		);
+		shown++;
+	}
+	if (channel_filter[0]) {
+		printf("Channels: %d of %d matching \"%s\" (/ to show all)\n", shown, resp->size - 2, channel_filter);
+	} else {
+		printf("Channels: %d (/text to show only channels whose caller ID, DID, account code, etc. contain it)\n", shown);
+	}
+	if (num_costs >= 0) {
+		free(costs);
 	}
 
 #undef AMI_CHAN_FORMAT_HDR
@@ -390,7 +716,7 @@ static struct ami_response *print_channels(struct ami_session *ami, int *iptr)
 
 static int get_channel(struct ami_session *ami)
 {
-	char channo[15];
+	char channo[sizeof(channel_filter) + 2];
 	int chan_no;
 	struct ami_response *resp = NULL;
 	int i, res, invalid = 0;
@@ -438,6 +764,10 @@ static int get_channel(struct ami_session *ami)
 		if (!strcasecmp(channo, "q\n")) {
 			res = -1;
 			break;
+		} else if (channo[0] == '/') {
+			/* Filter the list */
+			channo[strcspn(channo, "\n")] = '\0';
+			snprintf(channel_filter, sizeof(channel_filter), "%s", channo + 1);
 		} else if (strcmp(channo, "\n")) {
 			/* We got something (hopefully a valid channel number) */
 			chan_no = atoi(channo);
@@ -469,8 +799,28 @@ static void restore_term(int num)
 	exit(EXIT_FAILURE);
 }
 
-static int ttyspy(struct ami_session *ami)
+int tty_attach(struct ami_session *ami)
 {
+	/* Enable TTY on the target channel, with per-character RX for realtime display. */
+	if (session_observe(ami, ttychan)) {
+		return -1;
+	}
+	recorder_add(ttychan); /* Also record it, if we're recording */
+	ASTTYSPY_PROBE1(session__attach, ttychan);
+	return 0;
+}
+
+void tty_detach(struct ami_session *ami)
+{
+	ASTTYSPY_PROBE1(session__detach, ttychan);
+	session_unobserve(ami, ttychan);
+	ttychan[0] = '\0';
+}
+
+int ttyspy(struct ami_session *ami)
+{
+	int res;
+
 	tcgetattr(STDIN_FILENO, &origterm);
 	ttyterm = origterm;
 
@@ -487,10 +837,7 @@ static int ttyspy(struct ami_session *ami)
 			break;
 		}
 
-		/* Enable TTY on the target channel. */
-		if (ami_action_response_result(ami, ami_action(ami, "TddRx", "Channel:%s\r\nOptions:%s", ttychan, TTY_RX_OPTIONS))) {
-			/* This could be because TTY was already enabled on the channel (can't do it twice) */
-			fprintf(stderr, "Failed to enable TTY on channel %s\n", ttychan);
+		if (tty_attach(ami)) {
 			break;
 		}
 
@@ -506,91 +853,33 @@ static int ttyspy(struct ami_session *ami)
 		tty_active = 2; /* Get set, go! */
 		tcsetattr(STDIN_FILENO, TCSANOW, &ttyterm); /* Apply changes */
 
-		if (handle_input(ami)) {
-			break;
+		res = handle_input(ami);
+		tty_detach(ami); /* Do it on a new channel, so prompt for channel explicitly */
+		if (completer) {
+			completer_reset(completer); /* But keep what was learned */
 		}
-		/* Do it on a new channel, so prompt for channel explicitly */
-		ttychan[0] = '\0';
-	}
-
-	ami_disconnect(ami);
-	ami_destroy(ami);
-	tcsetattr(STDIN_FILENO, TCSANOW, &origterm); /* Restore the original term settings */
-	return 0;
-}
-
-static void show_help(void)
-{
-	printf("AsTTYSpy for Asterisk\n");
-	printf(" -c <channel> Target channel with which to converse using this virtual TTY. If not provided, will prompt for selection.\n");
-	printf(" -h           Show this help\n");
-	printf(" -l           Asterisk AMI hostname. Default is localhost (127.0.0.1)\n");
-	printf(" -p           Asterisk AMI password. By default, this will be autodetected for local connections if possible.\n");
-	printf(" -r           Always refresh channel list during selection\n"); /* (rather than purely event driven) */
-	printf(" -u           Asterisk AMI username.\n");
-	printf("(C) 2022 Naveen Albert\n");
-}
-
-int main(int argc,char *argv[])
-{
-	char c;
-	static const char *getopt_settings = "?c:hl:p:ru:";
-	char ami_host[92] = "127.0.0.1"; /* Default to localhost */
-	char ami_username[64] = "";
-	char ami_password[64] = "";
-	struct ami_session *ami;
-
-	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
-		switch (c) {
-		case 'c':
-			strncpy(ttychan, optarg, sizeof(ttychan));
-			break;
-		case '?':
-		case 'h':
-			show_help();
-			return 0;
-		case 'l':
-			strncpy(ami_host, optarg, sizeof(ami_host));
+		if (res) {
 			break;
-		case 'p':
-			strncpy(ami_password, optarg, sizeof(ami_password));
-			break;
-		case 'r':
-			always_refresh = 1;
-			break;
-		case 'u':
-			strncpy(ami_username, optarg, sizeof(ami_username));
-			break;
-		default:
-			fprintf(stderr, "Invalid option: %c\n", c);
-			return -1;
 		}
 	}
 
-	if (ami_username[0] && !ami_password[0] && !strcmp(ami_host, "127.0.0.1")) {
-		/* If we're running as a privileged user with access to manager.conf, grab the password ourselves, which is more
-		 * secure than getting as a command line arg from the user (and kind of convenient)
-		 * Not that running as a user with access to the Asterisk config is great either, but, hey...
-		 */
-		if (ami_auto_detect_ami_pass(ami_username, ami_password, sizeof(ami_password))) {
-			fprintf(stderr, "No password specified, and failed to autodetect from /etc/asterisk/manager.conf\n");
-			return -1;
-		}
-	}
-
-	if (!ami_username[0]) {
-		fprintf(stderr, "No username provided (use -u flag)\n");
-		return -1;
+	recorder_stop();
+	ami_disconnect(ami);
+	sessions_destroy(); /* Not until no more events can come in for them */
+	chanmeta_destroy();
+	if (rtt_gateway) {
+		rtt_gateway_stop(rtt_gateway); /* After disconnecting, so no more text is added */
+		rtt_gateway = NULL;
 	}
-
-	ami = ami_connect(ami_host, 0, ami_callback, simple_disconnect_callback);
-	if (!ami) {
-		return -1;
+	if (msg_gateway) {
+		msg_gateway_stop(msg_gateway);
+		msg_gateway = NULL;
 	}
-	if (ami_action_login(ami, ami_username, ami_password)) {
-		fprintf(stderr, "Failed to log in with username %s\n", ami_username);
-		return -1;
+	ami_destroy(ami);
+	if (completer) {
+		completer_destroy(completer);
+		completer = NULL;
 	}
-
-	return ttyspy(ami) ? -1 : 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &origterm); /* Restore the original term settings */
+	return 0;
 }
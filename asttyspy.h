@@ -0,0 +1,87 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief AsTTYSpy core, shared between the program and the benchmarks
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*! \brief Target channel */
+extern char ttychan[256];
+
+/*! \brief 0 = not started, 1 = selecting a channel, 2 = conversing */
+extern int tty_active;
+
+/*! \brief Set when the channel list has changed since it was last printed */
+extern int new_channel;
+
+/*! \brief Always refresh the channel list during selection (-r) */
+extern int always_refresh;
+
+/*! \brief RTT gateway for the target channel (-g), if any */
+extern struct rtt_gateway *rtt_gateway;
+
+/*! \brief SIP MESSAGE gateway for the target channel (-m), if any */
+extern struct msg_gateway *msg_gateway;
+
+/*! \brief Phrase and word completion for what the operator types, if enabled */
+extern struct completer *completer;
+
+/*! \brief Callback function executing asynchronously when new events are available */
+void ami_callback(struct ami_session *ami, struct ami_event *event);
+
+void simple_disconnect_callback(struct ami_session *ami);
+
+/*! \brief Send a DTMF digit on the target channel */
+int send_dtmf(struct ami_session *ami, char digit);
+
+/*!
+ * \brief Escape text for TddTx: spaces become _ (AMI ignores whitespace), and newlines become \n (the reverse of tty_unescape)
+ * \param text
+ * \param[out] len Length of the escaped text
+ * \return Escaped text, which the caller must free, or NULL on failure
+ */
+char *tdd_escape(const char *text, size_t *len);
+
+/*! \brief Like tdd_tx(), but with text already escaped by tdd_escape(), so it can be sent on many channels */
+int tdd_tx_escaped(struct ami_session *ami, const char *channel, const char *escaped, size_t len, const char *text);
+
+/*!
+ * \brief Send text on a channel as Baudot (TddTx), and record it if recording
+ * \retval 0 on success, -1 on failure
+ */
+int tdd_tx(struct ami_session *ami, const char *channel, const char *text);
+
+/*! \brief Send text on the target channel as Baudot, and echo it locally */
+int send_msg(struct ami_session *ami, const char *typed);
+
+/*! \brief Print the list of channels. On return, *iptr is 1 more than the highest channel number */
+struct ami_response *print_channels(struct ami_session *ami, int *iptr);
+
+/*! \brief Enable TTY on the target channel, and record it if recording */
+int tty_attach(struct ami_session *ami);
+
+/*! \brief Done with the target channel */
+void tty_detach(struct ami_session *ami);
+
+/*! \brief Run the virtual TTY until the user quits. Disconnects and destroys the AMI session. */
+int ttyspy(struct ami_session *ami);
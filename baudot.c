@@ -0,0 +1,311 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Baudot (US TTY, 45.45 baud FSK) modulation and demodulation
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "baudot.h"
+
+/* US TTY character set. 0 = no character (blank or shift). */
+static const char ltrs[32] = {
+	0, 'E', '\n', 'A', ' ', 'S', 'I', 'U', '\r', 'D', 'R', 'J', 'N', 'F', 'C', 'K',
+	'T', 'Z', 'L', 'W', 'H', 'Y', 'P', 'Q', 'O', 'B', 'G', 0, 'M', 'X', 'V', 0,
+};
+static const char figs[32] = {
+	0, '3', '\n', '-', ' ', '\a', '8', '7', '\r', '$', '4', '\'', ',', '!', ':', '(',
+	'5', '"', ')', '2', '=', '6', '0', '1', '9', '?', '+', 0, '.', '/', ';', 0,
+};
+
+void baudot_tx_init(struct baudot_tx *tx)
+{
+	tx->phase = 0;
+	tx->mark_hz = BAUDOT_MARK_HZ;
+	tx->space_hz = BAUDOT_SPACE_HZ;
+	tx->samples_per_bit = BAUDOT_SAMPLE_RATE / BAUDOT_BAUD;
+	tx->bit_remainder = 0;
+	tx->amplitude = 8192; /* About -12 dBFS */
+	tx->figs = -1;
+}
+
+static int find_code(const char *table, char c)
+{
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		if (table[i] == c) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int baudot_encode(int *shift, char c, unsigned char codes[2])
+{
+	int code;
+
+	c = (char) toupper((unsigned char) c);
+
+	/* Space, CR and LF are the same in both shifts, so never need a shift */
+	if (c == ' ' || c == '\r' || c == '\n') {
+		codes[0] = (unsigned char) find_code(ltrs, c);
+		return 1;
+	}
+
+	code = find_code(ltrs, c);
+	if (code >= 0) {
+		if (*shift == 0) {
+			codes[0] = (unsigned char) code;
+			return 1;
+		}
+		*shift = 0;
+		codes[0] = BAUDOT_LTRS;
+		codes[1] = (unsigned char) code;
+		return 2;
+	}
+	code = find_code(figs, c);
+	if (code >= 0) {
+		if (*shift == 1) {
+			codes[0] = (unsigned char) code;
+			return 1;
+		}
+		*shift = 1;
+		codes[0] = BAUDOT_FIGS;
+		codes[1] = (unsigned char) code;
+		return 2;
+	}
+	return 0;
+}
+
+char baudot_decode(int shift, unsigned char code)
+{
+	code &= 0x1F;
+	return shift == 1 ? figs[code] : ltrs[code];
+}
+
+int baudot_valid_char(char c)
+{
+	c = (char) toupper((unsigned char) c);
+	return c && (find_code(ltrs, c) >= 0 || find_code(figs, c) >= 0);
+}
+
+unsigned int baudot_text_ms(const char *text)
+{
+	unsigned char codes[2];
+	int shift = -1, n = 0;
+
+	for (; *text; text++) {
+		n += baudot_encode(&shift, *text, codes);
+	}
+	return (unsigned int) (n * BAUDOT_CODE_MS);
+}
+
+size_t baudot_tx_tone(struct baudot_tx *tx, int mark, double bits, int16_t *out, size_t max)
+{
+	double exact = bits * tx->samples_per_bit + tx->bit_remainder;
+	size_t i, samples = (size_t) exact;
+	double step = 2 * M_PI * (mark ? tx->mark_hz : tx->space_hz) / BAUDOT_SAMPLE_RATE;
+
+	/* Carry the fractional sample over, so the average bit length is exact. */
+	tx->bit_remainder = exact - (double) samples;
+	if (samples > max) {
+		samples = max;
+	}
+	for (i = 0; i < samples; i++) {
+		out[i] = (int16_t) (tx->amplitude * sin(tx->phase));
+		tx->phase += step;
+		if (tx->phase > 2 * M_PI) {
+			tx->phase -= 2 * M_PI;
+		}
+	}
+	return samples;
+}
+
+size_t baudot_tx_code(struct baudot_tx *tx, unsigned char code, int16_t *out, size_t max)
+{
+	size_t len;
+	int bit;
+
+	len = baudot_tx_tone(tx, 0, 1, out, max); /* Start bit */
+	for (bit = 0; bit < 5; bit++) {
+		len += baudot_tx_tone(tx, (code >> bit) & 1, 1, out + len, max - len);
+	}
+	len += baudot_tx_tone(tx, 1, BAUDOT_STOP_BITS, out + len, max - len);
+	return len;
+}
+
+size_t baudot_tx_char(struct baudot_tx *tx, char c, int16_t *out, size_t max)
+{
+	unsigned char codes[2];
+	size_t len = 0;
+	int i, num;
+
+	num = baudot_encode(&tx->figs, c, codes);
+	for (i = 0; i < num; i++) {
+		len += baudot_tx_code(tx, codes[i], out + len, max - len);
+	}
+	return len;
+}
+
+/*
+ * Demodulation is non-coherent: the input is mixed with each tone and lowpassed,
+ * and whichever tone has more power is the current bit.
+ * For carrier detect, the same is done at 1000 Hz and 2200 Hz, just outside the
+ * tones, to estimate the noise: a carrier is present only if the stronger tone
+ * stands out from that, as well as being above an absolute level.
+ * At 8 kHz, all these frequencies repeat exactly every 40 samples,
+ * so the oscillators are just a table lookup.
+ */
+#define RX_OSC_PERIOD 40
+#define RX_LPF_ALPHA 0.08f
+#define RX_CARRIER_THRESHOLD 1e-5f /* Tone power (of full scale), about -44 dBFS */
+#define RX_CARRIER_SNR 4.0f /* Stronger tone over the noise estimate, 6 dB */
+#define RX_NOISE_LOW_HZ 1000.0
+#define RX_NOISE_HIGH_HZ 2200.0
+
+/* Cosine and sine for mark, space, and the two noise frequencies */
+static float osc[RX_FILTERS][RX_OSC_PERIOD];
+
+static void osc_init(void)
+{
+	static const double freqs[RX_FILTERS / 2] = { BAUDOT_MARK_HZ, BAUDOT_SPACE_HZ, RX_NOISE_LOW_HZ, RX_NOISE_HIGH_HZ };
+	int f, i;
+
+	for (f = 0; f < RX_FILTERS / 2; f++) {
+		for (i = 0; i < RX_OSC_PERIOD; i++) {
+			osc[2 * f][i] = (float) cos(2 * M_PI * freqs[f] * i / BAUDOT_SAMPLE_RATE);
+			osc[2 * f + 1][i] = (float) sin(2 * M_PI * freqs[f] * i / BAUDOT_SAMPLE_RATE);
+		}
+	}
+}
+
+void baudot_rx_init(struct baudot_rx *rx)
+{
+	static pthread_once_t osc_once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&osc_once, osc_init);
+	memset(rx, 0, sizeof(*rx));
+	rx->samples_per_bit = (float) (BAUDOT_SAMPLE_RATE / BAUDOT_BAUD);
+	rx->threshold = RX_CARRIER_THRESHOLD;
+	rx->figs = -1;
+}
+
+void baudot_rx_reset(struct baudot_rx *rx)
+{
+	rx->state = BAUDOT_RX_IDLE;
+	rx->seen_mark = 0;
+}
+
+/*! \brief Handle a complete 5-bit code. Returns the character, or 0 if none. */
+static char rx_code(struct baudot_rx *rx, unsigned char code)
+{
+	if (code == BAUDOT_LTRS) {
+		rx->figs = 0;
+		return 0;
+	} else if (code == BAUDOT_FIGS) {
+		rx->figs = 1;
+		return 0;
+	}
+	return baudot_decode(rx->figs, code);
+}
+
+size_t baudot_rx(struct baudot_rx *rx, const int16_t *samples, size_t len, char *out, size_t max)
+{
+	size_t i, chars = 0;
+	int t;
+
+	for (i = 0; i < len; i++) {
+		float x = samples[i] * (1.0f / 32768);
+		float mark_power, space_power, noise_power;
+		int carrier, mark;
+
+		for (t = 0; t < RX_FILTERS; t++) {
+			float mixed = x * osc[t][rx->phase];
+			rx->lpf[t][0] += RX_LPF_ALPHA * (mixed - rx->lpf[t][0]);
+			rx->lpf[t][1] += RX_LPF_ALPHA * (rx->lpf[t][0] - rx->lpf[t][1]);
+		}
+		if (++rx->phase == RX_OSC_PERIOD) {
+			rx->phase = 0;
+		}
+		mark_power = rx->lpf[0][1] * rx->lpf[0][1] + rx->lpf[1][1] * rx->lpf[1][1];
+		space_power = rx->lpf[2][1] * rx->lpf[2][1] + rx->lpf[3][1] * rx->lpf[3][1];
+		noise_power = (rx->lpf[4][1] * rx->lpf[4][1] + rx->lpf[5][1] * rx->lpf[5][1]
+			+ rx->lpf[6][1] * rx->lpf[6][1] + rx->lpf[7][1] * rx->lpf[7][1]) / 2;
+		mark = mark_power > space_power;
+		carrier = mark_power + space_power > rx->threshold && (mark ? mark_power : space_power) > RX_CARRIER_SNR * noise_power;
+
+		switch (rx->state) {
+		case BAUDOT_RX_IDLE:
+			/* A start bit must follow at least half a bit of mark. Noise rarely manages that. */
+			if (!carrier) {
+				rx->seen_mark = 0;
+			} else if (mark) {
+				rx->seen_mark++;
+			} else if (rx->seen_mark >= rx->samples_per_bit / 2) {
+				rx->state = BAUDOT_RX_START; /* Mark to space transition */
+				rx->pos = 0;
+			} else {
+				rx->seen_mark = 0;
+			}
+			break;
+		case BAUDOT_RX_START:
+			if (++rx->pos >= rx->samples_per_bit / 2) {
+				if (!carrier || mark) {
+					baudot_rx_reset(rx); /* Glitch, not a start bit */
+					break;
+				}
+				rx->state = BAUDOT_RX_DATA;
+				rx->bit = 0;
+				rx->code = 0;
+				rx->next = rx->samples_per_bit * 1.5f;
+			}
+			break;
+		case BAUDOT_RX_DATA:
+			if (++rx->pos < rx->next) {
+				break;
+			}
+			rx->next += rx->samples_per_bit;
+			if (rx->bit < 5) {
+				rx->code |= (unsigned char) (mark << rx->bit++);
+				break;
+			}
+			/* Stop bit. If it isn't mark, it's a framing error, so discard the character. */
+			if (carrier && mark) {
+				char c = rx_code(rx, rx->code);
+				if (c && c != '\r' && chars < max) {
+					out[chars++] = c;
+				}
+			}
+			rx->state = BAUDOT_RX_IDLE;
+			/* We're in the middle of the stop bit, so the next start bit can be as little as half a bit away */
+			rx->seen_mark = carrier && mark ? (int) (rx->samples_per_bit / 2) : 0;
+			break;
+		}
+	}
+	return chars;
+}
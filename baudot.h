@@ -0,0 +1,142 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Baudot (US TTY, 45.45 baud FSK) modulation and demodulation
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BAUDOT_SAMPLE_RATE 8000
+#define BAUDOT_BAUD 45.45
+#define BAUDOT_MARK_HZ 1400.0
+#define BAUDOT_SPACE_HZ 1800.0
+#define BAUDOT_STOP_BITS 1.5
+
+#define BAUDOT_LTRS 0x1F
+#define BAUDOT_FIGS 0x1B
+
+/*! \brief Time to send one code (start bit, 5 data bits, stop bits), in ms */
+#define BAUDOT_CODE_MS (1000 * (1 + 5 + BAUDOT_STOP_BITS) / BAUDOT_BAUD)
+
+/*! \brief Max samples that baudot_tx_char() can produce (shift character + character) */
+#define BAUDOT_MAX_CHAR_SAMPLES 3200
+
+struct baudot_tx {
+	double phase;			/*!< Oscillator phase, kept continuous across tones */
+	double mark_hz;
+	double space_hz;
+	double samples_per_bit;	/*!< Nominally BAUDOT_SAMPLE_RATE / BAUDOT_BAUD */
+	double bit_remainder;	/*!< Fractional sample carried over between bits */
+	double amplitude;
+	int figs;				/*!< Current shift: 0 = letters, 1 = figures, -1 = unknown */
+};
+
+/*! \brief Initialize a modulator with nominal frequencies and timing */
+void baudot_tx_init(struct baudot_tx *tx);
+
+/*!
+ * \brief Convert a character to Baudot code(s)
+ * \param figs Current shift (0 = letters, 1 = figures, -1 = unknown). Updated if a shift is needed.
+ * \param c Character. Lowercase letters are converted to uppercase.
+ * \param codes Up to 2 codes (shift, then the character)
+ * \return Number of codes, 0 if the character cannot be sent
+ */
+int baudot_encode(int *figs, char c, unsigned char codes[2]);
+
+/*!
+ * \brief Get the character for a Baudot code
+ * \param figs Current shift
+ * \param code 5-bit code
+ * \return Character, or 0 for shift codes and codes with no character
+ */
+char baudot_decode(int figs, unsigned char code);
+
+/*! \brief Whether a character can be sent as Baudot */
+int baudot_valid_char(char c);
+
+/*! \brief How long it takes to send text, including shifts, starting in an unknown shift, in ms */
+unsigned int baudot_text_ms(const char *text);
+
+/*!
+ * \brief Generate a steady tone (mark or space), continuing the phase of the previous tone
+ * \param tx
+ * \param mark 1 for mark, 0 for space
+ * \param bits Duration, in bits
+ * \param[out] out Samples
+ * \param max Size of out, in samples
+ * \return Number of samples generated
+ */
+size_t baudot_tx_tone(struct baudot_tx *tx, int mark, double bits, int16_t *out, size_t max);
+
+/*!
+ * \brief Modulate one 5-bit code (start bit, 5 data bits LSB first, stop bits)
+ * \return Number of samples generated
+ */
+size_t baudot_tx_code(struct baudot_tx *tx, unsigned char code, int16_t *out, size_t max);
+
+/*!
+ * \brief Modulate a character, preceded by a shift character if needed
+ * \return Number of samples generated (0 if the character cannot be sent)
+ */
+size_t baudot_tx_char(struct baudot_tx *tx, char c, int16_t *out, size_t max);
+
+enum baudot_rx_state {
+	BAUDOT_RX_IDLE = 0,		/*!< Waiting for a start bit */
+	BAUDOT_RX_START,		/*!< In a start bit, until it is confirmed at its center */
+	BAUDOT_RX_DATA,			/*!< Sampling data bits, then the stop bit */
+};
+
+#define RX_FILTERS 8
+
+struct baudot_rx {
+	float lpf[RX_FILTERS][2];	/*!< I and Q for mark, space and 2 noise frequencies, each through a 2 pole lowpass */
+	unsigned int phase;		/*!< Oscillator index (both tones repeat every 40 samples) */
+	float samples_per_bit;
+	float pos;				/*!< Samples since the start bit began */
+	float next;				/*!< When to sample the next bit */
+	float threshold;		/*!< Minimum tone power for carrier detect */
+	enum baudot_rx_state state;
+	int seen_mark;			/*!< Samples of mark seen (in idle), to qualify a start bit */
+	int bit;
+	unsigned char code;
+	int figs;				/*!< Current shift: 0 = letters, 1 = figures, -1 = unknown */
+};
+
+/*! \brief Initialize a demodulator */
+void baudot_rx_init(struct baudot_rx *rx);
+
+/*! \brief Discard any partially received character, e.g. after a gap in the audio. The shift is kept. */
+void baudot_rx_reset(struct baudot_rx *rx);
+
+/*!
+ * \brief Demodulate audio
+ * \param rx
+ * \param samples Audio, at BAUDOT_SAMPLE_RATE
+ * \param len Number of samples
+ * \param[out] out Decoded characters (not null terminated). Carriage returns are discarded.
+ * \param max Size of out
+ * \return Number of characters decoded
+ */
+size_t baudot_rx(struct baudot_rx *rx, const int16_t *samples, size_t len, char *out, size_t max);
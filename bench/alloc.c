@@ -0,0 +1,84 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Allocation counting for benchmarks
+ *
+ * This interposes the glibc allocator, so allocations made inside libc
+ * on our behalf (strdup, stdio buffers, etc.) are counted too.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdlib.h>
+
+#include "alloc.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static int counting = 0;
+static unsigned long num_allocs = 0;
+static unsigned long num_bytes = 0;
+
+static inline void count_alloc(size_t size)
+{
+	if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&num_allocs, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&num_bytes, size, __ATOMIC_RELAXED);
+	}
+}
+
+void *malloc(size_t size)
+{
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count_alloc(nmemb * size);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count_alloc(size);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+void alloc_counting(int enabled)
+{
+	__atomic_store_n(&counting, enabled, __ATOMIC_RELAXED);
+}
+
+void alloc_counts_take(struct alloc_counts *counts)
+{
+	counts->allocs = __atomic_exchange_n(&num_allocs, 0, __ATOMIC_RELAXED);
+	counts->bytes = __atomic_exchange_n(&num_bytes, 0, __ATOMIC_RELAXED);
+}
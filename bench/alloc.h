@@ -0,0 +1,37 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Allocation counting for benchmarks
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+struct alloc_counts {
+	unsigned long allocs;	/*!< Number of malloc/calloc/realloc calls */
+	unsigned long bytes;	/*!< Bytes requested by those calls */
+};
+
+/*! \brief Start or stop counting allocations (made by any thread) */
+void alloc_counting(int enabled);
+
+/*! \brief Get the counts accumulated so far, and reset them */
+void alloc_counts_take(struct alloc_counts *counts);
@@ -0,0 +1,263 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Benchmark baselines, and comparing a run against one
+ *
+ * A baseline is a text file: a version line, then one line per benchmark
+ * and metric, with the median of the trials and how noisy they were. A
+ * metric only counts as having changed if the change is more than the
+ * tolerance, and more than about three standard deviations of either run's
+ * trials, so benchmarks that are noisy on the machine don't fail the
+ * comparison.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "baseline.h"
+
+struct metric_info {
+	const char *name;
+	int higher_is_better;
+	double tolerance;		/*!< Multiple of the tolerance that applies to this metric */
+	double floor;			/*!< Changes smaller than this never count */
+};
+
+static const struct metric_info metrics[METRIC_COUNT] = {
+	{ "ops_per_sec", 1, 1.0, 0 },
+	{ "p50_ns", 0, 2.0, 20 },			/* About what reading the clock costs */
+	{ "p99_ns", 0, 3.0, 50 },			/* Tail latency is noisier still */
+	{ "allocs_per_op", 0, 0.5, 0.01 },
+	{ "bytes_per_op", 0, 0.5, 1 },
+	{ "rss_kb", 0, 1.0, 1024 },
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+double baseline_percentile(double *values, int count, double pct)
+{
+	int i;
+
+	if (count < 1) {
+		return 0;
+	}
+	qsort(values, (size_t) count, sizeof(*values), cmp_double);
+	i = (int) (pct / 100.0 * count);
+	return values[i < count ? i : count - 1];
+}
+
+double baseline_median(double *values, int count)
+{
+	if (count < 1) {
+		return 0;
+	}
+	qsort(values, (size_t) count, sizeof(*values), cmp_double);
+	return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+static struct baseline_result *find_result(const struct baseline *b, const char *name)
+{
+	int i;
+
+	for (i = 0; i < b->count; i++) {
+		if (!strcmp(b->results[i].name, name)) {
+			return &b->results[i];
+		}
+	}
+	return NULL;
+}
+
+/*! \brief Get a result to fill in, adding it if it isn't there yet */
+static struct baseline_result *get_result(struct baseline *b, const char *name)
+{
+	struct baseline_result *r = find_result(b, name), *results;
+
+	if (r) {
+		return r;
+	}
+	results = realloc(b->results, (size_t) (b->count + 1) * sizeof(*results));
+	if (!results) {
+		return NULL;
+	}
+	b->results = results;
+	r = &b->results[b->count++];
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	return r;
+}
+
+const struct baseline_result *baseline_add(struct baseline *b, const char *name, double trials[][METRIC_COUNT], int count)
+{
+	struct baseline_result *r = get_result(b, name);
+	double values[BASELINE_MAX_TRIALS];
+	int i, m;
+
+	if (!r || count < 1 || count > BASELINE_MAX_TRIALS) {
+		return NULL;
+	}
+	for (m = 0; m < METRIC_COUNT; m++) {
+		for (i = 0; i < count; i++) {
+			values[i] = trials[i][m];
+		}
+		r->value[m] = baseline_median(values, count);
+		for (i = 0; i < count; i++) {
+			values[i] = fabs(trials[i][m] - r->value[m]);
+		}
+		r->noise[m] = baseline_median(values, count);
+	}
+	return r;
+}
+
+int baseline_save(const struct baseline *b, const char *file)
+{
+	FILE *fp = fopen(file, "w");
+	int i, m;
+
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s for writing\n", file);
+		return -1;
+	}
+	fprintf(fp, "# AsTTYSpy benchmark baseline: benchmark, metric, median, median absolute deviation\n");
+	fprintf(fp, "version %d\n", BASELINE_VERSION);
+	fprintf(fp, "iterations %lu\n", b->iterations);
+	fprintf(fp, "trials %d\n", b->trials);
+	for (i = 0; i < b->count; i++) {
+		for (m = 0; m < METRIC_COUNT; m++) {
+			fprintf(fp, "%s %s %.6g %.6g\n", b->results[i].name, metrics[m].name, b->results[i].value[m], b->results[i].noise[m]);
+		}
+	}
+	if (fclose(fp)) {
+		fprintf(stderr, "Failed to write %s\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+int baseline_load(struct baseline *b, const char *file)
+{
+	struct baseline_result *r;
+	char line[256], name[32], metric[32];
+	double value, noise;
+	int m, version = -1;
+	FILE *fp = fopen(file, "r");
+
+	memset(b, 0, sizeof(*b));
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s\n", file);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || sscanf(line, "version %d", &version) == 1 || sscanf(line, "iterations %lu", &b->iterations) == 1
+			|| sscanf(line, "trials %d", &b->trials) == 1) {
+			continue;
+		} else if (version != BASELINE_VERSION) {
+			break;
+		} else if (sscanf(line, "%31s %31s %lf %lf", name, metric, &value, &noise) != 4) {
+			fprintf(stderr, "Invalid baseline line: %s", line);
+			continue;
+		}
+		for (m = 0; m < METRIC_COUNT && strcmp(metrics[m].name, metric); m++);
+		if (m == METRIC_COUNT) {
+			continue; /* Not tracked anymore */
+		}
+		r = get_result(b, name);
+		if (!r) {
+			break;
+		}
+		r->value[m] = value;
+		r->noise[m] = noise;
+	}
+	fclose(fp);
+	if (version != BASELINE_VERSION) {
+		fprintf(stderr, "%s is a version %d baseline, not version %d\n", file, version, BASELINE_VERSION);
+		baseline_free(b);
+		return -1;
+	}
+	return 0;
+}
+
+int baseline_compare(FILE *out, const struct baseline *base, const struct baseline *run, double tolerance)
+{
+	const struct baseline_result *old, *cur;
+	double diff, threshold, noise;
+	int i, m, compared = 0, regressions = 0, improvements = 0;
+
+	if (base->iterations != run->iterations) {
+		fprintf(out, "Note: baseline was run with %lu iterations, this run with %lu\n", base->iterations, run->iterations);
+	}
+	fprintf(out, "\n%-20s %-14s %12s %12s %8s\n", "Benchmark", "Metric", "Baseline", "This run", "Change");
+	for (i = 0; i < run->count; i++) {
+		cur = &run->results[i];
+		old = find_result(base, cur->name);
+		if (!old) {
+			fprintf(out, "%-20s not in the baseline\n", cur->name);
+			continue;
+		}
+		compared++;
+		for (m = 0; m < METRIC_COUNT; m++) {
+			/* How much worse it got: positive is a regression */
+			diff = metrics[m].higher_is_better ? old->value[m] - cur->value[m] : cur->value[m] - old->value[m];
+			noise = old->noise[m] > cur->noise[m] ? old->noise[m] : cur->noise[m];
+			threshold = fabs(old->value[m]) * tolerance * metrics[m].tolerance / 100.0;
+			if (threshold < 3 * 1.4826 * noise) {
+				threshold = 3 * 1.4826 * noise; /* The deviation is 1.4826 times the MAD, for normal noise */
+			}
+			if (threshold < metrics[m].floor) {
+				threshold = metrics[m].floor;
+			}
+			if (fabs(diff) <= threshold) {
+				continue;
+			}
+			fprintf(out, "%-20s %-14s %12.6g %12.6g", cur->name, metrics[m].name, old->value[m], cur->value[m]);
+			if (old->value[m]) {
+				fprintf(out, " %+7.1f%%", 100.0 * (cur->value[m] - old->value[m]) / old->value[m]);
+			} else {
+				fprintf(out, " %8s", "-");
+			}
+			if (diff > 0) {
+				fprintf(out, "  REGRESSION\n");
+				regressions++;
+			} else {
+				fprintf(out, "  improved\n");
+				improvements++;
+			}
+		}
+	}
+	fprintf(out, "%d benchmarks compared: %d regressions, %d improvements (tolerance %.0f%%)\n", compared, regressions, improvements, tolerance);
+	return regressions;
+}
+
+void baseline_free(struct baseline *b)
+{
+	free(b->results);
+	b->results = NULL;
+	b->count = 0;
+}
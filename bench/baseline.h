@@ -0,0 +1,96 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Benchmark baselines, and comparing a run against one
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define BASELINE_VERSION 1
+#define BASELINE_MAX_TRIALS 32
+#define BASELINE_TOLERANCE 10.0	/* Percent a metric can get worse by before it's a regression */
+
+enum baseline_metric {
+	METRIC_OPS_SEC = 0,
+	METRIC_P50_NS,
+	METRIC_P99_NS,
+	METRIC_ALLOCS,
+	METRIC_BYTES,
+	METRIC_RSS_KB,
+	METRIC_COUNT,
+};
+
+struct baseline_result {
+	char name[32];
+	double value[METRIC_COUNT];	/*!< Median of the trials */
+	double noise[METRIC_COUNT];	/*!< Median absolute deviation of the trials */
+};
+
+struct baseline {
+	unsigned long iterations;
+	int trials;
+	int count;
+	struct baseline_result *results;
+};
+
+/*!
+ * \brief Median of some values
+ * \note Sorts the values
+ */
+double baseline_median(double *values, int count);
+
+/*!
+ * \brief Percentile of some values
+ * \param values
+ * \param count
+ * \param pct e.g. 99
+ * \note Sorts the values
+ */
+double baseline_percentile(double *values, int count, double pct);
+
+/*!
+ * \brief Summarize a benchmark's trials, and add it to a baseline
+ * \param b
+ * \param name Benchmark name
+ * \param trials Metrics from each trial
+ * \param count Number of trials, at most BASELINE_MAX_TRIALS
+ * \return The result, or NULL on failure
+ */
+const struct baseline_result *baseline_add(struct baseline *b, const char *name, double trials[][METRIC_COUNT], int count);
+
+/*! \retval 0 on success, -1 on failure */
+int baseline_save(const struct baseline *b, const char *file);
+
+/*! \retval 0 on success, -1 on failure (including a baseline from another version) */
+int baseline_load(struct baseline *b, const char *file);
+
+/*!
+ * \brief Compare a run against a baseline, and report whatever got better or worse by more than the noise
+ * \param out
+ * \param base The baseline
+ * \param run This run
+ * \param tolerance Percent a metric can get worse by before it's a regression
+ * \return Number of regressions
+ */
+int baseline_compare(FILE *out, const struct baseline *base, const struct baseline *run, double tolerance);
+
+void baseline_free(struct baseline *b);
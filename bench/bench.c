@@ -0,0 +1,971 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief In-process microbenchmarks of the AsTTYSpy core, using the mock AMI
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define _GNU_SOURCE /* sched_setaffinity */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "session.h"
+#include "codec.h"
+#include "baudot.h"
+#include "echo.h"
+#include "rtp.h"
+#include "rtt.h"
+#include "sipmsg.h"
+#include "broadcast.h"
+#include "mock_ami.h"
+#include "alloc.h"
+#include "soak.h"
+#include "dialsim.h"
+#include "viewsim.h"
+#include "websim.h"
+#include "ptysim.h"
+#include "macro.h"
+#include "complete.h"
+#include "baseline.h"
+
+#define BENCH_CHANNEL "PJSIP/bench-00000001"
+#define BENCH_RECORD_CHAR "PJSIP/record-char-00000004"
+#define BENCH_RECORD_LINE "PJSIP/record-line-00000005"
+#define BENCH_RECORD_SWITCH "PJSIP/record-switch-00000006"
+#define BENCH_FRAME_SAMPLES 160 /* 20 ms */
+#define BENCH_LINE "THE_QUICK_BROWN_FOX_JUMPS_OVER_THE_LAZY_DOG_0123456789_HELLO_GA_"
+#define BENCH_BATCH 4096
+#define BENCH_TURN "HELLO THIS IS THE OPERATOR GA"
+#define BENCH_TURN_SAMPLES (BAUDOT_SAMPLE_RATE + (sizeof(BENCH_TURN) - 1) * BAUDOT_MAX_CHAR_SAMPLES)
+#define BENCH_ECHO_DELAY 24 /* 3 ms */
+#define BENCH_RTP_STREAMS 256
+#define BENCH_RTP_PACKET_LEN (12 + BENCH_FRAME_SAMPLES)
+#define BENCH_BROADCAST_CHANNELS 64
+#define BENCH_BROADCAST "EMERGENCY: PLEASE EVACUATE THE BUILDING GA\n"
+#define BENCH_MSG_TO "pjsip:bench"
+#define BENCH_MSG_LINE_B64 "SEVMTE8gVEhJUyBJUyBKT0hOIEdB" /* HELLO THIS IS JOHN GA */
+#define BENCH_MSG_IN_B64 "aGVsbG8KdGhlcmU=" /* hello, newline, there */
+#define BENCH_COMPLETE_LINES 20000 /* Learned, as from past transcripts */
+#define BENCH_COMPLETE_TYPED "PLEASE HOLD WHILE I DIAL THE NUMBER GA\n"
+#define BENCH_LATENCY_SAMPLES 1000 /* Operations timed one at a time, per trial, for latency percentiles */
+
+struct bench_case {
+	const char *name;
+	const char *description;
+	/*! \brief Called before timing, to set up global state */
+	void (*setup)(void);
+	/*! \brief Called before timing, for each iteration, to prepare its input. Optional. */
+	struct ami_event *(*prepare)(void);
+	/*! \brief The operation being measured. event is what prepare returned, if anything. */
+	void (*op)(struct ami_event *event);
+	/*! \brief Audio samples processed per operation, if any, to report samples/sec */
+	int samples;
+};
+
+static struct ami_session *ami;
+static FILE *out; /* Results go here, since stdout is what's being benchmarked */
+static int channels_printed;
+static char record_dir[] = "/tmp/asttyspy-bench-XXXXXX";
+static int16_t slin_frame[BENCH_FRAME_SAMPLES];
+static unsigned char g711_frame[BENCH_FRAME_SAMPLES];
+
+/* An operator turn: what we sent, and what came back (our echo, at -10 dB) */
+static int16_t turn_tx[BENCH_TURN_SAMPLES];
+static int16_t turn_rx[BENCH_TURN_SAMPLES];
+static size_t turn_len;
+static size_t turn_pos;
+static struct baudot_rx decoder;
+static struct echo_canceller canceller;
+
+/* The operator turn, as RTP, on many streams at once */
+static unsigned char turn_ulaw[BENCH_TURN_SAMPLES];
+static struct rtp_receiver *receiver;
+static unsigned long rtp_packets;
+static int rtp_reorder;
+
+/* Real-time text: one character per packet, with redundancy */
+static struct t140_tx t140_sender;
+static struct t140_rx t140_receiver;
+static unsigned char t140_pkt[RTT_PACKET_SIZE];
+static size_t t140_pkt_len;
+static uint64_t t140_now;
+static uint16_t t140_seq;
+
+/* SIP MESSAGE gateway: MessageSend actions issued so far */
+static unsigned long msg_sent;
+
+/* Completion */
+static struct completer *bench_completer;
+static size_t complete_pos;
+
+static void setup_conversing(void)
+{
+	static int attached = 0;
+
+	snprintf(ttychan, sizeof(ttychan), "%s", BENCH_CHANNEL);
+	if (!attached && !tty_attach(ami)) {
+		attached = 1;
+	}
+	tty_active = 2;
+}
+
+static void setup_record(const char *channel, enum rx_policy policy)
+{
+	record_rx_policy = policy;
+	if (session_record(ami, channel, record_dir)) {
+		fprintf(stderr, "Failed to record %s\n", channel);
+	} else if (!strstr(mock_ami_last_action(), rx_policy_options(policy))) {
+		fprintf(stderr, "%s was not armed with %s\n", channel, rx_policy_options(policy));
+	}
+}
+
+static void setup_record_char(void)
+{
+	setup_record(BENCH_RECORD_CHAR, RX_POLICY_CHAR);
+}
+
+static void setup_record_line(void)
+{
+	setup_record(BENCH_RECORD_LINE, RX_POLICY_LINE);
+}
+
+static void setup_record_switch(void)
+{
+	setup_record(BENCH_RECORD_SWITCH, RX_POLICY_LINE);
+}
+
+static void setup_selecting(void)
+{
+	tty_active = 1;
+}
+
+static void setup_channels_10(void)
+{
+	mock_ami_set_channels(10);
+}
+
+static void setup_channels_100(void)
+{
+	mock_ami_set_channels(100);
+}
+
+static void setup_slin_frame(void)
+{
+	int i;
+
+	/* Sweep through the whole range, so every segment is hit */
+	for (i = 0; i < BENCH_FRAME_SAMPLES; i++) {
+		slin_frame[i] = (int16_t) (-32768 + i * (65535 / BENCH_FRAME_SAMPLES));
+	}
+}
+
+static void setup_ulaw_frame(void)
+{
+	setup_slin_frame();
+	codec_encode(CODEC_ULAW, slin_frame, BENCH_FRAME_SAMPLES, g711_frame);
+}
+
+static void setup_alaw_frame(void)
+{
+	setup_slin_frame();
+	codec_encode(CODEC_ALAW, slin_frame, BENCH_FRAME_SAMPLES, g711_frame);
+}
+
+static void setup_turn(enum echo_mode mode)
+{
+	struct baudot_tx tx;
+	const char *c;
+	size_t i;
+
+	if (!turn_len) {
+		baudot_tx_init(&tx);
+		turn_len = baudot_tx_tone(&tx, 1, 7, turn_tx, BENCH_TURN_SAMPLES);
+		for (c = BENCH_TURN; *c; c++) {
+			turn_len += baudot_tx_char(&tx, *c, turn_tx + turn_len, BENCH_TURN_SAMPLES - turn_len);
+		}
+		turn_len += baudot_tx_tone(&tx, 1, 14, turn_tx + turn_len, BENCH_TURN_SAMPLES - turn_len);
+		turn_len -= turn_len % BENCH_FRAME_SAMPLES;
+		for (i = BENCH_ECHO_DELAY; i < turn_len; i++) {
+			turn_rx[i] = (int16_t) (turn_tx[i - BENCH_ECHO_DELAY] * 0.316);
+		}
+	}
+	turn_pos = 0;
+	baudot_rx_init(&decoder);
+	echo_init(&canceller, mode);
+}
+
+static void setup_echo_none(void)
+{
+	setup_turn(ECHO_NONE);
+}
+
+static void setup_echo_gate(void)
+{
+	setup_turn(ECHO_GATE);
+}
+
+static void setup_echo_cancel(void)
+{
+	setup_turn(ECHO_CANCEL);
+}
+
+static void setup_rtp(int reorder)
+{
+	setup_turn(ECHO_NONE);
+	codec_encode(CODEC_ULAW, turn_tx, turn_len, turn_ulaw);
+	if (receiver) {
+		rtp_receiver_destroy(receiver);
+	}
+	receiver = rtp_receiver_create(-1, NULL, NULL);
+	rtp_packets = 0;
+	rtp_reorder = reorder;
+}
+
+static void setup_rtp_inorder(void)
+{
+	setup_rtp(0);
+}
+
+static void setup_rtp_reordered(void)
+{
+	setup_rtp(1);
+}
+
+static void setup_t140(void)
+{
+	int i;
+
+	t140_tx_init(&t140_sender, 1);
+	t140_rx_init(&t140_receiver);
+	t140_now = 0;
+	/* A packet with new text and two generations of redundant text */
+	for (i = 0; i < RTT_REDUNDANCY + 1; i++) {
+		t140_tx_queue(&t140_sender, "A", 1, t140_now);
+		t140_pkt_len = t140_tx_packet(&t140_sender, t140_now, t140_pkt);
+		t140_now += RTT_INTERVAL_MS;
+	}
+	t140_seq = 0;
+}
+
+static struct ami_event *prepare_rx_char(void)
+{
+	return mock_ami_event("Event", "TddRxMsg", "Channel", BENCH_CHANNEL, "Message", "A", NULL);
+}
+
+static struct ami_event *prepare_rx_newline(void)
+{
+	return mock_ami_event("Event", "TddRxMsg", "Channel", BENCH_CHANNEL, "Message", "\\n", NULL);
+}
+
+static struct ami_event *prepare_rx_line(void)
+{
+	return mock_ami_event("Event", "TddRxMsg", "Channel", BENCH_CHANNEL, "Message", "HELLO_THIS_IS_JOHN_GA", NULL);
+}
+
+static struct ami_event *prepare_rx_other(void)
+{
+	return mock_ami_event("Event", "TddRxMsg", "Channel", "PJSIP/other-00000002", "Message", "A", NULL);
+}
+
+static struct ami_event *prepare_msg_in(void)
+{
+	return mock_ami_event("Event", "UserEvent", "UserEvent", MSG_USEREVENT, "From", "\"Bench\" <sip:bench@127.0.0.1>", "Base64Body", BENCH_MSG_IN_B64, NULL);
+}
+
+static struct ami_event *prepare_varset(void)
+{
+	return mock_ami_event("Event", "VarSet", "Channel", BENCH_CHANNEL, "Variable", "BRIDGEPEER", "Value", "PJSIP/other-00000002", NULL);
+}
+
+static struct ami_event *prepare_newchannel(void)
+{
+	return mock_ami_event("Event", "Newchannel", "Channel", "PJSIP/new-00000003", "ChannelState", "0", NULL);
+}
+
+static void op_event(struct ami_event *event)
+{
+	mock_ami_deliver(ami, event);
+}
+
+/*! \brief A 64 character line, as app_tdd raises it with per-character RX: one event per character, then the newline */
+static void op_record_line_char(struct ami_event *event)
+{
+	char c[2] = "";
+	int i;
+
+	for (i = 0; BENCH_LINE[i]; i++) {
+		c[0] = BENCH_LINE[i];
+		mock_ami_deliver(ami, mock_ami_event("Event", "TddRxMsg", "Channel", BENCH_RECORD_CHAR, "Message", c, NULL));
+	}
+	mock_ami_deliver(ami, mock_ami_event("Event", "TddRxMsg", "Channel", BENCH_RECORD_CHAR, "Message", "\\n", NULL));
+}
+
+/*! \brief The same line, as app_tdd raises it with line-buffered RX: a single event */
+static void op_record_line_line(struct ami_event *event)
+{
+	mock_ami_deliver(ami, mock_ami_event("Event", "TddRxMsg", "Channel", BENCH_RECORD_LINE, "Message", BENCH_LINE "\\n", NULL));
+}
+
+static void op_policy_switch(struct ami_event *event)
+{
+	session_observe(ami, BENCH_RECORD_SWITCH);
+	session_unobserve(ami, BENCH_RECORD_SWITCH);
+}
+
+static void op_ulaw_decode(struct ami_event *event)
+{
+	codec_decode(CODEC_ULAW, g711_frame, BENCH_FRAME_SAMPLES, slin_frame);
+}
+
+static void op_alaw_decode(struct ami_event *event)
+{
+	codec_decode(CODEC_ALAW, g711_frame, BENCH_FRAME_SAMPLES, slin_frame);
+}
+
+static void op_ulaw_encode(struct ami_event *event)
+{
+	codec_encode(CODEC_ULAW, slin_frame, BENCH_FRAME_SAMPLES, g711_frame);
+}
+
+static void op_alaw_encode(struct ami_event *event)
+{
+	codec_encode(CODEC_ALAW, slin_frame, BENCH_FRAME_SAMPLES, g711_frame);
+}
+
+/*! \brief Receive a 20 ms frame of the operator turn, suppressing our own echo */
+static void op_decode_turn(struct ami_event *event)
+{
+	int16_t frame[BENCH_FRAME_SAMPLES];
+	char text[BENCH_FRAME_SAMPLES];
+
+	memcpy(frame, turn_rx + turn_pos, sizeof(frame));
+	echo_tx(&canceller, turn_tx + turn_pos, BENCH_FRAME_SAMPLES);
+	if (echo_rx(&canceller, frame, BENCH_FRAME_SAMPLES)) {
+		baudot_rx(&decoder, frame, BENCH_FRAME_SAMPLES, text, sizeof(text));
+	} else {
+		baudot_rx_reset(&decoder);
+	}
+	turn_pos += BENCH_FRAME_SAMPLES;
+	if (turn_pos >= turn_len) {
+		turn_pos = 0;
+	}
+}
+
+/*! \brief Receive the next packet, round robin across the streams */
+static void op_rtp_ingest(struct ami_event *event)
+{
+	unsigned char pkt[BENCH_RTP_PACKET_LEN];
+	uint32_t ssrc = (uint32_t) (rtp_packets % BENCH_RTP_STREAMS) + 1, ts;
+	unsigned long frame = rtp_packets / BENCH_RTP_STREAMS;
+	size_t pos;
+
+	if (rtp_reorder && frame % 8 < 2) {
+		frame ^= 1; /* Every fourth pair of packets arrives swapped */
+	}
+	pos = (frame * BENCH_FRAME_SAMPLES) % turn_len;
+	ts = (uint32_t) (frame * BENCH_FRAME_SAMPLES);
+
+	pkt[0] = 0x80;
+	pkt[1] = RTP_PT_PCMU;
+	pkt[2] = (unsigned char) (frame >> 8);
+	pkt[3] = (unsigned char) frame;
+	pkt[4] = (unsigned char) (ts >> 24);
+	pkt[5] = (unsigned char) (ts >> 16);
+	pkt[6] = (unsigned char) (ts >> 8);
+	pkt[7] = (unsigned char) ts;
+	pkt[8] = (unsigned char) (ssrc >> 24);
+	pkt[9] = (unsigned char) (ssrc >> 16);
+	pkt[10] = (unsigned char) (ssrc >> 8);
+	pkt[11] = (unsigned char) ssrc;
+	memcpy(pkt + 12, turn_ulaw + pos, BENCH_FRAME_SAMPLES);
+	rtp_receiver_process(receiver, pkt, sizeof(pkt), (uint64_t) rtp_packets / BENCH_RTP_STREAMS * 20000000);
+	rtp_packets++;
+}
+
+/*! \brief Send a character typed on the TTY as T.140 */
+static void op_t140_send(struct ami_event *event)
+{
+	unsigned char pkt[RTT_PACKET_SIZE];
+
+	t140_tx_queue(&t140_sender, "A", 1, t140_now);
+	t140_tx_packet(&t140_sender, t140_now, pkt);
+	t140_now += RTT_INTERVAL_MS;
+}
+
+/*! \brief Receive a T.140 packet and convert it for the TTY. Every fourth packet is lost, and recovered. */
+static void op_t140_receive(struct ami_event *event)
+{
+	char text[RTT_MAX_TEXT], tty[RTT_MAX_TEXT];
+	unsigned long dropped = 0;
+	int len;
+
+	t140_seq += (t140_seq & 3) == 3 ? 2 : 1;
+	t140_pkt[2] = (unsigned char) (t140_seq >> 8);
+	t140_pkt[3] = (unsigned char) t140_seq;
+	len = t140_rx_packet(&t140_receiver, t140_pkt, t140_pkt_len, text, sizeof(text));
+	if (len > 0) {
+		rtt_to_tty(text, (size_t) len, tty, &dropped);
+	}
+}
+
+/*! \brief Wait for the gateway threads to issue an action */
+static int wait_for_action(const char *action, unsigned long count)
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (mock_ami_action_count(action) < count) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - start.tv_sec > 2) {
+			return -1;
+		}
+		sched_yield();
+	}
+	return 0;
+}
+
+static int bench_msg_tty(const char *text, void *data)
+{
+	return send_msg(ami, text);
+}
+
+/*! \brief Start the message gateway, and check it end to end: a line from the TTY is one message, and a message goes to the TTY */
+static void setup_msg(void)
+{
+	setup_conversing();
+	if (msg_gateway) {
+		return;
+	}
+	msg_gateway = msg_gateway_start(ami, BENCH_MSG_TO, NULL, bench_msg_tty, NULL);
+	if (!msg_gateway) {
+		fprintf(stderr, "Failed to start message gateway\n");
+		return;
+	}
+
+	mock_ami_reset();
+	mock_ami_deliver(ami, prepare_rx_line());
+	mock_ami_deliver(ami, prepare_rx_newline());
+	if (wait_for_action("MessageSend", 1) || !strstr(mock_ami_last_action(), "Base64Body:" BENCH_MSG_LINE_B64)) {
+		fprintf(stderr, "Line was not sent as a message: %s\n", mock_ami_last_action());
+	}
+	mock_ami_deliver(ami, prepare_msg_in());
+	if (wait_for_action("TddTx", 1) || !strstr(mock_ami_last_action(), "Message:HELLO\\nTHERE\\n")) {
+		fprintf(stderr, "Message was not sent to the TTY: %s\n", mock_ami_last_action());
+	}
+	msg_sent = 0;
+}
+
+/*! \brief A line from the TTY, until the gateway has sent it as a message */
+static void op_msg_line(struct ami_event *event)
+{
+	mock_ami_deliver(ami, prepare_rx_line());
+	mock_ami_deliver(ami, prepare_rx_newline());
+	if (wait_for_action("MessageSend", ++msg_sent)) {
+		fprintf(stderr, "Message was not sent\n");
+	}
+}
+
+/*! \brief Sessions to broadcast to, and a check that a rate limited broadcast reaches them all, evenly paced */
+static void setup_broadcast(void)
+{
+	struct broadcast_result result;
+	char channel[64];
+	int i;
+
+	for (i = 0; i < BENCH_BROADCAST_CHANNELS; i++) {
+		snprintf(channel, sizeof(channel), "PJSIP/broadcast-%08x", i);
+		if (session_observe(ami, channel)) {
+			fprintf(stderr, "Failed to attach to %s\n", channel);
+			return;
+		}
+	}
+	broadcast_rate = 1000;
+	if (broadcast(ami, "PJSIP/broadcast-*", BENCH_BROADCAST, &result) || result.acknowledged != BENCH_BROADCAST_CHANNELS) {
+		fprintf(stderr, "Broadcast reached %d of %d channels\n", result.acknowledged, BENCH_BROADCAST_CHANNELS);
+	} else if (result.last_ack_us < (BENCH_BROADCAST_CHANNELS - BROADCAST_BURST) * 1000) {
+		fprintf(stderr, "Broadcast wasn't rate limited (last acknowledged after %lu us)\n", (unsigned long) result.last_ack_us);
+	}
+	broadcast_rate = 0; /* Measure the fan-out itself */
+}
+
+static void op_broadcast(struct ami_event *event)
+{
+	struct broadcast_result result;
+
+	broadcast(ami, "PJSIP/broadcast-*", BENCH_BROADCAST, &result);
+}
+
+static void setup_complete(void)
+{
+	static const char *vocabulary[] = {
+		"PLEASE", "HOLD", "WHILE", "I", "DIAL", "THE", "NUMBER", "GA", "SK", "THANK", "YOU", "FOR", "CALLING",
+		"HELLO", "THIS", "IS", "OPERATOR", "HOW", "CAN", "HELP", "Q", "RINGING", "ANSWERING", "MACHINE", "BUSY",
+		"NO", "ANSWER", "WOULD", "LIKE", "TO", "LEAVE", "A", "MESSAGE", "ONE", "MOMENT", "REPEAT", "THAT",
+		"PHARMACY", "DOCTOR", "APPOINTMENT", "TOMORROW", "MORNING", "CONNECTED", "NOW", "GOODBYE",
+	};
+	struct macro macros[MAX_MACROS];
+	char line[COMPLETE_MAX_PHRASE];
+	unsigned int seed = 1;
+	size_t len;
+	int i, words, num_macros;
+
+	if (bench_completer) {
+		return;
+	}
+	bench_completer = completer_create();
+	if (!bench_completer) {
+		return;
+	}
+	num_macros = macros_load(NULL, macros);
+	completer_learn_macros(bench_completer, macros, num_macros);
+	for (i = 0; i < BENCH_COMPLETE_LINES; i++) {
+		len = 0;
+		for (words = 3 + (int) (rand_r(&seed) % 8); words > 0; words--) {
+			len += (size_t) snprintf(line + len, sizeof(line) - len, "%s ", vocabulary[rand_r(&seed) % (sizeof(vocabulary) / sizeof(vocabulary[0]))]);
+		}
+		strcpy(line + len - 1, "\n");
+		completer_learn(bench_completer, line, 1);
+	}
+	completer_learn(bench_completer, BENCH_COMPLETE_TYPED, 2);
+}
+
+static void op_complete_key(struct ami_event *event)
+{
+	size_t len;
+
+	completer_typed(bench_completer, BENCH_COMPLETE_TYPED[complete_pos]);
+	completer_suggest(bench_completer, &len);
+	complete_pos = (complete_pos + 1) % (sizeof(BENCH_COMPLETE_TYPED) - 1);
+}
+
+static void op_send_char(struct ami_event *event)
+{
+	send_msg(ami, "A");
+}
+
+static void op_send_greeting(struct ami_event *event)
+{
+	send_msg(ami, "HELLO GA");
+}
+
+static void op_send_dtmf(struct ami_event *event)
+{
+	send_dtmf(ami, '5');
+}
+
+static void op_print_channels(struct ami_event *event)
+{
+	struct ami_response *resp = print_channels(ami, &channels_printed);
+	if (resp) {
+		ami_resp_free(resp);
+	}
+}
+
+static struct bench_case cases[] = {
+	{ "rx_char", "TddRxMsg, 1 character, rendered", setup_conversing, prepare_rx_char, op_event, 0 },
+	{ "rx_newline", "TddRxMsg, newline, rendered", setup_conversing, prepare_rx_newline, op_event, 0 },
+	{ "rx_line", "TddRxMsg, 21 characters, rendered", setup_conversing, prepare_rx_line, op_event, 0 },
+	{ "rx_other_channel", "TddRxMsg for another channel, discarded", setup_conversing, prepare_rx_other, op_event, 0 },
+	{ "event_ignored", "Non-TTY event while conversing", setup_conversing, prepare_varset, op_event, 0 },
+	{ "chanlist_event", "Newchannel while selecting a channel", setup_selecting, prepare_newchannel, op_event, 0 },
+	{ "record_line_char", "Recorded 64 character line, per-character RX", setup_record_char, NULL, op_record_line_char, 0 },
+	{ "record_line_line", "Recorded 64 character line, line-buffered RX", setup_record_line, NULL, op_record_line_line, 0 },
+	{ "policy_switch", "Observer attaches to and leaves a recorded channel", setup_record_switch, NULL, op_policy_switch, 0 },
+	{ "send_char", "send_msg, 1 character", setup_conversing, NULL, op_send_char, 0 },
+	{ "complete_key", "Keystroke tracked and completion suggested, 20000 lines learned", setup_complete, NULL, op_complete_key, 0 },
+	{ "send_greeting", "send_msg, greeting memo", setup_conversing, NULL, op_send_greeting, 0 },
+	{ "send_dtmf", "send_dtmf", setup_conversing, NULL, op_send_dtmf, 0 },
+	{ "print_channels_10", "Channel table, 10 channels", setup_channels_10, NULL, op_print_channels, 0 },
+	{ "print_channels_100", "Channel table, 100 channels", setup_channels_100, NULL, op_print_channels, 0 },
+	{ "ulaw_decode", "20 ms ulaw frame to slin", setup_ulaw_frame, NULL, op_ulaw_decode, BENCH_FRAME_SAMPLES },
+	{ "alaw_decode", "20 ms alaw frame to slin", setup_alaw_frame, NULL, op_alaw_decode, BENCH_FRAME_SAMPLES },
+	{ "ulaw_encode", "20 ms slin frame to ulaw", setup_slin_frame, NULL, op_ulaw_encode, BENCH_FRAME_SAMPLES },
+	{ "alaw_encode", "20 ms slin frame to alaw", setup_slin_frame, NULL, op_alaw_encode, BENCH_FRAME_SAMPLES },
+	{ "decode_echo_none", "20 ms of our own echo, decoded", setup_echo_none, NULL, op_decode_turn, BENCH_FRAME_SAMPLES },
+	{ "decode_echo_gate", "20 ms of our own echo, gated while sending", setup_echo_gate, NULL, op_decode_turn, BENCH_FRAME_SAMPLES },
+	{ "decode_echo_cancel", "20 ms of our own echo, cancelled (NLMS)", setup_echo_cancel, NULL, op_decode_turn, BENCH_FRAME_SAMPLES },
+	{ "rtp_ingest", "20 ms RTP packet, 256 streams, decoded", setup_rtp_inorder, NULL, op_rtp_ingest, BENCH_FRAME_SAMPLES },
+	{ "rtp_ingest_reordered", "20 ms RTP packet, 256 streams, 1 in 4 pairs swapped", setup_rtp_reordered, NULL, op_rtp_ingest, BENCH_FRAME_SAMPLES },
+	{ "t140_send", "TTY character to a T.140 packet, with redundancy", setup_t140, NULL, op_t140_send, 0 },
+	{ "t140_receive", "T.140 packet to TTY text, 1 in 4 lost and recovered", setup_t140, NULL, op_t140_receive, 0 },
+	{ "broadcast_64", "Broadcast to 64 sessions, pipelined, unlimited rate", setup_broadcast, NULL, op_broadcast, 0 },
+	{ "msg_line", "TTY line to MessageSend, through the gateway thread", setup_msg, NULL, op_msg_line, 0 },
+	{ "msg_receive", "Incoming message UserEvent to the TTY queue", setup_msg, prepare_msg_in, op_event, 0 },
+};
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*! \brief Resident set size, in KB */
+static double rss_kb(void)
+{
+	long pages, resident;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (!fp) {
+		return 0;
+	}
+	if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(fp);
+	return (double) (resident * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+/*!
+ * \brief Run a benchmark once, after it has been set up
+ * \param bc
+ * \param iterations
+ * \param[out] metrics
+ * \param[out] delivered Events delivered
+ */
+static int run_trial(struct bench_case *bc, unsigned long iterations, double *metrics, unsigned long *delivered)
+{
+	static struct ami_event *events[BENCH_BATCH];
+	static double latency[BENCH_LATENCY_SAMPLES];
+	struct alloc_counts counts;
+	struct timespec start, end;
+	unsigned long done = 0, allocs = 0, bytes = 0, before = mock_ami_event_count();
+	int i, samples = iterations < BENCH_LATENCY_SAMPLES ? (int) iterations : BENCH_LATENCY_SAMPLES;
+	double ns = 0;
+
+	while (done < iterations) {
+		unsigned long j, batch = iterations - done;
+
+		if (batch > BENCH_BATCH) {
+			batch = BENCH_BATCH;
+		}
+		/* Build the inputs outside of the timed region */
+		for (j = 0; j < batch; j++) {
+			events[j] = bc->prepare ? bc->prepare() : NULL;
+			if (bc->prepare && !events[j]) {
+				fprintf(stderr, "Failed to create event\n");
+				return -1;
+			}
+		}
+
+		alloc_counts_take(&counts);
+		alloc_counting(1);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (j = 0; j < batch; j++) {
+			bc->op(events[j]);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		alloc_counting(0);
+		alloc_counts_take(&counts);
+
+		ns += elapsed_ns(&start, &end);
+		allocs += counts.allocs;
+		bytes += counts.bytes;
+		done += batch;
+	}
+	*delivered = mock_ami_event_count() - before;
+
+	/* Then some on their own, for latency percentiles. These include the cost of reading the clock. */
+	for (i = 0; i < samples; i++) {
+		struct ami_event *event = bc->prepare ? bc->prepare() : NULL;
+
+		if (bc->prepare && !event) {
+			fprintf(stderr, "Failed to create event\n");
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		bc->op(event);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		latency[i] = elapsed_ns(&start, &end);
+	}
+
+	metrics[METRIC_OPS_SEC] = (double) iterations / ns * 1e9;
+	metrics[METRIC_P50_NS] = baseline_percentile(latency, samples, 50);
+	metrics[METRIC_P99_NS] = baseline_percentile(latency, samples, 99);
+	metrics[METRIC_ALLOCS] = (double) allocs / iterations;
+	metrics[METRIC_BYTES] = (double) bytes / iterations;
+	metrics[METRIC_RSS_KB] = rss_kb();
+	return 0;
+}
+
+/*! \brief Set up a benchmark, run it some number of times, and add the results to a baseline */
+static int run_case(struct bench_case *bc, unsigned long iterations, int trials, struct baseline *run)
+{
+	double metrics[BASELINE_MAX_TRIALS][METRIC_COUNT];
+	const struct baseline_result *r;
+	unsigned long delivered, total_delivered = 0;
+	int t;
+
+	if (bc->setup) {
+		bc->setup();
+	}
+	mock_ami_reset();
+
+	for (t = 0; t < trials; t++) {
+		if (run_trial(bc, iterations, metrics[t], &delivered)) {
+			return -1;
+		}
+		total_delivered += delivered;
+	}
+	r = baseline_add(run, bc->name, metrics, trials);
+	if (!r) {
+		return -1;
+	}
+
+	fprintf(out, "%-20s %10lu %12.1f %10.2f %10.1f %10.2f %10.0f %10.0f", bc->name, iterations,
+		1e9 / r->value[METRIC_OPS_SEC], r->value[METRIC_ALLOCS], r->value[METRIC_BYTES], (double) total_delivered / iterations / trials,
+		r->value[METRIC_P50_NS], r->value[METRIC_P99_NS]);
+	if (bc->samples) {
+		fprintf(out, " %12.1f", (double) bc->samples * r->value[METRIC_OPS_SEC] / 1e6); /* Millions of samples per second */
+	} else {
+		fprintf(out, " %12s", "-");
+	}
+	fprintf(out, "  %s\n", bc->description);
+	return 0;
+}
+
+/*! \brief Remove the transcripts written by the recording benchmarks */
+static void cleanup_record_dir(void)
+{
+	char path[512];
+	struct dirent *entry;
+	DIR *dir = opendir(record_dir);
+
+	if (!dir) {
+		return;
+	}
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", record_dir, entry->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dir);
+	rmdir(record_dir);
+}
+
+static void show_help(void)
+{
+	printf("AsTTYSpy benchmarks\n");
+	printf(" -a <agents>  Web console: attach this many browser agents over loopback WebSockets, and report batching, bandwidth and CPU\n");
+	printf(" -b <file>    Compare against a baseline, and fail if any metric regressed\n");
+	printf(" -c <calls>   Soak: calls per simulated day. Default is 2400.\n");
+	printf(" -d <calls>   Dialer: simulate a notification campaign of this many calls, and report calls per hour and success rate\n");
+	printf(" -f <name>    Only run benchmarks whose name contains this string\n");
+	printf(" -h           Show this help\n");
+	printf(" -j <calls>   Dialer: max concurrent calls. Default is 20.\n");
+	printf(" -l           List benchmarks\n");
+	printf(" -n <count>   Iterations per benchmark. Default is 200000.\n");
+	printf(" -p <cpu>     Pin to a CPU\n");
+	printf(" -s <days>    Soak: simulate this many days of call churn and fail if resource usage keeps growing\n");
+	printf(" -t <trials>  Run each benchmark this many times, and report the median. Default is 1.\n");
+	printf(" -u <chars>   UI: run it on a pseudo-terminal, type and receive this many characters, and report latency and bytes written\n");
+	printf(" -T <percent> How much worse a metric can get than the baseline before it's a regression. Default is %.0f.\n", BASELINE_TOLERANCE);
+	printf(" -v <viewers> Remote viewers: fan 32 sessions out to this many viewers over loopback, and report bandwidth per viewer\n");
+	printf(" -w <file>    Save the results as a baseline\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int c, outfd, res;
+	int soak_days = 0, calls_per_day = 2400, dial_calls = 0, dial_concurrency = 20, viewers = 0, agents = 0, ui_chars = 0;
+	int trials = 1, cpu = -1;
+	size_t i;
+	unsigned long iterations = 200000;
+	double tolerance = BASELINE_TOLERANCE;
+	const char *filter = NULL, *baseline_file = NULL, *save_file = NULL;
+	struct baseline base, run;
+	cpu_set_t cpus;
+
+	while ((c = getopt(argc, argv, "?a:b:c:d:f:hj:ln:p:s:t:T:u:v:w:")) != -1) {
+		switch (c) {
+		case 'a':
+			agents = atoi(optarg);
+			break;
+		case 'b':
+			baseline_file = optarg;
+			break;
+		case 'c':
+			calls_per_day = atoi(optarg);
+			break;
+		case 'd':
+			dial_calls = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'j':
+			dial_concurrency = atoi(optarg);
+			break;
+		case 'l':
+			for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+				printf("%-20s %s\n", cases[i].name, cases[i].description);
+			}
+			return 0;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			cpu = atoi(optarg);
+			break;
+		case 's':
+			soak_days = atoi(optarg);
+			break;
+		case 't':
+			trials = atoi(optarg);
+			break;
+		case 'T':
+			tolerance = atof(optarg);
+			break;
+		case 'u':
+			ui_chars = atoi(optarg);
+			break;
+		case 'v':
+			viewers = atoi(optarg);
+			break;
+		case 'w':
+			save_file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (!iterations) {
+		fprintf(stderr, "Invalid iteration count\n");
+		return -1;
+	} else if (trials < 1 || trials > BASELINE_MAX_TRIALS) {
+		fprintf(stderr, "Trials must be between 1 and %d\n", BASELINE_MAX_TRIALS);
+		return -1;
+	}
+	if (cpu >= 0) {
+		/* Threads started later (gateways, broadcast workers) inherit this */
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus)) {
+			fprintf(stderr, "Failed to pin to CPU %d: %s\n", cpu, strerror(errno));
+			return -1;
+		}
+	}
+	memset(&base, 0, sizeof(base));
+	memset(&run, 0, sizeof(run));
+	if (baseline_file && baseline_load(&base, baseline_file)) {
+		return -1;
+	}
+	run.iterations = iterations;
+	run.trials = trials;
+
+	/* Rendering still goes through stdio, but to /dev/null, so the terminal isn't what's being measured. */
+	outfd = dup(STDOUT_FILENO);
+	out = outfd < 0 ? NULL : fdopen(outfd, "w");
+	if (!out || !freopen("/dev/null", "w", stdout)) {
+		fprintf(stderr, "Failed to redirect stdout\n");
+		return -1;
+	}
+
+	if (soak_days > 0) {
+		res = soak_run(out, soak_days, calls_per_day);
+		fclose(out);
+		return res;
+	}
+	if (dial_calls > 0) {
+		res = dial_concurrency > 0 ? dialsim_run(out, dial_calls, dial_concurrency) : -1;
+		fclose(out);
+		return res;
+	}
+	if (viewers > 0) {
+		res = viewsim_run(out, viewers);
+		fclose(out);
+		return res;
+	}
+	if (agents > 0) {
+		res = websim_run(out, agents);
+		fclose(out);
+		return res;
+	}
+	if (ui_chars > 0) {
+		res = ptysim_run(out, ui_chars);
+		fclose(out);
+		return res;
+	}
+
+	ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+	if (!ami || mock_ami_set_channels(10)) {
+		return -1;
+	}
+	if (!mkdtemp(record_dir)) {
+		fprintf(stderr, "Failed to create transcript directory\n");
+		return -1;
+	}
+
+	fprintf(out, "%-20s %10s %12s %10s %10s %10s %10s %10s %12s\n", "Benchmark", "Iterations", "ns/op", "allocs/op", "bytes/op", "events/op",
+		"p50 ns", "p99 ns", "Msamples/s");
+	res = 0;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (filter && !strstr(cases[i].name, filter)) {
+			continue;
+		}
+		if (run_case(&cases[i], iterations, trials, &run)) {
+			res = -1;
+			break;
+		}
+	}
+
+	if (msg_gateway) {
+		msg_gateway_stop(msg_gateway);
+	}
+	sessions_destroy();
+	cleanup_record_dir();
+	if (receiver) {
+		rtp_receiver_destroy(receiver);
+	}
+	if (bench_completer) {
+		completer_destroy(bench_completer);
+	}
+	ami_destroy(ami);
+
+	if (!res && save_file && baseline_save(&run, save_file)) {
+		res = -1;
+	}
+	if (!res && baseline_file && baseline_compare(out, &base, &run, tolerance)) {
+		res = 1;
+	}
+	baseline_free(&base);
+	baseline_free(&run);
+	fclose(out);
+	return res;
+}
@@ -0,0 +1,312 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Simulated outbound notification campaign, using the mock AMI
+ *
+ * Asterisk is simulated by reacting to the campaign's actions: Originate
+ * is answered (or not) after a ring delay, TddTx gets a reply (or not), and
+ * Hangup raises a Hangup event. Replies are delivered by a separate thread,
+ * as CAMI's event thread would. Each call's outcome is picked from its number:
+ *
+ * - 1 in 10 isn't answered
+ * - 1 in 10 is answered, but the user never types SK, so it times out
+ * - 1 in 20 hangs up after reading the notice, without typing SK
+ * - The rest type a reply ending in SK
+ *
+ * Time is simulated (see vclock.h), so the delays and timeouts are those of
+ * real calls, but an hour of calls takes milliseconds, and the report is the
+ * same every time.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "session.h"
+#include "campaign.h"
+#include "baudot.h"
+#include "vclock.h"
+#include "mock_ami.h"
+#include "dialsim.h"
+
+#define DIALSIM_NOTICE "OUTAGE TONIGHT GA"
+#define DIALSIM_THINK_MS 4000	/* From the end of the notice to the user starting to type */
+#define DIALSIM_HANGUP_MS 20	/* From Hangup to the Hangup event */
+
+enum dialsim_outcome {
+	SIM_ACK = 0,
+	SIM_NO_ANSWER,
+	SIM_NO_ACK,
+	SIM_HANGUP,
+};
+
+struct dialsim_event {
+	uint64_t due_ms;
+	struct ami_event *event;
+	struct dialsim_event *next;
+};
+
+static struct ami_session *sim_ami;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static struct dialsim_event *sim_events = NULL; /* Sorted by due_ms */
+static int sim_stop = 0;
+
+static enum dialsim_outcome outcome(unsigned long callno)
+{
+	if (callno % 10 == 3) {
+		return SIM_NO_ANSWER;
+	} else if (callno % 10 == 7) {
+		return SIM_NO_ACK;
+	} else if (callno % 20 == 5) {
+		return SIM_HANGUP;
+	}
+	return SIM_ACK;
+}
+
+/*! \brief Ring delay, 5 to 25 seconds, varying by call */
+static int ring_ms(unsigned long callno)
+{
+	return 5000 + (int) ((callno * 2654435761UL) % 20001);
+}
+
+/*! \brief From TddTx until the user has read the notice and typed something, at TTY speed */
+static int reply_ms(const char *reply)
+{
+	return (int) (baudot_text_ms(DIALSIM_NOTICE) + DIALSIM_THINK_MS + baudot_text_ms(reply));
+}
+
+static void schedule(struct ami_event *event, int delay_ms)
+{
+	struct dialsim_event *e = malloc(sizeof(*e)), **pos;
+
+	if (!e || !event) {
+		free(e);
+		if (event) {
+			ami_event_free(event);
+		}
+		return;
+	}
+	e->due_ms = vclock_now_ms() + (uint64_t) delay_ms;
+	e->event = event;
+	pthread_mutex_lock(&sim_lock);
+	for (pos = &sim_events; *pos && (*pos)->due_ms <= e->due_ms; pos = &(*pos)->next);
+	e->next = *pos;
+	*pos = e;
+	vclock_signal(&sim_cond);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+/*! \brief Deliver events when they are due, as CAMI's event thread would */
+static void *sim_thread(void *varg)
+{
+	struct dialsim_event *e;
+
+	(void) varg;
+	pthread_mutex_lock(&sim_lock);
+	while (!sim_stop) {
+		if (sim_events && sim_events->due_ms <= vclock_now_ms()) {
+			e = sim_events;
+			sim_events = e->next;
+			pthread_mutex_unlock(&sim_lock);
+			mock_ami_deliver(sim_ami, e->event);
+			free(e);
+			pthread_mutex_lock(&sim_lock);
+			continue;
+		}
+		vclock_wait(&sim_cond, &sim_lock, sim_events ? sim_events->due_ms : VCLOCK_FOREVER);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return NULL;
+}
+
+/*! \brief Get a field from an action */
+static const char *field(const char *fields, const char *key, char *buf, size_t len)
+{
+	size_t keylen = strlen(key);
+	const char *s = fields;
+
+	buf[0] = '\0';
+	while (s && *s) {
+		if (!strncmp(s, key, keylen) && s[keylen] == ':') {
+			s += keylen + 1;
+			snprintf(buf, len, "%.*s", (int) strcspn(s, "\r\n"), s);
+			break;
+		}
+		s = strstr(s, "\r\n");
+		s = s ? s + 2 : NULL;
+	}
+	return buf;
+}
+
+/*! \brief Call number, from a channel name or ChannelId (the number after the last -) */
+static unsigned long callno_of(const char *s)
+{
+	const char *dash = strrchr(s, '-');
+
+	return dash ? strtoul(dash + 1, NULL, 10) : 0;
+}
+
+/*! \brief React to the campaign's actions, as Asterisk and the TTY user would */
+static void sim_action(const char *action, const char *fields)
+{
+	char id[64], dest[64], channel[80];
+	unsigned long callno;
+
+	if (!strcmp(action, "Originate")) {
+		field(fields, "ChannelId", id, sizeof(id));
+		field(fields, "Channel", dest, sizeof(dest));
+		callno = callno_of(id);
+		if (outcome(callno) == SIM_NO_ANSWER) {
+			schedule(mock_ami_event("Event", "OriginateResponse", "Response", "Failure", "Channel", dest, "Uniqueid", id, "Reason", "3", NULL), ring_ms(callno));
+			return;
+		}
+		snprintf(channel, sizeof(channel), "PJSIP/%s", id); /* So the Uniqueid can be found from the channel */
+		schedule(mock_ami_event("Event", "OriginateResponse", "Response", "Success", "Channel", channel, "Uniqueid", id, "Reason", "4", NULL), ring_ms(callno));
+	} else if (!strcmp(action, "TddTx")) {
+		field(fields, "Channel", channel, sizeof(channel));
+		callno = callno_of(channel);
+		snprintf(id, sizeof(id), "%s", channel + strlen("PJSIP/"));
+		switch (outcome(callno)) {
+		case SIM_ACK:
+			schedule(mock_ami_event("Event", "TddRxMsg", "Channel", channel, "Message", "OK_THANKS_", NULL), reply_ms("OK THANKS "));
+			/* Half type SK and hang up themselves, without a space after it */
+			schedule(mock_ami_event("Event", "TddRxMsg", "Channel", channel, "Message", callno % 2 ? "SK_SK_" : "SKSK", NULL),
+				reply_ms(callno % 2 ? "OK THANKS SK SK " : "OK THANKS SKSK"));
+			if (!(callno % 2)) {
+				schedule(mock_ami_event("Event", "Hangup", "Channel", channel, "Uniqueid", id, NULL), reply_ms("OK THANKS SKSK") + 1);
+			}
+			break;
+		case SIM_HANGUP:
+			schedule(mock_ami_event("Event", "Hangup", "Channel", channel, "Uniqueid", id, NULL), reply_ms(""));
+			break;
+		case SIM_NO_ANSWER:
+		case SIM_NO_ACK:
+			break;
+		}
+	} else if (!strcmp(action, "Hangup")) {
+		field(fields, "Channel", channel, sizeof(channel));
+		snprintf(id, sizeof(id), "%s", channel + strlen("PJSIP/"));
+		schedule(mock_ami_event("Event", "Hangup", "Channel", channel, "Uniqueid", id, NULL), DIALSIM_HANGUP_MS);
+	}
+}
+
+int dialsim_run(FILE *out, int calls, int concurrency)
+{
+	struct campaign_options opts;
+	struct campaign_stats stats;
+	struct dialsim_event *e;
+	pthread_t thread;
+	char **dests;
+	unsigned long expected[SIM_HANGUP + 1] = { 0 };
+	unsigned long i, answered, failures = 0;
+	struct timespec start, end;
+	int res;
+
+	dests = calloc((size_t) calls, sizeof(*dests));
+	if (!dests) {
+		return -1;
+	}
+	for (i = 0; i < (unsigned long) calls; i++) {
+		dests[i] = malloc(40);
+		if (!dests[i]) {
+			res = -1;
+			goto cleanup;
+		}
+		snprintf(dests[i], 40, "PJSIP/555%07lu@trunk", i);
+		expected[outcome(i)]++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	vclock_simulate();
+	sim_ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+	if (!sim_ami) {
+		vclock_real();
+		res = -1;
+		goto cleanup;
+	}
+	sim_stop = 0;
+	if (vclock_thread_create(&thread, sim_thread, NULL)) {
+		ami_destroy(sim_ami);
+		vclock_real();
+		res = -1;
+		goto cleanup;
+	}
+	mock_ami_set_action_hook(sim_action);
+
+	campaign_defaults(&opts);
+	opts.concurrency = concurrency;
+	res = campaign_run(sim_ami, dests, calls, DIALSIM_NOTICE, &opts, &stats);
+
+	mock_ami_set_action_hook(NULL);
+	pthread_mutex_lock(&sim_lock);
+	sim_stop = 1;
+	vclock_signal(&sim_cond);
+	pthread_mutex_unlock(&sim_lock);
+	vclock_thread_join(thread);
+	while ((e = sim_events)) {
+		sim_events = e->next;
+		ami_event_free(e->event);
+		free(e);
+	}
+	sessions_destroy();
+	ami_destroy(sim_ami);
+	vclock_real();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (res) {
+		goto cleanup;
+	}
+
+	fprintf(out, "Simulated campaign: %d calls, %d at a time, %s notice\n", calls, concurrency, DIALSIM_NOTICE);
+	campaign_report(out, &stats);
+	fprintf(out, "Simulated in:       %.0f ms\n",
+		(double) (end.tv_sec - start.tv_sec) * 1000.0 + (double) (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+	answered = (unsigned long) calls - expected[SIM_NO_ANSWER];
+	if (stats.attempted != (unsigned long) calls || stats.answered != answered || stats.delivered != answered) {
+		fprintf(out, "FAIL: expected %d attempted, %lu answered and delivered\n", calls, answered);
+		failures++;
+	}
+	if (stats.acknowledged != expected[SIM_ACK]) {
+		fprintf(out, "FAIL: expected %lu acknowledged\n", expected[SIM_ACK]);
+		failures++;
+	}
+	if (stats.timeouts != expected[SIM_NO_ACK]) {
+		fprintf(out, "FAIL: expected %lu timed out\n", expected[SIM_NO_ACK]);
+		failures++;
+	}
+	res = failures ? 1 : 0;
+
+cleanup:
+	for (i = 0; i < (unsigned long) calls; i++) {
+		free(dests[i]);
+	}
+	free(dests);
+	return res;
+}
@@ -0,0 +1,35 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Simulated outbound notification campaign, using the mock AMI
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Run a campaign against simulated TTY users, and report calls per hour and success rate
+ * \param out Where to write the report
+ * \param calls Number of calls
+ * \param concurrency Max calls at once
+ * \retval 0 if every call had the expected outcome, 1 if not, -1 on error
+ */
+int dialsim_run(FILE *out, int calls, int concurrency);
@@ -0,0 +1,335 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Mock AMI: link-time stand-in for CAMI
+ *
+ * This implements the parts of the CAMI API that AsTTYSpy uses, without any socket.
+ * Events are synthesized by the caller and actions are only recorded.
+ *
+ * The core only ever accesses events through ami_keyvalue(), so events use
+ * their own representation here. Responses are accessed directly by the core,
+ * so those use CAMI's struct ami_response.
+ *
+ * Actions don't allocate anything, so allocations counted by the benchmarks
+ * are those made by AsTTYSpy itself.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "mock_ami.h"
+
+#define MOCK_MAX_FIELDS 32
+#define MOCK_MAX_ACTIONS 32
+
+struct ami_session {
+	void (*callback)(struct ami_session *ami, struct ami_event *event);
+	void (*dis_callback)(struct ami_session *ami);
+};
+
+struct mock_event {
+	int size;
+	char *keys[MOCK_MAX_FIELDS];
+	char *values[MOCK_MAX_FIELDS];
+	char data[];
+};
+
+struct mock_action {
+	char name[32];
+	unsigned long count;
+};
+
+/* Declared here too, so the format attribute is present even if the CAMI headers don't have it */
+struct ami_response *ami_action(struct ami_session *ami, const char *action, const char *fmt, ...) __attribute__ ((format (printf, 3, 4)));
+
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_action actions[MOCK_MAX_ACTIONS];
+static int num_actions = 0;
+static unsigned long total_actions = 0;
+static char last_action[512] = "";
+static int action_result = 0;
+static unsigned long events_delivered = 0;
+static void (*action_hook)(const char *action, const char *fields) = NULL;
+
+/* Actions just return one of these, so they are never freed */
+static struct ami_response mock_success, mock_failure;
+static struct ami_response *channels_resp = NULL;
+
+struct ami_event *mock_ami_event(const char *key, ...)
+{
+	va_list ap;
+	struct mock_event *event;
+	const char *k, *v;
+	size_t len = 0;
+	char *pos;
+	int size = 0;
+
+	va_start(ap, key);
+	for (k = key; k; k = va_arg(ap, const char *)) {
+		v = va_arg(ap, const char *);
+		len += strlen(k) + strlen(v) + 2;
+		size++;
+	}
+	va_end(ap);
+
+	if (size > MOCK_MAX_FIELDS) {
+		return NULL;
+	}
+	event = malloc(sizeof(*event) + len);
+	if (!event) {
+		return NULL;
+	}
+	event->size = size;
+	pos = event->data;
+	size = 0;
+
+	va_start(ap, key);
+	for (k = key; k; k = va_arg(ap, const char *)) {
+		v = va_arg(ap, const char *);
+		event->keys[size] = pos;
+		pos = stpcpy(pos, k) + 1;
+		event->values[size] = pos;
+		pos = stpcpy(pos, v) + 1;
+		size++;
+	}
+	va_end(ap);
+	return (struct ami_event *) event;
+}
+
+void mock_ami_deliver(struct ami_session *ami, struct ami_event *event)
+{
+	events_delivered++;
+	if (ami->callback) {
+		ami->callback(ami, event);
+	} else {
+		ami_event_free(event);
+	}
+}
+
+const char *ami_keyvalue(struct ami_event *event, const char *key)
+{
+	struct mock_event *e = (struct mock_event *) event;
+	int i;
+
+	for (i = 0; i < e->size; i++) {
+		if (!strcasecmp(e->keys[i], key)) {
+			return e->values[i];
+		}
+	}
+	return ""; /* Like CAMI, return an empty string rather than NULL */
+}
+
+void ami_event_free(struct ami_event *event)
+{
+	free(event);
+}
+
+int mock_ami_set_channels(int count)
+{
+	struct ami_response *resp;
+	int i;
+
+	resp = calloc(1, sizeof(*resp) + (count + 2) * sizeof(resp->events[0]));
+	if (!resp) {
+		return -1;
+	}
+	resp->size = count + 2;
+	resp->events[0] = mock_ami_event("Response", "Success", "EventList", "start", NULL);
+	for (i = 1; i <= count; i++) {
+		char channel[64], duration[16], cid[16], connected[16];
+		snprintf(channel, sizeof(channel), "PJSIP/mock-%08x", i);
+		snprintf(duration, sizeof(duration), "00:%02d:%02d", (i / 60) % 60, i % 60);
+		snprintf(cid, sizeof(cid), "555%07d", i);
+		snprintf(connected, sizeof(connected), "711");
+		resp->events[i] = mock_ami_event("Event", "CoreShowChannel", "Channel", channel, "Duration", duration,
+			"CallerIDNum", cid, "ConnectedLineNum", connected, NULL);
+	}
+	resp->events[count + 1] = mock_ami_event("Event", "CoreShowChannelsComplete", "ListItems", "0", NULL);
+
+	pthread_mutex_lock(&mock_lock);
+	if (channels_resp) {
+		for (i = 0; i < channels_resp->size; i++) {
+			ami_event_free(channels_resp->events[i]);
+		}
+		free(channels_resp);
+	}
+	channels_resp = resp;
+	pthread_mutex_unlock(&mock_lock);
+	return 0;
+}
+
+void mock_ami_set_action_hook(void (*hook)(const char *action, const char *fields))
+{
+	action_hook = hook;
+}
+
+void mock_ami_set_action_result(int res)
+{
+	action_result = res;
+}
+
+unsigned long mock_ami_action_count(const char *action)
+{
+	unsigned long count = 0;
+	int i;
+
+	pthread_mutex_lock(&mock_lock);
+	if (!action) {
+		count = total_actions;
+	} else {
+		for (i = 0; i < num_actions; i++) {
+			if (!strcmp(actions[i].name, action)) {
+				count = actions[i].count;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&mock_lock);
+	return count;
+}
+
+const char *mock_ami_last_action(void)
+{
+	return last_action;
+}
+
+unsigned long mock_ami_event_count(void)
+{
+	return events_delivered;
+}
+
+void mock_ami_reset(void)
+{
+	pthread_mutex_lock(&mock_lock);
+	num_actions = 0;
+	total_actions = 0;
+	events_delivered = 0;
+	last_action[0] = '\0';
+	pthread_mutex_unlock(&mock_lock);
+}
+
+static void record_action(const char *action)
+{
+	int i;
+
+	for (i = 0; i < num_actions; i++) {
+		if (!strcmp(actions[i].name, action)) {
+			break;
+		}
+	}
+	if (i == num_actions && num_actions < MOCK_MAX_ACTIONS) {
+		snprintf(actions[i].name, sizeof(actions[i].name), "%s", action);
+		actions[i].count = 0;
+		num_actions++;
+	}
+	if (i < num_actions) {
+		actions[i].count++;
+	}
+	total_actions++;
+}
+
+struct ami_response *ami_action(struct ami_session *ami, const char *action, const char *fmt, ...)
+{
+	va_list ap;
+	char fields[sizeof(last_action)];
+	int len;
+
+	pthread_mutex_lock(&mock_lock);
+	record_action(action);
+	len = snprintf(last_action, sizeof(last_action), "Action:%s\r\n", action);
+	if (len > 0 && (size_t) len < sizeof(last_action)) {
+		va_start(ap, fmt);
+		vsnprintf(last_action + len, sizeof(last_action) - (size_t) len, fmt, ap);
+		va_end(ap);
+	}
+	if (action_hook) {
+		snprintf(fields, sizeof(fields), "%s", len > 0 && (size_t) len < sizeof(last_action) ? last_action + len : "");
+	}
+	pthread_mutex_unlock(&mock_lock);
+
+	if (action_hook) {
+		action_hook(action, fields); /* Outside the lock, since it may issue actions or deliver events */
+	}
+	return action_result ? &mock_failure : &mock_success;
+}
+
+int ami_action_response_result(struct ami_session *ami, struct ami_response *resp)
+{
+	return resp == &mock_success ? 0 : -1;
+}
+
+void ami_resp_free(struct ami_response *resp)
+{
+	/* Responses are owned by the mock */
+}
+
+struct ami_response *ami_action_show_channels(struct ami_session *ami)
+{
+	pthread_mutex_lock(&mock_lock);
+	record_action("CoreShowChannels");
+	pthread_mutex_unlock(&mock_lock);
+	return channels_resp;
+}
+
+int ami_action_login(struct ami_session *ami, const char *username, const char *password)
+{
+	pthread_mutex_lock(&mock_lock);
+	record_action("Login");
+	pthread_mutex_unlock(&mock_lock);
+	return action_result;
+}
+
+int ami_auto_detect_ami_pass(const char *amiusername, char *buf, size_t buflen)
+{
+	snprintf(buf, buflen, "mock");
+	return 0;
+}
+
+struct ami_session *ami_connect(const char *hostname, int port, void (*callback)(struct ami_session *ami, struct ami_event *event), void (*dis_callback)(struct ami_session *ami))
+{
+	struct ami_session *ami = calloc(1, sizeof(*ami));
+
+	if (!ami) {
+		return NULL;
+	}
+	ami->callback = callback;
+	ami->dis_callback = dis_callback;
+	return ami;
+}
+
+int ami_disconnect(struct ami_session *ami)
+{
+	return 0;
+}
+
+void ami_destroy(struct ami_session *ami)
+{
+	free(ami);
+}
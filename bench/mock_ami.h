@@ -0,0 +1,63 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Mock AMI: link-time stand-in for CAMI
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Create a synthetic event
+ * \param key First key, followed by its value, then more key/value pairs, ending with NULL
+ * \return Event, which will be freed by whoever consumes it using ami_event_free()
+ */
+struct ami_event *mock_ami_event(const char *key, ...) __attribute__ ((sentinel));
+
+/*! \brief Deliver an event to the session's event callback, as CAMI's event thread would */
+void mock_ami_deliver(struct ami_session *ami, struct ami_event *event);
+
+/*! \brief Set the number of channels returned by CoreShowChannels */
+int mock_ami_set_channels(int count);
+
+/*!
+ * \brief Call a function for every action issued, so a simulation can react to it as Asterisk would
+ * \param hook Called with the action name and its fields, formatted as on the wire, or NULL for none
+ */
+void mock_ami_set_action_hook(void (*hook)(const char *action, const char *fields));
+
+/*! \brief Make subsequent actions fail (nonzero) or succeed (0) */
+void mock_ami_set_action_result(int res);
+
+/*!
+ * \brief Number of actions issued
+ * \param action Action name, or NULL for all actions
+ */
+unsigned long mock_ami_action_count(const char *action);
+
+/*! \brief The last action issued, formatted as it would be sent on the wire (without the ActionID) */
+const char *mock_ami_last_action(void);
+
+/*! \brief Number of events delivered */
+unsigned long mock_ami_event_count(void);
+
+/*! \brief Reset action and event counters */
+void mock_ami_reset(void);
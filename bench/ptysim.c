@@ -0,0 +1,442 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief The interactive UI, driven through a pseudo-terminal
+ *
+ * The UI (ttyspy) runs as it would for real, in its own thread, but with
+ * stdin and stdout on the slave side of a pseudo-terminal, so stdio buffers
+ * as it would on a terminal, and the line discipline echoes and translates
+ * as it would. The master side is read by another thread, which timestamps
+ * every byte written to the "screen". Keystrokes are written to the master,
+ * and received text is delivered through the mock AMI, one character per
+ * event as Asterisk sends it, waiting for each to show up before the next.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define _GNU_SOURCE /* posix_openpt, memmem */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "macro.h"
+#include "complete.h"
+#include "mock_ami.h"
+#include "baseline.h"
+#include "ptysim.h"
+
+#define PTYSIM_CHANNELS 10
+#define PTYSIM_REFRESHES 3		/* New channels while the picker is up */
+#define PTYSIM_WAIT_MS 3000		/* For anything to show up. The picker only refreshes every second. */
+#define PTYSIM_SETTLE_MS 50		/* No output for this long, and the screen is done changing */
+#define PTYSIM_PROMPT "=> Channel No.: "
+#define PTYSIM_MENU "TAB accepts a suggestion"
+/* Neither has K, [ or digits, so a character can't be mistaken for part of an escape sequence */
+#define PTYSIM_TYPED "HELLO THIS IS THE OPERATOR GA\n"
+#define PTYSIM_RX "GO AHEAD PLEASE THIS IS MARY GA\n"
+
+/* Everything written to the screen, and when each byte was read */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *buf;
+	uint64_t *times;
+	size_t len;
+	size_t size;
+	int fd;
+	int stop;
+} screen = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, -1, 0 };
+
+static struct ami_session *ui_ami;
+
+static uint64_t sim_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void *reader(void *varg)
+{
+	struct pollfd pfd;
+	char chunk[4096];
+	ssize_t n;
+	uint64_t now;
+	size_t i;
+
+	(void) varg;
+	pfd.fd = screen.fd;
+	pfd.events = POLLIN;
+	while (!__atomic_load_n(&screen.stop, __ATOMIC_ACQUIRE)) {
+		if (poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+		n = read(screen.fd, chunk, sizeof(chunk));
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		now = sim_now_ns();
+		pthread_mutex_lock(&screen.lock);
+		if (screen.len + (size_t) n > screen.size) {
+			size_t size = 2 * (screen.len + (size_t) n);
+			char *buf = realloc(screen.buf, size);
+			uint64_t *times = buf ? realloc(screen.times, size * sizeof(*times)) : NULL;
+
+			if (buf) {
+				screen.buf = buf;
+			}
+			if (!times) {
+				pthread_mutex_unlock(&screen.lock);
+				break;
+			}
+			screen.times = times;
+			screen.size = size;
+		}
+		memcpy(screen.buf + screen.len, chunk, (size_t) n);
+		for (i = 0; i < (size_t) n; i++) {
+			screen.times[screen.len++] = now;
+		}
+		pthread_cond_broadcast(&screen.cond);
+		pthread_mutex_unlock(&screen.lock);
+	}
+	return NULL;
+}
+
+static void *ui_thread(void *varg)
+{
+	(void) varg;
+	ttyspy(ui_ami);
+	return NULL;
+}
+
+static void deadline_after(struct timespec *ts, int ms)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long) (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/*!
+ * \brief Wait for text to show up on the screen
+ * \param text
+ * \param from Where on the screen to look from
+ * \param[out] at When the last byte of it was written
+ * \return Where on the screen it ended, or 0 if it didn't show up
+ */
+static size_t wait_for(const char *text, size_t from, uint64_t *at)
+{
+	struct timespec ts;
+	size_t len = strlen(text), end = 0;
+	char *found;
+
+	deadline_after(&ts, PTYSIM_WAIT_MS);
+	pthread_mutex_lock(&screen.lock);
+	for (;;) {
+		found = screen.len > from ? memmem(screen.buf + from, screen.len - from, text, len) : NULL;
+		if (found) {
+			end = (size_t) (found - screen.buf) + len;
+			*at = screen.times[end - 1];
+			break;
+		}
+		if (pthread_cond_timedwait(&screen.cond, &screen.lock, &ts) == ETIMEDOUT) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&screen.lock);
+	return end;
+}
+
+/*! \brief Wait for the screen to stop changing, and return how much has been written to it */
+static size_t settle(void)
+{
+	struct timespec ts;
+	size_t len;
+
+	pthread_mutex_lock(&screen.lock);
+	do {
+		len = screen.len;
+		deadline_after(&ts, PTYSIM_SETTLE_MS);
+		while (screen.len == len && pthread_cond_timedwait(&screen.cond, &screen.lock, &ts) != ETIMEDOUT);
+	} while (screen.len != len);
+	pthread_mutex_unlock(&screen.lock);
+	return len;
+}
+
+static size_t screen_len(void)
+{
+	size_t len;
+
+	pthread_mutex_lock(&screen.lock);
+	len = screen.len;
+	pthread_mutex_unlock(&screen.lock);
+	return len;
+}
+
+/*! \brief Characters that end up visible: printable ones, not counting escape sequences */
+static unsigned long displayed(size_t from, size_t to)
+{
+	unsigned long count = 0;
+	size_t i;
+
+	pthread_mutex_lock(&screen.lock);
+	for (i = from; i < to; i++) {
+		unsigned char c = (unsigned char) screen.buf[i];
+
+		if (c == 27) {
+			if (i + 1 < to && screen.buf[i + 1] == '[') {
+				/* CSI: parameters, then a final byte from @ to ~ */
+				for (i += 2; i < to && (screen.buf[i] < '@' || screen.buf[i] > '~'); i++);
+			} else {
+				i++;
+			}
+		} else if (c >= ' ' && c != 127) {
+			count++;
+		}
+	}
+	pthread_mutex_unlock(&screen.lock);
+	return count;
+}
+
+static void report_latency(FILE *out, const char *what, double *us, int count)
+{
+	double total = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		total += us[i];
+	}
+	fprintf(out, "%-22s avg %7.1f us, p50 %7.1f us, p99 %7.1f us, max %7.1f us\n", what, total / count,
+		baseline_percentile(us, count, 50), baseline_percentile(us, count, 99), baseline_percentile(us, count, 100));
+}
+
+int ptysim_run(FILE *out, int chars)
+{
+	struct macro macros[MAX_MACROS];
+	pthread_t ui, rd;
+	double *type_us = NULL, *rx_us = NULL, refresh_ms[PTYSIM_REFRESHES], refresh_total = 0;
+	unsigned long draw_bytes, draw_chars, refresh_bytes = 0, refresh_chars = 0, type_chars, rx_chars;
+	size_t from, pos, type_from, type_to, rx_from, rx_to;
+	uint64_t start, at;
+	char c, expect[2] = "", msg[3], channel[64];
+	int i, master, slave, saved_in, saved_out, num_macros, conversing = 0, res = -1;
+
+	if (chars < 1 || chars > PTYSIM_MAX_CHARS) {
+		fprintf(stderr, "Characters must be between 1 and %d\n", PTYSIM_MAX_CHARS);
+		return -1;
+	}
+	type_us = malloc((size_t) chars * sizeof(*type_us));
+	rx_us = malloc((size_t) chars * sizeof(*rx_us));
+	if (!type_us || !rx_us) {
+		goto cleanup;
+	}
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		fprintf(stderr, "Failed to open a pseudo-terminal: %s\n", strerror(errno));
+		if (master >= 0) {
+			close(master);
+		}
+		goto cleanup;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", ptsname(master), strerror(errno));
+		close(master);
+		goto cleanup;
+	}
+
+	/* As it would be run: the default macros to complete from */
+	ui_ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+	if (!ui_ami || mock_ami_set_channels(PTYSIM_CHANNELS)) {
+		if (ui_ami) {
+			ami_destroy(ui_ami);
+		}
+		close(slave);
+		close(master);
+		goto cleanup;
+	}
+	num_macros = macros_load(NULL, macros);
+	completer = completer_create();
+	if (completer && num_macros > 0) {
+		completer_learn_macros(completer, macros, num_macros);
+	}
+
+	/* The UI's stdin and stdout are the pseudo-terminal. stdout hasn't been written yet, so it will be line buffered, as on a terminal. */
+	fflush(stdout);
+	saved_in = dup(STDIN_FILENO);
+	saved_out = dup(STDOUT_FILENO);
+	dup2(slave, STDIN_FILENO);
+	dup2(slave, STDOUT_FILENO);
+	screen.fd = master;
+	screen.stop = 0;
+	start = sim_now_ns();
+	if (pthread_create(&rd, NULL, reader, NULL)) {
+		goto restore;
+	}
+	if (pthread_create(&ui, NULL, ui_thread, NULL)) {
+		__atomic_store_n(&screen.stop, 1, __ATOMIC_RELEASE);
+		pthread_join(rd, NULL);
+		goto restore;
+	}
+
+	/* The channel picker: first drawn, then redrawn for new channels */
+	pos = wait_for(PTYSIM_PROMPT, 0, &at);
+	if (!pos) {
+		fprintf(out, "FAIL: channel picker never showed up\n");
+		goto quit;
+	}
+	draw_bytes = (unsigned long) pos;
+	draw_chars = displayed(0, pos);
+	fprintf(out, "UI on a pseudo-terminal: %d channels, %d characters typed and received\n", PTYSIM_CHANNELS, chars);
+	fprintf(out, "Picker: drawn in %.1f ms, %lu bytes for %lu characters shown\n", (double) (at - start) / 1e6, draw_bytes, draw_chars);
+	for (i = 0; i < PTYSIM_REFRESHES; i++) {
+		from = settle();
+		snprintf(channel, sizeof(channel), "PJSIP/new-%08x", i);
+		start = sim_now_ns();
+		mock_ami_deliver(ui_ami, mock_ami_event("Event", "Newchannel", "Channel", channel, NULL));
+		pos = wait_for(PTYSIM_PROMPT, from, &at);
+		if (!pos) {
+			fprintf(out, "FAIL: channel picker wasn't redrawn for a new channel\n");
+			goto quit;
+		}
+		refresh_ms[i] = (double) (at - start) / 1e6;
+		refresh_total += refresh_ms[i];
+		refresh_bytes += (unsigned long) (pos - from);
+		refresh_chars += displayed(from, pos);
+	}
+	fprintf(out, "Picker refresh:        avg %7.1f ms, max %7.1f ms after a new channel (it's checked when waiting for input times out)\n",
+		refresh_total / PTYSIM_REFRESHES, baseline_percentile(refresh_ms, PTYSIM_REFRESHES, 100));
+	fprintf(out, "Picker bytes:          %.2f per character shown (%lu bytes per redraw)\n",
+		refresh_chars ? (double) refresh_bytes / (double) refresh_chars : 0, refresh_bytes / PTYSIM_REFRESHES);
+
+	/* Pick the first channel */
+	from = settle();
+	if (write(master, "1\n", 2) != 2 || !wait_for(PTYSIM_MENU, from, &at)) {
+		fprintf(out, "FAIL: conversation screen never showed up\n");
+		goto quit;
+	}
+	conversing = 1;
+
+	/* The operator types. Echo is the first thing written after each keystroke (the suggestion follows). */
+	type_from = settle();
+	for (i = 0; i < chars; i++) {
+		c = PTYSIM_TYPED[i % (int) (sizeof(PTYSIM_TYPED) - 1)];
+		expect[0] = c;
+		from = screen_len();
+		start = sim_now_ns();
+		if (write(master, &c, 1) != 1 || !wait_for(expect, from, &at)) {
+			fprintf(out, "FAIL: keystroke %d was never echoed\n", i);
+			goto quit;
+		}
+		type_us[i] = (double) (at - start) / 1e3;
+	}
+	type_to = settle();
+
+	/* The TTY user replies, a character per event */
+	rx_from = type_to;
+	for (i = 0; i < chars; i++) {
+		c = PTYSIM_RX[i % (int) (sizeof(PTYSIM_RX) - 1)];
+		expect[0] = c;
+		snprintf(msg, sizeof(msg), "%s", c == ' ' ? "_" : c == '\n' ? "\\n" : expect);
+		from = screen_len();
+		start = sim_now_ns();
+		mock_ami_deliver(ui_ami, mock_ami_event("Event", "TddRxMsg", "Channel", ttychan, "Message", msg, NULL));
+		if (!wait_for(expect, from, &at)) {
+			fprintf(out, "FAIL: received character %d never showed up\n", i);
+			goto quit;
+		}
+		rx_us[i] = (double) (at - start) / 1e3;
+	}
+	rx_to = settle();
+
+	type_chars = displayed(type_from, type_to);
+	rx_chars = displayed(rx_from, rx_to);
+	report_latency(out, "Keystroke to echo:", type_us, chars);
+	report_latency(out, "RX to screen:", rx_us, chars);
+	fprintf(out, "Conversation bytes:    %.2f per character typed (with suggestions), %.2f per character received\n",
+		(double) (type_to - type_from) / chars, (double) (rx_to - rx_from) / chars);
+	fprintf(out, "Characters shown:      %lu while typing (including suggestions), %lu while receiving\n", type_chars, rx_chars);
+	res = 0;
+
+quit:
+	/* Quit from wherever the UI is */
+	if (conversing) {
+		if (write(master, "\eq", 2) != 2) {
+			res = -1;
+		}
+	} else if (write(master, "q\n", 2) != 2) {
+		res = -1;
+	}
+	pthread_join(ui, NULL); /* Disconnects and destroys the AMI session, and the completer */
+	ui_ami = NULL;
+	__atomic_store_n(&screen.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(rd, NULL);
+	if (res) {
+		res = 1;
+	}
+
+restore:
+	fflush(stdout);
+	dup2(saved_in, STDIN_FILENO);
+	dup2(saved_out, STDOUT_FILENO);
+	close(saved_in);
+	close(saved_out);
+	close(slave);
+	close(master);
+	if (ui_ami) {
+		ami_destroy(ui_ami);
+		ui_ami = NULL;
+	}
+	if (completer) {
+		completer_destroy(completer);
+		completer = NULL;
+	}
+	free(screen.buf);
+	free(screen.times);
+	screen.buf = NULL;
+	screen.times = NULL;
+	screen.len = screen.size = 0;
+
+cleanup:
+	free(type_us);
+	free(rx_us);
+	return res;
+}
@@ -0,0 +1,36 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief The interactive UI, driven through a pseudo-terminal
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define PTYSIM_MAX_CHARS 10000
+
+/*!
+ * \brief Run the UI on a pseudo-terminal, pick a channel, type and receive text, and report latency and bytes written
+ * \param out Where to write the report
+ * \param chars Characters to type, and to receive, at most PTYSIM_MAX_CHARS
+ * \retval 0 if every keystroke and received character showed up on the screen, 1 if not, -1 on error
+ */
+int ptysim_run(FILE *out, int chars);
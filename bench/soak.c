@@ -0,0 +1,333 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Accelerated soak test, using the mock AMI
+ *
+ * Each simulated call goes through channel selection (Newchannel event,
+ * channel table), attach, a conversation in both directions, hangup and detach,
+ * and the AMI connection is periodically torn down and reconnected.
+ * No time actually passes between events, so weeks of calls run in seconds.
+ *
+ * Resource usage is sampled every simulated hour. After a warmup period,
+ * the samples are split into two halves, and a resource is considered to be
+ * growing without bound if its peak in the second half is higher than in the first
+ * (by more than a small tolerance, for things like RSS that fluctuate).
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <time.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "mock_ami.h"
+#include "soak.h"
+
+#define SOAK_RECONNECT_CALLS 50
+#define SOAK_WARMUP_FRACTION 4 /* Ignore the first 1/4 of samples */
+
+enum soak_metric {
+	SOAK_RSS = 0,
+	SOAK_HEAP,
+	SOAK_FRAG,
+	SOAK_FDS,
+	SOAK_TIMERS,
+	SOAK_THREADS,
+	SOAK_NUM_METRICS,
+};
+
+/*! \brief Metrics, and how much the peak may increase before it counts as growth */
+static const struct {
+	const char *name;
+	double tolerance;		/*!< Absolute */
+	double rel_tolerance;	/*!< Relative to the peak in the first half */
+} metrics[SOAK_NUM_METRICS] = {
+	/* RSS and heap can fluctuate with allocator behavior, so allow a little slack. Descriptors etc. should never increase. */
+	[SOAK_RSS] = { "RSS (KB)", 256, 0.02 },
+	[SOAK_HEAP] = { "Heap in use (KB)", 64, 0.02 },
+	[SOAK_FRAG] = { "Heap fragmentation", 0.10, 0 },
+	[SOAK_FDS] = { "Open file descriptors", 0, 0 },
+	[SOAK_TIMERS] = { "Timers", 0, 0 },
+	[SOAK_THREADS] = { "Threads", 0, 0 },
+};
+
+struct soak_sample {
+	double values[SOAK_NUM_METRICS]; /* -1 if not available */
+};
+
+static unsigned int soak_seed = 42;
+
+static unsigned int soak_rand(void)
+{
+	/* xorshift32: deterministic, so runs are comparable */
+	soak_seed ^= soak_seed << 13;
+	soak_seed ^= soak_seed >> 17;
+	soak_seed ^= soak_seed << 5;
+	return soak_seed;
+}
+
+static int count_dir(const char *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int count = 0;
+
+	dir = opendir(path);
+	if (!dir) {
+		return -1;
+	}
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] != '.') {
+			count++;
+		}
+	}
+	closedir(dir);
+	return count - 1; /* Don't count the descriptor used to read the directory */
+}
+
+static int count_timers(void)
+{
+	char line[128];
+	int count = 0;
+	FILE *fp = fopen("/proc/self/timers", "r"); /* Only present if the kernel has CONFIG_CHECKPOINT_RESTORE */
+
+	if (!fp) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, "ID:", 3)) {
+			count++;
+		}
+	}
+	fclose(fp);
+	return count;
+}
+
+static int sample(struct soak_sample *s)
+{
+	char line[128];
+	long pages, resident;
+	struct mallinfo2 mi;
+	FILE *fp;
+
+	fp = fopen("/proc/self/statm", "r");
+	if (!fp) {
+		return -1;
+	}
+	if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	s->values[SOAK_RSS] = (double) (resident * (sysconf(_SC_PAGESIZE) / 1024));
+
+	mi = mallinfo2();
+	s->values[SOAK_HEAP] = (double) ((mi.uordblks + mi.hblkhd) / 1024);
+	/* Free space within the heap, as a fraction of the heap */
+	s->values[SOAK_FRAG] = mi.arena ? (double) mi.fordblks / (double) mi.arena : 0;
+
+	s->values[SOAK_FDS] = count_dir("/proc/self/fd");
+	s->values[SOAK_TIMERS] = count_timers();
+
+	s->values[SOAK_THREADS] = -1;
+	fp = fopen("/proc/self/status", "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (!strncmp(line, "Threads:", 8)) {
+				s->values[SOAK_THREADS] = atoi(line + 8);
+				break;
+			}
+		}
+		fclose(fp);
+	}
+	return 0;
+}
+
+static void deliver(struct ami_session *ami, struct ami_event *event)
+{
+	if (event) {
+		mock_ami_deliver(ami, event);
+	}
+}
+
+static int simulate_call(struct ami_session *ami, unsigned int callno)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789-?";
+	char channel[64], text[2];
+	struct ami_response *resp;
+	int i, turn, turns, chars, printed;
+
+	snprintf(channel, sizeof(channel), "PJSIP/soak-%08x", callno);
+
+	/* Channel selection */
+	tty_active = 1;
+	deliver(ami, mock_ami_event("Event", "Newchannel", "Channel", channel, "ChannelState", "0", NULL));
+	resp = print_channels(ami, &printed);
+	if (!resp) {
+		return -1;
+	}
+	ami_resp_free(resp);
+
+	snprintf(ttychan, sizeof(ttychan), "%s", channel);
+	if (tty_attach(ami)) {
+		return -1;
+	}
+	tty_active = 2;
+
+	/* Conversation: alternate turns, each ending with GA */
+	turns = 2 + soak_rand() % 8;
+	for (turn = 0; turn < turns; turn++) {
+		chars = 10 + soak_rand() % 60;
+		for (i = 0; i < chars; i++) {
+			text[0] = alphabet[soak_rand() % (sizeof(alphabet) - 1)];
+			text[1] = '\0';
+			if (turn % 2) {
+				if (send_msg(ami, text)) {
+					return -1;
+				}
+			} else {
+				deliver(ami, mock_ami_event("Event", "TddRxMsg", "Channel", channel, "Message", text[0] == ' ' ? "_" : text, NULL));
+			}
+		}
+		if (turn % 2) {
+			send_msg(ami, " GA\n");
+		} else {
+			deliver(ami, mock_ami_event("Event", "TddRxMsg", "Channel", channel, "Message", "_GA", NULL));
+			deliver(ami, mock_ami_event("Event", "TddRxMsg", "Channel", channel, "Message", "\\n", NULL));
+		}
+	}
+
+	deliver(ami, mock_ami_event("Event", "Hangup", "Channel", channel, "Cause", "16", NULL));
+	tty_detach(ami);
+	return 0;
+}
+
+/*! \brief Check whether a metric's peak in the second half of the samples exceeds its peak in the first half */
+static int check_growth(FILE *out, struct soak_sample *samples, int start, int mid, int end, enum soak_metric metric)
+{
+	double peak1 = -1, peak2 = -1;
+	int i;
+
+	for (i = start; i < mid; i++) {
+		if (samples[i].values[metric] > peak1) {
+			peak1 = samples[i].values[metric];
+		}
+	}
+	for (i = mid; i < end; i++) {
+		if (samples[i].values[metric] > peak2) {
+			peak2 = samples[i].values[metric];
+		}
+	}
+	if (peak1 < 0) {
+		return 0; /* Not available on this system */
+	}
+	if (peak2 > peak1 + metrics[metric].tolerance + peak1 * metrics[metric].rel_tolerance) {
+		fprintf(out, "FAIL: %s grew from %g to %g\n", metrics[metric].name, peak1, peak2);
+		return 1;
+	}
+	return 0;
+}
+
+int soak_run(FILE *out, int days, int calls_per_day)
+{
+	struct ami_session *ami;
+	struct soak_sample *samples;
+	struct timespec start, end;
+	int hours = days * 24;
+	int calls_per_hour = calls_per_day / 24;
+	int hour, call, warmup, mid, metric, failures = 0, res = -1;
+	unsigned int callno = 0;
+	double secs;
+
+	if (calls_per_hour < 1) {
+		calls_per_hour = 1;
+	}
+	samples = calloc((size_t) hours, sizeof(*samples));
+	if (!samples) {
+		return -1;
+	}
+	ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+	if (!ami || mock_ami_set_channels(20)) {
+		goto cleanup;
+	}
+
+	fprintf(out, "Soak: %d simulated days, %d calls/hour, reconnecting every %d calls\n", days, calls_per_hour, SOAK_RECONNECT_CALLS);
+	fprintf(out, "%5s %9s %10s %10s %7s %5s %7s %8s\n", "Day", "Calls", "RSS (KB)", "Heap (KB)", "Frag", "FDs", "Timers", "Threads");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (hour = 0; hour < hours; hour++) {
+		for (call = 0; call < calls_per_hour; call++) {
+			if (simulate_call(ami, ++callno)) {
+				fprintf(out, "Call %u failed\n", callno);
+				goto cleanup;
+			}
+			if (!(callno % SOAK_RECONNECT_CALLS)) {
+				/* Simulate the AMI connection dropping and being re-established */
+				ami_disconnect(ami);
+				ami_destroy(ami);
+				ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+				if (!ami) {
+					goto cleanup;
+				}
+			}
+		}
+		if (sample(&samples[hour])) {
+			fprintf(out, "Failed to sample resource usage\n");
+			goto cleanup;
+		}
+		if (!((hour + 1) % 24)) {
+			double *v = samples[hour].values;
+			fprintf(out, "%5d %9u %10.0f %10.0f %6.1f%% %5.0f %7.0f %8.0f\n", (hour + 1) / 24, callno,
+				v[SOAK_RSS], v[SOAK_HEAP], v[SOAK_FRAG] * 100, v[SOAK_FDS], v[SOAK_TIMERS], v[SOAK_THREADS]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(out, "Simulated %d days (%u calls) in %.2f s\n", days, callno, secs);
+
+	warmup = hours / SOAK_WARMUP_FRACTION;
+	mid = warmup + (hours - warmup) / 2;
+	if (hours - warmup < 2) {
+		fprintf(out, "Too few samples to check for growth (simulate more days)\n");
+	} else {
+		for (metric = 0; metric < SOAK_NUM_METRICS; metric++) {
+			failures += check_growth(out, samples, warmup, mid, hours, metric);
+		}
+		fprintf(out, "%s\n", failures ? "Soak FAILED: resource usage is growing" : "Soak passed: resource usage is bounded");
+	}
+	res = failures ? 1 : 0;
+
+cleanup:
+	if (ami) {
+		ami_disconnect(ami);
+		ami_destroy(ami);
+	}
+	free(samples);
+	return res;
+}
@@ -0,0 +1,35 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Accelerated soak test, using the mock AMI
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Simulate call churn for a number of days in compressed time, checking for resource growth
+ * \param out Where to write the report
+ * \param days Number of simulated days
+ * \param calls_per_day Number of calls per simulated day
+ * \retval 0 if resource usage stayed bounded, 1 if something kept growing, -1 on error
+ */
+int soak_run(FILE *out, int days, int calls_per_day);
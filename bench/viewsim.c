@@ -0,0 +1,493 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Remote viewer fan-out simulation, over loopback
+ *
+ * VIEWSIM_SESSIONS sessions (on the mock AMI) each type a scripted conversation
+ * a character at a time, in rounds VIEWSIM_TICK_US apart, through session_rx()
+ * and session_tx(), as the AMI event callback and TddTx would.
+ * Every viewer subscribes to all of them. 1 in 10 ask for compression.
+ * Besides those, there is a slow viewer, which doesn't read anything until
+ * the conversation is over (so it must resync), and a late joiner, which
+ * connects halfway through (so it depends on the snapshots).
+ *
+ * Each viewer's copy of the text is rebuilt from the frames it gets,
+ * and must match what was typed exactly.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "session.h"
+#include "baudot.h"
+#include "viewer.h"
+#include "viewsim.h"
+
+#define VIEWSIM_SESSIONS 32
+#define VIEWSIM_CHARS 1000			/* Per session. Must fit in the snapshot history (3 bytes each). */
+#define VIEWSIM_TICK_US 1000
+#define VIEWSIM_TIMEOUT_MS 60000
+#define VIEWSIM_CHANNEL "PJSIP/view-%04d"
+
+struct sim_viewer {
+	struct viewer_client *client;
+	int fd;
+	int compressed;
+	int streams;				/*!< Streams known */
+	int resyncs;
+	uint64_t ids[VIEWSIM_SESSIONS];
+	size_t len[VIEWSIM_SESSIONS];
+	size_t total;				/*!< Characters, across all streams */
+	char text[VIEWSIM_SESSIONS][VIEWSIM_CHARS];
+	int failed;
+};
+
+static char script[VIEWSIM_SESSIONS][VIEWSIM_CHARS + 1];
+static char script_tx[VIEWSIM_SESSIONS][VIEWSIM_CHARS];	/* Whether each character was sent (the CA), rather than received */
+static struct sim_viewer *sims;
+static int num_sims;
+static int late_index, slow_index;
+static int late_ready = 0, slow_paused = 1, reader_stop = 0;
+
+static uint64_t sim_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/*! \brief A conversation: lines alternate between the TTY (received) and the CA (sent) */
+static void make_script(void)
+{
+	static const char *lines[] = {
+		"HELLO THIS IS THE RELAY CENTER, WHO ARE YOU CALLING GA\n",
+		"PLEASE CALL MY DOCTOR AT 555 0134 ABOUT MY APPOINTMENT GA\n",
+		"DIALING NOW, PLEASE HOLD... IT IS RINGING (3 RINGS) GA\n",
+		"THANK YOU, I WILL WAIT FOR THE OFFICE TO ANSWER GA\n",
+	};
+	size_t len, n;
+	int i, line;
+
+	for (i = 0; i < VIEWSIM_SESSIONS; i++) {
+		for (len = 0, line = i; len < VIEWSIM_CHARS; line++) {
+			n = strlen(lines[line % 4]);
+			if (n > VIEWSIM_CHARS - len) {
+				n = VIEWSIM_CHARS - len;
+			}
+			memcpy(script[i] + len, lines[line % 4], n);
+			memset(script_tx[i] + len, line % 2, n);
+			len += n;
+		}
+		script[i][len] = '\0';
+	}
+}
+
+static int stream_index(const struct sim_viewer *v, uint64_t id)
+{
+	int i;
+
+	for (i = 0; i < VIEWSIM_SESSIONS; i++) {
+		if (v->len[i] != (size_t) -1 && v->ids[i] == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void add_text(struct sim_viewer *v, int i, const unsigned char *text, size_t len)
+{
+	if (v->len[i] + len > VIEWSIM_CHARS) {
+		v->failed = 1;
+		return;
+	}
+	memcpy(v->text[i] + v->len[i], text, len);
+	v->len[i] += len;
+	v->total += len;
+}
+
+static void forget_streams(struct sim_viewer *v)
+{
+	int i;
+
+	for (i = 0; i < VIEWSIM_SESSIONS; i++) {
+		v->len[i] = (size_t) -1;
+	}
+	v->streams = 0;
+	v->total = 0;
+}
+
+static void handle_frame(struct sim_viewer *v, int type, const unsigned char *payload, size_t plen)
+{
+	const unsigned char *text;
+	uint64_t id, namelen, base, dt;
+	size_t pos, used, tlen;
+	int i, tx, session;
+
+	switch (type) {
+	case VIEWER_FRAME_SNAPSHOT:
+		pos = viewer_varint_get(payload, plen, &id);
+		used = pos ? viewer_varint_get(payload + pos, plen - pos, &namelen) : 0;
+		if (!used || namelen > plen - pos - used || sscanf((const char *) payload + pos + used, VIEWSIM_CHANNEL, &session) != 1
+			|| session < 0 || session >= VIEWSIM_SESSIONS) {
+			v->failed = 1;
+			return;
+		}
+		pos += used + namelen;
+		used = viewer_varint_get(payload + pos, plen - pos, &base);
+		if (!used) {
+			v->failed = 1;
+			return;
+		}
+		pos += used;
+		if (v->len[session] == (size_t) -1) {
+			v->streams++;
+		} else {
+			v->total -= v->len[session];
+		}
+		v->ids[session] = id;
+		v->len[session] = 0;
+		while (pos < plen && (used = viewer_record_get(payload + pos, plen - pos, &dt, &tx, &text, &tlen))) {
+			add_text(v, session, text, tlen);
+			pos += used;
+		}
+		break;
+	case VIEWER_FRAME_DELTA:
+		pos = viewer_varint_get(payload, plen, &id);
+		i = pos ? stream_index(v, id) : -1;
+		if (i < 0 || !viewer_record_get(payload + pos, plen - pos, &dt, &tx, &text, &tlen)) {
+			v->failed = 1;
+			return;
+		}
+		if (v->len[i] < VIEWSIM_CHARS && tx != script_tx[i][v->len[i]]) {
+			v->failed = 1;
+		}
+		add_text(v, i, text, tlen);
+		break;
+	case VIEWER_FRAME_RESYNC:
+		v->resyncs++;
+		forget_streams(v);
+		break;
+	default:
+		break;
+	}
+}
+
+static void *reader(void *unused)
+{
+	struct pollfd *pfds = calloc((size_t) num_sims, sizeof(*pfds));
+	const unsigned char *payload;
+	size_t plen;
+	int i, n, type, res;
+
+	(void) unused;
+
+	if (!pfds) {
+		return NULL;
+	}
+	while (!__atomic_load_n(&reader_stop, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < num_sims; i++) {
+			pfds[i].fd = sims[i].fd;
+			pfds[i].events = POLLIN;
+			if ((i == late_index && !__atomic_load_n(&late_ready, __ATOMIC_ACQUIRE))
+				|| (i == slow_index && __atomic_load_n(&slow_paused, __ATOMIC_ACQUIRE))) {
+				pfds[i].fd = -1;
+			}
+		}
+		n = poll(pfds, (nfds_t) num_sims, 10);
+		if (n <= 0) {
+			continue;
+		}
+		for (i = 0; i < num_sims; i++) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+			if (viewer_client_read(sims[i].client)) {
+				sims[i].failed = 1;
+				sims[i].fd = -1;
+				continue;
+			}
+			while ((res = viewer_client_next(sims[i].client, &type, &payload, &plen)) > 0) {
+				handle_frame(&sims[i], type, payload, plen);
+			}
+			if (res < 0) {
+				sims[i].failed = 1;
+			}
+		}
+	}
+	free(pfds);
+	return NULL;
+}
+
+static int connect_viewer(struct sim_viewer *v, int port, int flags, int rcvbuf)
+{
+	struct sockaddr_in sin;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+	if (rcvbuf) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((uint16_t) port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *) &sin, sizeof(sin))) {
+		fprintf(stderr, "Failed to connect viewer: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	v->client = viewer_client_create(fd);
+	if (!v->client) {
+		close(fd);
+		return -1;
+	}
+	forget_streams(v);
+	v->compressed = flags & VIEWER_SUBSCRIBE_DEFLATE ? 1 : 0;
+	if (viewer_client_subscribe(v->client, "PJSIP/view-*", flags)) {
+		return -1;
+	}
+	v->fd = fd;
+	return 0;
+}
+
+/*! \brief Wait until viewers (all but the excluded one) have all the text typed so far, or the timeout */
+static int wait_caught_up(int exclude, size_t chars, uint64_t deadline_us)
+{
+	int i;
+
+	for (;;) {
+		for (i = 0; i < num_sims; i++) {
+			if (i != exclude && sims[i].client && !sims[i].failed && (sims[i].streams != VIEWSIM_SESSIONS || sims[i].total < chars)) {
+				break;
+			}
+		}
+		if (i == num_sims) {
+			return 0;
+		} else if (sim_now_us() > deadline_us) {
+			return -1;
+		}
+		usleep(1000);
+	}
+}
+
+static int check_text(const struct sim_viewer *v)
+{
+	int i;
+
+	if (v->failed || v->streams != VIEWSIM_SESSIONS) {
+		return -1;
+	}
+	for (i = 0; i < VIEWSIM_SESSIONS; i++) {
+		if (v->len[i] != VIEWSIM_CHARS || memcmp(v->text[i], script[i], VIEWSIM_CHARS)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int viewsim_run(FILE *out, int viewers)
+{
+	struct ami_session *ami;
+	struct viewer_stats stats;
+	pthread_t thread;
+	char channel[64], msg[4];
+	uint64_t start, t, publish_total = 0, publish_max = 0, published_us, caught_up_us, deadline;
+	uint64_t plain_bytes = 0, deflate_bytes = 0;
+	int i, j, port, plain = 0, compressed = 0, bad = 0, res = -1;
+	size_t pos;
+
+	make_script();
+	ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+	port = viewer_start("127.0.0.1", 0);
+	if (!ami || port < 0) {
+		return -1;
+	}
+	for (i = 0; i < VIEWSIM_SESSIONS; i++) {
+		snprintf(channel, sizeof(channel), VIEWSIM_CHANNEL, i);
+		if (session_observe(ami, channel)) {
+			goto cleanup;
+		}
+	}
+
+	num_sims = viewers + 2;
+	slow_index = viewers;
+	late_index = viewers + 1;
+	sims = calloc((size_t) num_sims, sizeof(*sims));
+	if (!sims) {
+		goto cleanup;
+	}
+	for (i = 0; i < num_sims; i++) {
+		sims[i].fd = -1;
+	}
+	for (i = 0; i < viewers; i++) {
+		if (connect_viewer(&sims[i], port, i % 10 == 9 ? VIEWER_SUBSCRIBE_DEFLATE : 0, 0)) {
+			goto cleanup;
+		}
+	}
+	/* The slow viewer's tiny receive buffer fills up almost immediately */
+	if (connect_viewer(&sims[slow_index], port, 0, 2048)) {
+		goto cleanup;
+	}
+	if (pthread_create(&thread, NULL, reader, NULL)) {
+		goto cleanup;
+	}
+
+	deadline = sim_now_us() + VIEWSIM_TIMEOUT_MS * 1000ULL;
+	if (wait_caught_up(slow_index, 0, deadline)) {
+		fprintf(stderr, "Viewers didn't all subscribe\n");
+		goto stop;
+	}
+
+	/* Type a character on every session each round */
+	start = sim_now_us();
+	for (pos = 0; pos < VIEWSIM_CHARS; pos++) {
+		if (pos == VIEWSIM_CHARS / 2) {
+			if (connect_viewer(&sims[late_index], port, 0, 0)) {
+				goto stop;
+			}
+			__atomic_store_n(&late_ready, 1, __ATOMIC_RELEASE);
+		}
+		for (i = 0; i < VIEWSIM_SESSIONS; i++) {
+			snprintf(channel, sizeof(channel), VIEWSIM_CHANNEL, i);
+			t = sim_now_us();
+			if (script_tx[i][pos]) {
+				msg[0] = script[i][pos];
+				msg[1] = '\0';
+				session_tx(channel, msg);
+			} else {
+				/* As escaped in a TddRxMsg event */
+				if (script[i][pos] == ' ') {
+					strcpy(msg, "_");
+				} else if (script[i][pos] == '\n') {
+					strcpy(msg, "\\n");
+				} else {
+					msg[0] = script[i][pos];
+					msg[1] = '\0';
+				}
+				session_rx(channel, msg);
+			}
+			t = sim_now_us() - t;
+			publish_total += t;
+			if (t > publish_max) {
+				publish_max = t;
+			}
+		}
+		usleep(VIEWSIM_TICK_US);
+	}
+	published_us = sim_now_us();
+
+	res = 0;
+	if (wait_caught_up(slow_index, VIEWSIM_SESSIONS * VIEWSIM_CHARS, deadline)) {
+		fprintf(stderr, "Viewers didn't all get every character\n");
+		res = 1;
+	}
+	caught_up_us = sim_now_us();
+	__atomic_store_n(&slow_paused, 0, __ATOMIC_RELEASE);
+	if (wait_caught_up(-1, VIEWSIM_SESSIONS * VIEWSIM_CHARS, deadline)) {
+		fprintf(stderr, "The slow viewer didn't catch up\n");
+		res = 1;
+	}
+
+stop:
+	__atomic_store_n(&reader_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	if (res < 0) {
+		goto cleanup;
+	}
+
+	for (i = 0; i < num_sims; i++) {
+		if (check_text(&sims[i])) {
+			bad++;
+		}
+		if (i < viewers) {
+			if (sims[i].compressed) {
+				deflate_bytes += viewer_client_bytes(sims[i].client);
+				compressed++;
+			} else {
+				plain_bytes += viewer_client_bytes(sims[i].client);
+				plain++;
+			}
+		}
+	}
+	viewer_get_stats(&stats);
+
+	fprintf(out, "Viewers: %d (%d compressed), plus a slow viewer and a late joiner, watching %d sessions\n", viewers, compressed, VIEWSIM_SESSIONS);
+	fprintf(out, "Typed: %d characters in %.1f s\n", VIEWSIM_SESSIONS * VIEWSIM_CHARS, (double) (published_us - start) / 1e6);
+	fprintf(out, "Producer: %.1f us avg, %lu us max per character, fanned out to %d viewers\n",
+		(double) publish_total / (VIEWSIM_SESSIONS * VIEWSIM_CHARS), (unsigned long) publish_max, viewers + 2);
+	fprintf(out, "Fan-out: every viewer had every character %.1f ms after the last was typed\n", (double) (caught_up_us - published_us) / 1e3);
+	if (plain) {
+		double per_char = (double) plain_bytes / plain / (VIEWSIM_SESSIONS * VIEWSIM_CHARS);
+		fprintf(out, "Bandwidth: %.0f bytes per viewer, %.2f bytes/char, %.0f bytes/s per session watched at Baudot speed\n",
+			(double) plain_bytes / plain, per_char, per_char * 1000 / BAUDOT_CODE_MS);
+	}
+	if (compressed) {
+		double per_char = (double) deflate_bytes / compressed / (VIEWSIM_SESSIONS * VIEWSIM_CHARS);
+		fprintf(out, "Compressed: %.0f bytes per viewer, %.2f bytes/char\n", (double) deflate_bytes / compressed, per_char);
+	}
+	fprintf(out, "Slow viewer: %d resync%s, %s\n", sims[slow_index].resyncs, sims[slow_index].resyncs == 1 ? "" : "s",
+		check_text(&sims[slow_index]) ? "text WRONG" : "text correct");
+	fprintf(out, "Late joiner: %s\n", check_text(&sims[late_index]) ? "text WRONG" : "text correct");
+	fprintf(out, "Server: %lu frames, %lu bytes queued, %lu sent, %lu resyncs\n",
+		stats.frames, (unsigned long) stats.bytes_queued, (unsigned long) stats.bytes_sent, stats.resyncs);
+	if (bad) {
+		fprintf(out, "%d viewer%s had the wrong text\n", bad, bad == 1 ? "" : "s");
+		res = 1;
+	}
+
+cleanup:
+	if (sims) {
+		for (i = 0; i < num_sims; i++) {
+			if (sims[i].client) {
+				viewer_client_destroy(sims[i].client);
+			}
+		}
+		free(sims);
+	}
+	for (j = 0; j < VIEWSIM_SESSIONS; j++) {
+		snprintf(channel, sizeof(channel), VIEWSIM_CHANNEL, j);
+		session_hangup(channel);
+	}
+	viewer_stop();
+	sessions_destroy();
+	if (ami) {
+		ami_destroy(ami);
+	}
+	return res;
+}
@@ -0,0 +1,34 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Remote viewer fan-out simulation, over loopback
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Serve sessions to many viewers, and report producer cost, fan-out latency and bandwidth per viewer
+ * \param out Where to write the report
+ * \param viewers Number of viewers
+ * \retval 0 if every viewer ended up with exactly the text that was typed, 1 if not, -1 on error
+ */
+int viewsim_run(FILE *out, int viewers);
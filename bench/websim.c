@@ -0,0 +1,551 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Web console simulation
+ *
+ * Each agent connects to the web console over a WebSocket, as a browser would,
+ * lists the channels, and attaches to WEBSIM_WATCH of the WEBSIM_SESSIONS
+ * sessions (on the mock AMI), through the console thread. The first agent on
+ * each session then types a reply, which goes through the session's TX queue
+ * and TddTx and comes back to every agent attached as a TX record, while
+ * the other party types a scripted message a character at a time, in rounds
+ * WEBSIM_TICK_US apart, through session_rx(), as the AMI event callback would.
+ *
+ * Each agent's copy of the text is rebuilt from the frames it gets, and must
+ * match what was typed exactly.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "session.h"
+#include "viewer.h"
+#include "webconsole.h"
+#include "mock_ami.h"
+#include "websim.h"
+
+#define WEBSIM_SESSIONS 64
+#define WEBSIM_WATCH 2				/* Sessions per agent */
+#define WEBSIM_CHARS 300			/* Received per session */
+#define WEBSIM_TICK_US 2000
+#define WEBSIM_TIMEOUT_MS 60000
+#define WEBSIM_CHANNEL "PJSIP/web-%04d"
+#define WEBSIM_REPLY "HELLO THIS IS THE OPERATOR GA\n"
+
+struct sim_stream {
+	uint64_t id;
+	int known;					/*!< Got a snapshot */
+	size_t rx_len;
+	size_t tx_len;
+	char rx[WEBSIM_CHARS];
+	char tx[sizeof(WEBSIM_REPLY)];
+};
+
+struct sim_agent {
+	struct viewer_client *client;
+	int fd;
+	int sessions[WEBSIM_WATCH];
+	struct sim_stream streams[WEBSIM_WATCH];
+	int listed;					/*!< Got the channel list */
+	int attached;				/*!< "Attached to" replies */
+	int resyncs;
+	int typer;					/*!< Types the reply on its first session */
+	uint64_t sent_us;
+	uint64_t echo_us;			/*!< When the first of the reply came back */
+	int failed;
+};
+
+static char script[WEBSIM_SESSIONS][WEBSIM_CHARS + 1];
+static int typed_reply[WEBSIM_SESSIONS];
+static struct sim_agent *sims;
+static int num_sims;
+static int reader_stop = 0;
+
+static uint64_t sim_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void make_script(void)
+{
+	static const char *lines[] = {
+		"HELLO I NEED TO CALL MY PHARMACY ABOUT A PRESCRIPTION GA\n",
+		"THE NUMBER IS 555 0187, ASK FOR THE PHARMACIST PLEASE GA\n",
+		"YES I WILL HOLD, THANK YOU (TAKE YOUR TIME) GA\n",
+	};
+	size_t len, n;
+	int i, line;
+
+	for (i = 0; i < WEBSIM_SESSIONS; i++) {
+		for (len = 0, line = i; len < WEBSIM_CHARS; line++) {
+			n = strlen(lines[line % 3]);
+			if (n > WEBSIM_CHARS - len) {
+				n = WEBSIM_CHARS - len;
+			}
+			memcpy(script[i] + len, lines[line % 3], n);
+			len += n;
+		}
+		script[i][len] = '\0';
+	}
+}
+
+static void add_record(struct sim_agent *a, struct sim_stream *s, int tx, const unsigned char *text, size_t len)
+{
+	if (tx) {
+		if (s->tx_len + len > sizeof(s->tx)) {
+			a->failed = 1;
+			return;
+		}
+		if (a->typer && s == &a->streams[0] && !a->echo_us) {
+			a->echo_us = sim_now_us();
+		}
+		memcpy(s->tx + s->tx_len, text, len);
+		s->tx_len += len;
+	} else {
+		if (s->rx_len + len > WEBSIM_CHARS) {
+			a->failed = 1;
+			return;
+		}
+		memcpy(s->rx + s->rx_len, text, len);
+		s->rx_len += len;
+	}
+}
+
+static void handle_frame(struct sim_agent *a, int type, const unsigned char *payload, size_t plen)
+{
+	const unsigned char *text;
+	struct sim_stream *s = NULL;
+	uint64_t id, namelen, base, dt;
+	size_t pos, used, tlen;
+	int i, tx, session;
+
+	switch (type) {
+	case VIEWER_FRAME_SNAPSHOT:
+		pos = viewer_varint_get(payload, plen, &id);
+		used = pos ? viewer_varint_get(payload + pos, plen - pos, &namelen) : 0;
+		if (!used || namelen > plen - pos - used || sscanf((const char *) payload + pos + used, WEBSIM_CHANNEL, &session) != 1) {
+			a->failed = 1;
+			return;
+		}
+		for (i = 0; i < WEBSIM_WATCH; i++) {
+			if (a->sessions[i] == session) {
+				s = &a->streams[i];
+			}
+		}
+		pos += used + namelen;
+		used = viewer_varint_get(payload + pos, plen - pos, &base);
+		if (!s || !used) {
+			a->failed = 1; /* Not attached to that one */
+			return;
+		}
+		pos += used;
+		s->id = id;
+		s->known = 1;
+		s->rx_len = s->tx_len = 0;
+		while (pos < plen && (used = viewer_record_get(payload + pos, plen - pos, &dt, &tx, &text, &tlen))) {
+			add_record(a, s, tx, text, tlen);
+			pos += used;
+		}
+		break;
+	case VIEWER_FRAME_DELTA:
+		pos = viewer_varint_get(payload, plen, &id);
+		for (i = 0; pos && i < WEBSIM_WATCH; i++) {
+			if (a->streams[i].known && a->streams[i].id == id) {
+				s = &a->streams[i];
+			}
+		}
+		if (!s || !viewer_record_get(payload + pos, plen - pos, &dt, &tx, &text, &tlen)) {
+			a->failed = 1;
+			return;
+		}
+		add_record(a, s, tx, text, tlen);
+		break;
+	case VIEWER_FRAME_RESYNC:
+		a->resyncs++;
+		for (i = 0; i < WEBSIM_WATCH; i++) {
+			a->streams[i].known = 0;
+		}
+		break;
+	case CONSOLE_FRAME_CHANNELS:
+		a->listed = 1;
+		break;
+	case CONSOLE_FRAME_STATUS:
+		if (plen > 12 && !memcmp(payload, "Attached to ", 12)) {
+			a->attached++;
+		} else {
+			a->failed = 1;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void *reader(void *unused)
+{
+	struct pollfd *pfds = calloc((size_t) num_sims, sizeof(*pfds));
+	const unsigned char *payload;
+	size_t plen;
+	int i, n, type, res;
+
+	(void) unused;
+
+	if (!pfds) {
+		return NULL;
+	}
+	while (!__atomic_load_n(&reader_stop, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < num_sims; i++) {
+			pfds[i].fd = sims[i].fd;
+			pfds[i].events = POLLIN;
+		}
+		n = poll(pfds, (nfds_t) num_sims, 10);
+		if (n <= 0) {
+			continue;
+		}
+		for (i = 0; i < num_sims; i++) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+			if (viewer_client_read(sims[i].client)) {
+				sims[i].failed = 1;
+				sims[i].fd = -1;
+				continue;
+			}
+			while ((res = viewer_client_next(sims[i].client, &type, &payload, &plen)) > 0) {
+				handle_frame(&sims[i], type, payload, plen);
+			}
+			if (res < 0) {
+				sims[i].failed = 1;
+			}
+		}
+	}
+	free(pfds);
+	return NULL;
+}
+
+static int connect_agent(struct sim_agent *a, int port)
+{
+	struct sockaddr_in sin;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((uint16_t) port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *) &sin, sizeof(sin))) {
+		fprintf(stderr, "Failed to connect agent: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	a->client = viewer_client_create_web(fd, "127.0.0.1");
+	if (!a->client) {
+		close(fd);
+		return -1;
+	}
+	a->fd = fd;
+	return 0;
+}
+
+/*! \brief Send a command with a channel (and maybe text), as the page does */
+static int agent_command(struct sim_agent *a, int type, int session, const char *text)
+{
+	unsigned char payload[256];
+	char channel[64];
+	size_t len, tlen = text ? strlen(text) : 0;
+	int n = snprintf(channel, sizeof(channel), WEBSIM_CHANNEL, session);
+
+	len = 0;
+	if (type == CONSOLE_FRAME_SEND) {
+		payload[len++] = (unsigned char) n; /* A varint, since it's less than 128 */
+	}
+	memcpy(payload + len, channel, (size_t) n);
+	len += (size_t) n;
+	if (tlen) {
+		memcpy(payload + len, text, tlen);
+		len += tlen;
+	}
+	return viewer_client_send(a->client, type, payload, len);
+}
+
+/*! \brief Wait until a condition holds for every agent, or the timeout */
+static int wait_all(int (*done)(const struct sim_agent *a), uint64_t deadline_us)
+{
+	int i;
+
+	for (;;) {
+		for (i = 0; i < num_sims; i++) {
+			if (!sims[i].failed && !done(&sims[i])) {
+				break;
+			}
+		}
+		if (i == num_sims) {
+			return 0;
+		} else if (sim_now_us() > deadline_us) {
+			return -1;
+		}
+		usleep(1000);
+	}
+}
+
+static int is_attached(const struct sim_agent *a)
+{
+	int i;
+
+	for (i = 0; i < WEBSIM_WATCH; i++) {
+		if (!a->streams[i].known) {
+			return 0;
+		}
+	}
+	return a->listed && a->attached == WEBSIM_WATCH;
+}
+
+static int has_everything(const struct sim_agent *a)
+{
+	int i;
+
+	for (i = 0; i < WEBSIM_WATCH; i++) {
+		if (!a->streams[i].known || a->streams[i].rx_len < WEBSIM_CHARS
+			|| a->streams[i].tx_len < (typed_reply[a->sessions[i]] ? strlen(WEBSIM_REPLY) : 0)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int check_text(const struct sim_agent *a)
+{
+	const struct sim_stream *s;
+	int i;
+
+	if (a->failed) {
+		return -1;
+	}
+	for (i = 0; i < WEBSIM_WATCH; i++) {
+		s = &a->streams[i];
+		if (s->rx_len != WEBSIM_CHARS || memcmp(s->rx, script[a->sessions[i]], WEBSIM_CHARS)) {
+			return -1;
+		} else if (typed_reply[a->sessions[i]] && (s->tx_len != strlen(WEBSIM_REPLY) || memcmp(s->tx, WEBSIM_REPLY, s->tx_len))) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (double) ru.ru_utime.tv_sec + (double) ru.ru_utime.tv_usec / 1e6 + (double) ru.ru_stime.tv_sec + (double) ru.ru_stime.tv_usec / 1e6;
+}
+
+int websim_run(FILE *out, int agents)
+{
+	struct ami_session *ami;
+	struct viewer_stats stats;
+	pthread_t thread;
+	char channel[64], msg[4];
+	uint64_t start, attach_us, published_us = 0, caught_up_us = 0, deadline, echo_total = 0, echo_max = 0, bytes = 0;
+	double cpu;
+	int i, j, port, typers = 0, bad = 0, res = -1;
+	size_t pos;
+
+	make_script();
+	memset(typed_reply, 0, sizeof(typed_reply));
+	ami = ami_connect("127.0.0.1", 0, ami_callback, simple_disconnect_callback);
+	if (!ami || mock_ami_set_channels(WEBSIM_SESSIONS)) {
+		if (ami) {
+			ami_destroy(ami);
+		}
+		return -1;
+	}
+	port = webconsole_start(ami, "127.0.0.1", 0, NULL);
+	if (port < 0) {
+		ami_destroy(ami);
+		return -1;
+	}
+
+	num_sims = agents;
+	sims = calloc((size_t) num_sims, sizeof(*sims));
+	if (!sims) {
+		goto cleanup;
+	}
+	for (i = 0; i < num_sims; i++) {
+		sims[i].fd = -1;
+		for (j = 0; j < WEBSIM_WATCH; j++) {
+			sims[i].sessions[j] = (i + j * WEBSIM_SESSIONS / WEBSIM_WATCH) % WEBSIM_SESSIONS;
+		}
+		/* The first agent on each session types */
+		if (!typed_reply[sims[i].sessions[0]]) {
+			typed_reply[sims[i].sessions[0]] = 1;
+			sims[i].typer = 1;
+			typers++;
+		}
+	}
+
+	start = sim_now_us();
+	for (i = 0; i < num_sims; i++) {
+		if (connect_agent(&sims[i], port)) {
+			goto cleanup;
+		}
+	}
+	if (pthread_create(&thread, NULL, reader, NULL)) {
+		goto cleanup;
+	}
+	for (i = 0; i < num_sims; i++) {
+		if (viewer_client_send(sims[i].client, CONSOLE_FRAME_LIST, NULL, 0)) {
+			goto stop;
+		}
+		for (j = 0; j < WEBSIM_WATCH; j++) {
+			if (agent_command(&sims[i], CONSOLE_FRAME_ATTACH, sims[i].sessions[j], NULL)) {
+				goto stop;
+			}
+		}
+	}
+	deadline = sim_now_us() + WEBSIM_TIMEOUT_MS * 1000ULL;
+	if (wait_all(is_attached, deadline)) {
+		fprintf(stderr, "Agents didn't all attach\n");
+		goto stop;
+	}
+	attach_us = sim_now_us() - start;
+
+	cpu = cpu_seconds();
+	start = sim_now_us();
+	for (i = 0; i < num_sims; i++) {
+		if (sims[i].typer) {
+			sims[i].sent_us = sim_now_us();
+			if (agent_command(&sims[i], CONSOLE_FRAME_SEND, sims[i].sessions[0], WEBSIM_REPLY)) {
+				goto stop;
+			}
+		}
+	}
+	/* The other party types a character on every session each round */
+	for (pos = 0; pos < WEBSIM_CHARS; pos++) {
+		for (i = 0; i < WEBSIM_SESSIONS; i++) {
+			snprintf(channel, sizeof(channel), WEBSIM_CHANNEL, i);
+			/* As escaped in a TddRxMsg event */
+			if (script[i][pos] == ' ') {
+				strcpy(msg, "_");
+			} else if (script[i][pos] == '\n') {
+				strcpy(msg, "\\n");
+			} else {
+				msg[0] = script[i][pos];
+				msg[1] = '\0';
+			}
+			session_rx(channel, msg);
+		}
+		usleep(WEBSIM_TICK_US);
+	}
+	published_us = sim_now_us();
+
+	res = 0;
+	if (wait_all(has_everything, deadline)) {
+		fprintf(stderr, "Agents didn't all get every character\n");
+		res = 1;
+	}
+	caught_up_us = sim_now_us();
+	cpu = cpu_seconds() - cpu;
+
+stop:
+	__atomic_store_n(&reader_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	if (res < 0) {
+		goto cleanup;
+	}
+
+	for (i = 0; i < num_sims; i++) {
+		if (check_text(&sims[i])) {
+			bad++;
+		}
+		if (sims[i].typer && sims[i].echo_us) {
+			uint64_t echo = sims[i].echo_us - sims[i].sent_us;
+			echo_total += echo;
+			if (echo > echo_max) {
+				echo_max = echo;
+			}
+		}
+		bytes += viewer_client_bytes(sims[i].client);
+	}
+	viewer_get_stats(&stats);
+
+	fprintf(out, "Agents: %d, each attached to %d of %d sessions (%.1f per session)\n", agents, WEBSIM_WATCH, WEBSIM_SESSIONS, (double) agents * WEBSIM_WATCH / WEBSIM_SESSIONS);
+	fprintf(out, "Attach: every agent connected, listed channels and attached in %.1f ms\n", (double) attach_us / 1e3);
+	fprintf(out, "Typed: %d characters received in %.1f s, and a %d character reply on %d sessions\n",
+		WEBSIM_SESSIONS * WEBSIM_CHARS, (double) (published_us - start) / 1e6, (int) strlen(WEBSIM_REPLY), typers);
+	if (typers) {
+		fprintf(out, "Reply: back on the agent's screen %.1f ms avg, %.1f ms max after it was typed\n",
+			(double) echo_total / typers / 1e3, (double) echo_max / 1e3);
+	}
+	fprintf(out, "Fan-out: every agent had every character %.1f ms after the last was typed (the reply goes out at TTY speed)\n", (double) (caught_up_us - published_us) / 1e3);
+	fprintf(out, "Batching: %lu frames in %lu WebSocket messages, %.1f frames per message, %.1f messages/s per agent\n",
+		stats.frames, stats.messages, stats.messages ? (double) stats.frames / stats.messages : 0,
+		(double) stats.messages / agents / ((double) (caught_up_us - start) / 1e6));
+	fprintf(out, "Bandwidth: %.0f bytes per agent, %.2f bytes/char watched\n", (double) bytes / agents,
+		(double) bytes / agents / (WEBSIM_WATCH * WEBSIM_CHARS));
+	fprintf(out, "CPU: %.2f s (%.0f%% of one core), including the simulated browsers\n", cpu, 100 * cpu / ((double) (caught_up_us - start) / 1e6));
+	fprintf(out, "Server: %lu frames, %lu bytes queued, %lu sent, %lu resyncs\n",
+		stats.frames, (unsigned long) stats.bytes_queued, (unsigned long) stats.bytes_sent, stats.resyncs);
+	if (bad) {
+		fprintf(out, "%d agent%s had the wrong text\n", bad, bad == 1 ? "" : "s");
+		res = 1;
+	}
+
+cleanup:
+	if (sims) {
+		for (i = 0; i < num_sims; i++) {
+			if (sims[i].client) {
+				viewer_client_destroy(sims[i].client);
+			}
+		}
+		free(sims);
+	}
+	webconsole_stop();
+	for (j = 0; j < WEBSIM_SESSIONS; j++) {
+		snprintf(channel, sizeof(channel), WEBSIM_CHANNEL, j);
+		session_hangup(channel);
+	}
+	viewer_stop();
+	sessions_destroy();
+	ami_destroy(ami);
+	return res;
+}
@@ -0,0 +1,34 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Web console simulation: many agents' browsers, over loopback WebSockets
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Serve the web console to many agents, and report attach time, batching, bandwidth and CPU
+ * \param out Where to write the report
+ * \param agents Number of agents
+ * \retval 0 if every agent ended up with exactly the text of the sessions it attached to, 1 if not, -1 on error
+ */
+int websim_run(FILE *out, int agents);
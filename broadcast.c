@@ -0,0 +1,142 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Broadcast
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+
+#include "asttyspy.h"
+#include "broadcast.h"
+#include "ratelimit.h"
+#include "session.h"
+#include "vclock.h"
+
+double broadcast_rate = BROADCAST_RATE;
+
+struct broadcast_job {
+	struct ami_session *ami;
+	char **channels;
+	int count;
+	int next;				/*!< Next channel to send to */
+	const char *text;
+	const char *escaped;	/*!< Escaped once, for all channels */
+	size_t len;
+	uint64_t start_us;
+	struct rate_limiter limiter;
+	pthread_mutex_t lock;	/*!< Protects next and result */
+	struct broadcast_result *result;
+};
+
+static void *broadcast_worker(void *varg)
+{
+	struct broadcast_job *job = varg;
+	uint64_t elapsed;
+	int i, res;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		i = job->next < job->count ? job->next++ : -1;
+		pthread_mutex_unlock(&job->lock);
+		if (i < 0) {
+			break;
+		}
+
+		ratelimit_wait(&job->limiter);
+		res = tdd_tx_escaped(job->ami, job->channels[i], job->escaped, job->len, job->text);
+		elapsed = vclock_now_us() - job->start_us;
+
+		pthread_mutex_lock(&job->lock);
+		if (res) {
+			job->result->failed++;
+		} else {
+			if (!job->result->acknowledged++) {
+				job->result->first_ack_us = elapsed;
+			}
+			if (elapsed > job->result->last_ack_us) {
+				job->result->last_ack_us = elapsed;
+			}
+		}
+		pthread_mutex_unlock(&job->lock);
+	}
+	return NULL;
+}
+
+int broadcast(struct ami_session *ami, const char *pattern, const char *text, struct broadcast_result *result)
+{
+	struct broadcast_job job;
+	pthread_t threads[BROADCAST_WORKERS];
+	char *escaped;
+	int i, workers = 0, res = 0;
+
+	memset(result, 0, sizeof(*result));
+	memset(&job, 0, sizeof(job));
+	job.start_us = vclock_now_us();
+
+	escaped = tdd_escape(text, &job.len);
+	if (!escaped) {
+		return -1;
+	}
+	job.count = session_channels(pattern, &job.channels);
+	if (job.count < 0) {
+		free(escaped);
+		return -1;
+	}
+	job.ami = ami;
+	job.text = text;
+	job.escaped = escaped;
+	job.result = result;
+	result->channels = job.count;
+	ratelimit_init(&job.limiter, broadcast_rate, BROADCAST_BURST);
+	pthread_mutex_init(&job.lock, NULL);
+
+	/* There's no point in more threads than channels */
+	while (workers < BROADCAST_WORKERS && workers < job.count) {
+		if (vclock_thread_create(&threads[workers], broadcast_worker, &job)) {
+			break;
+		}
+		workers++;
+	}
+	if (!workers && job.count) {
+		fprintf(stderr, "Failed to start broadcast threads\n");
+		res = -1;
+	}
+	for (i = 0; i < workers; i++) {
+		vclock_thread_join(threads[i]);
+	}
+
+	pthread_mutex_destroy(&job.lock);
+	ratelimit_destroy(&job.limiter);
+	for (i = 0; i < job.count; i++) {
+		free(job.channels[i]);
+	}
+	free(job.channels);
+	free(escaped);
+	return res;
+}
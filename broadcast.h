@@ -0,0 +1,63 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Broadcast: send one message to many TTY sessions at once
+ *
+ * The message is escaped for AMI once, and TddTx actions for all of the
+ * channels are issued by a pool of threads, so they are pipelined rather than
+ * each waiting for the previous one's response, while a shared rate limiter
+ * keeps Asterisk from being flooded.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdint.h>
+
+/*! \brief Threads issuing actions for a broadcast */
+#define BROADCAST_WORKERS 8
+
+/*! \brief Default max TddTx actions per second */
+#define BROADCAST_RATE 50
+
+/*! \brief Actions that can be issued at once, before the rate applies */
+#define BROADCAST_BURST 10
+
+/*! \brief Max TddTx actions per second for broadcasts, or 0 for no limit */
+extern double broadcast_rate;
+
+struct broadcast_result {
+	int channels;			/*!< Channels the message was sent to */
+	int acknowledged;		/*!< Channels that accepted it */
+	int failed;
+	uint64_t first_ack_us;	/*!< From the command to the first channel acknowledging */
+	uint64_t last_ack_us;	/*!< From the command to the last channel acknowledging */
+};
+
+/*!
+ * \brief Send a message to every session on which TTY is enabled
+ * \param ami
+ * \param pattern Only channels matching this glob (e.g. PJSIP/trunk-*), or NULL for all
+ * \param text Message
+ * \param[out] result
+ * \retval 0 on success (even if some channels failed), -1 on failure
+ */
+int broadcast(struct ami_session *ami, const char *pattern, const char *text, struct broadcast_result *result);
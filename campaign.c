@@ -0,0 +1,399 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Outbound TTY notification dialer
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "asttyspy.h"
+#include "campaign.h"
+#include "session.h"
+#include "record.h"
+#include "baudot.h"
+#include "vclock.h"
+
+#define CAMPAIGN_POLL_MS 250			/* Max time between checks, so campaign_stop() is noticed */
+#define CAMPAIGN_ANSWER_GRACE_MS 5000	/* Give up on calls with no OriginateResponse this long after they should have stopped ringing */
+
+enum call_state {
+	CALL_FREE = 0,
+	CALL_BUSY,		/*!< The campaign thread is issuing actions for it */
+	CALL_DIALING,	/*!< Originated, waiting for OriginateResponse */
+	CALL_ANSWERED,	/*!< Notice not sent yet */
+	CALL_WAITING,	/*!< Notice sent, waiting for SK */
+	CALL_HANGUP,	/*!< Needs to be hung up */
+};
+
+/*!
+ * \brief A call in progress.
+ *        Only the campaign thread changes the state; the event callback just sets the flags.
+ */
+struct campaign_call {
+	enum call_state state;
+	char id[64];			/*!< ChannelId, and so Uniqueid */
+	char channel[256];		/*!< Once answered */
+	const char *dest;
+	uint64_t originated_ms;
+	uint64_t deadline_ms;
+	unsigned int answered:1;
+	unsigned int failed:1;
+	unsigned int hungup:1;
+	unsigned int observed:1;
+	unsigned int delivered:1;
+	unsigned int acked:1;
+	char word[8];			/*!< Word being received, to detect SK */
+	size_t wordlen;
+};
+
+static pthread_mutex_t campaign_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t campaign_cond = PTHREAD_COND_INITIALIZER;
+static struct campaign_call *calls = NULL; /* Only while a campaign is running */
+static int num_calls = 0;
+static volatile sig_atomic_t stopping = 0;
+
+void campaign_defaults(struct campaign_options *opts)
+{
+	opts->concurrency = 4;
+	opts->interval_ms = 1000;
+	opts->ring_ms = 30000;
+	opts->timeout_ms = 30000;
+}
+
+void campaign_stop(void)
+{
+	stopping = 1; /* The campaign thread checks at least every CAMPAIGN_POLL_MS */
+}
+
+/*! \note Must be called with the lock held */
+static struct campaign_call *find_call(const char *id)
+{
+	int i;
+
+	for (i = 0; i < num_calls; i++) {
+		if (calls[i].state != CALL_FREE && !strcmp(calls[i].id, id)) {
+			return &calls[i];
+		}
+	}
+	return NULL;
+}
+
+/*! \brief A word was received. SK (or SKSK) means the other end is done. */
+static void end_word(struct campaign_call *call)
+{
+	call->word[call->wordlen] = '\0';
+	if (!strcmp(call->word, "SK") || !strcmp(call->word, "SKSK")) {
+		call->acked = 1;
+	}
+	call->wordlen = 0;
+}
+
+void campaign_event(struct ami_event *event)
+{
+	const char *eventname = ami_keyvalue(event, "Event");
+	struct campaign_call *call;
+	int i;
+
+	pthread_mutex_lock(&campaign_lock);
+	if (!calls) {
+		pthread_mutex_unlock(&campaign_lock);
+		return;
+	}
+	call = find_call(ami_keyvalue(event, "Uniqueid"));
+	if (!strcmp(eventname, "OriginateResponse")) {
+		if (!call) {
+			/* If the channel was never created, there may be no Uniqueid, but the dial string is there */
+			for (i = 0; i < num_calls; i++) {
+				if (calls[i].state == CALL_DIALING && !strcmp(calls[i].dest, ami_keyvalue(event, "Channel"))) {
+					call = &calls[i];
+					break;
+				}
+			}
+		}
+		if (call && !strcasecmp(ami_keyvalue(event, "Response"), "Success")) {
+			snprintf(call->channel, sizeof(call->channel), "%s", ami_keyvalue(event, "Channel"));
+			call->answered = 1;
+		} else if (call) {
+			call->failed = 1;
+		}
+	} else if (!strcmp(eventname, "Hangup") && call) {
+		end_word(call); /* SK, then hung up without a space */
+		call->hungup = 1;
+	}
+	vclock_signal(&campaign_cond);
+	pthread_mutex_unlock(&campaign_lock);
+}
+
+void campaign_rx(const char *channel, const char *msg)
+{
+	struct campaign_call *call = NULL;
+	char *text, *c;
+	int i;
+
+	pthread_mutex_lock(&campaign_lock);
+	for (i = 0; calls && i < num_calls; i++) {
+		if (calls[i].state != CALL_FREE && calls[i].answered && !strcmp(calls[i].channel, channel)) {
+			call = &calls[i];
+			break;
+		}
+	}
+	if (!call) {
+		pthread_mutex_unlock(&campaign_lock);
+		return;
+	}
+	text = strdup(msg);
+	if (text) {
+		tty_unescape(text);
+		for (c = text; *c; c++) {
+			if (isalpha((unsigned char) *c)) {
+				if (call->wordlen < sizeof(call->word) - 1) {
+					call->word[call->wordlen++] = (char) toupper((unsigned char) *c);
+				}
+			} else {
+				end_word(call);
+			}
+		}
+		free(text);
+	}
+	vclock_signal(&campaign_cond);
+	pthread_mutex_unlock(&campaign_lock);
+}
+
+/*! \note Must be called with the lock held. Releases it while issuing actions. */
+static void finish_call(struct ami_session *ami, struct campaign_call *call, struct campaign_stats *stats)
+{
+	if (call->delivered && call->acked) {
+		stats->acknowledged++;
+	}
+	if (call->observed) {
+		call->state = CALL_BUSY;
+		pthread_mutex_unlock(&campaign_lock);
+		session_unobserve(ami, call->channel);
+		pthread_mutex_lock(&campaign_lock);
+	}
+	memset(call, 0, sizeof(*call));
+}
+
+/*!
+ * \brief Do whatever is next for a call
+ * \note Must be called with the lock held. Releases it while issuing actions.
+ */
+static void step_call(struct ami_session *ami, struct campaign_call *call, const char *notice, unsigned int notice_ms,
+	const struct campaign_options *opts, struct campaign_stats *stats)
+{
+	uint64_t now = vclock_now_ms();
+	int res, observed;
+
+	switch (call->state) {
+	case CALL_DIALING:
+		if (call->failed || (call->hungup && !call->answered)) {
+			finish_call(ami, call, stats);
+			return;
+		} else if (!call->answered) {
+			if (now >= call->deadline_ms) {
+				finish_call(ami, call, stats); /* Originate will have given up by now */
+			}
+			return;
+		}
+		stats->answered++;
+		stats->answer_total_ms += now - call->originated_ms;
+		recorder_add(call->channel); /* If recording */
+		call->state = CALL_ANSWERED;
+		/* Fall through */
+	case CALL_ANSWERED:
+		if (call->hungup) {
+			finish_call(ami, call, stats);
+			return;
+		} else if (stopping) {
+			call->state = CALL_HANGUP;
+			break;
+		}
+		call->state = CALL_BUSY;
+		pthread_mutex_unlock(&campaign_lock);
+		observed = !session_observe(ami, call->channel);
+		res = observed ? tdd_tx(ami, call->channel, notice) : -1;
+		pthread_mutex_lock(&campaign_lock);
+		call->observed = (unsigned int) observed;
+		if (res) {
+			call->state = CALL_HANGUP;
+			break;
+		}
+		call->delivered = 1;
+		stats->delivered++;
+		call->deadline_ms = vclock_now_ms() + notice_ms + (uint64_t) opts->timeout_ms;
+		call->state = CALL_WAITING;
+		return;
+	case CALL_WAITING:
+		if (call->hungup) {
+			finish_call(ami, call, stats);
+			return;
+		} else if (call->acked || stopping) {
+			call->state = CALL_HANGUP;
+		} else if (now >= call->deadline_ms) {
+			stats->timeouts++;
+			call->state = CALL_HANGUP;
+		} else {
+			return;
+		}
+		break;
+	case CALL_FREE:
+	case CALL_BUSY:
+	case CALL_HANGUP:
+		break;
+	}
+
+	if (call->state == CALL_HANGUP) {
+		if (!call->hungup) {
+			call->state = CALL_BUSY;
+			pthread_mutex_unlock(&campaign_lock);
+			ami_action_response_result(ami, ami_action(ami, "Hangup", "Channel:%s", call->channel));
+			pthread_mutex_lock(&campaign_lock);
+		}
+		finish_call(ami, call, stats);
+	}
+}
+
+/*! \note Must be called with the lock held. Releases it while issuing the action. */
+static void originate(struct ami_session *ami, struct campaign_call *call, const char *dest, int wait_secs,
+	const struct campaign_options *opts, struct campaign_stats *stats)
+{
+	int res;
+
+	memset(call, 0, sizeof(*call));
+	snprintf(call->id, sizeof(call->id), "asttyspy-%d-%lu", (int) getpid(), stats->attempted);
+	call->dest = dest;
+	call->originated_ms = vclock_now_ms();
+	call->deadline_ms = call->originated_ms + (uint64_t) opts->ring_ms + CAMPAIGN_ANSWER_GRACE_MS;
+	call->state = CALL_BUSY;
+	stats->attempted++;
+
+	pthread_mutex_unlock(&campaign_lock);
+	res = ami_action_response_result(ami, ami_action(ami, "Originate", "Channel:%s\r\nApplication:Wait\r\nData:%d\r\nTimeout:%d\r\nAsync:true\r\nChannelId:%s",
+		dest, wait_secs, opts->ring_ms, call->id));
+	pthread_mutex_lock(&campaign_lock);
+
+	if (res) {
+		fprintf(stderr, "Failed to originate call to %s\n", dest);
+		memset(call, 0, sizeof(*call));
+		return;
+	}
+	call->state = CALL_DIALING;
+}
+
+int campaign_run(struct ami_session *ami, char *const *dests, int count, const char *notice,
+	const struct campaign_options *opts, struct campaign_stats *stats)
+{
+	unsigned int notice_ms = baudot_text_ms(notice);
+	uint64_t start, now, next_originate, wake;
+	int i, next = 0, active, wait_secs;
+
+	if (opts->concurrency < 1) {
+		fprintf(stderr, "Invalid concurrency: %d\n", opts->concurrency);
+		return -1;
+	}
+	memset(stats, 0, sizeof(*stats));
+	/* Keep calls up (in Wait) for longer than we could possibly need them, in case we go away */
+	wait_secs = (int) ((notice_ms + (unsigned int) opts->timeout_ms) / 1000) + 60;
+
+	pthread_mutex_lock(&campaign_lock);
+	calls = calloc((size_t) opts->concurrency, sizeof(*calls));
+	if (!calls) {
+		pthread_mutex_unlock(&campaign_lock);
+		return -1;
+	}
+	num_calls = opts->concurrency;
+	stopping = 0;
+	start = next_originate = vclock_now_ms();
+
+	for (;;) {
+		active = 0;
+		for (i = 0; i < num_calls; i++) {
+			if (calls[i].state != CALL_FREE) {
+				step_call(ami, &calls[i], notice, notice_ms, opts, stats);
+			}
+			if (calls[i].state != CALL_FREE) {
+				active++;
+			}
+		}
+
+		now = vclock_now_ms();
+		if (!stopping && next < count && active < num_calls && now >= next_originate) {
+			for (i = 0; calls[i].state != CALL_FREE; i++);
+			originate(ami, &calls[i], dests[next++], wait_secs, opts, stats);
+			next_originate = now + (uint64_t) opts->interval_ms;
+			continue;
+		}
+		if ((stopping || next == count) && !active) {
+			break;
+		}
+
+		/* Sleep until something is due, or an event wakes us up */
+		wake = now + CAMPAIGN_POLL_MS;
+		if (!stopping && next < count && active < num_calls && next_originate < wake) {
+			wake = next_originate;
+		}
+		for (i = 0; i < num_calls; i++) {
+			if ((calls[i].state == CALL_DIALING || calls[i].state == CALL_WAITING) && calls[i].deadline_ms < wake) {
+				wake = calls[i].deadline_ms;
+			}
+		}
+		if (wake <= now) {
+			continue;
+		}
+		vclock_wait(&campaign_cond, &campaign_lock, wake);
+	}
+
+	free(calls);
+	calls = NULL;
+	num_calls = 0;
+	pthread_mutex_unlock(&campaign_lock);
+	stats->elapsed_ms = vclock_now_ms() - start;
+	return 0;
+}
+
+void campaign_report(FILE *fp, const struct campaign_stats *stats)
+{
+	double hours = (double) stats->elapsed_ms / 3600000.0;
+
+	fprintf(fp, "Calls attempted:    %lu\n", stats->attempted);
+	fprintf(fp, "Answered:           %lu (avg %.0f ms to answer)\n", stats->answered,
+		stats->answered ? (double) stats->answer_total_ms / (double) stats->answered : 0);
+	fprintf(fp, "Notice delivered:   %lu\n", stats->delivered);
+	fprintf(fp, "Acknowledged (SK):  %lu\n", stats->acknowledged);
+	fprintf(fp, "Timed out:          %lu\n", stats->timeouts);
+	fprintf(fp, "Elapsed:            %.1f s\n", (double) stats->elapsed_ms / 1000.0);
+	fprintf(fp, "Calls per hour:     %.0f\n", hours > 0 ? (double) stats->attempted / hours : 0);
+	fprintf(fp, "Success rate:       %.1f%% delivered, %.1f%% acknowledged\n",
+		stats->attempted ? 100.0 * (double) stats->delivered / (double) stats->attempted : 0,
+		stats->attempted ? 100.0 * (double) stats->acknowledged / (double) stats->attempted : 0);
+}
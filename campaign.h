@@ -0,0 +1,84 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Outbound TTY notification dialer (campaigns)
+ *
+ * Each destination is called with an asynchronous Originate (to the Wait
+ * application, so the channel stays up while we use it), with a ChannelId so
+ * its events can be recognized by Uniqueid. Once it answers (OriginateResponse),
+ * TTY is enabled and the notice is sent. The call is hung up once the other
+ * end sends SK, or if it doesn't by the time the notice should have been sent
+ * plus a timeout.
+ *
+ * Actions are only issued by the thread running the campaign; the AMI event
+ * callback just updates the state of calls and wakes it up.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct campaign_options {
+	int concurrency;	/*!< Max calls at once */
+	int interval_ms;	/*!< Min time between originating calls (pacing) */
+	int ring_ms;		/*!< How long to let each call ring */
+	int timeout_ms;		/*!< How long to wait for SK, after the notice should have been sent */
+};
+
+struct campaign_stats {
+	unsigned long attempted;
+	unsigned long answered;
+	unsigned long delivered;	/*!< Answered, and the notice was sent */
+	unsigned long acknowledged;	/*!< Delivered, and the other end sent SK */
+	unsigned long timeouts;		/*!< Delivered, but no SK before the timeout */
+	uint64_t answer_total_ms;	/*!< From originating to answer, for answered calls */
+	uint64_t elapsed_ms;
+};
+
+/*! \brief Set campaign_options to the defaults */
+void campaign_defaults(struct campaign_options *opts);
+
+/*!
+ * \brief Run a campaign, until every destination has been called or campaign_stop() is called
+ * \param ami
+ * \param dests Dial strings, e.g. PJSIP/5551234@trunk
+ * \param count Number of destinations
+ * \param notice Text to send
+ * \param opts
+ * \param[out] stats
+ * \retval 0 on success, -1 on failure
+ */
+int campaign_run(struct ami_session *ami, char *const *dests, int count, const char *notice,
+	const struct campaign_options *opts, struct campaign_stats *stats);
+
+/*! \brief Stop originating calls, and hang up calls in progress. Async-signal-safe. */
+void campaign_stop(void);
+
+/*! \brief Handle an AMI event (OriginateResponse or Hangup). Safe to call from the AMI event callback. */
+void campaign_event(struct ami_event *event);
+
+/*! \brief Handle received text. Safe to call from the AMI event callback. */
+void campaign_rx(const char *channel, const char *msg);
+
+/*! \brief Print a campaign report: outcomes, calls per hour and success rate */
+void campaign_report(FILE *fp, const struct campaign_stats *stats);
@@ -0,0 +1,354 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Channel metadata, cached from the AMI events that go by
+ *
+ * Asterisk already sends most of what there is to know about a channel
+ * (caller ID, the number dialed, account code, linked ID, bridge, variables)
+ * in events we receive anyway, so it is kept here, rather than asked for
+ * with more actions whenever it's needed. Channels that existed before we
+ * connected are filled in from the channel list, whenever it is fetched.
+ *
+ * Channels are indexed both by name and by unique ID. Events are matched by
+ * unique ID when they have one, since the name can change (Rename).
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define _GNU_SOURCE /* strcasestr */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+
+#include "chanmeta.h"
+#include "vclock.h"
+
+#define CHANMETA_BUCKETS 256
+
+struct chan_entry {
+	struct chan_entry *next_channel;
+	struct chan_entry *next_uniqueid;
+	struct chan_meta meta;
+};
+
+static pthread_mutex_t chanmeta_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct chan_entry *by_channel[CHANMETA_BUCKETS];
+static struct chan_entry *by_uniqueid[CHANMETA_BUCKETS];
+static int num_entries = 0;
+
+static unsigned int meta_hash(const char *s)
+{
+	unsigned int hash = 2166136261u; /* FNV-1a */
+
+	for (; *s; s++) {
+		hash ^= (unsigned char) *s;
+		hash *= 16777619u;
+	}
+	return hash % CHANMETA_BUCKETS;
+}
+
+/*! \note Must be called with chanmeta_lock held */
+static struct chan_entry *find_channel(const char *channel)
+{
+	struct chan_entry *e;
+
+	for (e = by_channel[meta_hash(channel)]; e; e = e->next_channel) {
+		if (!strcmp(e->meta.channel, channel)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*! \note Must be called with chanmeta_lock held */
+static struct chan_entry *find_uniqueid(const char *uniqueid)
+{
+	struct chan_entry *e;
+
+	for (e = by_uniqueid[meta_hash(uniqueid)]; e; e = e->next_uniqueid) {
+		if (!strcmp(e->meta.uniqueid, uniqueid)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*! \note Must be called with chanmeta_lock held */
+static void unlink_channel(struct chan_entry *entry)
+{
+	struct chan_entry **e;
+
+	for (e = &by_channel[meta_hash(entry->meta.channel)]; *e; e = &(*e)->next_channel) {
+		if (*e == entry) {
+			*e = entry->next_channel;
+			return;
+		}
+	}
+}
+
+/*! \note Must be called with chanmeta_lock held */
+static void unlink_uniqueid(struct chan_entry *entry)
+{
+	struct chan_entry **e;
+
+	if (!entry->meta.uniqueid[0]) {
+		return;
+	}
+	for (e = &by_uniqueid[meta_hash(entry->meta.uniqueid)]; *e; e = &(*e)->next_uniqueid) {
+		if (*e == entry) {
+			*e = entry->next_uniqueid;
+			return;
+		}
+	}
+}
+
+/*! \note Must be called with chanmeta_lock held */
+static void link_uniqueid(struct chan_entry *e)
+{
+	unsigned int bucket;
+
+	if (!e->meta.uniqueid[0]) {
+		return;
+	}
+	bucket = meta_hash(e->meta.uniqueid);
+	e->next_uniqueid = by_uniqueid[bucket];
+	by_uniqueid[bucket] = e;
+}
+
+/*! \note Must be called with chanmeta_lock held */
+static struct chan_entry *create_entry(const char *channel)
+{
+	unsigned int bucket = meta_hash(channel);
+	struct chan_entry *e = calloc(1, sizeof(*e));
+
+	if (!e) {
+		return NULL;
+	}
+	snprintf(e->meta.channel, sizeof(e->meta.channel), "%s", channel);
+	e->meta.created = vclock_time();
+	e->next_channel = by_channel[bucket];
+	by_channel[bucket] = e;
+	num_entries++;
+	return e;
+}
+
+/*! \brief Copy a field from an event, if it has it (CAMI returns an empty string if not) */
+static void set_field(char *buf, size_t len, struct ami_event *event, const char *key)
+{
+	const char *value = ami_keyvalue(event, key);
+
+	if (value && *value) {
+		snprintf(buf, len, "%s", value);
+	}
+}
+
+#define SET_FIELD(field, key) set_field(e->meta.field, sizeof(e->meta.field), event, key)
+
+/*! \note Must be called with chanmeta_lock held */
+static void set_var(struct chan_entry *e, const char *name, const char *value)
+{
+	struct chan_var *v;
+	int i;
+
+	for (i = 0; i < e->meta.num_vars; i++) {
+		if (!strcmp(e->meta.vars[i].name, name)) {
+			break;
+		}
+	}
+	if (i == CHANMETA_MAX_VARS) {
+		return; /* Full */
+	}
+	v = &e->meta.vars[i];
+	if (i == e->meta.num_vars) {
+		snprintf(v->name, sizeof(v->name), "%s", name);
+		e->meta.num_vars++;
+	}
+	snprintf(v->value, sizeof(v->value), "%s", value ? value : "");
+}
+
+void chanmeta_event(struct ami_event *event, const char *eventname)
+{
+	struct chan_entry *e;
+	const char *channel, *uniqueid;
+	int create;
+
+	/* Quickly skip anything that can't be interesting, since this sees every event */
+	switch (eventname[0]) {
+	case 'B': case 'C': case 'H': case 'N': case 'R': case 'V':
+		break;
+	default:
+		return;
+	}
+	create = !strcmp(eventname, "Newchannel") || !strcmp(eventname, "CoreShowChannel");
+	if (!create && strcmp(eventname, "NewCallerid") && strcmp(eventname, "NewConnectedLine") && strcmp(eventname, "NewAccountCode")
+		&& strcmp(eventname, "VarSet") && strcmp(eventname, "BridgeEnter") && strcmp(eventname, "BridgeLeave")
+		&& strcmp(eventname, "Rename") && strcmp(eventname, "Hangup")) {
+		return;
+	}
+	channel = ami_keyvalue(event, "Channel");
+	uniqueid = ami_keyvalue(event, "Uniqueid");
+	if (!channel || !*channel) {
+		return;
+	}
+
+	pthread_mutex_lock(&chanmeta_lock);
+	e = uniqueid && *uniqueid ? find_uniqueid(uniqueid) : NULL;
+	if (!e) {
+		e = find_channel(channel);
+	}
+	if (!e && create) {
+		e = create_entry(channel);
+	}
+	if (!e) {
+		pthread_mutex_unlock(&chanmeta_lock);
+		return;
+	}
+	if (!e->meta.uniqueid[0] && uniqueid && *uniqueid) {
+		snprintf(e->meta.uniqueid, sizeof(e->meta.uniqueid), "%s", uniqueid);
+		link_uniqueid(e);
+	}
+
+	if (create) {
+		SET_FIELD(linkedid, "Linkedid");
+		SET_FIELD(context, "Context");
+		SET_FIELD(exten, "Exten");
+		SET_FIELD(accountcode, "AccountCode");
+		SET_FIELD(callerid_num, "CallerIDNum");
+		SET_FIELD(callerid_name, "CallerIDName");
+		SET_FIELD(connected_num, "ConnectedLineNum");
+		SET_FIELD(connected_name, "ConnectedLineName");
+		SET_FIELD(bridge, "BridgeId"); /* Only in CoreShowChannel */
+	} else if (!strcmp(eventname, "NewCallerid")) {
+		SET_FIELD(callerid_num, "CallerIDNum");
+		SET_FIELD(callerid_name, "CallerIDName");
+	} else if (!strcmp(eventname, "NewConnectedLine")) {
+		SET_FIELD(connected_num, "ConnectedLineNum");
+		SET_FIELD(connected_name, "ConnectedLineName");
+	} else if (!strcmp(eventname, "NewAccountCode")) {
+		SET_FIELD(accountcode, "AccountCode");
+	} else if (!strcmp(eventname, "VarSet")) {
+		const char *name = ami_keyvalue(event, "Variable");
+		if (name && *name) {
+			set_var(e, name, ami_keyvalue(event, "Value"));
+		}
+	} else if (!strcmp(eventname, "BridgeEnter")) {
+		SET_FIELD(bridge, "BridgeUniqueid");
+	} else if (!strcmp(eventname, "BridgeLeave")) {
+		e->meta.bridge[0] = '\0';
+	} else if (!strcmp(eventname, "Rename")) {
+		const char *newname = ami_keyvalue(event, "Newname");
+		if (newname && *newname) {
+			unlink_channel(e);
+			snprintf(e->meta.channel, sizeof(e->meta.channel), "%s", newname);
+			e->next_channel = by_channel[meta_hash(newname)];
+			by_channel[meta_hash(newname)] = e;
+		}
+	} else { /* Hangup */
+		unlink_channel(e);
+		unlink_uniqueid(e);
+		num_entries--;
+		free(e);
+	}
+	pthread_mutex_unlock(&chanmeta_lock);
+}
+
+#undef SET_FIELD
+
+int chanmeta_get(const char *channel, struct chan_meta *meta)
+{
+	struct chan_entry *e;
+
+	pthread_mutex_lock(&chanmeta_lock);
+	e = find_channel(channel);
+	if (e) {
+		*meta = e->meta;
+	}
+	pthread_mutex_unlock(&chanmeta_lock);
+	return e ? 0 : -1;
+}
+
+int chanmeta_get_uniqueid(const char *uniqueid, struct chan_meta *meta)
+{
+	struct chan_entry *e;
+
+	pthread_mutex_lock(&chanmeta_lock);
+	e = find_uniqueid(uniqueid);
+	if (e) {
+		*meta = e->meta;
+	}
+	pthread_mutex_unlock(&chanmeta_lock);
+	return e ? 0 : -1;
+}
+
+int chanmeta_match(const char *channel, const char *text)
+{
+	struct chan_entry *e;
+	const struct chan_meta *m;
+	int i, match = 0;
+
+	pthread_mutex_lock(&chanmeta_lock);
+	e = find_channel(channel);
+	if (e) {
+		m = &e->meta;
+		match = strcasestr(m->channel, text) || strcasestr(m->uniqueid, text) || strcasestr(m->linkedid, text)
+			|| strcasestr(m->exten, text) || strcasestr(m->accountcode, text) || strcasestr(m->callerid_num, text)
+			|| strcasestr(m->callerid_name, text) || strcasestr(m->connected_num, text) || strcasestr(m->connected_name, text)
+			|| strcasestr(m->bridge, text);
+		for (i = 0; !match && i < m->num_vars; i++) {
+			match = strcasestr(m->vars[i].value, text) != NULL;
+		}
+	}
+	pthread_mutex_unlock(&chanmeta_lock);
+	return match;
+}
+
+int chanmeta_count(void)
+{
+	int count;
+
+	pthread_mutex_lock(&chanmeta_lock);
+	count = num_entries;
+	pthread_mutex_unlock(&chanmeta_lock);
+	return count;
+}
+
+void chanmeta_destroy(void)
+{
+	struct chan_entry *e;
+	int i;
+
+	pthread_mutex_lock(&chanmeta_lock);
+	for (i = 0; i < CHANMETA_BUCKETS; i++) {
+		while ((e = by_channel[i])) {
+			by_channel[i] = e->next_channel;
+			free(e);
+		}
+		by_uniqueid[i] = NULL;
+	}
+	num_entries = 0;
+	pthread_mutex_unlock(&chanmeta_lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Channel metadata, cached from the AMI events that go by
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <time.h>
+
+/*! \brief Channel variables (from VarSet) kept per channel. Variables set after that are not kept. */
+#define CHANMETA_MAX_VARS 8
+
+struct chan_var {
+	char name[32];
+	char value[64];
+};
+
+struct chan_meta {
+	char channel[256];
+	char uniqueid[64];
+	char linkedid[64];		/*!< Uniqueid of the first channel in the call */
+	char context[80];
+	char exten[80];			/*!< Extension dialed, i.e. the DID for inbound calls */
+	char accountcode[80];
+	char callerid_num[80];
+	char callerid_name[80];
+	char connected_num[80];
+	char connected_name[80];
+	char bridge[64];		/*!< Bridge it is in, if any */
+	time_t created;			/*!< When it was first seen */
+	int num_vars;
+	struct chan_var vars[CHANMETA_MAX_VARS];
+};
+
+struct ami_event;
+
+/*!
+ * \brief Update the cache from an event, if it has anything for it: Newchannel, NewCallerid, NewConnectedLine,
+ *        NewAccountCode, VarSet, BridgeEnter, BridgeLeave, Rename, Hangup, and CoreShowChannel (from the channel list)
+ * \param event
+ * \param eventname The event's name
+ */
+void chanmeta_event(struct ami_event *event, const char *eventname);
+
+/*!
+ * \brief Get a channel's metadata
+ * \retval 0 on success, -1 if it isn't cached
+ */
+int chanmeta_get(const char *channel, struct chan_meta *meta);
+
+/*!
+ * \brief Get a channel's metadata, by its unique ID
+ * \retval 0 on success, -1 if it isn't cached
+ */
+int chanmeta_get_uniqueid(const char *uniqueid, struct chan_meta *meta);
+
+/*!
+ * \brief Whether any of a channel's metadata (caller ID, DID, account code, variables, etc.) contains some text, ignoring case
+ * \retval 1 if it does, 0 if not, or if it isn't cached
+ */
+int chanmeta_match(const char *channel, const char *text);
+
+/*! \brief Number of channels cached */
+int chanmeta_count(void);
+
+/*! \brief Empty the cache */
+void chanmeta_destroy(void);
@@ -0,0 +1,254 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief G.711 (mu-law and A-law) and signed linear conversion
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "codec.h"
+
+/* Generated from the ITU G.711 reference decoders */
+const int16_t codec_ulaw_table[256] = {
+	-32124, -31100, -30076, -29052, -28028, -27004, -25980, -24956,
+	-23932, -22908, -21884, -20860, -19836, -18812, -17788, -16764,
+	-15996, -15484, -14972, -14460, -13948, -13436, -12924, -12412,
+	-11900, -11388, -10876, -10364, -9852, -9340, -8828, -8316,
+	-7932, -7676, -7420, -7164, -6908, -6652, -6396, -6140,
+	-5884, -5628, -5372, -5116, -4860, -4604, -4348, -4092,
+	-3900, -3772, -3644, -3516, -3388, -3260, -3132, -3004,
+	-2876, -2748, -2620, -2492, -2364, -2236, -2108, -1980,
+	-1884, -1820, -1756, -1692, -1628, -1564, -1500, -1436,
+	-1372, -1308, -1244, -1180, -1116, -1052, -988, -924,
+	-876, -844, -812, -780, -748, -716, -684, -652,
+	-620, -588, -556, -524, -492, -460, -428, -396,
+	-372, -356, -340, -324, -308, -292, -276, -260,
+	-244, -228, -212, -196, -180, -164, -148, -132,
+	-120, -112, -104, -96, -88, -80, -72, -64,
+	-56, -48, -40, -32, -24, -16, -8, 0,
+	32124, 31100, 30076, 29052, 28028, 27004, 25980, 24956,
+	23932, 22908, 21884, 20860, 19836, 18812, 17788, 16764,
+	15996, 15484, 14972, 14460, 13948, 13436, 12924, 12412,
+	11900, 11388, 10876, 10364, 9852, 9340, 8828, 8316,
+	7932, 7676, 7420, 7164, 6908, 6652, 6396, 6140,
+	5884, 5628, 5372, 5116, 4860, 4604, 4348, 4092,
+	3900, 3772, 3644, 3516, 3388, 3260, 3132, 3004,
+	2876, 2748, 2620, 2492, 2364, 2236, 2108, 1980,
+	1884, 1820, 1756, 1692, 1628, 1564, 1500, 1436,
+	1372, 1308, 1244, 1180, 1116, 1052, 988, 924,
+	876, 844, 812, 780, 748, 716, 684, 652,
+	620, 588, 556, 524, 492, 460, 428, 396,
+	372, 356, 340, 324, 308, 292, 276, 260,
+	244, 228, 212, 196, 180, 164, 148, 132,
+	120, 112, 104, 96, 88, 80, 72, 64,
+	56, 48, 40, 32, 24, 16, 8, 0,
+};
+
+const int16_t codec_alaw_table[256] = {
+	-5504, -5248, -6016, -5760, -4480, -4224, -4992, -4736,
+	-7552, -7296, -8064, -7808, -6528, -6272, -7040, -6784,
+	-2752, -2624, -3008, -2880, -2240, -2112, -2496, -2368,
+	-3776, -3648, -4032, -3904, -3264, -3136, -3520, -3392,
+	-22016, -20992, -24064, -23040, -17920, -16896, -19968, -18944,
+	-30208, -29184, -32256, -31232, -26112, -25088, -28160, -27136,
+	-11008, -10496, -12032, -11520, -8960, -8448, -9984, -9472,
+	-15104, -14592, -16128, -15616, -13056, -12544, -14080, -13568,
+	-344, -328, -376, -360, -280, -264, -312, -296,
+	-472, -456, -504, -488, -408, -392, -440, -424,
+	-88, -72, -120, -104, -24, -8, -56, -40,
+	-216, -200, -248, -232, -152, -136, -184, -168,
+	-1376, -1312, -1504, -1440, -1120, -1056, -1248, -1184,
+	-1888, -1824, -2016, -1952, -1632, -1568, -1760, -1696,
+	-688, -656, -752, -720, -560, -528, -624, -592,
+	-944, -912, -1008, -976, -816, -784, -880, -848,
+	5504, 5248, 6016, 5760, 4480, 4224, 4992, 4736,
+	7552, 7296, 8064, 7808, 6528, 6272, 7040, 6784,
+	2752, 2624, 3008, 2880, 2240, 2112, 2496, 2368,
+	3776, 3648, 4032, 3904, 3264, 3136, 3520, 3392,
+	22016, 20992, 24064, 23040, 17920, 16896, 19968, 18944,
+	30208, 29184, 32256, 31232, 26112, 25088, 28160, 27136,
+	11008, 10496, 12032, 11520, 8960, 8448, 9984, 9472,
+	15104, 14592, 16128, 15616, 13056, 12544, 14080, 13568,
+	344, 328, 376, 360, 280, 264, 312, 296,
+	472, 456, 504, 488, 408, 392, 440, 424,
+	88, 72, 120, 104, 24, 8, 56, 40,
+	216, 200, 248, 232, 152, 136, 184, 168,
+	1376, 1312, 1504, 1440, 1120, 1056, 1248, 1184,
+	1888, 1824, 2016, 1952, 1632, 1568, 1760, 1696,
+	688, 656, 752, 720, 560, 528, 624, 592,
+	944, 912, 1008, 976, 816, 784, 880, 848,
+};
+
+/*
+ * Vectors of 4 samples (128 bits as 32-bit integers, so SSE2 or NEON).
+ * Where there is no SIMD support for an operation, GCC lowers it to scalar code,
+ * so this is still portable.
+ */
+typedef int16_t v4hi __attribute__ ((vector_size(8)));
+typedef int32_t v4si __attribute__ ((vector_size(16)));
+typedef float v4sf __attribute__ ((vector_size(16)));
+typedef unsigned char v4qu __attribute__ ((vector_size(4)));
+
+/*
+ * For 0 < x < 2^24, x converted to float is exact, so its biased exponent gives
+ * the position of the highest set bit, and the top 4 bits of its fraction are
+ * the 4 bits below that, which is what both laws use as the mantissa.
+ */
+#define FLOAT_BITS(x) ((v4si) __builtin_convertvector(x, v4sf))
+#define HIGH_BIT(bits) (((bits) >> 23) - 127)
+#define MANTISSA(bits) (((bits) >> 19) & 0x0F)
+
+static inline v4si ulaw_encode4(v4si x)
+{
+	v4si neg = x >> 31; /* All ones if negative */
+	v4si sign = neg & 0x80;
+	v4si mag = (x ^ neg) - neg;
+	v4si clip = mag > 32635;
+	v4si bits, exponent;
+
+	mag = ((mag & ~clip) | (32635 & clip)) + 0x84;
+	bits = FLOAT_BITS(mag);
+	exponent = HIGH_BIT(bits) - 7; /* mag >= 0x84, so the high bit is at least bit 7 */
+	return ~(sign | (exponent << 4) | MANTISSA(bits)) & 0xFF;
+}
+
+static inline v4si alaw_encode4(v4si x)
+{
+	v4si neg, mag, mask, clip, small, bits, seg, mantissa;
+
+	x >>= 3;
+	neg = x >> 31;
+	mag = x ^ neg; /* -x - 1 if negative */
+	mask = 0xD5 ^ (neg & (0xD5 ^ 0x55));
+	clip = mag > 0xFFF;
+	small = mag < 0x20; /* Segment 0 */
+	bits = FLOAT_BITS(mag);
+	seg = (HIGH_BIT(bits) - 4) & ~small;
+	mantissa = (MANTISSA(bits) & ~small) | ((mag >> 1) & 0x0F & small);
+	return ((((seg << 4) | mantissa) & ~clip) | (0x7F & clip)) ^ mask;
+}
+
+unsigned char codec_linear_to_ulaw(int16_t sample)
+{
+	v4si x = { sample };
+	return (unsigned char) ulaw_encode4(x)[0];
+}
+
+unsigned char codec_linear_to_alaw(int16_t sample)
+{
+	v4si x = { sample };
+	return (unsigned char) alaw_encode4(x)[0];
+}
+
+int codec_parse(const char *name)
+{
+	if (!strcasecmp(name, "slin") || !strcasecmp(name, "sln")) {
+		return CODEC_SLIN;
+	} else if (!strcasecmp(name, "ulaw")) {
+		return CODEC_ULAW;
+	} else if (!strcasecmp(name, "alaw")) {
+		return CODEC_ALAW;
+	}
+	return -1;
+}
+
+const char *codec_name(enum codec codec)
+{
+	switch (codec) {
+	case CODEC_ULAW:
+		return "ulaw";
+	case CODEC_ALAW:
+		return "alaw";
+	case CODEC_SLIN:
+	default:
+		return "sln";
+	}
+}
+
+size_t codec_sample_bytes(enum codec codec)
+{
+	return codec == CODEC_SLIN ? sizeof(int16_t) : 1;
+}
+
+static void g711_decode(const int16_t *table, const unsigned char *in, size_t samples, int16_t *out)
+{
+	size_t i, unrolled = samples & ~(size_t) 7;
+
+	/* Table lookups are gathers, which don't vectorize well, so just unroll */
+	for (i = 0; i < unrolled; i += 8) {
+		out[i] = table[in[i]];
+		out[i + 1] = table[in[i + 1]];
+		out[i + 2] = table[in[i + 2]];
+		out[i + 3] = table[in[i + 3]];
+		out[i + 4] = table[in[i + 4]];
+		out[i + 5] = table[in[i + 5]];
+		out[i + 6] = table[in[i + 6]];
+		out[i + 7] = table[in[i + 7]];
+	}
+	for (; i < samples; i++) {
+		out[i] = table[in[i]];
+	}
+}
+
+void codec_decode(enum codec codec, const void *in, size_t samples, int16_t *out)
+{
+	switch (codec) {
+	case CODEC_ULAW:
+		g711_decode(codec_ulaw_table, in, samples, out);
+		break;
+	case CODEC_ALAW:
+		g711_decode(codec_alaw_table, in, samples, out);
+		break;
+	case CODEC_SLIN:
+		memcpy(out, in, samples * sizeof(int16_t));
+		break;
+	}
+}
+
+void codec_encode(enum codec codec, const int16_t *in, size_t samples, void *outbuf)
+{
+	unsigned char *out = outbuf;
+	size_t i, vectorized = samples & ~(size_t) 3;
+
+	if (codec == CODEC_SLIN) {
+		memcpy(out, in, samples * sizeof(int16_t));
+		return;
+	}
+
+	for (i = 0; i < vectorized; i += 4) {
+		v4hi s;
+		v4si x;
+		v4qu u;
+
+		memcpy(&s, in + i, sizeof(s));
+		x = __builtin_convertvector(s, v4si);
+		x = codec == CODEC_ULAW ? ulaw_encode4(x) : alaw_encode4(x);
+		u = __builtin_convertvector(x, v4qu);
+		memcpy(out + i, &u, sizeof(u));
+	}
+	for (; i < samples; i++) {
+		out[i] = codec == CODEC_ULAW ? codec_linear_to_ulaw(in[i]) : codec_linear_to_alaw(in[i]);
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief G.711 (mu-law and A-law) and signed linear conversion
+ *
+ * Decoding uses 256-entry lookup tables. Encoding is computed rather than looked up:
+ * the segment and mantissa are taken from the exponent and fraction of the sample
+ * converted to float, which needs no branches or loops, so the frame converters
+ * are vectorized (4 samples at a time) using GCC vector extensions.
+ * Results are identical to the ITU reference implementation.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum codec {
+	CODEC_SLIN = 0,	/*!< 16-bit signed linear, host byte order */
+	CODEC_ULAW,
+	CODEC_ALAW,
+};
+
+extern const int16_t codec_ulaw_table[256];
+extern const int16_t codec_alaw_table[256];
+
+static inline int16_t codec_ulaw_to_linear(unsigned char u)
+{
+	return codec_ulaw_table[u];
+}
+
+static inline int16_t codec_alaw_to_linear(unsigned char a)
+{
+	return codec_alaw_table[a];
+}
+
+unsigned char codec_linear_to_ulaw(int16_t sample);
+
+unsigned char codec_linear_to_alaw(int16_t sample);
+
+/*! \brief Parse a codec name (slin, ulaw or alaw). Returns -1 if invalid. */
+int codec_parse(const char *name);
+
+/*! \brief Codec name, also used as the file extension (sln, ulaw, alaw) */
+const char *codec_name(enum codec codec);
+
+/*! \brief Bytes per sample */
+size_t codec_sample_bytes(enum codec codec);
+
+/*!
+ * \brief Convert a frame to signed linear
+ * \param codec Format of in
+ * \param in Encoded frame
+ * \param samples Number of samples
+ * \param[out] out Signed linear samples
+ */
+void codec_decode(enum codec codec, const void *in, size_t samples, int16_t *out);
+
+/*!
+ * \brief Convert a frame from signed linear
+ * \param codec Format of out
+ * \param in Signed linear samples
+ * \param samples Number of samples
+ * \param[out] out Encoded frame, samples * codec_sample_bytes(codec) bytes
+ */
+void codec_encode(enum codec codec, const int16_t *in, size_t samples, void *out);
@@ -0,0 +1,380 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Operator phrase and word completion
+ *
+ * Counts only ever go up, so when an entry is seen again, the cached best
+ * entry of each node above it only needs comparing against that entry.
+ * Nodes are allocated in chunks, since there is one per character learned.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+
+#include "complete.h"
+#include "macro.h"
+
+#define NODE_CHUNK 1024
+
+struct trie_node {
+	struct trie_node *child;	/*!< First child */
+	struct trie_node *next;		/*!< Next sibling */
+	struct trie_node *best;		/*!< Most frequent entry below this one (not including itself) */
+	char *text;					/*!< The entry ending here, if any */
+	unsigned int count;			/*!< Times the entry was seen */
+	char c;
+};
+
+struct node_chunk {
+	struct node_chunk *next;
+	size_t used;
+	struct trie_node nodes[NODE_CHUNK];
+};
+
+struct trie {
+	struct trie_node root;
+	size_t entries;
+};
+
+struct completer {
+	struct trie words;
+	struct trie phrases;
+	struct node_chunk *chunks;
+	size_t nodes;
+	size_t len;					/*!< Of the current line */
+	int overflow;				/*!< The current line is too long to be a phrase */
+	char line[COMPLETE_MAX_PHRASE + 1];
+};
+
+struct completer *completer_create(void)
+{
+	return calloc(1, sizeof(struct completer));
+}
+
+void completer_destroy(struct completer *c)
+{
+	struct node_chunk *chunk;
+	size_t i;
+
+	while ((chunk = c->chunks)) {
+		c->chunks = chunk->next;
+		for (i = 0; i < chunk->used; i++) {
+			free(chunk->nodes[i].text);
+		}
+		free(chunk);
+	}
+	free(c);
+}
+
+static struct trie_node *node_alloc(struct completer *c)
+{
+	struct node_chunk *chunk = c->chunks;
+	struct trie_node *node;
+
+	if (!chunk || chunk->used == NODE_CHUNK) {
+		chunk = malloc(sizeof(*chunk));
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->used = 0;
+		chunk->next = c->chunks;
+		c->chunks = chunk;
+	}
+	node = &chunk->nodes[chunk->used++];
+	memset(node, 0, sizeof(*node));
+	c->nodes++;
+	return node;
+}
+
+/*! \brief Find a node's child, or add it */
+static struct trie_node *node_child(struct completer *c, struct trie_node *node, char ch, int create)
+{
+	struct trie_node *child;
+
+	for (child = node->child; child; child = child->next) {
+		if (child->c == ch) {
+			return child;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	child = node_alloc(c);
+	if (child) {
+		child->c = ch;
+		child->next = node->child;
+		node->child = child;
+	}
+	return child;
+}
+
+/*! \brief Count an entry (already uppercase) as seen, adding it if it's new */
+static void trie_add(struct completer *c, struct trie *t, const char *key, size_t len, unsigned int weight)
+{
+	struct trie_node *path[COMPLETE_MAX_PHRASE + 1], *node = &t->root;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		path[i] = node;
+		node = node_child(c, node, key[i], 1);
+		if (!node) {
+			return;
+		}
+	}
+	if (!node->text) {
+		node->text = strndup(key, len);
+		if (!node->text) {
+			return;
+		}
+		t->entries++;
+	}
+	node->count += weight;
+	for (i = 0; i < len; i++) {
+		if (!path[i]->best || path[i]->best->count < node->count) {
+			path[i]->best = node;
+		}
+	}
+}
+
+/*! \brief The most frequent entry that starts with a prefix, and is longer than it and more frequent than it as an entry */
+static const struct trie_node *trie_suggest(struct completer *c, struct trie *t, const char *prefix, size_t len)
+{
+	const struct trie_node *node = &t->root;
+	size_t i;
+
+	for (i = 0; i < len && node; i++) {
+		node = node_child(c, (struct trie_node *) node, prefix[i], 0);
+	}
+	if (!node || !node->best || node->best->count < node->count) {
+		return NULL;
+	}
+	return node->best;
+}
+
+static void learn_word(struct completer *c, const char *word, size_t len, unsigned int weight)
+{
+	if (len >= 2 && len <= COMPLETE_MAX_WORD) {
+		trie_add(c, &c->words, word, len, weight);
+	}
+}
+
+/*! \brief Learn a line (already uppercase), and its words */
+static void learn_line(struct completer *c, const char *line, size_t len, unsigned int weight)
+{
+	size_t start, i;
+
+	while (len && line[0] == ' ') {
+		line++;
+		len--;
+	}
+	while (len && line[len - 1] == ' ') {
+		len--;
+	}
+	if (len >= 3 && len <= COMPLETE_MAX_PHRASE) {
+		trie_add(c, &c->phrases, line, len, weight);
+	}
+	for (start = i = 0; i <= len; i++) {
+		if (i == len || line[i] == ' ') {
+			learn_word(c, line + start, i - start, weight);
+			start = i + 1;
+		}
+	}
+}
+
+void completer_learn(struct completer *c, const char *text, unsigned int weight)
+{
+	char line[COMPLETE_MAX_PHRASE + 2]; /* One more, so a line that is too long isn't learned as a phrase */
+	size_t len = 0;
+
+	for (;; text++) {
+		if (!*text || *text == '\n' || *text == '\r') {
+			learn_line(c, line, len, weight);
+			len = 0;
+			if (!*text) {
+				break;
+			}
+		} else if (len < sizeof(line) - 1) {
+			line[len++] = (char) toupper(*text);
+		}
+	}
+}
+
+void completer_learn_macros(struct completer *c, const struct macro *macros, int num_macros)
+{
+	char text[sizeof(macros->text)], *s;
+	int i;
+
+	for (i = 0; i < num_macros; i++) {
+		strcpy(text, macros[i].text);
+		/* Newlines are escaped in macros */
+		for (s = text; (s = strstr(s, "\\n")); s++) {
+			s[0] = '\n';
+			memmove(s + 1, s + 2, strlen(s + 2) + 1);
+		}
+		completer_learn(c, text, COMPLETE_MACRO_WEIGHT);
+	}
+}
+
+/*! \brief Learn the CA (operator) turns of a transcript */
+static void learn_transcript(struct completer *c, FILE *fp)
+{
+	char line[512];
+	int ours = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || !strncmp(line, "TTY: ", 5)) {
+			ours = 0;
+		} else if (!strncmp(line, "CA : ", 5)) {
+			ours = 1;
+			completer_learn(c, line + 5, 1);
+		} else if (ours) {
+			completer_learn(c, line, 1); /* The operator's turn continues on a new line */
+		}
+	}
+}
+
+int completer_learn_transcripts(struct completer *c, const char *dir)
+{
+	char path[512];
+	struct dirent *entry;
+	DIR *d = opendir(dir);
+	FILE *fp;
+	size_t len;
+	int files = 0;
+
+	if (!d) {
+		return -1;
+	}
+	while ((entry = readdir(d))) {
+		len = strlen(entry->d_name);
+		if (len < 4 || strcmp(entry->d_name + len - 4, ".txt")) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		fp = fopen(path, "r");
+		if (fp) {
+			learn_transcript(c, fp);
+			fclose(fp);
+			files++;
+		}
+	}
+	closedir(d);
+	return files;
+}
+
+/*! \brief Where the last word of the current line starts */
+static size_t word_start(const struct completer *c)
+{
+	size_t i = c->len;
+
+	while (i && c->line[i - 1] != ' ') {
+		i--;
+	}
+	return i;
+}
+
+void completer_typed(struct completer *c, char ch)
+{
+	size_t start;
+
+	if (ch == '\b' || ch == 127) {
+		if (c->len) {
+			c->len--;
+		}
+		return;
+	} else if (ch == '\n' || ch == '\r' || ch == ' ') {
+		start = word_start(c);
+		if (ch != ' ' && !c->overflow) {
+			learn_line(c, c->line, c->len, 1); /* Including its words */
+			completer_reset(c);
+			return;
+		}
+		learn_word(c, c->line + start, c->len - start, 1);
+		if (ch != ' ') {
+			completer_reset(c);
+			return;
+		} else if (c->overflow) {
+			c->len = 0; /* Only the current word of a line that is too long is kept */
+			return;
+		} else if (!c->len) {
+			return; /* Lines are learned without leading spaces */
+		}
+	}
+	if (c->len == COMPLETE_MAX_PHRASE) {
+		/* Too long to be a phrase: from now on, only track words */
+		start = word_start(c);
+		c->len -= start;
+		memmove(c->line, c->line + start, c->len);
+		c->overflow = 1;
+		if (c->len == COMPLETE_MAX_PHRASE) {
+			c->len = 0; /* Not a word, either */
+		}
+	}
+	c->line[c->len++] = (char) toupper(ch);
+}
+
+void completer_reset(struct completer *c)
+{
+	c->len = 0;
+	c->overflow = 0;
+}
+
+const char *completer_suggest(struct completer *c, size_t *len)
+{
+	const struct trie_node *best;
+	size_t start;
+
+	if (!c->len) {
+		return NULL;
+	}
+	if (!c->overflow && c->len >= 2) {
+		best = trie_suggest(c, &c->phrases, c->line, c->len);
+		if (best && best->count >= COMPLETE_MIN_PHRASE_COUNT) {
+			*len = strlen(best->text) - c->len;
+			if (*len >= 2) {
+				return best->text + c->len;
+			}
+		}
+	}
+	start = word_start(c);
+	if (start == c->len) {
+		return NULL;
+	}
+	best = trie_suggest(c, &c->words, c->line + start, c->len - start);
+	if (!best) {
+		return NULL;
+	}
+	*len = strlen(best->text) - (c->len - start);
+	return *len >= 2 ? best->text + (c->len - start) : NULL;
+}
+
+void completer_get_stats(struct completer *c, struct completer_stats *stats)
+{
+	stats->words = c->words.entries;
+	stats->phrases = c->phrases.entries;
+	stats->nodes = c->nodes;
+}
@@ -0,0 +1,99 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Operator phrase and word completion
+ *
+ * Every character the operator types is Baudot airtime and effort, and
+ * operators type the same phrases over and over. Phrases (whole lines) and
+ * words are kept in two tries, learned from the macro library, the operator's
+ * side of past transcripts, and what the operator types, and ranked by how
+ * often they were seen. Each node caches the most frequent entry below it,
+ * so a suggestion is one walk down the trie, the length of what was typed.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+
+/*! \brief Longest phrase learned (longer lines are only learned as words) */
+#define COMPLETE_MAX_PHRASE 128
+
+/*! \brief Longest word learned */
+#define COMPLETE_MAX_WORD 32
+
+/*! \brief How many times a phrase must have been seen to be suggested */
+#define COMPLETE_MIN_PHRASE_COUNT 2
+
+/*! \brief Weight of a macro, relative to a phrase or word seen once */
+#define COMPLETE_MACRO_WEIGHT 4
+
+struct completer;
+
+struct macro;
+
+struct completer_stats {
+	size_t words;				/*!< Distinct words */
+	size_t phrases;				/*!< Distinct phrases */
+	size_t nodes;
+};
+
+/*! \brief Create an empty completer */
+struct completer *completer_create(void);
+
+void completer_destroy(struct completer *c);
+
+/*!
+ * \brief Learn the phrases and words in some text
+ * \param c
+ * \param text Each line is a phrase
+ * \param weight How many times to count it as seen
+ */
+void completer_learn(struct completer *c, const char *text, unsigned int weight);
+
+/*! \brief Learn the macros, with COMPLETE_MACRO_WEIGHT */
+void completer_learn_macros(struct completer *c, const struct macro *macros, int num_macros);
+
+/*!
+ * \brief Learn what the operator typed in the transcripts in a directory
+ * \return Number of transcripts read, or -1 if the directory couldn't be opened
+ */
+int completer_learn_transcripts(struct completer *c, const char *dir);
+
+/*!
+ * \brief Track a character the operator typed (or sent from a suggestion or macro).
+ * Learns each word and line as it is finished. \b or DEL erases.
+ */
+void completer_typed(struct completer *c, char ch);
+
+/*! \brief Forget what has been typed on the current line, e.g. on a new call */
+void completer_reset(struct completer *c);
+
+/*!
+ * \brief Suggest the rest of the current phrase, or if there is none, word
+ * \param c
+ * \param[out] len Length of the suggestion
+ * \return The rest, not null terminated, or NULL if there's no suggestion.
+ *         Valid until the completer is destroyed.
+ */
+const char *completer_suggest(struct completer *c, size_t *len);
+
+void completer_get_stats(struct completer *c, struct completer_stats *stats);
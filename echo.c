@@ -0,0 +1,199 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Suppression of our own transmitted tones (line echo) before decoding
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+#include "echo.h"
+
+/* Reference samples quieter than this don't count as transmitting */
+#define ECHO_TX_THRESHOLD 64
+/* Long enough for echo from the far end of a VoIP call to come back (round trip), plus the decoder's filters settling */
+#define ECHO_HANGOVER 2000
+/* Mean square residual below which there's nothing left worth decoding (about -44 dBFS) */
+#define ECHO_RESIDUAL_THRESHOLD 20000.0f
+#define ECHO_MU 0.3f
+/* Double talk detection: the echo is assumed to be at least 6 dB below what we sent,
+ * so if what's received is louder than that, the other side is talking, and adaptation is held off for a bit.
+ * This compares average power, rather than peaks (Geigel), so that line noise doesn't look like double talk. */
+#define ECHO_DOUBLETALK_RATIO 0.25f
+#define ECHO_RX_POWER_ALPHA (1.0f / 64)
+#define ECHO_DOUBLETALK_HOLD 240 /* 30 ms */
+/* Once the echo is this much (30 dB) louder than what's left after cancelling it, stop adapting until it isn't */
+#define ECHO_CONVERGED_ERLE 1000.0f
+
+typedef float v4sf __attribute__ ((vector_size(16)));
+
+int echo_mode_parse(const char *name)
+{
+	if (!strcasecmp(name, "none")) {
+		return ECHO_NONE;
+	} else if (!strcasecmp(name, "gate")) {
+		return ECHO_GATE;
+	} else if (!strcasecmp(name, "cancel")) {
+		return ECHO_CANCEL;
+	}
+	return -1;
+}
+
+void echo_init(struct echo_canceller *ec, enum echo_mode mode)
+{
+	memset(ec, 0, sizeof(*ec));
+	ec->mode = mode;
+}
+
+void echo_tx(struct echo_canceller *ec, const int16_t *samples, size_t len)
+{
+	size_t i, end;
+
+	if (ec->mode == ECHO_NONE) {
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		if (ec->fifo_len == ECHO_FIFO) {
+			/* Reference is way ahead of received audio, drop the oldest */
+			if (++ec->fifo_start == ECHO_FIFO) {
+				ec->fifo_start = 0;
+			}
+			ec->fifo_len--;
+		}
+		end = ec->fifo_start + ec->fifo_len++;
+		ec->fifo[end < ECHO_FIFO ? end : end - ECHO_FIFO] = samples[i];
+	}
+}
+
+static inline int16_t next_reference(struct echo_canceller *ec)
+{
+	int16_t ref;
+
+	if (!ec->fifo_len) {
+		return 0; /* Not transmitting */
+	}
+	ref = ec->fifo[ec->fifo_start];
+	if (++ec->fifo_start == ECHO_FIFO) {
+		ec->fifo_start = 0;
+	}
+	ec->fifo_len--;
+	return ref;
+}
+
+static inline void nlms_push(struct echo_canceller *ec, int16_t ref)
+{
+	int16_t old;
+
+	ec->pos = (ec->pos + ECHO_TAPS - 1) % ECHO_TAPS;
+	old = (int16_t) ec->history[ec->pos];
+	ec->history[ec->pos] = ec->history[ec->pos + ECHO_TAPS] = ref;
+	ec->history_power += ref * ref - old * old;
+}
+
+static inline float nlms_estimate(struct echo_canceller *ec)
+{
+	const float *window = ec->history + ec->pos; /* window[k] is the reference k samples ago */
+	v4sf acc = { 0, 0, 0, 0 };
+	int k;
+
+	for (k = 0; k < ECHO_TAPS; k += 4) {
+		v4sf t, w;
+		memcpy(&t, ec->taps + k, sizeof(t));
+		memcpy(&w, window + k, sizeof(w));
+		acc += t * w;
+	}
+	return acc[0] + acc[1] + acc[2] + acc[3];
+}
+
+static inline void nlms_adapt(struct echo_canceller *ec, float error)
+{
+	const float *window = ec->history + ec->pos;
+	float step = ECHO_MU * error / ((float) ec->history_power + 1.0f);
+	v4sf steps = { step, step, step, step };
+	int k;
+
+	for (k = 0; k < ECHO_TAPS; k += 4) {
+		v4sf t, w;
+		memcpy(&t, ec->taps + k, sizeof(t));
+		memcpy(&w, window + k, sizeof(w));
+		t += steps * w;
+		memcpy(ec->taps + k, &t, sizeof(t));
+	}
+}
+
+int echo_rx(struct echo_canceller *ec, int16_t *samples, size_t len)
+{
+	size_t i;
+	float residual = 0, echo_power = 0;
+	int transmitting = 0;
+
+	if (ec->mode == ECHO_NONE) {
+		return 1;
+	}
+	ec->frames++;
+
+	for (i = 0; i < len; i++) {
+		int16_t ref = next_reference(ec);
+
+		if (abs(ref) > ECHO_TX_THRESHOLD) {
+			ec->hangover = ECHO_HANGOVER;
+		} else if (ec->hangover > 0) {
+			ec->hangover--;
+		}
+		transmitting |= ec->hangover > 0;
+
+		if (ec->mode == ECHO_CANCEL && ec->hangover > 0) {
+			float rx = samples[i], error = rx;
+
+			nlms_push(ec, ref);
+			ec->rx_power += ECHO_RX_POWER_ALPHA * (rx * rx - ec->rx_power);
+			if (ec->rx_power > ECHO_DOUBLETALK_RATIO * (float) ec->history_power / ECHO_TAPS) {
+				ec->doubletalk = ECHO_DOUBLETALK_HOLD;
+			} else if (ec->doubletalk > 0) {
+				ec->doubletalk--;
+			}
+			if (ec->history_power) { /* Otherwise, there's nothing in the echo tail to cancel */
+				error = rx - nlms_estimate(ec);
+				if (!ec->converged && !ec->doubletalk) {
+					nlms_adapt(ec, error);
+				}
+				echo_power += rx * rx;
+				samples[i] = (int16_t) (error > 32767 ? 32767 : error < -32768 ? -32768 : error);
+			}
+			residual += error * error;
+		}
+	}
+
+	if (ec->mode == ECHO_CANCEL) {
+		ec->converged = echo_power > ECHO_CONVERGED_ERLE * residual;
+	}
+	if (!transmitting) {
+		return 1;
+	} else if (ec->mode == ECHO_CANCEL && residual / (float) len > ECHO_RESIDUAL_THRESHOLD) {
+		return 1; /* Something besides our echo */
+	}
+	ec->skipped++;
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Suppression of our own transmitted tones (line echo) before decoding
+ *
+ * While we are sending Baudot, the decoder on the same channel hears our own
+ * tones reflected back from the far end of the line, and decodes them as
+ * if they were received text. Given what we sent (the reference), this can either:
+ *
+ * - Gate: skip decoding entirely while we are sending, and for a short
+ *   hangover afterwards, for the echo to die out. TTYs are half-duplex anyway,
+ *   so this is usually what you want, and it is nearly free.
+ * - Cancel: subtract an estimate of the echo (NLMS adaptive filter), and only
+ *   decode if something is left, i.e. the other side is typing over us.
+ *
+ * Usage, per 20 ms (or any size) frame: echo_tx() with what was sent in the frame,
+ * if anything, then echo_rx() with what was received. If it returns 0, skip
+ * decoding the frame (and reset the decoder, since it's a gap in its audio).
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ECHO_TAPS 128		/* 16 ms echo tail */
+#define ECHO_FIFO 8000		/* 1 second of reference, at most */
+
+enum echo_mode {
+	ECHO_NONE = 0,
+	ECHO_GATE,
+	ECHO_CANCEL,
+};
+
+struct echo_canceller {
+	enum echo_mode mode;
+	float taps[ECHO_TAPS];
+	float history[ECHO_TAPS * 2];	/*!< Reference, stored twice, so the last ECHO_TAPS samples are always contiguous */
+	unsigned int pos;
+	int64_t history_power;			/*!< Sum of squares of the last ECHO_TAPS reference samples (exact, so it really gets back to 0) */
+	int16_t fifo[ECHO_FIFO];		/*!< Reference not yet matched up with received audio */
+	size_t fifo_start;
+	size_t fifo_len;
+	float rx_power;					/*!< Recent average power of received audio, for double talk detection */
+	int doubletalk;					/*!< Samples left for which not to adapt, since the other side is talking */
+	int converged;					/*!< The filter matched the echo well enough last frame not to need adapting */
+	int hangover;					/*!< Samples left in which our transmission may still be echoing */
+	unsigned long frames;			/*!< Frames processed */
+	unsigned long skipped;			/*!< Frames for which decoding was skipped */
+};
+
+/*! \brief Parse an echo mode name (none, gate or cancel). Returns -1 if invalid. */
+int echo_mode_parse(const char *name);
+
+void echo_init(struct echo_canceller *ec, enum echo_mode mode);
+
+/*! \brief Add what we transmitted (signed linear) to the reference */
+void echo_tx(struct echo_canceller *ec, const int16_t *samples, size_t len);
+
+/*!
+ * \brief Process received audio
+ * \param ec
+ * \param samples Received audio (signed linear). In cancel mode, the echo is removed in place.
+ * \param len
+ * \retval 1 if the frame should be decoded, 0 if decoding should be skipped
+ */
+int echo_rx(struct echo_canceller *ec, int16_t *samples, size_t len);
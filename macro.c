@@ -0,0 +1,81 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Macro library
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "macro.h"
+
+static const struct macro default_macros[] = {
+	{ "GA", " GA\\n" },
+	{ "SK", " SK\\n" },
+	{ "Greeting", "HELLO THIS IS THE OPERATOR HOW CAN I HELP Q GA\\n" },
+	{ "Hold", "PLEASE HOLD A MOMENT GA\\n" },
+	{ "Repeat", "PLEASE REPEAT THAT GA\\n" },
+	{ "Goodbye", "THANK YOU FOR CALLING BYE SK SK\\n" },
+};
+
+int macros_load(const char *file, struct macro *macros)
+{
+	FILE *fp;
+	char line[256], *eq, *end;
+	int num_macros = 0;
+
+	if (!file) {
+		memcpy(macros, default_macros, sizeof(default_macros));
+		return sizeof(default_macros) / sizeof(default_macros[0]);
+	}
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	while (num_macros < MAX_MACROS && fgets(line, sizeof(line), fp)) {
+		end = line + strcspn(line, "\r\n");
+		*end = '\0';
+		eq = strchr(line, '=');
+		if (!eq || line[0] == '#' || line[0] == ';') {
+			continue;
+		}
+		*eq++ = '\0';
+		/* Tabs would break the web console's list */
+		if (strchr(line, '\t') || strchr(eq, '\t')) {
+			continue;
+		}
+		/* Too long is truncated */
+		snprintf(macros[num_macros].label, sizeof(macros[num_macros].label), "%.*s", (int) sizeof(macros[num_macros].label) - 1, line);
+		snprintf(macros[num_macros].text, sizeof(macros[num_macros].text), "%.*s", (int) sizeof(macros[num_macros].text) - 1, eq);
+		num_macros++;
+	}
+	fclose(fp);
+	if (!num_macros) {
+		fprintf(stderr, "No macros in %s (expected label=text lines)\n", file);
+		return -1;
+	}
+	return num_macros;
+}
@@ -0,0 +1,42 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Macro library: canned operator phrases (greeting, GA, SK, etc.)
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*! \brief Max macros */
+#define MAX_MACROS 32
+
+struct macro {
+	char label[32];
+	char text[128];				/*!< With newlines as \n, as in the file */
+};
+
+/*!
+ * \brief Load macros
+ * \param file File of macros (label=text, one per line, \n for a newline), or NULL for the defaults
+ * \param macros At least MAX_MACROS
+ * \return Number of macros, or -1 on failure
+ */
+int macros_load(const char *file, struct macro *macros);
@@ -0,0 +1,500 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief AsTTYSpy: Virtual TDD/TTY for Asterisk (program entry and options)
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "asttyspy.h"
+#include "session.h"
+#include "chanmeta.h"
+#include "record.h"
+#include "rtt.h"
+#include "relay.h"
+#include "sipmsg.h"
+#include "campaign.h"
+#include "broadcast.h"
+#include "viewer.h"
+#include "webconsole.h"
+#include "macro.h"
+#include "complete.h"
+#include "trace.h"
+#include "stall.h"
+
+/*! \brief Send text from a gateway (RTT or messages) to the TTY, if we're on a channel */
+static int gateway_to_channel(const char *text, void *data)
+{
+	struct ami_session *ami = data;
+
+	if (tty_active < 2) {
+		return -1;
+	}
+	return send_msg(ami, text);
+}
+
+static void campaign_signal(int num)
+{
+	(void) num;
+	campaign_stop();
+}
+
+/*! \brief Read destinations, one per line, skipping blank lines and comments (#) */
+static char **read_dests(const char *file, int *count)
+{
+	FILE *fp = fopen(file, "r");
+	char line[256], *s, **dests = NULL, **tmp;
+	int n = 0;
+
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s\n", file);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		s = line + strspn(line, " \t");
+		s[strcspn(s, " \t\r\n#")] = '\0';
+		if (!*s) {
+			continue;
+		}
+		tmp = realloc(dests, (size_t) (n + 1) * sizeof(*dests));
+		if (!tmp) {
+			break;
+		}
+		dests = tmp;
+		dests[n] = strdup(s);
+		if (!dests[n]) {
+			break;
+		}
+		n++;
+	}
+	fclose(fp);
+	if (!n) {
+		fprintf(stderr, "No destinations in %s\n", file);
+		free(dests);
+		return NULL;
+	}
+	*count = n;
+	return dests;
+}
+
+/*! \brief Run a notification campaign. Disconnects and destroys the AMI session. */
+static int run_campaign(struct ami_session *ami, const char *file, const char *notice, const struct campaign_options *opts)
+{
+	struct campaign_stats stats;
+	char **dests;
+	int i, count = 0, res;
+
+	dests = read_dests(file, &count);
+	if (!dests) {
+		ami_disconnect(ami);
+		ami_destroy(ami);
+		return -1;
+	}
+	signal(SIGINT, campaign_signal);
+	signal(SIGTERM, campaign_signal);
+
+	fprintf(stderr, "Calling %d destination%s, %d at a time, press ^C to stop\n", count, count == 1 ? "" : "s", opts->concurrency);
+	res = campaign_run(ami, dests, count, notice, opts, &stats);
+	if (!res) {
+		campaign_report(stdout, &stats);
+	}
+
+	recorder_stop();
+	ami_disconnect(ami);
+	sessions_destroy(); /* Not until no more events can come in for them */
+	chanmeta_destroy();
+	ami_destroy(ami);
+	for (i = 0; i < count; i++) {
+		free(dests[i]);
+	}
+	free(dests);
+	return res;
+}
+
+/*!
+ * \brief Parse [addr:]port, for listening on loopback unless an address is given
+ * \param spec
+ * \param[out] addr
+ * \param len Size of addr
+ * \return Port
+ */
+static int parse_listen(const char *spec, char *addr, size_t len)
+{
+	const char *port = strrchr(spec, ':');
+
+	snprintf(addr, len, "127.0.0.1");
+	if (port) {
+		/* IPv6 addresses are in brackets, e.g. [::]:5039 */
+		if (*spec == '[' && port > spec && *(port - 1) == ']') {
+			snprintf(addr, len, "%.*s", (int) (port - spec - 2), spec + 1);
+		} else {
+			snprintf(addr, len, "%.*s", (int) (port - spec), spec);
+		}
+		port++;
+	} else {
+		port = spec;
+	}
+	return atoi(port);
+}
+
+/*! \brief What else was going on, for a stall report */
+static void stall_context(FILE *fp)
+{
+	struct session_cost *costs;
+	struct viewer_stats vstats;
+	int i, n = session_costs(&costs);
+
+	if (n >= 0) {
+		fprintf(fp, "Sessions: %d\n", n);
+		for (i = 0; i < n; i++) {
+			fprintf(fp, "  %-40s %8lu events, %8.3f ms CPU, %6lu bytes of transcript queued, %d viewers\n", costs[i].channel, costs[i].events,
+				(double) costs[i].cpu_ns / 1e6, (unsigned long) costs[i].queued, costs[i].viewers);
+		}
+		free(costs);
+	}
+	viewer_get_stats(&vstats);
+	if (vstats.streams || vstats.viewers) {
+		fprintf(fp, "Viewers: %lu, streams: %lu, %llu bytes queued and %llu sent so far, %lu resyncs\n", vstats.viewers, vstats.streams,
+			(unsigned long long) vstats.bytes_queued, (unsigned long long) vstats.bytes_sent, vstats.resyncs);
+	}
+}
+
+/*! \brief Serve remote viewers on [addr:]port */
+static int start_viewers(const char *spec)
+{
+	char addr[64];
+	int port = parse_listen(spec, addr, sizeof(addr));
+
+	if (viewer_start(addr, port) < 0) {
+		return -1;
+	}
+	atexit(viewer_stop); /* The program exits from several places */
+	return 0;
+}
+
+/*! \brief Learn phrases for completion from the macros and past transcripts */
+static int start_completion(const char *macro_file, const char *record_dir)
+{
+	struct macro macros[MAX_MACROS];
+	struct completer_stats stats;
+	int num_macros, transcripts = 0;
+
+	num_macros = macros_load(macro_file, macros);
+	if (num_macros < 0) {
+		return -1;
+	}
+	completer = completer_create();
+	if (!completer) {
+		return -1;
+	}
+	completer_learn_macros(completer, macros, num_macros);
+	if (record_dir) {
+		transcripts = completer_learn_transcripts(completer, record_dir);
+	}
+	completer_get_stats(completer, &stats);
+	fprintf(stderr, "Completion: %lu phrases and %lu words, from %d macros and %d transcripts\n",
+		(unsigned long) stats.phrases, (unsigned long) stats.words, num_macros, transcripts > 0 ? transcripts : 0);
+	return 0;
+}
+
+static void show_help(void)
+{
+	printf("AsTTYSpy for Asterisk\n");
+	printf(" -a           Record all channels (requires -R)\n");
+	printf(" -b <policy>  RX buffering for channels that are only being recorded: line (default) or char\n");
+	printf(" -c <channel> Target channel with which to converse using this virtual TTY. If not provided, will prompt for selection.\n");
+	printf(" -d <file>    Dial: send a notice (-n) to each destination in this file (one dial string per line, e.g. PJSIP/5551234@trunk), then exit\n");
+	printf(" -G <port>    Local UDP port for the RTT gateway. Default is the same as the peer's.\n");
+	printf(" -g <peer>    Gateway the target channel to an RTT (T.140, RFC 4103) peer, host:port\n");
+	printf(" -H           Headless: record transcripts without a user interface, until interrupted (requires -R)\n");
+	printf(" -h           Show this help\n");
+	printf(" -j <calls>   Max concurrent calls for -d. Default is 4.\n");
+	printf(" -K <file>    Macros for the web console and completion, one label=text per line (\\n for a newline)\n");
+	printf(" -L <rate>    Max TddTx actions per second when broadcasting (ESC+5), 0 for no limit. Default is %d.\n", BROADCAST_RATE);
+	printf(" -l           Asterisk AMI hostname. Default is localhost (127.0.0.1)\n");
+	printf(" -M <from>    From address for messages sent by the message gateway. Default is Asterisk's.\n");
+	printf(" -m <to>      Gateway the target channel to a SIP MESSAGE endpoint, with MessageSend (e.g. pjsip:alice)\n");
+	printf(" -n <text>    Notice to send for -d\n");
+	printf(" -p           Asterisk AMI password. By default, this will be autodetected for local connections if possible.\n");
+	printf(" -R <dir>     Record transcripts of TTY conversations to this directory\n");
+	printf(" -r           Always refresh channel list during selection\n"); /* (rather than purely event driven) */
+	printf(" -S <ms>      Whenever an event or action takes this long, write the timing of recent ones to a file (in -R's directory, or this one). Default is %d, 0 to disable.\n", STALL_DEFAULT_MS);
+	printf(" -T <secs>    How long to wait for SK after sending the notice, for -d. Default is 30.\n");
+	printf(" -t <file>    Write a Chrome trace-event JSON file of hot-path spans (open in chrome://tracing or ui.perfetto.dev)\n");
+	printf(" -u           Asterisk AMI username.\n");
+	printf(" -v <port>    Serve sessions to remote viewers (tools/ttyview) on this TCP port. Listens on 127.0.0.1 unless an address is given, e.g. 0.0.0.0:5039\n");
+	printf(" -W <port>    Web console: serve the virtual TTY to agents' browsers on this TCP port, without a user interface here.\n");
+	printf("              Listens on 127.0.0.1 unless an address is given, e.g. 0.0.0.0:8080. There is no authentication.\n");
+	printf(" -w <ms>      Min time between originating calls for -d. Default is 1000.\n");
+	printf(" -x <channel> Relay: bridge TTY text between the target channel (-c) and this channel, without a user interface\n");
+	printf("(C) 2022 Naveen Albert\n");
+}
+
+int main(int argc,char *argv[])
+{
+	char c;
+	static const char *getopt_settings = "?ab:c:d:G:g:Hhj:K:L:l:M:m:n:p:R:rS:T:t:u:v:W:w:x:";
+	char ami_host[92] = "127.0.0.1"; /* Default to localhost */
+	char ami_username[64] = "";
+	char ami_password[64] = "";
+	const char *trace_file = NULL, *record_dir = NULL, *rtt_peer = NULL, *relay_chan = NULL, *msg_to = NULL, *msg_from = NULL, *dial_file = NULL, *notice = NULL, *viewer_spec = NULL, *console_spec = NULL, *macro_file = NULL;
+	int record_all = 0, headless = 0, policy, rtt_port = -1, stall_ms = STALL_DEFAULT_MS;
+	struct ami_session *ami;
+	struct campaign_options campaign;
+
+	campaign_defaults(&campaign);
+
+	while ((c = getopt(argc, argv, getopt_settings)) != -1) {
+		switch (c) {
+		case 'a':
+			record_all = 1;
+			break;
+		case 'b':
+			policy = rx_policy_parse(optarg);
+			if (policy < 0) {
+				fprintf(stderr, "Invalid RX policy: %s\n", optarg);
+				return -1;
+			}
+			record_rx_policy = (enum rx_policy) policy;
+			break;
+		case 'c':
+			strncpy(ttychan, optarg, sizeof(ttychan));
+			break;
+		case 'd':
+			dial_file = optarg;
+			break;
+		case 'G':
+			rtt_port = atoi(optarg);
+			break;
+		case 'g':
+			rtt_peer = optarg;
+			break;
+		case 'H':
+			headless = 1;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'j':
+			campaign.concurrency = atoi(optarg);
+			break;
+		case 'K':
+			macro_file = optarg;
+			break;
+		case 'L':
+			broadcast_rate = atof(optarg);
+			break;
+		case 'l':
+			strncpy(ami_host, optarg, sizeof(ami_host));
+			break;
+		case 'M':
+			msg_from = optarg;
+			break;
+		case 'm':
+			msg_to = optarg;
+			break;
+		case 'n':
+			notice = optarg;
+			break;
+		case 'p':
+			strncpy(ami_password, optarg, sizeof(ami_password));
+			break;
+		case 'R':
+			record_dir = optarg;
+			break;
+		case 'r':
+			always_refresh = 1;
+			break;
+		case 'S':
+			stall_ms = atoi(optarg);
+			break;
+		case 'T':
+			campaign.timeout_ms = atoi(optarg) * 1000;
+			break;
+		case 't':
+			trace_file = optarg;
+			break;
+		case 'u':
+			strncpy(ami_username, optarg, sizeof(ami_username));
+			break;
+		case 'v':
+			viewer_spec = optarg;
+			break;
+		case 'W':
+			console_spec = optarg;
+			break;
+		case 'w':
+			campaign.interval_ms = atoi(optarg);
+			break;
+		case 'x':
+			relay_chan = optarg;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (ami_username[0] && !ami_password[0] && !strcmp(ami_host, "127.0.0.1")) {
+		/* If we're running as a privileged user with access to manager.conf, grab the password ourselves, which is more
+		 * secure than getting as a command line arg from the user (and kind of convenient)
+		 * Not that running as a user with access to the Asterisk config is great either, but, hey...
+		 */
+		if (ami_auto_detect_ami_pass(ami_username, ami_password, sizeof(ami_password))) {
+			fprintf(stderr, "No password specified, and failed to autodetect from /etc/asterisk/manager.conf\n");
+			return -1;
+		}
+	}
+
+	if (!ami_username[0]) {
+		fprintf(stderr, "No username provided (use -u flag)\n");
+		return -1;
+	}
+
+	if ((record_all || headless) && !record_dir) {
+		fprintf(stderr, "-a and -H require a transcript directory (use -R flag)\n");
+		return -1;
+	} else if (headless && !record_all && !ttychan[0]) {
+		fprintf(stderr, "Nothing to record (use -a or -c flag)\n");
+		return -1;
+	}
+
+	if (rtt_peer) {
+		if (headless) {
+			fprintf(stderr, "The RTT gateway needs per-character RX, so it can't be used headless\n");
+			return -1;
+		} else if (rtt_port < 0) {
+			const char *port = strrchr(rtt_peer, ':');
+			rtt_port = port ? atoi(port + 1) : -1;
+		}
+	}
+
+	if (dial_file) {
+		if (!notice || !*notice) {
+			fprintf(stderr, "Nothing to send (use -n flag)\n");
+			return -1;
+		} else if (campaign.concurrency < 1 || campaign.interval_ms < 0 || campaign.timeout_ms < 0) {
+			fprintf(stderr, "Invalid concurrency, pacing, or timeout\n");
+			return -1;
+		} else if (ttychan[0] || headless || rtt_peer || msg_to || relay_chan) {
+			fprintf(stderr, "Dialing can't be combined with -c, -H, -g, -m, or -x\n");
+			return -1;
+		}
+	}
+	if (msg_to && headless) {
+		fprintf(stderr, "The message gateway needs per-character RX, so it can't be used headless\n");
+		return -1;
+	}
+	if (relay_chan) {
+		if (!ttychan[0]) {
+			fprintf(stderr, "Relay requires a target channel (use -c flag)\n");
+			return -1;
+		} else if (headless || rtt_peer || msg_to) {
+			fprintf(stderr, "Relay can't be combined with -H, -g, or -m\n");
+			return -1;
+		}
+	}
+
+	if (console_spec && (dial_file || headless || rtt_peer || msg_to || relay_chan || ttychan[0])) {
+		fprintf(stderr, "The web console can't be combined with -c, -d, -g, -H, -m, or -x\n");
+		return -1;
+	}
+
+	if (trace_file && trace_start(trace_file)) {
+		return -1;
+	}
+	if (stall_ms > 0) {
+		stall_set_context(stall_context);
+		if (stall_start(record_dir ? record_dir : ".", (unsigned int) stall_ms)) {
+			return -1;
+		}
+	}
+
+	ami = ami_connect(ami_host, 0, ami_callback, simple_disconnect_callback);
+	if (!ami) {
+		return -1;
+	}
+	if (ami_action_login(ami, ami_username, ami_password)) {
+		fprintf(stderr, "Failed to log in with username %s\n", ami_username);
+		return -1;
+	}
+
+	if (viewer_spec && start_viewers(viewer_spec)) {
+		return -1;
+	}
+	if (record_dir && recorder_start(ami, record_dir, record_all)) {
+		return -1;
+	}
+	if (rtt_peer) {
+		rtt_gateway = rtt_gateway_start(rtt_peer, rtt_port, gateway_to_channel, ami);
+		if (!rtt_gateway) {
+			return -1;
+		}
+	}
+	if (msg_to) {
+		msg_gateway = msg_gateway_start(ami, msg_to, msg_from, gateway_to_channel, ami);
+		if (!msg_gateway) {
+			return -1;
+		}
+	}
+	if (console_spec) {
+		char addr[64];
+		int port = parse_listen(console_spec, addr, sizeof(addr));
+		port = webconsole_start(ami, addr, port, macro_file);
+		if (port < 0) {
+			return -1;
+		}
+		fprintf(stderr, "Web console listening on %s port %d\n", addr, port);
+		return webconsole_run(ami) ? -1 : 0;
+	}
+	if (dial_file) {
+		return run_campaign(ami, dial_file, notice, &campaign) ? -1 : 0;
+	}
+	if (relay_chan) {
+		recorder_add(ttychan); /* If recording */
+		recorder_add(relay_chan);
+		if (relay_start(ami, ttychan, relay_chan)) {
+			return -1;
+		}
+		return relay_run(ami) ? -1 : 0;
+	}
+	if (headless) {
+		if (ttychan[0]) {
+			recorder_add(ttychan);
+		}
+		return recorder_headless(ami) ? -1 : 0;
+	}
+	if (start_completion(macro_file, record_dir)) {
+		return -1;
+	}
+	return ttyspy(ami) ? -1 : 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief USDT static probes
+ *
+ * Probes are compiled in if sys/sdt.h (systemtap-sdt-dev) is available at build time.
+ * A probe that nothing is attached to is a single nop, and its arguments are
+ * only evaluated into registers, so keep arguments cheap (no function calls).
+ *
+ * The provider name is "asttyspy", e.g. usdt:./asttyspy:asttyspy:tx__submit
+ * See the scripts directory for example bpftrace scripts.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define ASTTYSPY_PROBE1(name, a) DTRACE_PROBE1(asttyspy, name, a)
+#define ASTTYSPY_PROBE2(name, a, b) DTRACE_PROBE2(asttyspy, name, a, b)
+#define ASTTYSPY_PROBE3(name, a, b, c) DTRACE_PROBE3(asttyspy, name, a, b, c)
+#else
+#define ASTTYSPY_PROBE1(name, a)
+#define ASTTYSPY_PROBE2(name, a, b)
+#define ASTTYSPY_PROBE3(name, a, b, c)
+#endif
@@ -0,0 +1,64 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Rate limiter
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include "ratelimit.h"
+#include "vclock.h"
+
+void ratelimit_init(struct rate_limiter *rl, double rate, int burst)
+{
+	pthread_mutex_init(&rl->lock, NULL);
+	rl->interval_us = rate > 0 ? (uint64_t) (1000000.0 / rate) : 0;
+	rl->burst_us = burst > 1 ? (uint64_t) (burst - 1) * rl->interval_us : 0;
+	rl->tat_us = 0;
+}
+
+void ratelimit_wait(struct rate_limiter *rl)
+{
+	uint64_t now, at;
+
+	if (!rl->interval_us) {
+		return;
+	}
+
+	pthread_mutex_lock(&rl->lock);
+	now = vclock_now_us();
+	if (rl->tat_us < now) {
+		rl->tat_us = now;
+	}
+	at = rl->tat_us > now + rl->burst_us ? rl->tat_us - rl->burst_us : now;
+	rl->tat_us += rl->interval_us;
+	pthread_mutex_unlock(&rl->lock);
+
+	if (at > now) {
+		vclock_sleep_until_us(at);
+	}
+}
+
+void ratelimit_destroy(struct rate_limiter *rl)
+{
+	pthread_mutex_destroy(&rl->lock);
+}
@@ -0,0 +1,53 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Rate limiter, for actions that are issued in bulk
+ *
+ * This is a token bucket, implemented as GCRA: each caller reserves the next
+ * slot under the lock, then sleeps until it without holding the lock, so many
+ * threads can share one limiter and their actions are still evenly spaced.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+struct rate_limiter {
+	pthread_mutex_t lock;
+	uint64_t interval_us;	/*!< Time between actions at the steady rate, 0 for no limit */
+	uint64_t burst_us;		/*!< How far ahead of the steady rate a burst can get */
+	uint64_t tat_us;		/*!< Theoretical arrival time of the next action */
+};
+
+/*!
+ * \brief Initialize a rate limiter
+ * \param rl
+ * \param rate Actions per second, or 0 for no limit
+ * \param burst Actions that can be issued at once, before the rate applies
+ */
+void ratelimit_init(struct rate_limiter *rl, double rate, int burst);
+
+/*! \brief Wait until another action is allowed */
+void ratelimit_wait(struct rate_limiter *rl);
+
+void ratelimit_destroy(struct rate_limiter *rl);
@@ -0,0 +1,199 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Transcript recorder
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "record.h"
+#include "session.h"
+#include "chanmeta.h"
+
+struct record_request {
+	struct record_request *next;
+	char channel[];
+};
+
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t record_cond = PTHREAD_COND_INITIALIZER;
+static struct record_request *queue_head = NULL, *queue_tail = NULL;
+static pthread_t record_thread;
+static int recording = 0, record_all = 0, record_stop = 0;
+static const char *record_dir;
+static volatile sig_atomic_t headless_stop = 0;
+
+void recorder_add(const char *channel)
+{
+	struct record_request *req;
+
+	if (!*channel) {
+		return; /* e.g. no -c */
+	}
+	pthread_mutex_lock(&record_lock);
+	if (!recording) {
+		pthread_mutex_unlock(&record_lock);
+		return;
+	}
+	req = malloc(sizeof(*req) + strlen(channel) + 1);
+	if (req) {
+		strcpy(req->channel, channel); /* Safe */
+		req->next = NULL;
+		if (queue_tail) {
+			queue_tail->next = req;
+		} else {
+			queue_head = req;
+		}
+		queue_tail = req;
+		pthread_cond_signal(&record_cond);
+	}
+	pthread_mutex_unlock(&record_lock);
+}
+
+void recorder_channel_created(const char *channel)
+{
+	if (record_all) {
+		recorder_add(channel);
+	}
+}
+
+static void queue_existing(struct ami_session *ami)
+{
+	struct ami_response *resp;
+	int i;
+
+	resp = ami_action_show_channels(ami);
+	if (!resp) {
+		fprintf(stderr, "Failed to get channel list\n");
+		return;
+	}
+	/* First and last events are the response itself and the list completion */
+	for (i = 1; i < resp->size - 1; i++) {
+		chanmeta_event(resp->events[i], "CoreShowChannel"); /* Before it's recorded, for the transcript header */
+		recorder_add(ami_keyvalue(resp->events[i], "Channel"));
+	}
+	ami_resp_free(resp);
+}
+
+static void *recorder(void *varg)
+{
+	struct ami_session *ami = varg;
+	struct record_request *req;
+
+	if (record_all) {
+		queue_existing(ami);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&record_lock);
+		while (!queue_head && !record_stop) {
+			pthread_cond_wait(&record_cond, &record_lock);
+		}
+		if (record_stop) {
+			pthread_mutex_unlock(&record_lock);
+			break;
+		}
+		req = queue_head;
+		queue_head = req->next;
+		if (!queue_head) {
+			queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&record_lock);
+
+		session_record(ami, req->channel, record_dir);
+		free(req);
+	}
+	return NULL;
+}
+
+int recorder_start(struct ami_session *ami, const char *dir, int all)
+{
+	record_dir = dir;
+	record_all = all;
+	record_stop = 0;
+	recording = 1;
+	if (pthread_create(&record_thread, NULL, recorder, ami)) {
+		fprintf(stderr, "Failed to start recorder thread\n");
+		recording = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void recorder_stop(void)
+{
+	struct record_request *req;
+
+	pthread_mutex_lock(&record_lock);
+	if (!recording) {
+		pthread_mutex_unlock(&record_lock);
+		return;
+	}
+	record_stop = 1;
+	recording = 0;
+	pthread_cond_signal(&record_cond);
+	pthread_mutex_unlock(&record_lock);
+
+	pthread_join(record_thread, NULL);
+	while ((req = queue_head)) {
+		queue_head = req->next;
+		free(req);
+	}
+	queue_tail = NULL;
+	record_all = 0;
+}
+
+static void headless_signal(int num)
+{
+	(void) num;
+	headless_stop = 1;
+}
+
+int recorder_headless(struct ami_session *ami)
+{
+	signal(SIGINT, headless_signal);
+	signal(SIGTERM, headless_signal);
+
+	fprintf(stderr, "Recording TTY transcripts, press ^C to stop\n");
+	while (!headless_stop) {
+		pause();
+	}
+	fprintf(stderr, "\nAsTTYSpy exiting...\n");
+
+	recorder_stop();
+	ami_disconnect(ami);
+	sessions_destroy(); /* Not until no more events can come in for them */
+	chanmeta_destroy();
+	sessions_report(stderr);
+	ami_destroy(ami);
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Transcript recorder
+ *
+ * Channels to record are queued and TTY is enabled on them from the recorder thread,
+ * since actions must not be issued from the AMI event callback.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Start the recorder
+ * \param ami
+ * \param dir Directory for transcripts
+ * \param all Record every channel, including any created later, not just ones added explicitly
+ * \retval 0 on success, -1 on failure
+ */
+int recorder_start(struct ami_session *ami, const char *dir, int all);
+
+/*! \brief Record a channel. Safe to call from the AMI event callback. Does nothing if the recorder isn't running, or the name is empty. */
+void recorder_add(const char *channel);
+
+/*! \brief A channel was created. Records it if recording all channels. */
+void recorder_channel_created(const char *channel);
+
+/*! \brief Stop the recorder. Transcripts are finished by sessions_destroy(), once the AMI session is disconnected. */
+void recorder_stop(void);
+
+/*! \brief Record without a user interface, until SIGINT or SIGTERM. Disconnects and destroys the AMI session. */
+int recorder_headless(struct ami_session *ami);
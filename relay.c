@@ -0,0 +1,205 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Two-leg relay
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "asttyspy.h"
+#include "relay.h"
+#include "session.h"
+#include "chanmeta.h"
+#include "record.h"
+#include "txqueue.h"
+
+struct relay_leg {
+	struct ami_session *ami;
+	char channel[256];
+	struct tx_queue *txq;		/*!< Text to send on this leg */
+	unsigned long rx_chars;		/*!< Characters received on this leg */
+};
+
+static pthread_mutex_t relay_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct relay_leg legs[2];
+static int relaying = 0;
+static int last_rx = -1;		/*!< Leg that last received text, for display */
+static sem_t relay_done;
+
+/*! \brief TX queue callback. Runs on the queue's thread, so it can issue actions. */
+static int relay_send(const char *text, void *data)
+{
+	struct relay_leg *leg = data;
+
+	return tdd_tx(leg->ami, leg->channel, text);
+}
+
+int relay_start(struct ami_session *ami, const char *chan_a, const char *chan_b)
+{
+	int i;
+
+	if (!strcmp(chan_a, chan_b)) {
+		fprintf(stderr, "Can't relay a channel to itself\n");
+		return -1;
+	}
+	snprintf(legs[0].channel, sizeof(legs[0].channel), "%s", chan_a);
+	snprintf(legs[1].channel, sizeof(legs[1].channel), "%s", chan_b);
+	sem_init(&relay_done, 0, 0);
+
+	/* Per-character RX on both legs, or text would only be relayed a line at a time */
+	for (i = 0; i < 2; i++) {
+		legs[i].ami = ami;
+		legs[i].rx_chars = 0;
+		if (session_observe(ami, legs[i].channel)) {
+			fprintf(stderr, "Failed to enable TTY on %s\n", legs[i].channel);
+			goto cleanup;
+		}
+		legs[i].txq = tx_queue_create(relay_send, &legs[i]);
+		if (!legs[i].txq) {
+			session_unobserve(ami, legs[i].channel);
+			goto cleanup;
+		}
+	}
+
+	pthread_mutex_lock(&relay_lock);
+	relaying = 1;
+	last_rx = -1;
+	pthread_mutex_unlock(&relay_lock);
+	return 0;
+
+cleanup:
+	while (--i >= 0) {
+		tx_queue_destroy(legs[i].txq);
+		session_unobserve(ami, legs[i].channel);
+	}
+	sem_destroy(&relay_done);
+	return -1;
+}
+
+int relay_rx(const char *channel, const char *msg)
+{
+	char *text;
+	size_t len;
+	int i;
+
+	pthread_mutex_lock(&relay_lock);
+	if (!relaying) {
+		pthread_mutex_unlock(&relay_lock);
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		if (!strcmp(legs[i].channel, channel)) {
+			break;
+		}
+	}
+	if (i == 2) {
+		pthread_mutex_unlock(&relay_lock);
+		return -1;
+	}
+
+	text = strdup(msg);
+	if (text) {
+		len = tty_unescape(text);
+		tx_queue_add(legs[!i].txq, text, len); /* Doesn't block */
+		legs[i].rx_chars += len;
+		if (last_rx != i) {
+			printf("\n%s: ", channel); /* The other leg started typing */
+			last_rx = i;
+		}
+		printf("%s", text);
+		fflush(stdout);
+		free(text);
+	}
+	pthread_mutex_unlock(&relay_lock);
+	return 0;
+}
+
+void relay_hangup(const char *channel)
+{
+	pthread_mutex_lock(&relay_lock);
+	if (relaying && (!strcmp(legs[0].channel, channel) || !strcmp(legs[1].channel, channel))) {
+		fprintf(stderr, "\n%s hung up\n", channel);
+		sem_post(&relay_done);
+	}
+	pthread_mutex_unlock(&relay_lock);
+}
+
+static void relay_signal(int num)
+{
+	(void) num;
+	sem_post(&relay_done); /* Async-signal-safe */
+}
+
+static void relay_stats(const struct relay_leg *from, const struct relay_leg *to)
+{
+	struct tx_queue_stats stats;
+
+	tx_queue_stats(to->txq, &stats);
+	fprintf(stderr, "%s -> %s: %lu received, %lu sent in %lu batches (%lu failed, %lu overflowed, %lu erased, %lu unsent), latency avg %.0f ms, max %lu ms\n",
+		from->channel, to->channel, from->rx_chars, stats.chars, stats.batches,
+		stats.failed, stats.overflow, stats.erased, (unsigned long) stats.queued,
+		stats.latency_avg_ms, stats.latency_max_ms);
+}
+
+int relay_run(struct ami_session *ami)
+{
+	int i;
+
+	signal(SIGINT, relay_signal);
+	signal(SIGTERM, relay_signal);
+
+	fprintf(stderr, "Relaying between %s and %s, press ^C to stop\n", legs[0].channel, legs[1].channel);
+	while (sem_wait(&relay_done) && errno == EINTR);
+	fprintf(stderr, "\nAsTTYSpy exiting...\n");
+
+	/* No more text will be added once this is cleared, so the queues can be destroyed without the lock */
+	pthread_mutex_lock(&relay_lock);
+	relaying = 0;
+	pthread_mutex_unlock(&relay_lock);
+
+	relay_stats(&legs[0], &legs[1]);
+	relay_stats(&legs[1], &legs[0]);
+	for (i = 0; i < 2; i++) {
+		tx_queue_destroy(legs[i].txq);
+		session_unobserve(ami, legs[i].channel);
+	}
+	sem_destroy(&relay_done);
+
+	recorder_stop();
+	ami_disconnect(ami);
+	sessions_destroy(); /* Not until no more events can come in for them */
+	chanmeta_destroy();
+	sessions_report(stderr);
+	ami_destroy(ami);
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Two-leg relay: bridge TTY text between two channels
+ *
+ * Text received on either channel (leg) is sent on the other. Each leg has
+ * a TX queue, so text is sent in batches as fast as that leg's TTY can send it,
+ * and latency is measured per character, from the TddRxMsg event on one leg
+ * to when the other leg should have finished sending it.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*!
+ * \brief Start relaying between two channels, enabling TTY on both
+ * \retval 0 on success, -1 on failure
+ */
+int relay_start(struct ami_session *ami, const char *chan_a, const char *chan_b);
+
+/*!
+ * \brief Handle received text. Safe to call from the AMI event callback.
+ * \param channel
+ * \param msg Message from the TddRxMsg event
+ * \retval 0 if the channel is a relay leg, -1 if not
+ */
+int relay_rx(const char *channel, const char *msg);
+
+/*! \brief A channel hung up. If it is a relay leg, the relay ends. */
+void relay_hangup(const char *channel);
+
+/*! \brief Relay until interrupted or either leg hangs up, then print statistics. Disconnects and destroys the AMI session. */
+int relay_run(struct ami_session *ami);
@@ -0,0 +1,480 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief RTP ingest for the local Baudot decoder
+ *
+ * Packets are read from the socket in batches with recvmmsg, so a single
+ * system call serves many streams. Each stream has a small reorder buffer,
+ * indexed by sequence number: packets are decoded in order as soon as
+ * they can be, and a missing packet is given up on once a few packets
+ * after it have arrived, so a lost packet only delays decoding by that much.
+ * A gap resets the decoder, so a partial character isn't spliced together.
+ *
+ * A receiver is not thread safe: it is meant to be used from a single thread,
+ * and scales with streams, not threads.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define _GNU_SOURCE /* recvmmsg */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "baudot.h"
+#include "codec.h"
+#include "rtp.h"
+
+#define RTP_HEADER_LEN 12
+#define RTP_PACKET_SIZE 1500
+#define RTP_BATCH 32
+#define RTP_BUCKETS 1024
+#define RTP_MAX_STREAMS 4096		/* Bound memory use, since anyone can make up SSRCs */
+#define RTP_REORDER_SLOTS 8			/* Power of 2 */
+#define RTP_REORDER_DEPTH 3			/* Packets to wait for a missing one (60 ms at 20 ms per packet) */
+#define RTP_MAX_DROPOUT 500			/* Bigger jumps than this (in packets) are a restarted stream, not loss */
+#define RTP_MAX_MISORDER 100
+#define RTP_STREAM_TIMEOUT_NS 30000000000ULL
+#define RTP_SWEEP_INTERVAL_NS 1000000000ULL
+#define RTP_NS_PER_TS (1000000000ULL / BAUDOT_SAMPLE_RATE)
+#define RTP_RCVBUF (4 * 1024 * 1024)
+
+struct rtp_slot {
+	int used;
+	uint16_t seq;
+	uint16_t len;
+	unsigned char payload[RTP_MAX_PAYLOAD];
+};
+
+struct rtp_stream {
+	struct rtp_stream *next;
+	uint32_t ssrc;
+	int payload_type;
+	enum codec codec;
+	uint16_t next_seq;			/*!< Next sequence number to decode */
+	int buffered;				/*!< Packets in the reorder buffer */
+	uint64_t last_arrival_ns;
+	int32_t last_transit;
+	int have_transit;
+	double jitter;				/*!< In timestamp units */
+	unsigned long received;
+	unsigned long lost;
+	unsigned long late;
+	unsigned long duplicate;
+	unsigned long chars;
+	struct baudot_rx rx;
+	struct rtp_slot slots[RTP_REORDER_SLOTS];
+};
+
+struct rtp_receiver {
+	int fd;
+	rtp_text_cb cb;
+	void *data;
+	struct rtp_stream *buckets[RTP_BUCKETS];
+	int num_streams;
+	unsigned long invalid;
+	uint64_t last_sweep_ns;
+	struct mmsghdr msgs[RTP_BATCH];
+	struct iovec iovs[RTP_BATCH];
+	unsigned char bufs[RTP_BATCH][RTP_PACKET_SIZE];
+};
+
+int rtp_bind(const char *addr, int port)
+{
+	struct addrinfo hints, *res, *ai;
+	char portstr[8];
+	int fd = -1, rcvbuf = RTP_RCVBUF;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	snprintf(portstr, sizeof(portstr), "%d", port);
+	if (getaddrinfo(addr, portstr, &hints, &res)) {
+		fprintf(stderr, "Invalid address: %s\n", addr ? addr : "(any)");
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		/* Lots of streams can burst a lot of packets at once */
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		if (!bind(fd, ai->ai_addr, ai->ai_addrlen)) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to bind to port %d: %s\n", port, strerror(errno));
+	}
+	return fd;
+}
+
+struct rtp_receiver *rtp_receiver_create(int fd, rtp_text_cb cb, void *data)
+{
+	struct rtp_receiver *rcv = calloc(1, sizeof(*rcv));
+	int i;
+
+	if (!rcv) {
+		return NULL;
+	}
+	rcv->fd = fd;
+	rcv->cb = cb;
+	rcv->data = data;
+	for (i = 0; i < RTP_BATCH; i++) {
+		rcv->iovs[i].iov_base = rcv->bufs[i];
+		rcv->iovs[i].iov_len = RTP_PACKET_SIZE;
+		rcv->msgs[i].msg_hdr.msg_iov = &rcv->iovs[i];
+		rcv->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return rcv;
+}
+
+static inline unsigned int ssrc_hash(uint32_t ssrc)
+{
+	return (ssrc * 2654435761u) >> 22; /* Fibonacci hashing, to 10 bits (RTP_BUCKETS) */
+}
+
+static struct rtp_stream *find_stream(struct rtp_receiver *rcv, uint32_t ssrc)
+{
+	struct rtp_stream *s;
+
+	for (s = rcv->buckets[ssrc_hash(ssrc)]; s; s = s->next) {
+		if (s->ssrc == ssrc) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+static struct rtp_stream *create_stream(struct rtp_receiver *rcv, uint32_t ssrc, uint16_t seq)
+{
+	unsigned int bucket = ssrc_hash(ssrc);
+	struct rtp_stream *s;
+
+	if (rcv->num_streams >= RTP_MAX_STREAMS) {
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		return NULL;
+	}
+	s->ssrc = ssrc;
+	s->next_seq = seq;
+	baudot_rx_init(&s->rx);
+	s->next = rcv->buckets[bucket];
+	rcv->buckets[bucket] = s;
+	rcv->num_streams++;
+	return s;
+}
+
+static void decode_payload(struct rtp_receiver *rcv, struct rtp_stream *s, const unsigned char *payload, size_t len)
+{
+	int16_t samples[RTP_MAX_PAYLOAD];
+	char text[RTP_MAX_PAYLOAD];
+	size_t chars;
+
+	codec_decode(s->codec, payload, len, samples);
+	chars = baudot_rx(&s->rx, samples, len, text, sizeof(text));
+	if (chars) {
+		s->chars += chars;
+		if (rcv->cb) {
+			rcv->cb(s->ssrc, text, chars, rcv->data);
+		}
+	}
+}
+
+/*! \brief Decode the next packet in sequence, or skip it if it's missing */
+static void playout(struct rtp_receiver *rcv, struct rtp_stream *s)
+{
+	struct rtp_slot *slot = &s->slots[s->next_seq % RTP_REORDER_SLOTS];
+
+	if (slot->used && slot->seq == s->next_seq) {
+		decode_payload(rcv, s, slot->payload, slot->len);
+		slot->used = 0;
+		s->buffered--;
+	} else {
+		s->lost++;
+		baudot_rx_reset(&s->rx); /* Gap in the audio */
+	}
+	s->next_seq++;
+}
+
+/*! \brief Start over from a new sequence number, e.g. the sender restarted */
+static void resync(struct rtp_stream *s, uint16_t seq)
+{
+	int i;
+
+	for (i = 0; i < RTP_REORDER_SLOTS; i++) {
+		s->slots[i].used = 0;
+	}
+	s->buffered = 0;
+	s->next_seq = seq;
+	baudot_rx_reset(&s->rx);
+}
+
+static void update_jitter(struct rtp_stream *s, uint32_t timestamp, uint64_t now_ns)
+{
+	int32_t transit = (int32_t) ((uint32_t) (now_ns / RTP_NS_PER_TS) - timestamp);
+
+	if (s->have_transit) {
+		int32_t d = transit - s->last_transit;
+		s->jitter += ((d < 0 ? -d : d) - s->jitter) / 16; /* RFC 3550 6.4.1 */
+	}
+	s->last_transit = transit;
+	s->have_transit = 1;
+}
+
+int rtp_parse(const unsigned char *pkt, size_t len, struct rtp_header *hdr)
+{
+	size_t start = RTP_HEADER_LEN, end = len;
+
+	if (len < RTP_HEADER_LEN || (pkt[0] >> 6) != 2) {
+		return -1;
+	}
+	start += 4 * (pkt[0] & 0x0F); /* CSRCs */
+	if (pkt[0] & 0x10) { /* Header extension */
+		if (len < start + 4) {
+			return -1;
+		}
+		start += 4 + 4 * (size_t) ((pkt[start + 2] << 8) | pkt[start + 3]);
+	}
+	if (pkt[0] & 0x20) { /* Padding */
+		if (!pkt[len - 1] || pkt[len - 1] > len) {
+			return -1;
+		}
+		end -= pkt[len - 1];
+	}
+	if (start >= end) {
+		return -1;
+	}
+	hdr->payload_type = pkt[1] & 0x7F;
+	hdr->marker = pkt[1] >> 7;
+	hdr->seq = (uint16_t) ((pkt[2] << 8) | pkt[3]);
+	hdr->timestamp = (uint32_t) pkt[4] << 24 | (uint32_t) pkt[5] << 16 | (uint32_t) pkt[6] << 8 | pkt[7];
+	hdr->ssrc = (uint32_t) pkt[8] << 24 | (uint32_t) pkt[9] << 16 | (uint32_t) pkt[10] << 8 | pkt[11];
+	hdr->payload = pkt + start;
+	hdr->len = end - start;
+	return 0;
+}
+
+size_t rtp_write_header(unsigned char *pkt, int payload_type, int marker, uint16_t seq, uint32_t timestamp, uint32_t ssrc)
+{
+	pkt[0] = 0x80;
+	pkt[1] = (unsigned char) ((marker ? 0x80 : 0) | payload_type);
+	pkt[2] = (unsigned char) (seq >> 8);
+	pkt[3] = (unsigned char) seq;
+	pkt[4] = (unsigned char) (timestamp >> 24);
+	pkt[5] = (unsigned char) (timestamp >> 16);
+	pkt[6] = (unsigned char) (timestamp >> 8);
+	pkt[7] = (unsigned char) timestamp;
+	pkt[8] = (unsigned char) (ssrc >> 24);
+	pkt[9] = (unsigned char) (ssrc >> 16);
+	pkt[10] = (unsigned char) (ssrc >> 8);
+	pkt[11] = (unsigned char) ssrc;
+	return RTP_HEADER_LEN;
+}
+
+int rtp_receiver_process(struct rtp_receiver *rcv, const unsigned char *pkt, size_t len, uint64_t now_ns)
+{
+	struct rtp_stream *s;
+	struct rtp_slot *slot;
+	struct rtp_header hdr;
+	int d;
+	enum codec codec;
+
+	if (rtp_parse(pkt, len, &hdr) || hdr.len > RTP_MAX_PAYLOAD) {
+		rcv->invalid++;
+		return -1;
+	}
+	if (hdr.payload_type == RTP_PT_PCMU) {
+		codec = CODEC_ULAW;
+	} else if (hdr.payload_type == RTP_PT_PCMA) {
+		codec = CODEC_ALAW;
+	} else {
+		rcv->invalid++;
+		return -1;
+	}
+
+	s = find_stream(rcv, hdr.ssrc);
+	if (!s) {
+		s = create_stream(rcv, hdr.ssrc, hdr.seq);
+		if (!s) {
+			rcv->invalid++;
+			return -1;
+		}
+	}
+	s->codec = codec;
+	s->payload_type = hdr.payload_type;
+	s->received++;
+	s->last_arrival_ns = now_ns;
+	update_jitter(s, hdr.timestamp, now_ns);
+
+	d = (int16_t) (hdr.seq - s->next_seq);
+	if (d < -RTP_MAX_MISORDER || d > RTP_MAX_DROPOUT) {
+		resync(s, hdr.seq);
+		d = 0;
+	} else if (d < 0) {
+		s->late++; /* Already decoded, or given up on */
+		return 0;
+	}
+	while (d >= RTP_REORDER_SLOTS) {
+		playout(rcv, s); /* Make room */
+		d--;
+	}
+
+	slot = &s->slots[hdr.seq % RTP_REORDER_SLOTS];
+	if (slot->used) {
+		s->duplicate++;
+		return 0;
+	}
+	slot->used = 1;
+	slot->seq = hdr.seq;
+	slot->len = (uint16_t) hdr.len;
+	memcpy(slot->payload, hdr.payload, hdr.len);
+	s->buffered++;
+
+	/* Decode whatever is now in order, giving up on a missing packet if enough have arrived after it */
+	while (s->buffered) {
+		slot = &s->slots[s->next_seq % RTP_REORDER_SLOTS];
+		if (!(slot->used && slot->seq == s->next_seq) && s->buffered < RTP_REORDER_DEPTH) {
+			break;
+		}
+		playout(rcv, s);
+	}
+	return 0;
+}
+
+/*! \brief Remove streams that haven't sent anything in a while */
+static void sweep_streams(struct rtp_receiver *rcv, uint64_t now_ns)
+{
+	int i;
+
+	for (i = 0; i < RTP_BUCKETS; i++) {
+		struct rtp_stream **sp = &rcv->buckets[i];
+		while (*sp) {
+			struct rtp_stream *s = *sp;
+			if (now_ns - s->last_arrival_ns > RTP_STREAM_TIMEOUT_NS) {
+				*sp = s->next;
+				free(s);
+				rcv->num_streams--;
+			} else {
+				sp = &s->next;
+			}
+		}
+	}
+	rcv->last_sweep_ns = now_ns;
+}
+
+int rtp_receiver_poll(struct rtp_receiver *rcv)
+{
+	struct timespec ts;
+	uint64_t now_ns = 0;
+	int i, n, total = 0;
+
+	for (;;) {
+		n = recvmmsg(rcv->fd, rcv->msgs, RTP_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
+		/* Packets in a batch were waiting together, so one timestamp does for all of them */
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now_ns = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+		for (i = 0; i < n; i++) {
+			rtp_receiver_process(rcv, rcv->bufs[i], rcv->msgs[i].msg_len, now_ns);
+		}
+		total += n;
+		if (n < RTP_BATCH) {
+			break; /* Drained */
+		}
+	}
+
+	if (now_ns && now_ns - rcv->last_sweep_ns > RTP_SWEEP_INTERVAL_NS) {
+		sweep_streams(rcv, now_ns);
+	}
+	return total;
+}
+
+int rtp_receiver_streams(struct rtp_receiver *rcv)
+{
+	return rcv->num_streams;
+}
+
+int rtp_receiver_stats(struct rtp_receiver *rcv, struct rtp_stream_stats *stats, int max)
+{
+	struct rtp_stream *s;
+	int i, n = 0;
+
+	for (i = 0; i < RTP_BUCKETS; i++) {
+		for (s = rcv->buckets[i]; s; s = s->next, n++) {
+			if (n >= max) {
+				continue;
+			}
+			stats[n].ssrc = s->ssrc;
+			stats[n].payload_type = s->payload_type;
+			stats[n].received = s->received;
+			stats[n].lost = s->lost;
+			stats[n].late = s->late;
+			stats[n].duplicate = s->duplicate;
+			stats[n].jitter_ms = s->jitter * 1000 / BAUDOT_SAMPLE_RATE;
+			stats[n].chars = s->chars;
+		}
+	}
+	return n;
+}
+
+unsigned long rtp_receiver_invalid(struct rtp_receiver *rcv)
+{
+	return rcv->invalid;
+}
+
+void rtp_receiver_destroy(struct rtp_receiver *rcv)
+{
+	struct rtp_stream *s;
+	int i;
+
+	for (i = 0; i < RTP_BUCKETS; i++) {
+		while ((s = rcv->buckets[i])) {
+			rcv->buckets[i] = s->next;
+			free(s);
+		}
+	}
+	if (rcv->fd >= 0) {
+		close(rcv->fd);
+	}
+	free(rcv);
+}
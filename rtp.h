@@ -0,0 +1,136 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief RTP ingest for the local Baudot decoder
+ *
+ * Asterisk can send channel audio as RTP (e.g. an ExternalMedia channel).
+ * Any number of streams can be sent to the same socket: they are told apart
+ * by SSRC, and each gets its own reorder buffer and decoder.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RTP_PT_PCMU 0
+#define RTP_PT_PCMA 8
+
+/*! \brief Max payload, in bytes (40 ms of G.711) */
+#define RTP_MAX_PAYLOAD 320
+
+struct rtp_receiver;
+
+/*! \brief A parsed RTP packet */
+struct rtp_header {
+	int payload_type;
+	int marker;
+	uint16_t seq;
+	uint32_t timestamp;
+	uint32_t ssrc;
+	const unsigned char *payload;	/*!< Points into the packet */
+	size_t len;						/*!< Payload length, without padding */
+};
+
+/*!
+ * \brief Parse an RTP packet, skipping CSRCs, header extensions and padding
+ * \retval 0 on success, -1 if not a valid RTP packet
+ */
+int rtp_parse(const unsigned char *pkt, size_t len, struct rtp_header *hdr);
+
+/*!
+ * \brief Write an RTP header (no CSRCs or extensions)
+ * \return Header length
+ */
+size_t rtp_write_header(unsigned char *pkt, int payload_type, int marker, uint16_t seq, uint32_t timestamp, uint32_t ssrc);
+
+/*! \brief Per-stream statistics */
+struct rtp_stream_stats {
+	uint32_t ssrc;
+	int payload_type;
+	unsigned long received;		/*!< Packets received (including late and duplicate) */
+	unsigned long lost;			/*!< Packets that never arrived in time to be decoded */
+	unsigned long late;			/*!< Packets that arrived after they were given up on */
+	unsigned long duplicate;
+	double jitter_ms;			/*!< Interarrival jitter (RFC 3550) */
+	unsigned long chars;		/*!< Characters decoded */
+};
+
+/*!
+ * \brief Callback for decoded text
+ * \param ssrc Stream
+ * \param text Decoded characters (not null terminated)
+ * \param len Number of characters
+ * \param data Callback data from rtp_receiver_create
+ */
+typedef void (*rtp_text_cb)(uint32_t ssrc, const char *text, size_t len, void *data);
+
+/*!
+ * \brief Create a UDP socket for receiving RTP
+ * \param addr Local address, or NULL for any
+ * \param port
+ * \return Non-blocking socket, or -1 on failure
+ */
+int rtp_bind(const char *addr, int port);
+
+/*!
+ * \brief Create a receiver
+ * \param fd Socket from rtp_bind(), or -1 to only use rtp_receiver_process()
+ * \param cb Called for decoded text
+ * \param data Passed to cb
+ * \return Receiver, or NULL on failure
+ */
+struct rtp_receiver *rtp_receiver_create(int fd, rtp_text_cb cb, void *data);
+
+/*!
+ * \brief Receive and process whatever is waiting on the socket, in batches, without blocking
+ * \return Number of packets processed, or -1 on failure
+ */
+int rtp_receiver_poll(struct rtp_receiver *rcv);
+
+/*!
+ * \brief Process a single RTP packet
+ * \param rcv
+ * \param pkt Packet
+ * \param len Length of packet
+ * \param now_ns Arrival time (CLOCK_MONOTONIC), in ns
+ * \retval 0 if the packet was accepted, -1 if it was invalid or unsupported
+ */
+int rtp_receiver_process(struct rtp_receiver *rcv, const unsigned char *pkt, size_t len, uint64_t now_ns);
+
+/*! \brief Number of streams currently known */
+int rtp_receiver_streams(struct rtp_receiver *rcv);
+
+/*!
+ * \brief Get statistics for all streams
+ * \param rcv
+ * \param[out] stats
+ * \param max Size of stats
+ * \return Number of streams (may be more than max)
+ */
+int rtp_receiver_stats(struct rtp_receiver *rcv, struct rtp_stream_stats *stats, int max);
+
+/*! \brief Packets dropped because they weren't valid RTP, or had an unsupported payload type */
+unsigned long rtp_receiver_invalid(struct rtp_receiver *rcv);
+
+/*! \brief Destroy a receiver. The socket is closed. */
+void rtp_receiver_destroy(struct rtp_receiver *rcv);
@@ -0,0 +1,551 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief TTY to RTT (real-time text) gateway
+ *
+ * Every packet carries the new text (if any) and the text of the previous
+ * RTT_REDUNDANCY packets (RFC 2198), so text survives isolated losses.
+ * After the last new text, packets with no new text are sent until it has
+ * been repeated RTT_REDUNDANCY times, and then nothing is sent until there
+ * is more text. New text is sent right away if nothing was sent in the last
+ * RTT_INTERVAL_MS, and otherwise waits until then, so it is never buffered
+ * for longer than that.
+ *
+ * The gateway thread owns the socket. Text for the TTY goes through a TX
+ * queue, whose thread is the only one that issues actions (through the
+ * callback). Text from the TTY is added from the AMI event callback,
+ * under the lock.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "baudot.h"
+#include "rtp.h"
+#include "rtt.h"
+#include "txqueue.h"
+
+#define RTT_MAX_MISORDER 100
+#define RTT_MAX_DROPOUT 1000		/* Bigger jumps than this (in packets) are a restarted sender, not loss */
+#define RTT_MAX_BLOCKS 16			/* Redundant blocks accepted in a received packet */
+
+void t140_tx_init(struct t140_tx *tx, uint32_t ssrc)
+{
+	memset(tx, 0, sizeof(*tx));
+	tx->ssrc = ssrc;
+	tx->seq = (uint16_t) (ssrc * 2654435761u >> 16); /* Random enough, since the SSRC is */
+	tx->ts_base = ssrc * 2246822519u;
+	tx->idle = 1;
+}
+
+size_t t140_tx_queue(struct t140_tx *tx, const char *text, size_t len, uint64_t now_ms)
+{
+	struct t140_block *b = &tx->pending;
+	size_t i;
+
+	if (!b->len) {
+		tx->pending_ms = now_ms;
+	}
+	for (i = 0; i < len; i++) {
+		if (text[i] == '\r') {
+			continue;
+		} else if (text[i] == '\n') {
+			if (b->len + 3 > RTT_MAX_BLOCK) {
+				break;
+			}
+			memcpy(b->data + b->len, "\xe2\x80\xa8", 3); /* U+2028 line separator */
+			b->len += 3;
+		} else {
+			if (b->len == RTT_MAX_BLOCK) {
+				break;
+			}
+			b->data[b->len++] = text[i];
+		}
+	}
+	return i;
+}
+
+int t140_tx_due(struct t140_tx *tx, uint64_t now_ms)
+{
+	int i, pending = tx->pending.len > 0;
+
+	for (i = 0; i < RTT_REDUNDANCY; i++) {
+		pending |= tx->gens[i].len > 0;
+	}
+	if (!pending) {
+		return -1;
+	}
+	if (now_ms >= tx->last_ms + RTT_INTERVAL_MS) {
+		return 0;
+	}
+	return (int) (tx->last_ms + RTT_INTERVAL_MS - now_ms);
+}
+
+size_t t140_tx_packet(struct t140_tx *tx, uint64_t now_ms, unsigned char *pkt)
+{
+	uint32_t ts = tx->ts_base + (uint32_t) now_ms;
+	unsigned char *p;
+	int i;
+
+	p = pkt + rtp_write_header(pkt, RTT_PT_RED, tx->idle, tx->seq++, ts, tx->ssrc);
+	for (i = 0; i < RTT_REDUNDANCY; i++) {
+		struct t140_block *b = &tx->gens[i];
+		uint32_t offset = ts - b->timestamp;
+		if (offset > 0x3FFF) { /* Too old to express, so it's too old to be useful */
+			b->len = 0;
+		}
+		if (!b->len) {
+			offset = 0;
+		}
+		*p++ = 0x80 | RTT_PT_T140;
+		*p++ = (unsigned char) (offset >> 6);
+		*p++ = (unsigned char) ((offset & 0x3F) << 2 | b->len >> 8);
+		*p++ = (unsigned char) b->len;
+	}
+	*p++ = RTT_PT_T140;
+	for (i = 0; i < RTT_REDUNDANCY; i++) {
+		memcpy(p, tx->gens[i].data, tx->gens[i].len);
+		p += tx->gens[i].len;
+	}
+	memcpy(p, tx->pending.data, tx->pending.len);
+	p += tx->pending.len;
+
+	/* This packet's new text is the newest generation for the next one */
+	memmove(tx->gens, tx->gens + 1, (RTT_REDUNDANCY - 1) * sizeof(tx->gens[0]));
+	tx->gens[RTT_REDUNDANCY - 1].timestamp = ts;
+	tx->gens[RTT_REDUNDANCY - 1].len = tx->pending.len;
+	memcpy(tx->gens[RTT_REDUNDANCY - 1].data, tx->pending.data, tx->pending.len);
+	tx->pending.len = 0;
+
+	tx->idle = 1;
+	for (i = 0; i < RTT_REDUNDANCY; i++) {
+		if (tx->gens[i].len) {
+			tx->idle = 0;
+		}
+	}
+	tx->last_ms = now_ms;
+	return (size_t) (p - pkt);
+}
+
+void t140_rx_init(struct t140_rx *rx)
+{
+	memset(rx, 0, sizeof(*rx));
+}
+
+static void append(char *out, size_t max, size_t *pos, const void *data, size_t len)
+{
+	if (!len) {
+		return;
+	}
+	if (len > max - *pos) {
+		len = max - *pos;
+	}
+	memcpy(out + *pos, data, len);
+	*pos += len;
+}
+
+int t140_rx_packet(struct t140_rx *rx, const unsigned char *pkt, size_t len, char *out, size_t max)
+{
+	struct rtp_header hdr;
+	const unsigned char *p, *end, *blocks[RTT_MAX_BLOCKS];
+	size_t lens[RTT_MAX_BLOCKS], pos = 0;
+	int i, k, nred = 0, lost = 0, d;
+
+	if (rtp_parse(pkt, len, &hdr)) {
+		return -1;
+	}
+	p = hdr.payload;
+	end = hdr.payload + hdr.len;
+	if (hdr.payload_type == RTT_PT_RED) {
+		/* Block headers: 4 bytes for each redundant block, then 1 byte for the primary */
+		while (p < end && *p & 0x80) {
+			if (nred == RTT_MAX_BLOCKS || end - p < 4) {
+				return -1;
+			}
+			lens[nred] = (size_t) ((p[2] & 0x03) << 8 | p[3]);
+			blocks[nred] = (p[0] & 0x7F) == RTT_PT_T140 ? p : NULL;
+			nred++;
+			p += 4;
+		}
+		if (p == end) {
+			return -1;
+		}
+		p++;
+		for (i = 0; i < nred; i++) {
+			if ((size_t) (end - p) < lens[i]) {
+				return -1;
+			}
+			if (blocks[i]) {
+				blocks[i] = p;
+			} else {
+				lens[i] = 0; /* Not text */
+			}
+			p += lens[i];
+		}
+	} else if (hdr.payload_type != RTT_PT_T140) {
+		return -1;
+	}
+
+	if (!rx->started) {
+		rx->started = 1;
+		rx->next_seq = hdr.seq;
+	}
+	d = (int16_t) (hdr.seq - rx->next_seq);
+	if (d < -RTT_MAX_MISORDER) {
+		d = 0; /* The sender restarted */
+	} else if (d < 0) {
+		return 0; /* Late or duplicate, and its text has already been used */
+	} else if (d > RTT_MAX_DROPOUT) {
+		d = RTT_REDUNDANCY + 1; /* Some text was lost, but not much more can be said */
+	}
+	rx->packets++;
+
+	/* Packets were lost: recover what we can, oldest first */
+	for (k = d; k >= 1; k--) {
+		if (k <= nred) {
+			append(out, max, &pos, blocks[nred - k], lens[nred - k]);
+			rx->recovered++;
+		} else {
+			rx->lost++;
+			if (!lost++) {
+				append(out, max, &pos, "\xef\xbf\xbd", 3); /* U+FFFD: missing text */
+			}
+		}
+	}
+	append(out, max, &pos, p, (size_t) (end - p));
+	rx->next_seq = (uint16_t) (hdr.seq + 1);
+	return (int) pos;
+}
+
+size_t rtt_to_tty(const char *text, size_t len, char *out, unsigned long *dropped)
+{
+	size_t i = 0, n = 0;
+
+	while (i < len) {
+		unsigned char c = (unsigned char) text[i];
+		uint32_t cp;
+		int j, bytes;
+
+		if (c < 0x80) {
+			cp = c;
+			bytes = 1;
+		} else if ((c & 0xE0) == 0xC0) {
+			cp = c & 0x1F;
+			bytes = 2;
+		} else if ((c & 0xF0) == 0xE0) {
+			cp = c & 0x0F;
+			bytes = 3;
+		} else if ((c & 0xF8) == 0xF0) {
+			cp = c & 0x07;
+			bytes = 4;
+		} else {
+			(*dropped)++; /* Not UTF-8 */
+			i++;
+			continue;
+		}
+		if (len - i < (size_t) bytes) {
+			(*dropped)++;
+			break;
+		}
+		for (j = 1; j < bytes; j++) {
+			if (((unsigned char) text[i + j] & 0xC0) != 0x80) {
+				break;
+			}
+			cp = cp << 6 | ((unsigned char) text[i + j] & 0x3F);
+		}
+		if (j < bytes) {
+			(*dropped)++;
+			i++;
+			continue;
+		}
+		i += (size_t) bytes;
+
+		switch (cp) {
+		case '\r': /* CR LF is a newline, and so is LF */
+		case 0xFEFF: /* Byte order mark, sent at the start */
+			break;
+		case '\n':
+		case 0x2028: /* Line separator */
+		case 0x2029: /* Paragraph separator */
+			out[n++] = '\n';
+			break;
+		case 0x08: /* Erase the last character */
+			out[n++] = '\b';
+			break;
+		case 0xFFFD: /* Missing text */
+			out[n++] = '?';
+			break;
+		case '\t':
+			out[n++] = ' ';
+			break;
+		default:
+			if (cp < 0x80 && baudot_valid_char((char) cp)) {
+				out[n++] = (char) toupper((int) cp);
+			} else {
+				(*dropped)++;
+			}
+		}
+	}
+	return n;
+}
+
+struct rtt_gateway {
+	int fd;
+	int wake[2];				/*!< Pipe to wake up the gateway thread */
+	pthread_t thread;
+	pthread_mutex_t lock;		/*!< Protects tx, stop, and the statistics for text to RTT */
+	int stop;
+	struct t140_tx tx;
+	struct t140_rx rx;
+	struct tx_queue *tty;		/*!< Text for the TTY */
+	/* Statistics */
+	unsigned long to_rtt;		/*!< Characters from the TTY */
+	unsigned long truncated;	/*!< Characters from the TTY that didn't fit in a packet */
+	unsigned long packets;
+	uint64_t latency_total_ms;	/*!< Time the oldest new text in each packet waited */
+	uint64_t latency_max_ms;
+	unsigned long latency_packets;
+	unsigned long dropped;		/*!< Characters from RTT that the TTY can't send */
+};
+
+static uint64_t rtt_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static void gateway_receive(struct rtt_gateway *gw)
+{
+	unsigned char pkt[RTT_PACKET_SIZE + 64];
+	char text[RTT_MAX_TEXT], tty[RTT_MAX_TEXT];
+	ssize_t len;
+	int res;
+
+	for (;;) {
+		len = recv(gw->fd, pkt, sizeof(pkt), 0);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break; /* EAGAIN, or an ICMP error if the peer isn't listening yet */
+		}
+		res = t140_rx_packet(&gw->rx, pkt, (size_t) len, text, sizeof(text));
+		if (res > 0) {
+			tx_queue_add(gw->tty, tty, rtt_to_tty(text, (size_t) res, tty, &gw->dropped));
+		}
+	}
+}
+
+static void *gateway_thread(void *varg)
+{
+	struct rtt_gateway *gw = varg;
+	struct pollfd pfds[2];
+	unsigned char pkt[RTT_PACKET_SIZE];
+
+	pfds[0].fd = gw->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = gw->wake[0];
+	pfds[1].events = POLLIN;
+
+	for (;;) {
+		uint64_t now = rtt_now_ms();
+		size_t pktlen = 0;
+		int timeout;
+
+		pthread_mutex_lock(&gw->lock);
+		if (gw->stop) {
+			pthread_mutex_unlock(&gw->lock);
+			break;
+		}
+		if (!t140_tx_due(&gw->tx, now)) {
+			if (gw->tx.pending.len) {
+				uint64_t latency = now - gw->tx.pending_ms;
+				gw->latency_total_ms += latency;
+				gw->latency_packets++;
+				if (latency > gw->latency_max_ms) {
+					gw->latency_max_ms = latency;
+				}
+			}
+			pktlen = t140_tx_packet(&gw->tx, now, pkt);
+			gw->packets++;
+		}
+		timeout = t140_tx_due(&gw->tx, now);
+		pthread_mutex_unlock(&gw->lock);
+
+		if (pktlen && send(gw->fd, pkt, pktlen, 0) < 0 && errno != ECONNREFUSED) {
+			fprintf(stderr, "Failed to send RTT: %s\n", strerror(errno));
+		}
+
+		if (poll(pfds, 2, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+		if (pfds[1].revents) {
+			char buf[64];
+			while (read(gw->wake[0], buf, sizeof(buf)) > 0);
+		}
+		if (pfds[0].revents) {
+			gateway_receive(gw);
+		}
+	}
+	return NULL;
+}
+
+static int connect_peer(int fd, const char *peer)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	char *port;
+	int ret = -1;
+
+	snprintf(host, sizeof(host), "%s", peer);
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "RTT peer must be host:port\n");
+		return -1;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res)) {
+		fprintf(stderr, "Invalid RTT peer: %s\n", peer);
+		return -1;
+	}
+	/* Connecting also means only the peer's packets are received */
+	for (ai = res; ai; ai = ai->ai_next) {
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			ret = 0;
+			break;
+		}
+	}
+	freeaddrinfo(res);
+	if (ret) {
+		fprintf(stderr, "Failed to connect to RTT peer %s: %s\n", peer, strerror(errno));
+	}
+	return ret;
+}
+
+struct rtt_gateway *rtt_gateway_start(const char *peer, int port, rtt_tty_cb cb, void *data)
+{
+	struct rtt_gateway *gw;
+	struct timespec ts;
+
+	gw = calloc(1, sizeof(*gw));
+	if (!gw) {
+		return NULL;
+	}
+	gw->fd = rtp_bind(NULL, port);
+	if (gw->fd < 0) {
+		free(gw);
+		return NULL;
+	}
+	if (connect_peer(gw->fd, peer) || pipe(gw->wake)) {
+		close(gw->fd);
+		free(gw);
+		return NULL;
+	}
+	fcntl(gw->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(gw->wake[1], F_SETFL, O_NONBLOCK);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	t140_tx_init(&gw->tx, (uint32_t) (ts.tv_nsec ^ ts.tv_sec ^ getpid() << 16));
+	t140_rx_init(&gw->rx);
+	pthread_mutex_init(&gw->lock, NULL);
+
+	gw->tty = tx_queue_create(cb, data);
+	if (!gw->tty || pthread_create(&gw->thread, NULL, gateway_thread, gw)) {
+		fprintf(stderr, "Failed to start RTT gateway thread\n");
+		if (gw->tty) {
+			tx_queue_destroy(gw->tty);
+		}
+		pthread_mutex_destroy(&gw->lock);
+		close(gw->wake[0]);
+		close(gw->wake[1]);
+		close(gw->fd);
+		free(gw);
+		return NULL;
+	}
+	return gw;
+}
+
+void rtt_gateway_text(struct rtt_gateway *gw, const char *text)
+{
+	size_t len = strlen(text), accepted;
+
+	pthread_mutex_lock(&gw->lock);
+	accepted = t140_tx_queue(&gw->tx, text, len, rtt_now_ms());
+	gw->to_rtt += accepted;
+	gw->truncated += len - accepted;
+	pthread_mutex_unlock(&gw->lock);
+
+	if (write(gw->wake[1], "", 1) < 0) {
+		/* Pipe is full, so the thread is already being woken up */
+	}
+}
+
+void rtt_gateway_stop(struct rtt_gateway *gw)
+{
+	struct tx_queue_stats stats;
+
+	pthread_mutex_lock(&gw->lock);
+	gw->stop = 1;
+	pthread_mutex_unlock(&gw->lock);
+	if (write(gw->wake[1], "", 1) < 0) {
+		/* Already being woken up */
+	}
+	pthread_join(gw->thread, NULL);
+	tx_queue_stats(gw->tty, &stats);
+	tx_queue_destroy(gw->tty);
+
+	fprintf(stderr, "RTT gateway: %lu characters to RTT in %lu packets (latency avg %.0f ms, max %lu ms, %lu truncated), "
+		"%lu characters to TTY in %lu batches (latency avg %.0f ms, max %lu ms, %lu dropped, %lu failed, %lu overflowed, %lu still queued), "
+		"%lu packets received (%lu lost, %lu recovered)\n",
+		gw->to_rtt, gw->packets, gw->latency_packets ? (double) gw->latency_total_ms / (double) gw->latency_packets : 0,
+		(unsigned long) gw->latency_max_ms, gw->truncated, stats.chars, stats.batches, stats.latency_avg_ms, stats.latency_max_ms,
+		gw->dropped + stats.too_late, stats.failed, stats.overflow, (unsigned long) stats.queued,
+		gw->rx.packets, gw->rx.lost, gw->rx.recovered);
+
+	pthread_mutex_destroy(&gw->lock);
+	close(gw->wake[0]);
+	close(gw->wake[1]);
+	close(gw->fd);
+	free(gw);
+}
@@ -0,0 +1,150 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief TTY to RTT (real-time text) gateway: T.140 over RTP, with redundancy (RFC 4103)
+ *
+ * Text received from the TTY is sent to an RTT peer as T.140, and text received
+ * from the peer is sent to the TTY as Baudot. Baudot is much slower than RTT
+ * (about 6 characters per second), so text for the TTY waits in a bounded queue
+ * and is handed over in batches, only as fast as the TTY can send it.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Dynamic payload types, as commonly used for text/t140 and text/red */
+#define RTT_PT_T140 98
+#define RTT_PT_RED 100
+
+/*! \brief Generations of redundancy (RFC 4103 recommends 2) */
+#define RTT_REDUNDANCY 2
+
+/*! \brief How long new text may be buffered before it is sent, in ms. T.140 allows up to 300 ms. */
+#define RTT_INTERVAL_MS 200
+
+/*! \brief Max new text per packet, in bytes */
+#define RTT_MAX_BLOCK 256
+
+#define RTT_PACKET_SIZE (12 + 4 * RTT_REDUNDANCY + 1 + (RTT_REDUNDANCY + 1) * RTT_MAX_BLOCK)
+
+/*! \brief Max text that t140_rx_packet() can return, in bytes */
+#define RTT_MAX_TEXT (RTT_PACKET_SIZE + 3)
+
+struct t140_block {
+	uint32_t timestamp;
+	size_t len;
+	char data[RTT_MAX_BLOCK];
+};
+
+/*! \brief T.140 sender */
+struct t140_tx {
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t ts_base;
+	int idle;								/*!< Nothing sent recently, so the next packet gets the marker bit */
+	uint64_t last_ms;						/*!< When the last packet was sent */
+	uint64_t pending_ms;					/*!< When the oldest pending text was queued */
+	struct t140_block pending;				/*!< New text, for the next packet */
+	struct t140_block gens[RTT_REDUNDANCY];	/*!< Text already sent, oldest first, to send again */
+};
+
+/*! \brief T.140 receiver */
+struct t140_rx {
+	int started;
+	uint16_t next_seq;
+	unsigned long packets;
+	unsigned long recovered;	/*!< Lost packets whose text was recovered from redundancy */
+	unsigned long lost;			/*!< Lost packets whose text could not be recovered */
+};
+
+void t140_tx_init(struct t140_tx *tx, uint32_t ssrc);
+
+/*!
+ * \brief Queue text from the TTY. Newlines are converted to the T.140 line separator.
+ * \return Number of characters of text accepted (less than len if the packet is full)
+ */
+size_t t140_tx_queue(struct t140_tx *tx, const char *text, size_t len, uint64_t now_ms);
+
+/*! \brief Milliseconds until a packet should be sent, 0 if one is due now, or -1 if there is nothing to send */
+int t140_tx_due(struct t140_tx *tx, uint64_t now_ms);
+
+/*!
+ * \brief Build the next packet: pending text, preceded by redundant copies of previous text
+ * \param tx
+ * \param now_ms
+ * \param[out] pkt At least RTT_PACKET_SIZE bytes
+ * \return Packet length
+ */
+size_t t140_tx_packet(struct t140_tx *tx, uint64_t now_ms, unsigned char *pkt);
+
+void t140_rx_init(struct t140_rx *rx);
+
+/*!
+ * \brief Process a T.140 packet (plain or with redundancy), recovering text from lost packets if possible
+ * \param rx
+ * \param pkt
+ * \param len
+ * \param[out] out UTF-8 text, in order. Text that could not be recovered is replaced with U+FFFD.
+ * \param max Size of out (RTT_MAX_TEXT is always enough)
+ * \return Number of bytes of text, or -1 if the packet is not valid T.140
+ */
+int t140_rx_packet(struct t140_rx *rx, const unsigned char *pkt, size_t len, char *out, size_t max);
+
+/*!
+ * \brief Convert UTF-8 T.140 text to characters that can be sent as Baudot.
+ *        Letters are uppercased, line separators become newlines, erasure (backspace) becomes '\b',
+ *        missing text becomes '?', and anything else that can't be sent is dropped.
+ * \param text
+ * \param len
+ * \param[out] out At least len bytes
+ * \param[out] dropped Incremented for each character dropped
+ * \return Number of characters
+ */
+size_t rtt_to_tty(const char *text, size_t len, char *out, unsigned long *dropped);
+
+struct rtt_gateway;
+
+/*!
+ * \brief Callback to send text to the TTY
+ * \param text Batch of characters that can be sent as Baudot, null terminated
+ * \param data
+ * \retval 0 on success, -1 on failure
+ */
+typedef int (*rtt_tty_cb)(const char *text, void *data);
+
+/*!
+ * \brief Start a gateway
+ * \param peer RTT peer, host:port
+ * \param port Local port
+ * \param cb Called from a TX queue thread to send text to the TTY, in batches
+ * \param data Passed to cb
+ * \return Gateway, or NULL on failure
+ */
+struct rtt_gateway *rtt_gateway_start(const char *peer, int port, rtt_tty_cb cb, void *data);
+
+/*! \brief Text received from the TTY, to send to the peer. Doesn't block, so safe to call from the AMI event callback. */
+void rtt_gateway_text(struct rtt_gateway *gw, const char *text);
+
+/*! \brief Stop a gateway, printing statistics to stderr */
+void rtt_gateway_stop(struct rtt_gateway *gw);
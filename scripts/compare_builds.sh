@@ -0,0 +1,115 @@
+#!/bin/sh
+#
+# Compare the benchmarks between debug, release (-O2, LTO) and PGO builds.
+# Reports the median latency (ns/op) of each benchmark over several runs,
+# and event throughput for the benchmarks that handle AMI events.
+#
+# Usage: scripts/compare_builds.sh [runs] [iterations]
+#
+
+set -e
+
+RUNS=${1:-3}
+ITERATIONS=${2:-100000}
+PROFILES="debug release pgo"
+MAKE="make -s --no-print-directory"
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+cd "$(dirname "$0")/.."
+
+for profile in $PROFILES; do
+	echo "Building $profile..." >&2
+	case $profile in
+	debug)
+		$MAKE clean
+		$MAKE bench > /dev/null
+		;;
+	release)
+		$MAKE clean
+		$MAKE BUILD=release bench > /dev/null
+		;;
+	pgo)
+		$MAKE pgo PGO_TARGETS=bench > /dev/null
+		;;
+	esac
+	cp asttyspy-bench "$OUT/bench-$profile"
+done
+$MAKE clean
+
+for profile in $PROFILES; do
+	echo "Running $profile ($RUNS runs)..." >&2
+	run=0
+	while [ $run -lt "$RUNS" ]; do
+		"$OUT/bench-$profile" -n "$ITERATIONS" | awk -v p="$profile" '$1 != "Benchmark" { print p, $1, $3, $6 }' >> "$OUT/results"
+		run=$((run + 1))
+	done
+done
+
+awk -v profiles="$PROFILES" '
+function median(key,    n, i, j, tmp, v) {
+	n = count[key]
+	for (i = 1; i <= n; i++) {
+		v[i] = samples[key, i]
+	}
+	for (i = 2; i <= n; i++) {
+		tmp = v[i]
+		for (j = i - 1; j >= 1 && v[j] > tmp; j--) {
+			v[j + 1] = v[j]
+		}
+		v[j + 1] = tmp
+	}
+	return n % 2 ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2
+}
+{
+	if (!($2 in seen)) {
+		seen[$2] = 1
+		names[++num_names] = $2
+	}
+	key = $1 SUBSEP $2
+	samples[key, ++count[key]] = $3
+	events[$2] = $4
+}
+END {
+	np = split(profiles, p, " ")
+
+	printf "Latency (median ns/op)\n"
+	printf "%-20s", "Benchmark"
+	for (i = 1; i <= np; i++) {
+		printf " %12s", p[i]
+	}
+	for (i = 2; i <= np; i++) {
+		printf " %10s", p[i] " x"
+	}
+	printf "\n"
+	for (n = 1; n <= num_names; n++) {
+		printf "%-20s", names[n]
+		for (i = 1; i <= np; i++) {
+			ns[i] = median(p[i] SUBSEP names[n])
+			printf " %12.1f", ns[i]
+		}
+		for (i = 2; i <= np; i++) {
+			printf " %9.2fx", (ns[i] > 0 ? ns[1] / ns[i] : 0)
+		}
+		printf "\n"
+	}
+
+	printf "\nEvent throughput (events/sec)\n"
+	printf "%-20s", "Benchmark"
+	for (i = 1; i <= np; i++) {
+		printf " %12s", p[i]
+	}
+	printf "\n"
+	for (n = 1; n <= num_names; n++) {
+		if (events[names[n]] <= 0) {
+			continue
+		}
+		printf "%-20s", names[n]
+		for (i = 1; i <= np; i++) {
+			v = median(p[i] SUBSEP names[n])
+			printf " %12.0f", (v > 0 ? events[names[n]] * 1e9 / v : 0)
+		}
+		printf "\n"
+	}
+}' "$OUT/results"
@@ -0,0 +1,747 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief TTY sessions (channels on which TddRx is enabled)
+ *
+ * app_tdd has no way to disable TddRx once enabled, so a session lasts until
+ * the channel hangs up, even if nothing is using it anymore. That way, TddRx
+ * is not enabled twice on the same channel if the operator leaves and comes back.
+ *
+ * Changing the RX policy of a session re-issues TddRx with the new options.
+ * If app_tdd rejects that, the session just keeps its current policy.
+ *
+ * Actions are never sent with the sessions lock held, since that would
+ * stall event processing for every session until the action completes.
+ * Remote viewers are updated with it held (which never blocks), so text
+ * racing with a hangup can't reopen a stream that has already ended.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+
+#include "session.h"
+#include "viewer.h"
+#include "analytics.h"
+#include "vclock.h"
+#include "stall.h"
+#include "chanmeta.h"
+
+#define SESSION_BUCKETS 256
+#define TRANSCRIPT_BUFSIZE BUFSIZ /* About what stdio allocates for a transcript */
+
+/* app_tdd sends the buffer when it fills up or a newline is received */
+#define RX_OPTIONS_CHAR "b(1)s"
+#define RX_OPTIONS_LINE "b(80)s"
+
+enum transcript_turn {
+	TURN_NONE = 0,
+	TURN_TTY,
+	TURN_CA,
+};
+
+struct tty_session {
+	struct tty_session *next;
+	int observers;				/*!< Interactive observers */
+	int armed;					/*!< TddRx has been enabled */
+	int recording;				/*!< Transcript requested */
+	enum rx_policy policy;		/*!< Policy TddRx was last enabled with */
+	FILE *transcript;			/*!< Transcript, if recording */
+	enum transcript_turn turn;	/*!< Who was last written to the transcript */
+	struct analytics analytics;
+	uint64_t cpu_ns;			/*!< CPU time spent handling its events */
+	unsigned long events;		/*!< Events handled */
+	size_t bytes;				/*!< Memory allocated for it */
+	size_t unflushed;			/*!< Transcript text not written out yet */
+	char channel[];
+};
+
+enum rx_policy record_rx_policy = RX_POLICY_LINE;
+
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tty_session *sessions[SESSION_BUCKETS];
+static int num_sessions = 0;
+static struct analytics_stats ended_stats; /* Totals for sessions that have ended */
+
+const char *rx_policy_options(enum rx_policy policy)
+{
+	return policy == RX_POLICY_LINE ? RX_OPTIONS_LINE : RX_OPTIONS_CHAR;
+}
+
+int rx_policy_parse(const char *name)
+{
+	if (!strcasecmp(name, "char")) {
+		return RX_POLICY_CHAR;
+	} else if (!strcasecmp(name, "line")) {
+		return RX_POLICY_LINE;
+	}
+	return -1;
+}
+
+size_t tty_unescape(char *msg)
+{
+	char *in = msg, *out = msg;
+
+	while (*in) {
+		if (*in == '_') {
+			*out++ = ' ';
+			in++;
+		} else if (*in == '\\' && *(in + 1) == 'n') {
+			*out++ = '\n';
+			in += 2;
+		} else {
+			*out++ = *in++;
+		}
+	}
+	*out = '\0';
+	return (size_t) (out - msg);
+}
+
+static unsigned int channel_hash(const char *channel)
+{
+	unsigned int hash = 2166136261u; /* FNV-1a */
+
+	for (; *channel; channel++) {
+		hash ^= (unsigned char) *channel;
+		hash *= 16777619u;
+	}
+	return hash % SESSION_BUCKETS;
+}
+
+/*! \note Must be called with sessions_lock held */
+static struct tty_session *find_session(const char *channel)
+{
+	struct tty_session *s;
+
+	for (s = sessions[channel_hash(channel)]; s; s = s->next) {
+		if (!strcmp(s->channel, channel)) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/*! \note Must be called with sessions_lock held */
+static struct tty_session *create_session(const char *channel)
+{
+	unsigned int bucket = channel_hash(channel);
+	struct tty_session *s = calloc(1, sizeof(*s) + strlen(channel) + 1);
+
+	if (!s) {
+		return NULL;
+	}
+	strcpy(s->channel, channel); /* Safe */
+	s->bytes = sizeof(*s) + strlen(channel) + 1;
+	analytics_init(&s->analytics);
+	s->next = sessions[bucket];
+	sessions[bucket] = s;
+	num_sessions++;
+	return s;
+}
+
+/*! \note Must be called with sessions_lock held */
+static struct tty_session *unlink_session(const char *channel)
+{
+	struct tty_session *s, *prev = NULL;
+	unsigned int bucket = channel_hash(channel);
+
+	for (s = sessions[bucket]; s; prev = s, s = s->next) {
+		if (!strcmp(s->channel, channel)) {
+			if (prev) {
+				prev->next = s->next;
+			} else {
+				sessions[bucket] = s->next;
+			}
+			num_sessions--;
+			return s;
+		}
+	}
+	return NULL;
+}
+
+static void session_free(struct tty_session *s)
+{
+	if (s->transcript) {
+		time_t now = vclock_time();
+		char timing[512];
+		if (s->analytics.stats.sessions) {
+			analytics_format(&s->analytics.stats, timing, sizeof(timing));
+			fprintf(s->transcript, "\n# Timing: %s", timing);
+		}
+		fprintf(s->transcript, "\n# Ended: %s", ctime(&now));
+		fclose(s->transcript);
+	}
+	free(s);
+}
+
+/*! \brief Enable TTY on a channel with the given RX policy. Must not be called with sessions_lock held. */
+static int arm(struct ami_session *ami, const char *channel, enum rx_policy policy)
+{
+	struct stall_sample stall;
+	int res;
+
+	stall_begin(&stall);
+	res = ami_action_response_result(ami, ami_action(ami, "TddRx", "Channel:%s\r\nOptions:%s", channel, rx_policy_options(policy)));
+	stall_mark(&stall, STALL_AMI);
+	stall_end(&stall, 1, "TddRx", channel, rx_policy_options(policy));
+	return res;
+}
+
+/*!
+ * \brief Make sure a session is armed with the RX policy it should have right now
+ * \retval 0 on success, or if it was already armed and just keeps its current policy, -1 if it has never been armed
+ */
+static int rearm(struct ami_session *ami, const char *channel)
+{
+	struct tty_session *s;
+	enum rx_policy want;
+	int was_armed, res;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (!s) {
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+	want = s->observers ? RX_POLICY_CHAR : record_rx_policy;
+	was_armed = s->armed;
+	if (was_armed && s->policy == want) {
+		pthread_mutex_unlock(&sessions_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+
+	res = arm(ami, channel, want);
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel); /* Might have hung up in the meantime */
+	if (s && !res) {
+		if (!s->armed) {
+			viewer_open(channel);
+		}
+		s->armed = 1;
+		s->policy = want;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+	if (res && was_armed) {
+		fprintf(stderr, "Failed to change RX policy on channel %s, keeping the current one\n", channel);
+		return 0;
+	}
+	return res;
+}
+
+int session_observe(struct ami_session *ami, const char *channel)
+{
+	struct tty_session *s;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (!s) {
+		s = create_session(channel);
+		if (!s) {
+			pthread_mutex_unlock(&sessions_lock);
+			return -1;
+		}
+	}
+	s->observers++;
+	pthread_mutex_unlock(&sessions_lock);
+
+	if (rearm(ami, channel)) {
+		/* This could be because TTY was already enabled on the channel (can't do it twice) */
+		fprintf(stderr, "Failed to enable TTY on channel %s\n", channel);
+		pthread_mutex_lock(&sessions_lock);
+		s = find_session(channel);
+		if (s && !--s->observers && !s->recording) {
+			session_free(unlink_session(channel));
+		}
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+	return 0;
+}
+
+void session_unobserve(struct ami_session *ami, const char *channel)
+{
+	struct tty_session *s;
+	int recording;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (!s || !s->observers) {
+		pthread_mutex_unlock(&sessions_lock);
+		return;
+	}
+	s->observers--;
+	recording = !s->observers && s->recording;
+	pthread_mutex_unlock(&sessions_lock);
+
+	if (recording) {
+		rearm(ami, channel); /* Nobody's watching anymore, go back to the cheaper policy */
+	}
+}
+
+/*! \brief Write what is known about the call, from the channel metadata cache */
+static void transcript_header(FILE *fp, const char *channel)
+{
+	struct chan_meta meta;
+	int i;
+
+	if (chanmeta_get(channel, &meta)) {
+		return;
+	}
+	if (meta.callerid_num[0] || meta.callerid_name[0]) {
+		fprintf(fp, "# Caller ID: %s%s%s%s\n", meta.callerid_name, meta.callerid_name[0] ? " <" : "", meta.callerid_num, meta.callerid_name[0] ? ">" : "");
+	}
+	if (meta.connected_num[0] || meta.connected_name[0]) {
+		fprintf(fp, "# Connected: %s%s%s%s\n", meta.connected_name, meta.connected_name[0] ? " <" : "", meta.connected_num, meta.connected_name[0] ? ">" : "");
+	}
+	if (meta.exten[0]) {
+		fprintf(fp, "# Dialed: %s%s%s\n", meta.exten, meta.context[0] ? "@" : "", meta.context);
+	}
+	if (meta.accountcode[0]) {
+		fprintf(fp, "# Account: %s\n", meta.accountcode);
+	}
+	if (meta.uniqueid[0]) {
+		fprintf(fp, "# Unique ID: %s\n", meta.uniqueid);
+	}
+	if (meta.linkedid[0]) {
+		fprintf(fp, "# Linked ID: %s\n", meta.linkedid);
+	}
+	if (meta.bridge[0]) {
+		fprintf(fp, "# Bridge: %s\n", meta.bridge);
+	}
+	for (i = 0; i < meta.num_vars; i++) {
+		fprintf(fp, "# Variable: %s=%s\n", meta.vars[i].name, meta.vars[i].value);
+	}
+}
+
+static FILE *open_transcript(const char *channel, const char *dir)
+{
+	char path[512], name[256];
+	char *c;
+	time_t now = vclock_time();
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s", channel);
+	for (c = name; *c; c++) {
+		if (*c == '/' || *c == ';' || *c == ' ') {
+			*c = '-';
+		}
+	}
+	snprintf(path, sizeof(path), "%s/%s-%ld.txt", dir, name, (long) now);
+	fp = fopen(path, "a");
+	if (!fp) {
+		fprintf(stderr, "Failed to open transcript %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	fprintf(fp, "# AsTTYSpy transcript\n# Channel: %s\n# Started: %s", channel, ctime(&now));
+	transcript_header(fp, channel);
+	return fp;
+}
+
+int session_record(struct ami_session *ami, const char *channel, const char *dir)
+{
+	struct tty_session *s;
+	FILE *fp;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (!s) {
+		s = create_session(channel);
+		if (!s) {
+			pthread_mutex_unlock(&sessions_lock);
+			return -1;
+		}
+	} else if (s->recording) {
+		pthread_mutex_unlock(&sessions_lock);
+		return 0;
+	}
+	s->recording = 1;
+	pthread_mutex_unlock(&sessions_lock);
+
+	/* Only create the transcript once TTY is enabled, so channels that can't do TTY don't leave empty ones behind */
+	if (rearm(ami, channel)) {
+		pthread_mutex_lock(&sessions_lock);
+		s = find_session(channel);
+		if (s && !s->observers) {
+			session_free(unlink_session(channel));
+		} else if (s) {
+			s->recording = 0;
+		}
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+
+	fp = open_transcript(channel, dir);
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (!s || !fp) {
+		if (s) {
+			s->recording = 0;
+		}
+		pthread_mutex_unlock(&sessions_lock);
+		if (fp) {
+			fclose(fp); /* Hung up in the meantime */
+		}
+		return -1;
+	}
+	s->transcript = fp;
+	s->bytes += TRANSCRIPT_BUFSIZE;
+	pthread_mutex_unlock(&sessions_lock);
+	return 0;
+}
+
+void session_hangup(const char *channel)
+{
+	struct tty_session *s;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = unlink_session(channel);
+	if (s) {
+		viewer_end(channel);
+		analytics_merge(&ended_stats, &s->analytics.stats);
+	}
+	pthread_mutex_unlock(&sessions_lock);
+
+	if (s) {
+		session_free(s);
+	}
+}
+
+/*! \note Must be called with sessions_lock held */
+static void transcript_write(struct tty_session *s, enum transcript_turn turn, const char *text)
+{
+	if (s->turn != turn) {
+		fprintf(s->transcript, "\n%s", turn == TURN_TTY ? "TTY: " : "CA : ");
+		s->turn = turn;
+		s->unflushed += 6;
+	}
+	fputs(text, s->transcript);
+	s->unflushed += strlen(text);
+	if (strchr(text, '\n')) {
+		fflush(s->transcript);
+		s->unflushed = 0;
+	}
+}
+
+int session_rx(const char *channel, const char *msg)
+{
+	struct tty_session *s;
+	char text[512];
+	size_t len;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (!s) {
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+	snprintf(text, sizeof(text), "%s", msg);
+	len = tty_unescape(text);
+	if (s->transcript) {
+		transcript_write(s, TURN_TTY, text);
+	}
+	analytics_text(&s->analytics, SIDE_TTY, text, len, vclock_now_ms());
+	viewer_publish(channel, 0, text, len);
+	pthread_mutex_unlock(&sessions_lock);
+	return 0;
+}
+
+void session_tx(const char *channel, const char *text)
+{
+	struct tty_session *s;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (s && s->transcript) {
+		transcript_write(s, TURN_CA, text);
+	}
+	if (s) {
+		size_t len = strlen(text);
+		analytics_text(&s->analytics, SIDE_CA, text, len, vclock_now_ms());
+		viewer_publish(channel, 1, text, len);
+	}
+	pthread_mutex_unlock(&sessions_lock);
+}
+
+void session_charge(const char *channel, uint64_t cpu_ns)
+{
+	struct tty_session *s;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (s) {
+		s->cpu_ns += cpu_ns;
+		s->events++;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+}
+
+static int cost_cmp(const void *a, const void *b)
+{
+	const struct session_cost *x = a, *y = b;
+
+	if (x->cpu_ns != y->cpu_ns) {
+		return x->cpu_ns < y->cpu_ns ? 1 : -1;
+	} else if (x->events != y->events) {
+		return x->events < y->events ? 1 : -1;
+	}
+	return strcmp(x->channel, y->channel);
+}
+
+int session_costs(struct session_cost **costs)
+{
+	struct tty_session *s;
+	struct session_cost *list, *c;
+	size_t stream_bytes;
+	int i, n = 0;
+
+	pthread_mutex_lock(&sessions_lock);
+	list = malloc((size_t) (num_sessions ? num_sessions : 1) * sizeof(*list));
+	if (!list) {
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+	for (i = 0; i < SESSION_BUCKETS; i++) {
+		for (s = sessions[i]; s; s = s->next) {
+			c = &list[n++];
+			snprintf(c->channel, sizeof(c->channel), "%s", s->channel);
+			c->cpu_ns = s->cpu_ns;
+			c->events = s->events;
+			c->bytes = s->bytes;
+			c->queued = s->unflushed;
+			c->history = 0;
+			c->viewers = 0;
+			if (!viewer_stream_usage(s->channel, &stream_bytes, &c->history, &c->viewers)) {
+				c->bytes += stream_bytes;
+			}
+		}
+	}
+	pthread_mutex_unlock(&sessions_lock);
+	qsort(list, (size_t) n, sizeof(*list), cost_cmp);
+	*costs = list;
+	return n;
+}
+
+/*! \brief Write a Prometheus label value */
+static void metrics_label(FILE *fp, const char *value)
+{
+	for (; *value; value++) {
+		if (*value == '\\' || *value == '"') {
+			fputc('\\', fp);
+		} else if (*value == '\n') {
+			fputs("\\n", fp);
+			continue;
+		}
+		fputc(*value, fp);
+	}
+}
+
+/*! \brief Write what is known about each session's call, as labels, from the channel metadata cache */
+static void metrics_info(FILE *fp, const struct session_cost *costs, int n)
+{
+	static const char *labels[] = { "channel", "uniqueid", "linkedid", "caller", "did", "account", "bridge" };
+	struct chan_meta meta;
+	const char *values[sizeof(labels) / sizeof(labels[0])];
+	size_t l;
+	int i;
+
+	fprintf(fp, "# HELP asttyspy_session_info What is known about the session's call\n# TYPE asttyspy_session_info gauge\n");
+	for (i = 0; i < n; i++) {
+		if (chanmeta_get(costs[i].channel, &meta)) {
+			memset(&meta, 0, sizeof(meta));
+		}
+		values[0] = costs[i].channel;
+		values[1] = meta.uniqueid;
+		values[2] = meta.linkedid;
+		values[3] = meta.callerid_num;
+		values[4] = meta.exten;
+		values[5] = meta.accountcode;
+		values[6] = meta.bridge;
+		fputs("asttyspy_session_info{", fp);
+		for (l = 0; l < sizeof(labels) / sizeof(labels[0]); l++) {
+			fprintf(fp, "%s%s=\"", l ? "," : "", labels[l]);
+			metrics_label(fp, values[l]);
+			fputc('"', fp);
+		}
+		fputs("} 1\n", fp);
+	}
+}
+
+/*! \brief Value of a metric, in the order sessions_metrics lists them */
+static double cost_metric(const struct session_cost *c, size_t m)
+{
+	switch (m) {
+	case 0:
+		return (double) c->cpu_ns / 1e9;
+	case 1:
+		return (double) c->events;
+	case 2:
+		return (double) c->bytes;
+	case 3:
+		return (double) c->queued;
+	case 4:
+		return (double) c->history;
+	default:
+		return c->viewers;
+	}
+}
+
+void sessions_metrics(FILE *fp)
+{
+	static const struct {
+		const char *name;
+		const char *type;
+		const char *help;
+	} metrics[] = {
+		{ "asttyspy_session_cpu_seconds_total", "counter", "CPU time spent handling the session's events" },
+		{ "asttyspy_session_events_total", "counter", "Events handled for the session" },
+		{ "asttyspy_session_memory_bytes", "gauge", "Memory allocated for the session" },
+		{ "asttyspy_session_queued_bytes", "gauge", "Transcript text not written out yet" },
+		{ "asttyspy_session_history_bytes", "gauge", "History kept for remote viewers" },
+		{ "asttyspy_session_viewers", "gauge", "Remote viewers the session is being sent to" },
+	};
+	struct session_cost *costs;
+	size_t m;
+	int i, n = session_costs(&costs);
+
+	if (n < 0) {
+		return;
+	}
+	fprintf(fp, "# HELP asttyspy_sessions Active TTY sessions\n# TYPE asttyspy_sessions gauge\nasttyspy_sessions %d\n", n);
+	for (m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+		fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", metrics[m].name, metrics[m].help, metrics[m].name, metrics[m].type);
+		for (i = 0; i < n; i++) {
+			fprintf(fp, "%s{channel=\"", metrics[m].name);
+			metrics_label(fp, costs[i].channel);
+			fputs("\"} ", fp);
+			fprintf(fp, "%.15g\n", cost_metric(&costs[i], m));
+		}
+	}
+	metrics_info(fp, costs, n);
+	free(costs);
+}
+
+int session_analytics(const char *channel, struct analytics_stats *stats)
+{
+	struct tty_session *s;
+
+	pthread_mutex_lock(&sessions_lock);
+	s = find_session(channel);
+	if (s) {
+		*stats = s->analytics.stats;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+	return s ? 0 : -1;
+}
+
+void sessions_analytics(struct analytics_stats *stats)
+{
+	struct tty_session *s;
+	int i;
+
+	pthread_mutex_lock(&sessions_lock);
+	*stats = ended_stats;
+	for (i = 0; i < SESSION_BUCKETS; i++) {
+		for (s = sessions[i]; s; s = s->next) {
+			analytics_merge(stats, &s->analytics.stats);
+		}
+	}
+	pthread_mutex_unlock(&sessions_lock);
+}
+
+void sessions_report(FILE *fp)
+{
+	struct analytics_stats stats;
+	char buf[512];
+
+	sessions_analytics(&stats);
+	if (stats.sessions) {
+		analytics_format(&stats, buf, sizeof(buf));
+		fprintf(fp, "Timing, all sessions: %s\n", buf);
+	}
+}
+
+int session_count(void)
+{
+	int count;
+
+	pthread_mutex_lock(&sessions_lock);
+	count = num_sessions;
+	pthread_mutex_unlock(&sessions_lock);
+	return count;
+}
+
+int session_channels(const char *pattern, char ***channels)
+{
+	struct tty_session *s;
+	char **list;
+	int i, n = 0;
+
+	pthread_mutex_lock(&sessions_lock);
+	list = malloc((size_t) (num_sessions ? num_sessions : 1) * sizeof(*list));
+	if (!list) {
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+	for (i = 0; i < SESSION_BUCKETS; i++) {
+		for (s = sessions[i]; s; s = s->next) {
+			if (!s->armed || (pattern && fnmatch(pattern, s->channel, 0))) {
+				continue;
+			}
+			list[n] = strdup(s->channel);
+			if (!list[n]) {
+				break;
+			}
+			n++;
+		}
+	}
+	pthread_mutex_unlock(&sessions_lock);
+	*channels = list;
+	return n;
+}
+
+void sessions_destroy(void)
+{
+	struct tty_session *s;
+	int i;
+
+	pthread_mutex_lock(&sessions_lock);
+	for (i = 0; i < SESSION_BUCKETS; i++) {
+		while ((s = sessions[i])) {
+			sessions[i] = s->next;
+			analytics_merge(&ended_stats, &s->analytics.stats);
+			session_free(s);
+		}
+	}
+	num_sessions = 0;
+	pthread_mutex_unlock(&sessions_lock);
+}
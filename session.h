@@ -0,0 +1,146 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief TTY sessions (channels on which TddRx is enabled)
+ *
+ * A session is created when something starts using a channel: an interactive
+ * observer (the operator's terminal), a transcript recording, or both.
+ * It lasts until the channel hangs up, since TddRx can't be disabled once enabled.
+ * Sessions are looked up by channel name.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdint.h>
+
+/*! \brief How app_tdd should buffer received characters before raising a TddRxMsg event */
+enum rx_policy {
+	RX_POLICY_CHAR = 0,	/*!< One event per character. Needed for realtime display. */
+	RX_POLICY_LINE,		/*!< One event per line (or full buffer). Much cheaper for recording. */
+};
+
+/*! \brief RX policy used for sessions that nobody is watching (-b) */
+extern enum rx_policy record_rx_policy;
+
+/*! \brief TddRx options for an RX policy */
+const char *rx_policy_options(enum rx_policy policy);
+
+/*! \brief Parse an RX policy name ("char" or "line"). Returns -1 if invalid. */
+int rx_policy_parse(const char *name);
+
+/*!
+ * \brief Convert a TddRxMsg message to text, in place: _ becomes space, and \n (escaped) becomes a newline
+ * \return Length of the converted text
+ */
+size_t tty_unescape(char *msg);
+
+/*!
+ * \brief Attach an interactive observer to a channel, enabling TTY on it if needed.
+ *        If the channel is being recorded with a buffered RX policy, it is switched to per-character.
+ * \retval 0 on success, -1 on failure
+ */
+int session_observe(struct ami_session *ami, const char *channel);
+
+/*!
+ * \brief Detach an interactive observer. If the channel is still being recorded,
+ *        it is switched back to the recording RX policy.
+ */
+void session_unobserve(struct ami_session *ami, const char *channel);
+
+/*!
+ * \brief Start recording a transcript of a channel, enabling TTY on it if needed
+ * \param ami
+ * \param channel
+ * \param dir Directory for transcripts
+ * \retval 0 on success (including if already recording), -1 on failure
+ */
+int session_record(struct ami_session *ami, const char *channel, const char *dir);
+
+/*! \brief The channel hung up. Finishes any transcript and removes the session. */
+void session_hangup(const char *channel);
+
+/*!
+ * \brief Handle received text for a channel
+ * \param channel
+ * \param msg Message from the TddRxMsg event
+ * \retval 0 if there is a session for this channel, -1 if not
+ */
+int session_rx(const char *channel, const char *msg);
+
+/*! \brief Record text sent on a channel, if it is being recorded */
+void session_tx(const char *channel, const char *text);
+
+/*!
+ * \brief Charge an event to a channel's session, if there is one
+ * \param channel
+ * \param cpu_ns CPU time spent handling it
+ */
+void session_charge(const char *channel, uint64_t cpu_ns);
+
+/*! \brief What a session has cost so far */
+struct session_cost {
+	char channel[256];
+	uint64_t cpu_ns;		/*!< CPU time spent handling its events */
+	unsigned long events;	/*!< Events handled */
+	size_t bytes;			/*!< Memory allocated for it, including its stream for remote viewers */
+	size_t queued;			/*!< Transcript text not written out yet */
+	size_t history;			/*!< History kept for remote viewers */
+	int viewers;			/*!< Remote viewers it is being sent to */
+};
+
+/*!
+ * \brief Get what every session has cost so far, most expensive (CPU time) first
+ * \param[out] costs The caller must free it
+ * \return Number of sessions, or -1 on failure
+ */
+int session_costs(struct session_cost **costs);
+
+/*! \brief Write what every session has cost so far, in the Prometheus text format */
+void sessions_metrics(FILE *fp);
+
+struct analytics_stats;
+
+/*!
+ * \brief Get the timing analytics of a session so far
+ * \retval 0 on success, -1 if there is no session for the channel
+ */
+int session_analytics(const char *channel, struct analytics_stats *stats);
+
+/*! \brief Get the timing analytics of every session, including ones that have ended, added together */
+void sessions_analytics(struct analytics_stats *stats);
+
+/*! \brief Write the timing analytics of every session, if there was any text */
+void sessions_report(FILE *fp);
+
+/*! \brief Number of active sessions */
+int session_count(void);
+
+/*!
+ * \brief Get the channels of all sessions on which TTY is enabled
+ * \param pattern Only channels matching this glob (e.g. PJSIP/trunk-*), or NULL for all
+ * \param[out] channels Channel names. The caller must free each, and the list.
+ * \return Number of channels, or -1 on failure
+ */
+int session_channels(const char *pattern, char ***channels);
+
+/*! \brief Finish all transcripts and remove all sessions */
+void sessions_destroy(void);
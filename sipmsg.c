@@ -0,0 +1,371 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief TTY to SIP MESSAGE gateway
+ *
+ * Message bodies are base64 encoded in both directions, since AMI ignores
+ * whitespace and can't carry newlines in a header.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "sipmsg.h"
+#include "rtt.h"
+#include "trace.h"
+#include "vclock.h"
+
+struct msg_gateway {
+	struct ami_session *ami;
+	char *to;
+	char *from;
+	pthread_t thread;
+	pthread_mutex_t lock;		/*!< Protects everything below */
+	pthread_cond_t cond;
+	int stop;
+	char pending[MSG_MAX_BODY];	/*!< Text from the TTY, not yet sent */
+	uint64_t added_ms[MSG_MAX_BODY];
+	size_t len;
+	struct tx_queue *tty;		/*!< Text for the TTY */
+	/* Statistics */
+	unsigned long to_msg;		/*!< Characters from the TTY */
+	unsigned long overflow;		/*!< Characters from the TTY that didn't fit */
+	unsigned long messages;
+	unsigned long failed;
+	uint64_t latency_total_ms;	/*!< From the first character of each message being received to sending it */
+	uint64_t latency_max_ms;
+	unsigned long received;		/*!< Incoming messages */
+	unsigned long ignored;		/*!< Incoming messages from other endpoints */
+	unsigned long dropped;		/*!< Characters from messages that the TTY can't send */
+};
+
+static const char b64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*! \param[out] out At least 4 * ((len + 2) / 3) + 1 bytes */
+static void b64_encode(const char *in, size_t len, char *out)
+{
+	const unsigned char *s = (const unsigned char *) in;
+	size_t i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		*out++ = b64_chars[s[i] >> 2];
+		*out++ = b64_chars[((s[i] & 0x03) << 4) | (s[i + 1] >> 4)];
+		*out++ = b64_chars[((s[i + 1] & 0x0f) << 2) | (s[i + 2] >> 6)];
+		*out++ = b64_chars[s[i + 2] & 0x3f];
+	}
+	if (i < len) {
+		*out++ = b64_chars[s[i] >> 2];
+		if (i + 1 < len) {
+			*out++ = b64_chars[((s[i] & 0x03) << 4) | (s[i + 1] >> 4)];
+			*out++ = b64_chars[(s[i + 1] & 0x0f) << 2];
+		} else {
+			*out++ = b64_chars[(s[i] & 0x03) << 4];
+			*out++ = '=';
+		}
+		*out++ = '=';
+	}
+	*out = '\0';
+}
+
+/*!
+ * \brief Decode base64, ignoring anything that isn't part of it
+ * \param[out] out At least 3 * strlen(in) / 4 + 1 bytes
+ * \return Number of bytes
+ */
+static size_t b64_decode(const char *in, char *out)
+{
+	uint32_t acc = 0;
+	size_t len = 0;
+	int bits = 0;
+	const char *c;
+
+	for (; *in && *in != '='; in++) {
+		c = strchr(b64_chars, *in);
+		if (!c) {
+			continue;
+		}
+		acc = (acc << 6) | (uint32_t) (c - b64_chars);
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			out[len++] = (char) ((acc >> bits) & 0xff);
+		}
+	}
+	out[len] = '\0';
+	return len;
+}
+
+/*!
+ * \brief Find the user (or PJSIP endpoint) in a URI, e.g. alice in pjsip:alice, pjsip:alice/sip:alice@host, or "Alice" <sip:alice@host:5060>
+ * \param uri
+ * \param[out] user Start of it
+ * \return Its length
+ */
+static size_t uri_user(const char *uri, const char **user)
+{
+	const char *s = strchr(uri, '<'), *colon;
+
+	s = s ? s + 1 : uri;
+	colon = strchr(s, ':');
+	if (colon && colon < s + strcspn(s, "@/")) {
+		s = colon + 1; /* Skip the scheme */
+	}
+	*user = s;
+	return strcspn(s, "@/>;:");
+}
+
+/*! \brief Whether an incoming message is from the endpoint messages are sent to */
+static int from_peer(struct msg_gateway *gw, const char *from)
+{
+	const char *a, *b;
+	size_t alen, blen;
+
+	alen = uri_user(gw->to, &a);
+	blen = uri_user(from, &b);
+	return alen && alen == blen && !strncmp(a, b, alen);
+}
+
+/*!
+ * \brief Take the next message, if one is due: a complete line, or everything if the window is up or it's full
+ * \param gw
+ * \param now
+ * \param[out] body At least MSG_MAX_BODY + 1 bytes
+ * \param[out] first_ms When the first character of the message was received
+ * \param[out] wait Milliseconds until the pending text is due, or -1 if there is none
+ * \return Length of the message, or -1 if none is due
+ * \note Must be called with the lock held
+ */
+static int take_message(struct msg_gateway *gw, uint64_t now, char *body, uint64_t *first_ms, int *wait)
+{
+	size_t n, consume;
+	char *nl;
+
+	*wait = -1;
+	for (;;) {
+		nl = memchr(gw->pending, '\n', gw->len);
+		if (nl) {
+			n = (size_t) (nl - gw->pending);
+			consume = n + 1;
+		} else if (gw->len && (gw->len == MSG_MAX_BODY || now - gw->added_ms[0] >= MSG_WINDOW_MS)) {
+			n = consume = gw->len;
+		} else {
+			*wait = gw->len ? (int) (gw->added_ms[0] + MSG_WINDOW_MS - now) : -1;
+			return -1;
+		}
+		memcpy(body, gw->pending, n);
+		body[n] = '\0';
+		*first_ms = gw->added_ms[0];
+		gw->len -= consume;
+		memmove(gw->pending, gw->pending + consume, gw->len);
+		memmove(gw->added_ms, gw->added_ms + consume, gw->len * sizeof(gw->added_ms[0]));
+		if (n) {
+			return (int) n;
+		}
+		/* Blank line, nothing to send */
+	}
+}
+
+static int send_message(struct msg_gateway *gw, const char *body, size_t len)
+{
+	char b64[4 * ((MSG_MAX_BODY + 2) / 3) + 1];
+	uint64_t tstart;
+	int res;
+
+	b64_encode(body, len, b64);
+	tstart = trace_begin();
+	if (gw->from) {
+		res = ami_action_response_result(gw->ami, ami_action(gw->ami, "MessageSend", "To:%s\r\nFrom:%s\r\nBase64Body:%s", gw->to, gw->from, b64));
+	} else {
+		res = ami_action_response_result(gw->ami, ami_action(gw->ami, "MessageSend", "To:%s\r\nBase64Body:%s", gw->to, b64));
+	}
+	trace_end("MessageSend", tstart, gw->to);
+	return res;
+}
+
+static void *msg_gateway_thread(void *varg)
+{
+	struct msg_gateway *gw = varg;
+	char body[MSG_MAX_BODY + 1];
+	uint64_t first_ms, now, latency;
+	int len, wait, res;
+
+	pthread_mutex_lock(&gw->lock);
+	while (!gw->stop) {
+		now = vclock_now_ms();
+		len = take_message(gw, now, body, &first_ms, &wait);
+		if (len >= 0) {
+			/* Actions may take a while, so never hold the lock while sending */
+			pthread_mutex_unlock(&gw->lock);
+			res = send_message(gw, body, (size_t) len);
+			now = vclock_now_ms();
+			pthread_mutex_lock(&gw->lock);
+			if (res) {
+				gw->failed++;
+				continue;
+			}
+			gw->messages++;
+			latency = now - first_ms;
+			gw->latency_total_ms += latency;
+			if (latency > gw->latency_max_ms) {
+				gw->latency_max_ms = latency;
+			}
+			continue;
+		}
+		vclock_wait(&gw->cond, &gw->lock, wait < 0 ? VCLOCK_FOREVER : now + (uint64_t) wait);
+	}
+	pthread_mutex_unlock(&gw->lock);
+	return NULL;
+}
+
+struct msg_gateway *msg_gateway_start(struct ami_session *ami, const char *to, const char *from, tx_queue_cb cb, void *data)
+{
+	struct msg_gateway *gw = calloc(1, sizeof(*gw));
+
+	if (!gw) {
+		return NULL;
+	}
+	gw->ami = ami;
+	gw->to = strdup(to);
+	gw->from = from ? strdup(from) : NULL;
+	if (!gw->to || (from && !gw->from)) {
+		goto cleanup;
+	}
+	gw->tty = tx_queue_create(cb, data);
+	if (!gw->tty) {
+		goto cleanup;
+	}
+	pthread_mutex_init(&gw->lock, NULL);
+	pthread_cond_init(&gw->cond, NULL);
+	if (vclock_thread_create(&gw->thread, msg_gateway_thread, gw)) {
+		fprintf(stderr, "Failed to start message gateway thread\n");
+		pthread_cond_destroy(&gw->cond);
+		pthread_mutex_destroy(&gw->lock);
+		tx_queue_destroy(gw->tty);
+		goto cleanup;
+	}
+	return gw;
+
+cleanup:
+	free(gw->to);
+	free(gw->from);
+	free(gw);
+	return NULL;
+}
+
+void msg_gateway_text(struct msg_gateway *gw, const char *text)
+{
+	uint64_t now = vclock_now_ms();
+
+	pthread_mutex_lock(&gw->lock);
+	for (; *text; text++) {
+		if (gw->len == MSG_MAX_BODY) {
+			gw->overflow++;
+			continue;
+		}
+		gw->pending[gw->len] = *text;
+		gw->added_ms[gw->len++] = now;
+		gw->to_msg++;
+	}
+	vclock_signal(&gw->cond);
+	pthread_mutex_unlock(&gw->lock);
+}
+
+int msg_gateway_event(struct msg_gateway *gw, struct ami_event *event)
+{
+	const char *b64, *body;
+	char *decoded = NULL, *text;
+	size_t len;
+	unsigned long dropped = 0;
+
+	if (strcmp(ami_keyvalue(event, "UserEvent"), MSG_USEREVENT)) {
+		return -1;
+	}
+	if (!from_peer(gw, ami_keyvalue(event, "From"))) {
+		/* Every endpoint's messages raise this event, but only the peer's should go to the TTY */
+		pthread_mutex_lock(&gw->lock);
+		gw->ignored++;
+		pthread_mutex_unlock(&gw->lock);
+		return 0;
+	}
+
+	b64 = ami_keyvalue(event, "Base64Body");
+	if (*b64) {
+		decoded = malloc(3 * strlen(b64) / 4 + 1);
+		if (!decoded) {
+			return 0;
+		}
+		len = b64_decode(b64, decoded);
+		body = decoded;
+	} else {
+		body = ami_keyvalue(event, "Body");
+		len = strlen(body);
+	}
+
+	text = malloc(len + 1);
+	if (text) {
+		len = rtt_to_tty(body, len, text, &dropped);
+		text[len++] = '\n'; /* Each message on its own line */
+		tx_queue_add(gw->tty, text, len); /* Doesn't block */
+		free(text);
+	}
+	free(decoded);
+
+	pthread_mutex_lock(&gw->lock);
+	gw->received++;
+	gw->dropped += dropped;
+	pthread_mutex_unlock(&gw->lock);
+	return 0;
+}
+
+void msg_gateway_stop(struct msg_gateway *gw)
+{
+	struct tx_queue_stats stats;
+
+	pthread_mutex_lock(&gw->lock);
+	gw->stop = 1;
+	vclock_signal(&gw->cond);
+	pthread_mutex_unlock(&gw->lock);
+	vclock_thread_join(gw->thread);
+	tx_queue_stats(gw->tty, &stats);
+	tx_queue_destroy(gw->tty);
+
+	fprintf(stderr, "Message gateway: %lu characters to %s in %lu messages (latency avg %.0f ms, max %lu ms, %lu failed, %lu overflowed, %lu unsent), "
+		"%lu messages received (%lu from other endpoints ignored), %lu characters to TTY in %lu batches (latency avg %.0f ms, max %lu ms, %lu dropped, %lu failed, %lu overflowed, %lu still queued)\n",
+		gw->to_msg, gw->to, gw->messages, gw->messages ? (double) gw->latency_total_ms / (double) gw->messages : 0,
+		(unsigned long) gw->latency_max_ms, gw->failed, gw->overflow, (unsigned long) gw->len,
+		gw->received, gw->ignored, stats.chars, stats.batches, stats.latency_avg_ms, stats.latency_max_ms,
+		gw->dropped + stats.too_late, stats.failed, stats.overflow, (unsigned long) stats.queued);
+
+	pthread_cond_destroy(&gw->cond);
+	pthread_mutex_destroy(&gw->lock);
+	free(gw->to);
+	free(gw->from);
+	free(gw);
+}
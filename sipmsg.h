@@ -0,0 +1,75 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief TTY to SIP MESSAGE gateway
+ *
+ * Text received from the TTY is sent to a messaging endpoint with the
+ * MessageSend action, a line at a time, or whatever has been typed once
+ * MSG_WINDOW_MS has passed, so each character doesn't become a message.
+ *
+ * Asterisk doesn't raise AMI events for incoming messages, so the dialplan
+ * context that messages from the endpoint are routed to must raise one:
+ *
+ *   exten => _X.,1,UserEvent(TddMessage,From: ${MESSAGE(from)},Base64Body: ${BASE64_ENCODE(${MESSAGE(body)})})
+ *
+ * These messages are sent to the TTY, one line each, through a TX queue.
+ * Messages from other endpoints raise the same event, so only those whose
+ * From has the same user as the destination (alice for pjsip:alice) are.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include "txqueue.h"
+
+/*! \brief Max time from the first character of a message being typed to sending it, if no newline is typed */
+#define MSG_WINDOW_MS 5000
+
+/*! \brief Max message text, in bytes. Longer lines are split. */
+#define MSG_MAX_BODY 1024
+
+/*! \brief UserEvent name for incoming messages */
+#define MSG_USEREVENT "TddMessage"
+
+struct msg_gateway;
+
+/*!
+ * \brief Start a gateway
+ * \param ami
+ * \param to MessageSend destination, e.g. pjsip:alice
+ * \param from MessageSend From, or NULL for the default
+ * \param cb Called from a TX queue thread to send text to the TTY, in batches
+ * \param data Passed to cb
+ * \return Gateway, or NULL on failure
+ */
+struct msg_gateway *msg_gateway_start(struct ami_session *ami, const char *to, const char *from, tx_queue_cb cb, void *data);
+
+/*! \brief Text received from the TTY, to send as messages. Doesn't block, so safe to call from the AMI event callback. */
+void msg_gateway_text(struct msg_gateway *gw, const char *text);
+
+/*!
+ * \brief Handle a UserEvent. Doesn't block, so safe to call from the AMI event callback.
+ * \retval 0 if it was an incoming message (whether or not it was from the peer), -1 if not
+ */
+int msg_gateway_event(struct msg_gateway *gw, struct ami_event *event);
+
+/*! \brief Stop a gateway, printing statistics to stderr */
+void msg_gateway_stop(struct msg_gateway *gw);
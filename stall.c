@@ -0,0 +1,340 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Stall recorder: recent per-event timing, written out when something is slow
+ *
+ * Every event and action that is timed ends up in a small ring, with how
+ * long each phase of handling it took. Recording one is a few clock reads
+ * and a copy into the ring, so it can always be on. When one takes longer
+ * than the threshold, the recorder waits for a few more (or a second) so the
+ * report shows what happened after, as well as before, then freezes a copy of
+ * the ring. Writing the report is left to the recorder's own thread, which
+ * also adds whatever context has been registered (queue depths, etc.), so
+ * the thread that stalled isn't held up any further.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "stall.h"
+
+#define STALL_NAME_LEN 24
+#define STALL_CHANNEL_LEN 48
+#define STALL_DETAIL_LEN 64
+#define STALL_AFTER_MS 1000 /* Max time to wait for events after a stall */
+
+struct stall_record {
+	uint64_t start;
+	uint64_t total;
+	uint64_t phases[STALL_PHASES];
+	long tid;
+	int action;
+	char name[STALL_NAME_LEN];
+	char channel[STALL_CHANNEL_LEN];
+	char detail[STALL_DETAIL_LEN];
+};
+
+int stall_enabled = 0;
+
+static pthread_mutex_t stall_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stall_cond = PTHREAD_COND_INITIALIZER;
+static struct stall_record ring[STALL_RING_SIZE];
+static unsigned long ring_count = 0;		/* Records ever added. The newest is at (ring_count - 1) % STALL_RING_SIZE. */
+static struct stall_record frozen[STALL_RING_SIZE];
+static int num_frozen = 0;
+static struct stall_record trigger;		/* The stall being reported */
+static int triggered = 0;				/* Waiting for records after the stall */
+static int after = 0;
+static unsigned long suppressed = 0;	/* Stalls not reported, since one was reported too recently */
+static uint64_t last_report = 0;
+static uint64_t threshold_ns;
+static char stall_dir[256];
+static stall_context_cb context_cb = NULL;
+static pthread_t stall_thread;
+static int stall_running = 0;
+static int stall_stopping = 0;
+static __thread long thread_tid = 0;
+
+static uint64_t stall_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void stall_begin(struct stall_sample *s)
+{
+	if (!stall_enabled) {
+		s->start = 0;
+		return;
+	}
+	memset(s->phases, 0, sizeof(s->phases));
+	s->start = s->mark = stall_now();
+}
+
+void stall_mark(struct stall_sample *s, enum stall_phase phase)
+{
+	uint64_t now;
+
+	if (!s->start) {
+		return;
+	}
+	now = stall_now();
+	s->phases[phase] += now - s->mark;
+	s->mark = now;
+}
+
+/*! \note Must be called with stall_lock held */
+static void freeze(void)
+{
+	unsigned long i, first = ring_count > STALL_RING_SIZE ? ring_count - STALL_RING_SIZE : 0;
+
+	/* Oldest first */
+	for (num_frozen = 0, i = first; i < ring_count; i++) {
+		frozen[num_frozen++] = ring[i % STALL_RING_SIZE];
+	}
+	triggered = 0;
+	pthread_cond_signal(&stall_cond);
+}
+
+void stall_end(struct stall_sample *s, int action, const char *name, const char *channel, const char *detail)
+{
+	struct stall_record *r;
+	uint64_t now;
+
+	if (!s->start) {
+		return;
+	}
+	now = stall_now();
+	if (!thread_tid) {
+		thread_tid = syscall(SYS_gettid);
+	}
+
+	pthread_mutex_lock(&stall_lock);
+	r = &ring[ring_count++ % STALL_RING_SIZE];
+	r->start = s->start;
+	r->total = now - s->start;
+	memcpy(r->phases, s->phases, sizeof(r->phases));
+	r->tid = thread_tid;
+	r->action = action;
+	snprintf(r->name, sizeof(r->name), "%s", name ? name : "");
+	snprintf(r->channel, sizeof(r->channel), "%s", channel ? channel : "");
+	snprintf(r->detail, sizeof(r->detail), "%s", detail ? detail : "");
+
+	if (triggered) {
+		if (++after >= STALL_AFTER) {
+			freeze();
+		}
+	} else if (r->total >= threshold_ns) {
+		if (num_frozen || (last_report && now - last_report < STALL_DUMP_INTERVAL_MS * 1000000ULL)) {
+			suppressed++;
+		} else {
+			trigger = *r;
+			triggered = 1;
+			after = 0;
+			last_report = now;
+			pthread_cond_signal(&stall_cond); /* Get the context now, while it's still relevant */
+		}
+	}
+	pthread_mutex_unlock(&stall_lock);
+}
+
+static void write_detail(FILE *fp, const char *detail)
+{
+	for (; *detail; detail++) {
+		fputc((unsigned char) *detail < ' ' ? '.' : *detail, fp);
+	}
+}
+
+static void write_record(FILE *fp, const struct stall_record *r, int is_trigger)
+{
+	uint64_t other = r->total;
+	int p;
+
+	fprintf(fp, "%s %+10.3f %9.3f", is_trigger ? ">>" : "  ", ((double) r->start - (double) trigger.start) / 1e6, (double) r->total / 1e6);
+	for (p = 0; p < STALL_PHASES; p++) {
+		fprintf(fp, " %9.3f", (double) r->phases[p] / 1e6);
+		other -= r->phases[p] < other ? r->phases[p] : other;
+	}
+	fprintf(fp, " %9.3f %6ld %-6s %-14s %-30s ", (double) other / 1e6, r->tid, r->action ? "action" : "event", r->name, r->channel[0] ? r->channel : "-");
+	write_detail(fp, r->detail);
+	fputc('\n', fp);
+}
+
+/*! \brief Write out a stall, the context captured when it happened, and the records around it */
+static void write_report(const char *context, unsigned long skipped)
+{
+	static unsigned int reports = 0;
+	char path[512];
+	time_t now = time(NULL);
+	double rtt_total = 0, rtt_max = 0, rtt;
+	int i, actions = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/asttyspy-stall-%ld-%u.txt", stall_dir, (long) now, ++reports);
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open stall report %s: %s\n", path, strerror(errno));
+		return;
+	}
+	fprintf(fp, "# AsTTYSpy stall: %s %s%s%s took %.3f ms (threshold %.0f ms)\n", trigger.action ? "action" : "event", trigger.name,
+		trigger.channel[0] ? " on " : "", trigger.channel, (double) trigger.total / 1e6, (double) threshold_ns / 1e6);
+	fprintf(fp, "# At: %s", ctime(&now));
+	if (skipped) {
+		fprintf(fp, "# %lu other stalls since the last report were not written out\n", skipped);
+	}
+
+	fprintf(fp, "\nContext, when it happened:\n%s", context ? context : "");
+	for (i = 0; i < num_frozen; i++) {
+		if (frozen[i].action) {
+			rtt = (double) frozen[i].phases[STALL_AMI] / 1e6;
+			rtt_total += rtt;
+			rtt_max = rtt > rtt_max ? rtt : rtt_max;
+			actions++;
+		}
+	}
+	if (actions) {
+		fprintf(fp, "AMI round trips: %d recent actions, avg %.3f ms, max %.3f ms\n", actions, rtt_total / actions, rtt_max);
+	}
+
+	fprintf(fp, "\nRecent events and actions, oldest first (ms, start relative to the stall):\n");
+	fprintf(fp, "   %10s %9s %9s %9s %9s %9s %9s %9s %9s %6s %-6s %-14s %-30s %s\n", "Start", "Total", "Parse", "Dispatch", "Lock", "Render", "Flush", "AMI",
+		"Other", "Thread", "Kind", "Name", "Channel", "Detail");
+	for (i = 0; i < num_frozen; i++) {
+		write_record(fp, &frozen[i], !memcmp(&frozen[i], &trigger, sizeof(trigger)));
+	}
+	fclose(fp);
+	fprintf(stderr, "Stall: %s took %.3f ms, wrote %s\n", trigger.name, (double) trigger.total / 1e6, path);
+}
+
+/*! \brief Run the context callback, and return what it wrote */
+static char *get_context(void)
+{
+	stall_context_cb cb;
+	char *buf = NULL;
+	size_t len;
+	FILE *fp;
+
+	pthread_mutex_lock(&stall_lock);
+	cb = context_cb;
+	pthread_mutex_unlock(&stall_lock);
+	if (!cb) {
+		return NULL;
+	}
+	fp = open_memstream(&buf, &len);
+	if (!fp) {
+		return NULL;
+	}
+	cb(fp);
+	fclose(fp);
+	return buf;
+}
+
+static void *stall_loop(void *varg)
+{
+	struct timespec ts;
+	unsigned long skipped;
+	char *context;
+
+	(void) varg;
+
+	pthread_mutex_lock(&stall_lock);
+	for (;;) {
+		while (!triggered && !num_frozen && !stall_stopping) {
+			pthread_cond_wait(&stall_cond, &stall_lock);
+		}
+		if (!triggered && !num_frozen) {
+			break; /* Stopping */
+		}
+		pthread_mutex_unlock(&stall_lock);
+		context = get_context();
+		pthread_mutex_lock(&stall_lock);
+
+		/* Wait for what happened after it, but not forever, since it might have been the last thing for a while */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += STALL_AFTER_MS / 1000;
+		while (triggered && !stall_stopping && pthread_cond_timedwait(&stall_cond, &stall_lock, &ts) != ETIMEDOUT);
+		if (triggered) {
+			freeze();
+		}
+		skipped = suppressed;
+		suppressed = 0;
+		pthread_mutex_unlock(&stall_lock);
+
+		/* Nothing else touches the frozen records or the trigger until num_frozen is cleared */
+		write_report(context, skipped);
+		free(context);
+
+		pthread_mutex_lock(&stall_lock);
+		num_frozen = 0;
+	}
+	pthread_mutex_unlock(&stall_lock);
+	return NULL;
+}
+
+void stall_set_context(stall_context_cb cb)
+{
+	pthread_mutex_lock(&stall_lock);
+	context_cb = cb;
+	pthread_mutex_unlock(&stall_lock);
+}
+
+int stall_start(const char *dir, unsigned int threshold_ms)
+{
+	snprintf(stall_dir, sizeof(stall_dir), "%s", dir);
+	threshold_ns = (uint64_t) threshold_ms * 1000000ULL;
+	stall_stopping = 0;
+	if (pthread_create(&stall_thread, NULL, stall_loop, NULL)) {
+		fprintf(stderr, "Failed to create stall recorder thread\n");
+		return -1;
+	}
+	stall_running = 1;
+	stall_enabled = 1;
+	atexit(stall_stop); /* The program exits from several places, so a stall waiting for context still gets written out */
+	return 0;
+}
+
+void stall_stop(void)
+{
+	if (!stall_running) {
+		return;
+	}
+	stall_enabled = 0;
+	stall_running = 0;
+
+	pthread_mutex_lock(&stall_lock);
+	stall_stopping = 1;
+	pthread_cond_signal(&stall_cond);
+	pthread_mutex_unlock(&stall_lock);
+	if (!pthread_equal(stall_thread, pthread_self())) {
+		pthread_join(stall_thread, NULL);
+	}
+}
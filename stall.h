@@ -0,0 +1,97 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Stall recorder: recent per-event timing, written out when something is slow
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*! \brief Default threshold. Nothing normally takes anywhere near this long, so it is on unless turned off. */
+#define STALL_DEFAULT_MS 1000
+
+/*! \brief Recent events and actions kept, and written out around a stall */
+#define STALL_RING_SIZE 64
+
+/*! \brief Events and actions after a stall to wait for, before writing it out */
+#define STALL_AFTER 16
+
+/*! \brief Min time between stall reports, so a burst of slow events doesn't become a burst of files */
+#define STALL_DUMP_INTERVAL_MS 10000
+
+enum stall_phase {
+	STALL_PARSE = 0,
+	STALL_DISPATCH,
+	STALL_LOCK,		/*!< Waiting for the terminal */
+	STALL_RENDER,
+	STALL_FLUSH,
+	STALL_AMI,		/*!< Waiting for Asterisk to respond to an action */
+	STALL_PHASES,
+};
+
+/*! \brief Timing of one event or action, as it is handled */
+struct stall_sample {
+	uint64_t start;		/*!< 0 if not recording */
+	uint64_t mark;		/*!< End of the last phase */
+	uint64_t phases[STALL_PHASES];
+};
+
+/*! \brief Nonzero while the recorder is running. Checked before doing any work. */
+extern int stall_enabled;
+
+/*!
+ * \brief Start recording, and writing out stalls
+ * \param dir Directory to write stall reports to
+ * \param threshold_ms Events or actions that take at least this long are stalls
+ * \retval 0 on success, -1 on failure
+ */
+int stall_start(const char *dir, unsigned int threshold_ms);
+
+/*! \brief Stop recording, writing out a stall that is waiting for context after it first. Safe to call more than once. */
+void stall_stop(void);
+
+/*!
+ * \brief Writes what else was going on (queue depths, etc.) to a stall report
+ * \note Called on the recorder's thread, without any recorder locks held
+ */
+typedef void (*stall_context_cb)(FILE *fp);
+
+/*! \brief Set (or with NULL, clear) what writes the context for stall reports */
+void stall_set_context(stall_context_cb cb);
+
+/*! \brief Start timing an event or action */
+void stall_begin(struct stall_sample *s);
+
+/*! \brief A phase of handling it just finished */
+void stall_mark(struct stall_sample *s, enum stall_phase phase);
+
+/*!
+ * \brief Finish timing an event or action, and write out the recent ones if it stalled
+ * \param s
+ * \param action 1 for an action, 0 for an event
+ * \param name Event or action name
+ * \param channel Channel, or NULL
+ * \param detail What it was, e.g. the message, or NULL. This is copied (and may be truncated).
+ */
+void stall_end(struct stall_sample *s, int action, const char *name, const char *channel, const char *detail);
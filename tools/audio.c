@@ -0,0 +1,140 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Audio file input for the tools
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "codec.h"
+#include "audio.h"
+
+#define AUDIO_CHUNK 160
+
+/*! \brief Skip to the start of the data chunk of a WAV file */
+static int wav_skip_header(FILE *fp)
+{
+	char id[4];
+	uint32_t size;
+
+	if (fread(id, 1, 4, fp) != 4 || memcmp(id, "RIFF", 4) || fseek(fp, 8, SEEK_CUR)) {
+		return -1;
+	}
+	while (fread(id, 1, 4, fp) == 4 && fread(&size, 4, 1, fp) == 1) {
+		if (!memcmp(id, "data", 4)) {
+			return 0;
+		}
+		if (fseek(fp, size, SEEK_CUR)) {
+			break;
+		}
+	}
+	return -1;
+}
+
+int audio_open(struct audio_file *af, const char *filename)
+{
+	const char *ext = strrchr(filename, '.');
+	int codec;
+
+	if (!ext) {
+		fprintf(stderr, "Unknown audio format: %s\n", filename);
+		return -1;
+	}
+	ext++;
+	if (!strcasecmp(ext, "wav")) {
+		codec = CODEC_SLIN;
+	} else {
+		codec = codec_parse(ext);
+		if (codec < 0) {
+			fprintf(stderr, "Unknown audio format: %s\n", filename);
+			return -1;
+		}
+	}
+	af->codec = (enum codec) codec;
+	af->fp = fopen(filename, "rb");
+	if (!af->fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	if (!strcasecmp(ext, "wav") && wav_skip_header(af->fp)) {
+		fprintf(stderr, "Invalid WAV file: %s\n", filename);
+		fclose(af->fp);
+		return -1;
+	}
+	return 0;
+}
+
+size_t audio_read(struct audio_file *af, int16_t *samples, size_t max)
+{
+	unsigned char buf[AUDIO_CHUNK * sizeof(int16_t)];
+	size_t total = 0;
+
+	while (total < max) {
+		size_t want = max - total < AUDIO_CHUNK ? max - total : AUDIO_CHUNK;
+		size_t len = fread(buf, codec_sample_bytes(af->codec), want, af->fp);
+		codec_decode(af->codec, buf, len, samples + total);
+		total += len;
+		if (len < want) {
+			break;
+		}
+	}
+	return total;
+}
+
+int16_t *audio_load(const char *filename, size_t *len)
+{
+	struct audio_file af;
+	int16_t *samples = NULL, *tmp;
+	size_t alloced = 0, res;
+
+	if (audio_open(&af, filename)) {
+		return NULL;
+	}
+	*len = 0;
+	do {
+		if (*len == alloced) {
+			alloced = alloced ? alloced * 2 : 8000;
+			tmp = realloc(samples, alloced * sizeof(*samples));
+			if (!tmp) {
+				free(samples);
+				audio_close(&af);
+				return NULL;
+			}
+			samples = tmp;
+		}
+		res = audio_read(&af, samples + *len, alloced - *len);
+		*len += res;
+	} while (res);
+	audio_close(&af);
+	return samples;
+}
+
+void audio_close(struct audio_file *af)
+{
+	fclose(af->fp);
+}
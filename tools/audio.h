@@ -0,0 +1,45 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Audio file input for the tools
+ *
+ * The format is determined from the file extension: .sln, .ulaw, .alaw,
+ * or .wav (16-bit mono PCM), all 8 kHz.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+struct audio_file {
+	FILE *fp;
+	enum codec codec;
+};
+
+/*! \brief Open an audio file. Returns 0 on success, -1 on failure (with an error printed). */
+int audio_open(struct audio_file *af, const char *filename);
+
+/*! \brief Read audio, as signed linear. Returns the number of samples read, 0 at the end of the file. */
+size_t audio_read(struct audio_file *af, int16_t *samples, size_t max);
+
+/*! \brief Read a whole audio file, as signed linear. Returns NULL on failure. */
+int16_t *audio_load(const char *filename, size_t *len);
+
+void audio_close(struct audio_file *af);
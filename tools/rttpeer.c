@@ -0,0 +1,277 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief RTT (T.140 over RTP) peer, for testing the RTT gateway
+ *
+ * Text from stdin is sent as it is read, or typed at a fixed rate (-c).
+ * Text received is printed on stdout.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "rtp.h"
+#include "rtt.h"
+
+#define PEER_MAX_INPUT 65536
+
+static volatile sig_atomic_t stop = 0;
+static uint64_t rng_state = 1;
+
+static void stop_handler(int signum)
+{
+	(void) signum;
+	stop = 1;
+}
+
+static double peer_rand(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (double) ((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static int connect_to(int fd, const char *dest)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	char *port;
+	int ret = -1;
+
+	snprintf(host, sizeof(host), "%s", dest);
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "Destination must be host:port\n");
+		return -1;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res)) {
+		fprintf(stderr, "Invalid destination: %s\n", dest);
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			ret = 0;
+			break;
+		}
+	}
+	freeaddrinfo(res);
+	if (ret) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", dest, strerror(errno));
+	}
+	return ret;
+}
+
+/*! \brief Print received text, with line separators as newlines */
+static void print_text(const char *text, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (i + 2 < len && !memcmp(text + i, "\xe2\x80\xa8", 3)) {
+			putchar('\n');
+			i += 2;
+		} else {
+			putchar(text[i]);
+		}
+	}
+	fflush(stdout);
+}
+
+static void show_help(void)
+{
+	printf("rttpeer: send and receive real-time text (T.140 with redundancy, RFC 4103)\n");
+	printf("Usage: rttpeer [options] -p <port> -d <host:port>\n");
+	printf(" -c <cps>     Type stdin at this many characters per second. Default is to send it as it is read.\n");
+	printf(" -D <rate>    Fraction of packets to drop, to test redundancy. Default is 0.\n");
+	printf(" -d <dest>    Peer host:port\n");
+	printf(" -h           Show this help\n");
+	printf(" -p <port>    Local UDP port\n");
+	printf(" -r <seed>    Random seed. Default is 1.\n");
+	printf(" -t <secs>    Exit this long after the end of input. Default is to run until interrupted.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static char input[PEER_MAX_INPUT];
+	struct t140_tx tx;
+	struct t140_rx rx;
+	struct pollfd pfds[2];
+	unsigned char pkt[RTT_PACKET_SIZE + 64];
+	char text[RTT_MAX_TEXT];
+	const char *dest = NULL;
+	size_t input_len = 0, typed = 0;
+	unsigned long sent = 0, dropped = 0;
+	double drop_rate = 0, cps = 0;
+	uint64_t next_key = 0, eof_ms = 0;
+	int c, fd, port = -1, linger = -1, eof = 0;
+
+	while ((c = getopt(argc, argv, "?c:D:d:hp:r:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			cps = atof(optarg);
+			break;
+		case 'D':
+			drop_rate = atof(optarg);
+			break;
+		case 'd':
+			dest = optarg;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'r':
+			rng_state = strtoull(optarg, NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+			break;
+		case 't':
+			linger = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+	if (!dest || port < 0) {
+		show_help();
+		return -1;
+	}
+
+	fd = rtp_bind(NULL, port);
+	if (fd < 0 || connect_to(fd, dest)) {
+		return -1;
+	}
+	t140_tx_init(&tx, (uint32_t) (peer_rand() * 4294967296.0));
+	t140_rx_init(&rx);
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	pfds[0].fd = fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = STDIN_FILENO;
+	pfds[1].events = POLLIN;
+
+	while (!stop) {
+		uint64_t now = now_ms();
+		int timeout = -1, due, res;
+
+		/* Type whatever is due */
+		if (cps > 0) {
+			while (typed < input_len && now >= next_key) {
+				if (!t140_tx_queue(&tx, input + typed, 1, now)) {
+					break; /* Full, until the next packet */
+				}
+				typed++;
+				next_key = (next_key ? next_key : now) + (uint64_t) (1000 / cps);
+			}
+			if (typed < input_len) {
+				timeout = (int) (next_key > now ? next_key - now : 0);
+			}
+		} else if (typed < input_len) {
+			typed += t140_tx_queue(&tx, input + typed, input_len - typed, now);
+		}
+
+		due = t140_tx_due(&tx, now);
+		if (!due) {
+			size_t len = t140_tx_packet(&tx, now, pkt);
+			if (drop_rate > 0 && peer_rand() < drop_rate) {
+				dropped++;
+			} else if (send(fd, pkt, len, 0) < 0 && errno != ECONNREFUSED) {
+				fprintf(stderr, "send failed: %s\n", strerror(errno));
+			}
+			sent++;
+			due = t140_tx_due(&tx, now);
+		}
+		if (due >= 0 && (timeout < 0 || due < timeout)) {
+			timeout = due;
+		}
+
+		if (eof && typed == input_len && due < 0 && linger >= 0) {
+			if (!eof_ms) {
+				eof_ms = now;
+			}
+			if (now >= eof_ms + (uint64_t) linger * 1000) {
+				break;
+			}
+			if (timeout < 0 || (uint64_t) timeout > eof_ms + (uint64_t) linger * 1000 - now) {
+				timeout = (int) (eof_ms + (uint64_t) linger * 1000 - now);
+			}
+		}
+
+		pfds[1].fd = eof || input_len == sizeof(input) ? -1 : STDIN_FILENO;
+		res = poll(pfds, 2, timeout);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfds[1].revents) {
+			ssize_t len = read(STDIN_FILENO, input + input_len, sizeof(input) - input_len);
+			if (len <= 0) {
+				eof = 1;
+			} else {
+				input_len += (size_t) len;
+			}
+		}
+		if (pfds[0].revents) {
+			ssize_t len;
+			while ((len = recv(fd, pkt, sizeof(pkt), MSG_DONTWAIT)) >= 0) {
+				res = t140_rx_packet(&rx, pkt, (size_t) len, text, sizeof(text));
+				if (res > 0) {
+					print_text(text, (size_t) res);
+				}
+			}
+		}
+	}
+
+	fprintf(stderr, "\nSent %lu packets (%lu dropped), received %lu (%lu lost, %lu recovered)\n",
+		sent, dropped, rx.packets, rx.lost, rx.recovered);
+	close(fd);
+	return 0;
+}
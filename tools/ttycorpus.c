@@ -0,0 +1,631 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Synthetic TTY audio corpus generator, for benchmarking Baudot decoders
+ *
+ * Each corpus item is an audio file (8 kHz mono) and a ground-truth transcript
+ * of exactly what was sent. Impairments are chosen per item from the ranges
+ * given on the command line, using a PRNG seeded from the item number,
+ * so a corpus can be regenerated exactly.
+ *
+ * The corpus directory also gets a manifest.tsv, with one line per item:
+ * audio file, duration, SNR, clock drift, frequency offset, dropout rate, talk-over level, text, echo level.
+ * This is what ttyscore reads.
+ *
+ * With echo (-e), each item starts with a local transmission (our own turn),
+ * and its echo is mixed into the received audio. What was sent is written
+ * to a .ref file alongside the item, for decoders that do echo suppression.
+ * A decoder that hears itself will score insertions.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "baudot.h"
+#include "codec.h"
+
+#define CORPUS_MAX_TEXTS 4096
+#define CORPUS_MAX_TEXT_LEN 256
+#define CORPUS_MAX_SNRS 16
+#define CORPUS_FRAME_SAMPLES 160 /* 20 ms, the usual RTP packetization */
+
+struct corpus_item {
+	char text[CORPUS_MAX_TEXT_LEN];	/*!< What was actually sent (unsendable characters removed) */
+	double seconds;
+	double snr;			/*!< INFINITY = no noise */
+	double drift_ppm;
+	double offset_hz;
+	double talkover_db;	/*!< -INFINITY = none */
+	double echo_db;		/*!< -INFINITY = none */
+};
+
+/* Options */
+static const char *outdir = NULL;
+static char *texts[CORPUS_MAX_TEXTS];
+static int num_texts = 0;
+static double snrs[CORPUS_MAX_SNRS];
+static int num_snrs = 0;
+static enum codec codec = CODEC_SLIN;
+static double max_drift_ppm = 0;
+static double max_offset_hz = 0;
+static double dropout_rate = 0;
+static double talkover_db = -INFINITY;
+static double echo_db = -INFINITY;
+static int write_wav = 0;
+static unsigned long seed = 1;
+
+static struct corpus_item *items;
+static int num_items = 100;
+static int next_item = 0;
+static int failed = 0;
+
+static const char *default_texts[] = {
+	"HELLO THIS IS THE RELAY OPERATOR GA",
+	"HI IM CALLING ABOUT MY APPOINTMENT ON TUESDAY GA",
+	"YES I CAN HOLD Q GA",
+	"MY NUMBER IS 555-0142 GA",
+	"THANK YOU VERY MUCH BYE SK",
+	"PLEASE CALL ME BACK AT 8:30 TOMORROW GA",
+	"THE TOTAL IS $42.17, IS THAT OK? GA",
+	"I DIDNT GET THAT, PLEASE REPEAT GA",
+	"WHAT IS YOUR ACCOUNT NUMBER Q GA",
+	"OK (SMILE) SEE YOU THEN GA",
+	"THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 1234567890 GA",
+	"HOLD PLEASE GA",
+};
+
+/*! \brief xorshift64*: fast, and deterministic per item */
+static double item_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (double) ((*state * 2685821657736338717ULL) >> 11) / 9007199254740992.0; /* [0, 1) */
+}
+
+static double item_uniform(uint64_t *state, double lo, double hi)
+{
+	return lo + (hi - lo) * item_rand(state);
+}
+
+static double item_gaussian(uint64_t *state)
+{
+	/* Box-Muller */
+	double u1 = item_rand(state), u2 = item_rand(state);
+	if (u1 < 1e-300) {
+		u1 = 1e-300;
+	}
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static int16_t clip16(double sample)
+{
+	if (sample > 32767) {
+		return 32767;
+	} else if (sample < -32768) {
+		return -32768;
+	}
+	return (int16_t) lrint(sample);
+}
+
+/*!
+ * \brief Add speech-like talk-over: voiced segments with a harmonic spectrum shaped by
+ *        three formants and a syllable-rate envelope, covering roughly a third of the item.
+ */
+static void add_talkover(uint64_t *state, double *audio, size_t len, double rms)
+{
+	size_t pos = (size_t) item_uniform(state, 0, BAUDOT_SAMPLE_RATE);
+
+	while (pos < len) {
+		size_t i, seglen = (size_t) (item_uniform(state, 0.3, 1.5) * BAUDOT_SAMPLE_RATE);
+		double f0 = item_uniform(state, 90, 220);
+		double formants[3] = { item_uniform(state, 300, 800), item_uniform(state, 900, 2200), item_uniform(state, 2300, 3000) };
+		double weights[40], norm = 0;
+		int h, harmonics = (int) (3400 / f0);
+
+		if (harmonics > 40) {
+			harmonics = 40;
+		}
+		for (h = 1; h <= harmonics; h++) {
+			int f;
+			weights[h - 1] = 0;
+			for (f = 0; f < 3; f++) {
+				double d = (h * f0 - formants[f]) / 150;
+				weights[h - 1] += exp(-d * d) / (f + 1);
+			}
+			norm += weights[h - 1] * weights[h - 1] / 2;
+		}
+		norm = norm > 0 ? rms / sqrt(norm) : 0;
+
+		for (i = 0; i < seglen && pos + i < len; i++) {
+			double t = (double) i / BAUDOT_SAMPLE_RATE, v = 0;
+			double envelope = 0.5 - 0.5 * cos(2 * M_PI * 4 * t); /* ~4 syllables/second */
+			for (h = 1; h <= harmonics; h++) {
+				v += weights[h - 1] * sin(2 * M_PI * h * f0 * t);
+			}
+			audio[pos + i] += v * norm * envelope * 1.633; /* The envelope has 3/8 power, so scale by sqrt(8/3) */
+		}
+		pos += seglen * 3 + (size_t) item_uniform(state, 0, BAUDOT_SAMPLE_RATE);
+	}
+}
+
+/*! \brief Write audio to <outdir>/<n><suffix>.<ext> */
+/*!
+ * \brief Add line echo of what we sent: a hybrid reflection with a short dispersive
+ *        tail, 1 to 5 ms after the reference, at the given gain
+ */
+static void add_echo(uint64_t *state, double *audio, const int16_t *reference, size_t len, double gain)
+{
+	static const double response[] = { 1, 0.35, -0.4, 0.1, 0, 0.15, -0.05 };
+	size_t i, k, delay = (size_t) item_uniform(state, 8, 40);
+	double re = 0, im = 0, w = 2 * M_PI * (BAUDOT_MARK_HZ + BAUDOT_SPACE_HZ) / 2 / BAUDOT_SAMPLE_RATE;
+
+	/* Normalize, so the echo is at the given level at the TTY frequencies */
+	for (k = 0; k < sizeof(response) / sizeof(response[0]); k++) {
+		re += response[k] * cos(w * (double) k);
+		im -= response[k] * sin(w * (double) k);
+	}
+	gain /= sqrt(re * re + im * im);
+
+	for (i = 0; i < len; i++) {
+		for (k = 0; k < sizeof(response) / sizeof(response[0]); k++) {
+			if (i >= delay + k) {
+				audio[i] += gain * response[k] * reference[i - delay - k];
+			}
+		}
+	}
+}
+
+static int write_audio(int n, const char *suffix, const int16_t *samples, size_t len)
+{
+	char path[512];
+	const char *ext;
+	FILE *fp;
+
+	if (write_wav) {
+		ext = "wav";
+	} else {
+		ext = codec_name(codec);
+	}
+	snprintf(path, sizeof(path), "%s/%05d%s.%s", outdir, n, suffix, ext);
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (write_wav) {
+		uint32_t data_len = (uint32_t) (len * 2), u32;
+		uint16_t u16;
+		fwrite("RIFF", 1, 4, fp);
+		u32 = 36 + data_len;
+		fwrite(&u32, 4, 1, fp);
+		fwrite("WAVEfmt ", 1, 8, fp);
+		u32 = 16;
+		fwrite(&u32, 4, 1, fp);
+		u16 = 1; /* PCM */
+		fwrite(&u16, 2, 1, fp);
+		fwrite(&u16, 2, 1, fp); /* Mono */
+		u32 = BAUDOT_SAMPLE_RATE;
+		fwrite(&u32, 4, 1, fp);
+		u32 = BAUDOT_SAMPLE_RATE * 2;
+		fwrite(&u32, 4, 1, fp);
+		u16 = 2;
+		fwrite(&u16, 2, 1, fp);
+		u16 = 16;
+		fwrite(&u16, 2, 1, fp);
+		fwrite("data", 1, 4, fp);
+		fwrite(&data_len, 4, 1, fp);
+	}
+
+	if (!write_wav && codec != CODEC_SLIN) {
+		unsigned char *encoded = malloc(len);
+		if (!encoded) {
+			fclose(fp);
+			return -1;
+		}
+		codec_encode(codec, samples, len, encoded);
+		fwrite(encoded, 1, len, fp);
+		free(encoded);
+	} else {
+		fwrite(samples, sizeof(int16_t), len, fp); /* Host byte order, same as Asterisk's .sln */
+	}
+	if (fclose(fp)) {
+		fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int write_item(int n, const int16_t *samples, size_t len)
+{
+	char path[512];
+	FILE *fp;
+
+	if (write_audio(n, "", samples, len)) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/%05d.txt", outdir, n);
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "%s\n", items[n].text);
+	fclose(fp);
+	return 0;
+}
+
+/*!
+ * \brief Send text: 150 ms of mark before the first character, and the carrier held 300 ms after
+ * \param tx
+ * \param text
+ * \param sent If not NULL, what was actually sent (unsendable characters removed)
+ * \param samples
+ * \param max
+ * \return Number of samples
+ */
+static size_t send_text(struct baudot_tx *tx, const char *text, char *sent, int16_t *samples, size_t max)
+{
+	size_t len;
+	int t = 0;
+
+	len = baudot_tx_tone(tx, 1, 150 / (1000 / BAUDOT_BAUD), samples, max);
+	for (; *text; text++) {
+		size_t charlen = baudot_tx_char(tx, *text, samples + len, max - len);
+		if (charlen) {
+			len += charlen;
+			if (sent && t < CORPUS_MAX_TEXT_LEN - 1) {
+				sent[t++] = *text;
+			}
+		}
+	}
+	if (sent) {
+		sent[t] = '\0';
+	}
+	len += baudot_tx_tone(tx, 1, 300 / (1000 / BAUDOT_BAUD), samples + len, max - len);
+	return len;
+}
+
+static int generate_item(int n)
+{
+	struct corpus_item *item = &items[n];
+	struct baudot_tx tx;
+	uint64_t state = (seed + (uint64_t) n) * 0x9E3779B97F4A7C15ULL + 1;
+	const char *text = texts[n % num_texts];
+	const char *local_text = texts[(n + 1) % num_texts];
+	int16_t *samples, *local = NULL;
+	double *audio, noise_sigma, tty_power;
+	size_t i, len = 0, max;
+	int res;
+
+	/* Half a second of silence before and after, and between turns */
+	max = 2 * BAUDOT_SAMPLE_RATE + strlen(text) * BAUDOT_MAX_CHAR_SAMPLES;
+	if (isfinite(echo_db)) {
+		max += BAUDOT_SAMPLE_RATE + strlen(local_text) * BAUDOT_MAX_CHAR_SAMPLES;
+		local = calloc(max, sizeof(*local));
+		if (!local) {
+			return -1;
+		}
+	}
+	samples = calloc(max, sizeof(*samples));
+	audio = calloc(max, sizeof(*audio));
+	if (!samples || !audio) {
+		free(samples);
+		free(audio);
+		free(local);
+		return -1;
+	}
+
+	baudot_tx_init(&tx);
+	item->drift_ppm = max_drift_ppm ? item_uniform(&state, -max_drift_ppm, max_drift_ppm) : 0;
+	item->offset_hz = max_offset_hz ? item_uniform(&state, -max_offset_hz, max_offset_hz) : 0;
+	item->snr = num_snrs ? snrs[n % num_snrs] : INFINITY;
+	item->talkover_db = talkover_db;
+	item->echo_db = echo_db;
+
+	len = BAUDOT_SAMPLE_RATE / 2;
+	if (local) {
+		/* Our own turn goes first, from our own (nominal) transmitter */
+		struct baudot_tx local_tx;
+		baudot_tx_init(&local_tx);
+		len += send_text(&local_tx, local_text, NULL, local + len, max - len);
+		len += BAUDOT_SAMPLE_RATE / 2;
+	}
+
+	tx.samples_per_bit *= 1 + item->drift_ppm / 1e6;
+	tx.mark_hz += item->offset_hz;
+	tx.space_hz += item->offset_hz;
+
+	len += send_text(&tx, text, item->text, samples + len, max - len);
+	len += BAUDOT_SAMPLE_RATE / 2;
+	item->seconds = (double) len / BAUDOT_SAMPLE_RATE;
+
+	for (i = 0; i < len; i++) {
+		audio[i] = samples[i];
+	}
+	tty_power = tx.amplitude * tx.amplitude / 2;
+
+	if (local) {
+		add_echo(&state, audio, local, len, pow(10, item->echo_db / 20));
+	}
+	if (isfinite(item->talkover_db)) {
+		add_talkover(&state, audio, len, sqrt(tty_power) * pow(10, item->talkover_db / 20));
+	}
+	if (isfinite(item->snr)) {
+		noise_sigma = sqrt(tty_power / pow(10, item->snr / 10));
+		for (i = 0; i < len; i++) {
+			audio[i] += noise_sigma * item_gaussian(&state);
+		}
+	}
+	if (dropout_rate > 0) {
+		/* Lost packets, with no concealment */
+		for (i = 0; i < len; i += CORPUS_FRAME_SAMPLES) {
+			if (item_rand(&state) < dropout_rate) {
+				size_t j;
+				for (j = i; j < i + CORPUS_FRAME_SAMPLES && j < len; j++) {
+					audio[j] = 0;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < len; i++) {
+		samples[i] = clip16(audio[i]);
+	}
+	/* Companding is an impairment too, so WAV output gets the G.711 round trip as well */
+	if (write_wav && codec != CODEC_SLIN) {
+		for (i = 0; i < len; i += CORPUS_FRAME_SAMPLES) {
+			unsigned char frame[CORPUS_FRAME_SAMPLES];
+			size_t frame_len = len - i < CORPUS_FRAME_SAMPLES ? len - i : CORPUS_FRAME_SAMPLES;
+			codec_encode(codec, samples + i, frame_len, frame);
+			codec_decode(codec, frame, frame_len, samples + i);
+		}
+	}
+
+	res = write_item(n, samples, len);
+	if (!res && local) {
+		res = write_audio(n, ".ref", local, len);
+	}
+	free(samples);
+	free(audio);
+	free(local);
+	return res;
+}
+
+static void *worker(void *varg)
+{
+	int n;
+
+	(void) varg;
+
+	while ((n = __atomic_fetch_add(&next_item, 1, __ATOMIC_RELAXED)) < num_items) {
+		if (generate_item(n)) {
+			__atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int load_texts(const char *filename)
+{
+	char line[CORPUS_MAX_TEXT_LEN];
+	FILE *fp = fopen(filename, "r");
+
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	while (num_texts < CORPUS_MAX_TEXTS && fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[0]) {
+			continue;
+		}
+		texts[num_texts] = strdup(line);
+		if (!texts[num_texts]) {
+			fclose(fp);
+			return -1;
+		}
+		num_texts++;
+	}
+	fclose(fp);
+	return num_texts ? 0 : -1;
+}
+
+static int parse_snrs(char *list)
+{
+	char *snr;
+
+	while ((snr = strsep(&list, ","))) {
+		if (num_snrs >= CORPUS_MAX_SNRS) {
+			return -1;
+		}
+		snrs[num_snrs++] = !strcasecmp(snr, "inf") ? INFINITY : atof(snr);
+	}
+	return 0;
+}
+
+static void show_help(void)
+{
+	printf("ttycorpus: generate TTY audio with ground-truth transcripts\n");
+	printf(" -c <codec>   slin (default), ulaw or alaw. Also the raw output format.\n");
+	printf(" -e <db>      Start each item with a local transmission, and add its echo at this level relative to\n");
+	printf("              the TTY signal (e.g. -10). What was sent is written to <item>.ref.<ext>. Default is none.\n");
+	printf(" -D <rate>    Fraction of 20 ms frames dropped. Default is 0.\n");
+	printf(" -d <ppm>     Max clock drift (uniform in +/- ppm per item). Default is 0.\n");
+	printf(" -f <hz>      Max frequency offset (uniform in +/- hz per item). Default is 0.\n");
+	printf(" -h           Show this help\n");
+	printf(" -i <file>    Text to send, one item per line. Default is a built-in set of phrases.\n");
+	printf(" -j <threads> Number of threads. Default is the number of CPUs.\n");
+	printf(" -n <count>   Number of items. Default is 100.\n");
+	printf(" -o <dir>     Output directory (required)\n");
+	printf(" -r <seed>    Random seed. Default is 1.\n");
+	printf(" -s <snrs>    Comma-separated SNRs in dB, used round robin (e.g. inf,30,20,10,6). Default is no noise.\n");
+	printf(" -t <db>      Add speech talk-over at this level relative to the TTY signal. Default is none.\n");
+	printf(" -w           Write WAV files (16-bit PCM) instead of raw audio\n");
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *threads;
+	struct timespec start, end;
+	double secs, audio_secs = 0;
+	char path[512];
+	FILE *fp;
+	int c, i, num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "?c:D:d:e:f:hi:j:n:o:r:s:t:w")) != -1) {
+		switch (c) {
+		case 'c':
+			i = codec_parse(optarg);
+			if (i < 0) {
+				fprintf(stderr, "Invalid codec: %s\n", optarg);
+				return -1;
+			}
+			codec = (enum codec) i;
+			break;
+		case 'D':
+			dropout_rate = atof(optarg);
+			break;
+		case 'd':
+			max_drift_ppm = atof(optarg);
+			break;
+		case 'e':
+			echo_db = atof(optarg);
+			break;
+		case 'f':
+			max_offset_hz = atof(optarg);
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'i':
+			if (load_texts(optarg)) {
+				return -1;
+			}
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'n':
+			num_items = atoi(optarg);
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			if (parse_snrs(optarg)) {
+				fprintf(stderr, "Too many SNRs\n");
+				return -1;
+			}
+			break;
+		case 't':
+			talkover_db = atof(optarg);
+			break;
+		case 'w':
+			write_wav = 1;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+
+	if (!outdir) {
+		fprintf(stderr, "No output directory specified (use -o flag)\n");
+		return -1;
+	}
+	if (mkdir(outdir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Failed to create %s: %s\n", outdir, strerror(errno));
+		return -1;
+	}
+	if (!num_texts) {
+		for (i = 0; i < (int) (sizeof(default_texts) / sizeof(default_texts[0])); i++) {
+			texts[num_texts++] = (char *) default_texts[i];
+		}
+	}
+	if (num_items < 1 || num_threads < 1) {
+		fprintf(stderr, "Invalid item or thread count\n");
+		return -1;
+	}
+
+	items = calloc((size_t) num_items, sizeof(*items));
+	threads = calloc((size_t) num_threads, sizeof(*threads));
+	if (!items || !threads) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL)) {
+			fprintf(stderr, "Failed to create thread\n");
+			num_threads = i;
+			failed = 1;
+			break;
+		}
+	}
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (failed) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/manifest.tsv", outdir);
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "# file\tseconds\tsnr_db\tdrift_ppm\toffset_hz\tdropout_rate\ttalkover_db\ttext\techo_db\n");
+	for (i = 0; i < num_items; i++) {
+		fprintf(fp, "%05d.%s\t%.3f\t%g\t%.1f\t%.2f\t%g\t%g\t%s\t%g\n", i,
+			write_wav ? "wav" : codec_name(codec),
+			items[i].seconds, items[i].snr, items[i].drift_ppm, items[i].offset_hz, dropout_rate, items[i].talkover_db, items[i].text, items[i].echo_db);
+		audio_secs += items[i].seconds;
+	}
+	fclose(fp);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Generated %d items (%.1f s of audio) in %.2f s with %d threads (%.0fx realtime)\n",
+		num_items, audio_secs, secs, num_threads, secs > 0 ? audio_secs / secs : 0);
+
+	free(threads);
+	free(items);
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Decode Baudot from an audio file, using the local decoder
+ *
+ * The decoded text is printed on stdout, so this can be used as the decoder for ttyscore.
+ * Audio is processed in 20 ms frames, as it would be from RTP.
+ *
+ * If what was transmitted on the same channel is available (the echo reference),
+ * our own tones can be suppressed, see echo.h.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "baudot.h"
+#include "codec.h"
+#include "echo.h"
+#include "audio.h"
+
+#define FRAME_SAMPLES 160
+
+static void show_help(void)
+{
+	printf("ttydecode: decode Baudot from an audio file\n");
+	printf("Usage: ttydecode [-e <reference file>] [-m <mode>] [-v] <audio file>\n");
+	printf(" -e <file>    Echo reference: audio that was transmitted on the same channel, time-aligned with the received audio\n");
+	printf(" -h           Show this help\n");
+	printf(" -m <mode>    Echo suppression: none, gate (default if -e) or cancel\n");
+	printf(" -v           Print statistics to stderr\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct audio_file rx_file, ref_file;
+	struct baudot_rx rx;
+	static struct echo_canceller ec;
+	int16_t samples[FRAME_SAMPLES], ref[FRAME_SAMPLES];
+	char text[FRAME_SAMPLES];
+	const char *reference = NULL;
+	int c, mode = -1, verbose = 0;
+	unsigned long total_samples = 0, total_chars = 0;
+	clock_t cpu;
+	size_t len;
+
+	while ((c = getopt(argc, argv, "?e:hm:v")) != -1) {
+		switch (c) {
+		case 'e':
+			reference = optarg;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'm':
+			mode = echo_mode_parse(optarg);
+			if (mode < 0) {
+				fprintf(stderr, "Invalid echo mode: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		show_help();
+		return -1;
+	}
+	if (mode < 0) {
+		mode = reference ? ECHO_GATE : ECHO_NONE;
+	}
+
+	if (audio_open(&rx_file, argv[optind])) {
+		return -1;
+	}
+	if (reference && audio_open(&ref_file, reference)) {
+		audio_close(&rx_file);
+		return -1;
+	}
+
+	baudot_rx_init(&rx);
+	echo_init(&ec, (enum echo_mode) mode);
+	cpu = clock();
+	while ((len = audio_read(&rx_file, samples, FRAME_SAMPLES)) > 0) {
+		size_t chars;
+		if (reference) {
+			size_t reflen = audio_read(&ref_file, ref, len);
+			echo_tx(&ec, ref, reflen);
+		}
+		if (!echo_rx(&ec, samples, len)) {
+			baudot_rx_reset(&rx);
+			total_samples += len;
+			continue;
+		}
+		chars = baudot_rx(&rx, samples, len, text, sizeof(text));
+		fwrite(text, 1, chars, stdout);
+		total_chars += chars;
+		total_samples += len;
+	}
+	cpu = clock() - cpu;
+	printf("\n");
+
+	if (verbose) {
+		double secs = (double) cpu / CLOCKS_PER_SEC;
+		fprintf(stderr, "%lu chars, %.2f s of audio, %lu/%lu frames skipped, %.3f s CPU (%.0fx realtime)\n",
+			total_chars, (double) total_samples / BAUDOT_SAMPLE_RATE, ec.skipped, ec.frames, secs,
+			secs > 0 ? (double) total_samples / BAUDOT_SAMPLE_RATE / secs : 0);
+	}
+
+	audio_close(&rx_file);
+	if (reference) {
+		audio_close(&ref_file);
+	}
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Receive RTP streams and decode Baudot from them
+ *
+ * Decoded text is printed on stdout, prefixed with the stream's SSRC.
+ * On exit (SIGINT or SIGTERM), or periodically, per-stream loss and
+ * jitter and the CPU used are printed to stderr.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "rtp.h"
+
+static volatile sig_atomic_t stop = 0;
+static uint32_t last_ssrc;
+static int have_last = 0;
+static int quiet = 0;
+
+static void stop_handler(int signum)
+{
+	(void) signum;
+	stop = 1;
+}
+
+static void on_text(uint32_t ssrc, const char *text, size_t len, void *data)
+{
+	if (quiet) {
+		return;
+	}
+	if (!have_last || ssrc != last_ssrc) {
+		printf("\n[%08x] ", ssrc);
+		last_ssrc = ssrc;
+		have_last = 1;
+	}
+	fwrite(text, 1, len, stdout);
+	fflush(stdout);
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (double) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + (double) (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void print_stats(struct rtp_receiver *rcv, unsigned long packets, double secs)
+{
+	struct rtp_stream_stats *stats;
+	unsigned long received = 0, lost = 0;
+	double cpu = cpu_seconds();
+	int i, n = rtp_receiver_streams(rcv);
+
+	stats = calloc((size_t) (n ? n : 1), sizeof(*stats));
+	if (!stats) {
+		return;
+	}
+	n = rtp_receiver_stats(rcv, stats, n);
+	fprintf(stderr, "\n%-10s %4s %10s %8s %6s %6s %11s %8s\n", "SSRC", "PT", "Received", "Lost", "Late", "Dup", "Jitter (ms)", "Chars");
+	for (i = 0; i < n; i++) {
+		fprintf(stderr, "%08x   %4d %10lu %8lu %6lu %6lu %11.2f %8lu\n", stats[i].ssrc, stats[i].payload_type,
+			stats[i].received, stats[i].lost, stats[i].late, stats[i].duplicate, stats[i].jitter_ms, stats[i].chars);
+		received += stats[i].received;
+		lost += stats[i].lost;
+	}
+	free(stats);
+	fprintf(stderr, "%d streams, %lu packets (%lu invalid), %.2f%% lost, %.2f s CPU in %.1f s (%.0f packets/CPU second)\n",
+		n, packets, rtp_receiver_invalid(rcv), received + lost ? 100.0 * (double) lost / (double) (received + lost) : 0,
+		cpu, secs, cpu > 0 ? (double) packets / cpu : 0);
+}
+
+static void show_help(void)
+{
+	printf("ttyrtp: receive RTP (PCMU or PCMA) streams and decode Baudot from them\n");
+	printf("Usage: ttyrtp [-a <addr>] [-i <secs>] [-q] -p <port>\n");
+	printf(" -a <addr>    Local address. Default is any.\n");
+	printf(" -h           Show this help\n");
+	printf(" -i <secs>    Print statistics this often. Default is only on exit.\n");
+	printf(" -p <port>    UDP port\n");
+	printf(" -q           Don't print decoded text\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct rtp_receiver *rcv;
+	struct pollfd pfd;
+	struct timespec start, now;
+	const char *addr = NULL;
+	unsigned long packets = 0;
+	int c, fd, port = -1, interval = 0;
+	time_t last_stats;
+
+	while ((c = getopt(argc, argv, "?a:hi:p:q")) != -1) {
+		switch (c) {
+		case 'a':
+			addr = optarg;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+	if (port < 0) {
+		show_help();
+		return -1;
+	}
+
+	fd = rtp_bind(addr, port);
+	if (fd < 0) {
+		return -1;
+	}
+	rcv = rtp_receiver_create(fd, on_text, NULL);
+	if (!rcv) {
+		close(fd);
+		return -1;
+	}
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last_stats = start.tv_sec;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!stop) {
+		int res = poll(&pfd, 1, 1000);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+		if (res > 0) {
+			res = rtp_receiver_poll(rcv);
+			if (res < 0) {
+				fprintf(stderr, "Failed to receive: %s\n", strerror(errno));
+				break;
+			}
+			packets += (unsigned long) res;
+		}
+		if (interval > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec - last_stats >= interval) {
+				print_stats(rcv, packets, (double) (now.tv_sec - start.tv_sec));
+				last_stats = now.tv_sec;
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	print_stats(rcv, packets, (double) (now.tv_sec - start.tv_sec) + (double) (now.tv_nsec - start.tv_nsec) / 1e9);
+	rtp_receiver_destroy(rcv);
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Send audio files as RTP streams, standing in for Asterisk
+ *
+ * Each stream sends one of the files (round robin) as 20 ms packets, in real time
+ * unless told otherwise. Packets can be dropped or reordered, to exercise the receiver.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#define _GNU_SOURCE /* sendmmsg */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "codec.h"
+#include "rtp.h"
+#include "audio.h"
+
+#define SEND_FRAME_SAMPLES 160
+#define SEND_PACKET_LEN (12 + SEND_FRAME_SAMPLES)
+#define SEND_BATCH 64
+#define SEND_MAX_FILES 256
+
+struct send_stream {
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t timestamp;
+	const unsigned char *audio;	/*!< Encoded audio */
+	size_t len;
+	size_t pos;
+	int held;					/*!< A packet is being held back, to send after the next one */
+	unsigned char held_pkt[SEND_PACKET_LEN];
+};
+
+static uint64_t rng_state = 1;
+
+static double send_rand(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (double) ((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static void build_packet(unsigned char *pkt, int pt, struct send_stream *s, const unsigned char *payload)
+{
+	pkt[0] = 0x80;
+	pkt[1] = (unsigned char) pt;
+	pkt[2] = (unsigned char) (s->seq >> 8);
+	pkt[3] = (unsigned char) s->seq;
+	pkt[4] = (unsigned char) (s->timestamp >> 24);
+	pkt[5] = (unsigned char) (s->timestamp >> 16);
+	pkt[6] = (unsigned char) (s->timestamp >> 8);
+	pkt[7] = (unsigned char) s->timestamp;
+	pkt[8] = (unsigned char) (s->ssrc >> 24);
+	pkt[9] = (unsigned char) (s->ssrc >> 16);
+	pkt[10] = (unsigned char) (s->ssrc >> 8);
+	pkt[11] = (unsigned char) s->ssrc;
+	memcpy(pkt + 12, payload, SEND_FRAME_SAMPLES);
+}
+
+static int connect_to(const char *dest)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1;
+
+	snprintf(host, sizeof(host), "%s", dest);
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "Destination must be host:port\n");
+		return -1;
+	}
+	host[port - host] = '\0';
+	port++;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res)) {
+		fprintf(stderr, "Invalid destination: %s\n", dest);
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && !connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			break;
+		}
+		if (fd >= 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", dest, strerror(errno));
+	}
+	return fd;
+}
+
+/*! \brief Send packets, in batches */
+struct send_batch {
+	int fd;
+	int count;
+	unsigned long sent;
+	struct mmsghdr msgs[SEND_BATCH];
+	struct iovec iovs[SEND_BATCH];
+	unsigned char pkts[SEND_BATCH][SEND_PACKET_LEN];
+};
+
+static void batch_flush(struct send_batch *b)
+{
+	int i, res;
+
+	for (i = 0; i < b->count; i += res) {
+		res = sendmmsg(b->fd, b->msgs + i, (unsigned int) (b->count - i), 0);
+		if (res <= 0) {
+			if (res < 0 && errno != EINTR) {
+				fprintf(stderr, "sendmmsg failed: %s\n", strerror(errno));
+				break; /* Drop the rest, like the network would */
+			}
+			res = 0;
+		}
+		b->sent += (unsigned long) res;
+	}
+	b->count = 0;
+}
+
+static unsigned char *batch_next(struct send_batch *b)
+{
+	if (b->count == SEND_BATCH) {
+		batch_flush(b);
+	}
+	return b->pkts[b->count++];
+}
+
+static void show_help(void)
+{
+	printf("ttyrtpsend: send audio files as RTP streams\n");
+	printf("Usage: ttyrtpsend [options] -d <host:port> <audio file> ...\n");
+	printf(" -c <codec>   ulaw (default) or alaw\n");
+	printf(" -D <rate>    Fraction of packets to drop. Default is 0.\n");
+	printf(" -d <dest>    Destination host:port\n");
+	printf(" -f           Send as fast as possible, rather than in real time\n");
+	printf(" -h           Show this help\n");
+	printf(" -n <count>   Number of streams. Default is the number of files.\n");
+	printf(" -R <rate>    Fraction of packets to swap with the next one. Default is 0.\n");
+	printf(" -r <seed>    Random seed. Default is 1.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct send_batch batch;
+	struct send_stream *streams;
+	unsigned char *encoded[SEND_MAX_FILES];
+	size_t lengths[SEND_MAX_FILES];
+	struct timespec next, start, end;
+	const char *dest = NULL;
+	enum codec codec = CODEC_ULAW;
+	double drop_rate = 0, reorder_rate = 0, secs;
+	int c, i, num_files, num_streams = 0, fast = 0, active;
+
+	while ((c = getopt(argc, argv, "?c:D:d:fhn:R:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			i = codec_parse(optarg);
+			if (i != CODEC_ULAW && i != CODEC_ALAW) {
+				fprintf(stderr, "Invalid codec: %s\n", optarg);
+				return -1;
+			}
+			codec = (enum codec) i;
+			break;
+		case 'D':
+			drop_rate = atof(optarg);
+			break;
+		case 'd':
+			dest = optarg;
+			break;
+		case 'f':
+			fast = 1;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'n':
+			num_streams = atoi(optarg);
+			break;
+		case 'R':
+			reorder_rate = atof(optarg);
+			break;
+		case 'r':
+			rng_state = strtoull(optarg, NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+	num_files = argc - optind;
+	if (!dest || num_files < 1 || num_files > SEND_MAX_FILES) {
+		show_help();
+		return -1;
+	}
+	if (num_streams < 1) {
+		num_streams = num_files;
+	}
+
+	for (i = 0; i < num_files; i++) {
+		int16_t *samples = audio_load(argv[optind + i], &lengths[i]);
+		if (!samples) {
+			return -1;
+		}
+		lengths[i] -= lengths[i] % SEND_FRAME_SAMPLES;
+		encoded[i] = malloc(lengths[i] ? lengths[i] : 1);
+		if (!encoded[i]) {
+			free(samples);
+			return -1;
+		}
+		codec_encode(codec, samples, lengths[i], encoded[i]);
+		free(samples);
+	}
+
+	batch.fd = connect_to(dest);
+	if (batch.fd < 0) {
+		return -1;
+	}
+	for (i = 0; i < SEND_BATCH; i++) {
+		batch.iovs[i].iov_base = batch.pkts[i];
+		batch.iovs[i].iov_len = SEND_PACKET_LEN;
+		batch.msgs[i].msg_hdr.msg_iov = &batch.iovs[i];
+		batch.msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	streams = calloc((size_t) num_streams, sizeof(*streams));
+	if (!streams) {
+		return -1;
+	}
+	for (i = 0; i < num_streams; i++) {
+		streams[i].ssrc = (uint32_t) (send_rand() * 4294967296.0);
+		streams[i].seq = (uint16_t) (send_rand() * 65536);
+		streams[i].timestamp = (uint32_t) (send_rand() * 4294967296.0);
+		streams[i].audio = encoded[i % num_files];
+		streams[i].len = lengths[i % num_files];
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	next = start;
+	do {
+		active = 0;
+		for (i = 0; i < num_streams; i++) {
+			struct send_stream *s = &streams[i];
+			unsigned char pkt[SEND_PACKET_LEN];
+
+			if (s->pos >= s->len) {
+				if (s->held) {
+					memcpy(batch_next(&batch), s->held_pkt, SEND_PACKET_LEN);
+					s->held = 0;
+				}
+				continue;
+			}
+			active = 1;
+			build_packet(pkt, codec == CODEC_ULAW ? RTP_PT_PCMU : RTP_PT_PCMA, s, s->audio + s->pos);
+			s->pos += SEND_FRAME_SAMPLES;
+			s->seq++;
+			s->timestamp += SEND_FRAME_SAMPLES;
+
+			if (drop_rate > 0 && send_rand() < drop_rate) {
+				continue;
+			}
+			if (s->held) {
+				memcpy(batch_next(&batch), pkt, SEND_PACKET_LEN);
+				memcpy(batch_next(&batch), s->held_pkt, SEND_PACKET_LEN);
+				s->held = 0;
+			} else if (reorder_rate > 0 && send_rand() < reorder_rate) {
+				memcpy(s->held_pkt, pkt, SEND_PACKET_LEN);
+				s->held = 1;
+			} else {
+				memcpy(batch_next(&batch), pkt, SEND_PACKET_LEN);
+			}
+		}
+		batch_flush(&batch);
+
+		if (!fast) {
+			next.tv_nsec += 20000000;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	} while (active);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "Sent %lu packets on %d streams in %.2f s\n", batch.sent, num_streams, secs);
+
+	close(batch.fd);
+	free(streams);
+	for (i = 0; i < num_files; i++) {
+		free(encoded[i]);
+	}
+	return 0;
+}
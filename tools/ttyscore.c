@@ -0,0 +1,344 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Score a Baudot decoder against a corpus generated by ttycorpus
+ *
+ * The decoder is any command that takes an audio file and prints the decoded text on stdout.
+ * For corpora generated with echo, it can also be given the item's echo reference.
+ * Alternately, if the decoder has already been run, its output can be
+ * provided as a .hyp file alongside each item's .txt file.
+ *
+ * Accuracy is reported as character error rate (edit distance / transcript length),
+ * after normalizing case and whitespace, overall and by SNR.
+ * Throughput is audio duration / decoder wall time.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+
+#define SCORE_MAX_TEXT 4096
+#define SCORE_MAX_GROUPS 32
+
+struct score_group {
+	double snr;
+	int items;
+	int exact;			/*!< Items decoded with no errors */
+	long errors;		/*!< Total edit distance */
+	long chars;			/*!< Total reference characters */
+	double audio_secs;
+	double decode_secs;
+};
+
+static struct score_group groups[SCORE_MAX_GROUPS];
+static int num_groups = 0;
+
+/*! \brief Uppercase, convert all whitespace runs to a single space, and trim */
+static void normalize(char *s)
+{
+	char *in = s, *out = s;
+	int space = 1; /* Skip leading whitespace */
+
+	for (; *in; in++) {
+		if (isspace((unsigned char) *in)) {
+			if (!space) {
+				*out++ = ' ';
+				space = 1;
+			}
+		} else {
+			*out++ = (char) toupper((unsigned char) *in);
+			space = 0;
+		}
+	}
+	if (out > s && out[-1] == ' ') {
+		out--;
+	}
+	*out = '\0';
+}
+
+/*! \brief Levenshtein distance, using a single row */
+static long edit_distance(const char *a, const char *b)
+{
+	size_t i, j, alen = strlen(a), blen = strlen(b);
+	long *row, diag, res;
+
+	row = malloc((blen + 1) * sizeof(*row));
+	if (!row) {
+		return -1;
+	}
+	for (j = 0; j <= blen; j++) {
+		row[j] = (long) j;
+	}
+	for (i = 1; i <= alen; i++) {
+		diag = row[0];
+		row[0] = (long) i;
+		for (j = 1; j <= blen; j++) {
+			long above = row[j];
+			long best = diag + (a[i - 1] != b[j - 1]);
+			if (above + 1 < best) {
+				best = above + 1;
+			}
+			if (row[j - 1] + 1 < best) {
+				best = row[j - 1] + 1;
+			}
+			row[j] = best;
+			diag = above;
+		}
+	}
+	res = row[blen];
+	free(row);
+	return res;
+}
+
+static struct score_group *get_group(double snr)
+{
+	int i;
+
+	for (i = 0; i < num_groups; i++) {
+		if (groups[i].snr == snr || (isinf(snr) && isinf(groups[i].snr))) {
+			return &groups[i];
+		}
+	}
+	if (num_groups >= SCORE_MAX_GROUPS) {
+		return NULL;
+	}
+	groups[num_groups].snr = snr;
+	return &groups[num_groups++];
+}
+
+/*!
+ * \brief Run the decoder command on an audio file. %s in the command is replaced with the file, or the file is appended.
+ *        %r is replaced with the item's echo reference (<item>.ref.<ext>).
+ */
+static int run_decoder(const char *decoder, const char *audiofile, char *buf, size_t len, double *secs)
+{
+	char cmd[1024], reference[512];
+	struct timespec start, end;
+	const char *ext = strrchr(audiofile, '.');
+	size_t bytes = 0, res, pos = 0;
+	int have_file = 0, base = ext ? (int) (ext - audiofile) : (int) strlen(audiofile);
+	FILE *pfp;
+
+	snprintf(reference, sizeof(reference), "%.*s.ref%s", base, audiofile, ext ? ext : "");
+	for (; *decoder && pos < sizeof(cmd) - 1; decoder++) {
+		if (*decoder == '%' && (*(decoder + 1) == 's' || *(decoder + 1) == 'r')) {
+			have_file |= *(decoder + 1) == 's';
+			pos += (size_t) snprintf(cmd + pos, sizeof(cmd) - pos, "%s", *(decoder + 1) == 's' ? audiofile : reference);
+			decoder++;
+		} else {
+			cmd[pos++] = *decoder;
+		}
+	}
+	if (pos >= sizeof(cmd)) {
+		fprintf(stderr, "Decoder command too long\n");
+		return -1;
+	}
+	cmd[pos] = '\0';
+	if (!have_file) {
+		snprintf(cmd + pos, sizeof(cmd) - pos, " %s", audiofile);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pfp = popen(cmd, "r");
+	if (!pfp) {
+		fprintf(stderr, "Failed to run %s: %s\n", cmd, strerror(errno));
+		return -1;
+	}
+	while (bytes < len - 1 && (res = fread(buf + bytes, 1, len - 1 - bytes, pfp)) > 0) {
+		bytes += res;
+	}
+	buf[bytes] = '\0';
+	if (pclose(pfp)) {
+		fprintf(stderr, "Decoder exited with failure on %s\n", audiofile);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return 0;
+}
+
+static int read_file(const char *filename, char *buf, size_t len)
+{
+	size_t bytes;
+	FILE *fp = fopen(filename, "r");
+
+	if (!fp) {
+		return -1;
+	}
+	bytes = fread(buf, 1, len - 1, fp);
+	buf[bytes] = '\0';
+	fclose(fp);
+	return 0;
+}
+
+static void print_row(const char *label, struct score_group *g)
+{
+	printf("%8s %6d %9.2f%% %7.1f%%", label, g->items,
+		g->chars ? 100.0 * (double) g->errors / (double) g->chars : 0, g->items ? 100.0 * g->exact / g->items : 0);
+	if (g->decode_secs > 0) {
+		printf(" %12.1fx", g->audio_secs / g->decode_secs);
+	}
+	printf("\n");
+}
+
+static void show_help(void)
+{
+	printf("ttyscore: score a Baudot decoder against a ttycorpus corpus\n");
+	printf("Usage: ttyscore [-d <decoder command>] <corpus dir>\n");
+	printf(" -d <command> Decoder to run on each audio file. %%s is replaced with the file name (or it is appended).\n");
+	printf("              %%r is replaced with the item's echo reference, for corpora generated with echo (ttycorpus -e).\n");
+	printf("              If not specified, decoder output is read from <item>.hyp files.\n");
+	printf(" -h           Show this help\n");
+	printf(" -v           Show each item that has errors\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char line[SCORE_MAX_TEXT], path[512], ref[SCORE_MAX_TEXT], hyp[SCORE_MAX_TEXT];
+	const char *decoder = NULL, *dir;
+	struct score_group total;
+	int c, verbose = 0, i;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "?d:hv")) != -1) {
+		switch (c) {
+		case 'd':
+			decoder = optarg;
+			break;
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		show_help();
+		return -1;
+	}
+	dir = argv[optind];
+
+	snprintf(path, sizeof(path), "%s/manifest.tsv", dir);
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *fields[8], *tmp = line, *base;
+		struct score_group *g;
+		double secs = 0;
+		long errors;
+		int f;
+
+		if (line[0] == '#') {
+			continue;
+		}
+		line[strcspn(line, "\r\n")] = '\0';
+		for (f = 0; f < 8; f++) {
+			fields[f] = strsep(&tmp, "\t");
+			if (!fields[f]) {
+				break;
+			}
+		}
+		if (f < 8) {
+			continue; /* Malformed */
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", dir, fields[0]);
+		if (decoder) {
+			if (run_decoder(decoder, path, hyp, sizeof(hyp), &secs)) {
+				fclose(fp);
+				return -1;
+			}
+		} else {
+			base = strrchr(path, '.');
+			if (base) {
+				*base = '\0';
+			}
+			strncat(path, ".hyp", sizeof(path) - strlen(path) - 1);
+			if (read_file(path, hyp, sizeof(hyp))) {
+				fprintf(stderr, "No decoder output for %s (%s)\n", fields[0], path);
+				hyp[0] = '\0';
+			}
+		}
+
+		snprintf(ref, sizeof(ref), "%s", fields[7]);
+		normalize(ref);
+		normalize(hyp);
+		errors = edit_distance(ref, hyp);
+		if (errors < 0) {
+			fclose(fp);
+			return -1;
+		}
+
+		g = get_group(!strcmp(fields[2], "inf") ? INFINITY : atof(fields[2]));
+		if (!g) {
+			fprintf(stderr, "Too many SNR levels\n");
+			fclose(fp);
+			return -1;
+		}
+		g->items++;
+		g->exact += !errors;
+		g->errors += errors;
+		g->chars += (long) strlen(ref);
+		g->audio_secs += atof(fields[1]);
+		g->decode_secs += secs;
+
+		if (verbose && errors) {
+			printf("%s: %ld errors\n  REF: %s\n  HYP: %s\n", fields[0], errors, ref, hyp);
+		}
+	}
+	fclose(fp);
+
+	memset(&total, 0, sizeof(total));
+	printf("%8s %6s %10s %8s", "SNR (dB)", "Items", "CER", "Exact");
+	if (decoder) {
+		printf(" %13s", "Throughput");
+	}
+	printf("\n");
+	for (i = 0; i < num_groups; i++) {
+		char label[16];
+		snprintf(label, sizeof(label), "%g", groups[i].snr);
+		print_row(label, &groups[i]);
+		total.items += groups[i].items;
+		total.exact += groups[i].exact;
+		total.errors += groups[i].errors;
+		total.chars += groups[i].chars;
+		total.audio_secs += groups[i].audio_secs;
+		total.decode_secs += groups[i].decode_secs;
+	}
+	print_row("All", &total);
+	return 0;
+}
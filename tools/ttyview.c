@@ -0,0 +1,293 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Remote viewer: watch sessions served by AsTTYSpy (-v), without an AMI login
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "viewer.h"
+
+#define MAX_STREAMS 256
+
+struct view_stream {
+	uint64_t id;
+	uint64_t last_ms;
+	char channel[256];
+};
+
+static volatile sig_atomic_t stop = 0;
+static struct view_stream streams[MAX_STREAMS];
+static int num_streams = 0;
+static const struct view_stream *last_stream = NULL;
+static int last_tx = -1;
+static int show_times = 0;
+
+static void stop_handler(int signum)
+{
+	(void) signum;
+	stop = 1;
+}
+
+static int connect_to(const char *dest)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	char *port;
+	int fd = -1;
+
+	snprintf(host, sizeof(host), "%s", dest);
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "Server must be host:port\n");
+		return -1;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res)) {
+		fprintf(stderr, "Invalid server: %s\n", dest);
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && !connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			break;
+		}
+		if (fd >= 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", dest, strerror(errno));
+	}
+	return fd;
+}
+
+static struct view_stream *find_stream(uint64_t id)
+{
+	int i;
+
+	for (i = 0; i < num_streams; i++) {
+		if (streams[i].id == id) {
+			return &streams[i];
+		}
+	}
+	return NULL;
+}
+
+static void remove_stream(struct view_stream *s)
+{
+	if (last_stream == s || last_stream == &streams[num_streams - 1]) {
+		last_stream = NULL; /* Whatever is printed next needs a new prefix */
+	}
+	*s = streams[--num_streams];
+}
+
+/*! \brief Print a record, starting a new line if the channel or who is typing changed */
+static void print_record(struct view_stream *s, uint64_t dt, int tx, const unsigned char *text, size_t len)
+{
+	s->last_ms += dt;
+	if (last_stream != s || last_tx != tx) {
+		if (show_times) {
+			char buf[16];
+			time_t t = (time_t) (s->last_ms / 1000);
+			strftime(buf, sizeof(buf), "%H:%M:%S", localtime(&t));
+			printf("\n%s [%s] %s", buf, s->channel, tx ? "CA : " : "TTY: ");
+		} else {
+			printf("\n[%s] %s", s->channel, tx ? "CA : " : "TTY: ");
+		}
+		last_stream = s;
+		last_tx = tx;
+	}
+	fwrite(text, 1, len, stdout);
+}
+
+static int handle_frame(int type, const unsigned char *payload, size_t plen)
+{
+	const unsigned char *text;
+	struct view_stream *s;
+	uint64_t id, namelen, dt;
+	size_t pos, used, tlen;
+	int tx;
+
+	switch (type) {
+	case VIEWER_FRAME_SNAPSHOT:
+		pos = viewer_varint_get(payload, plen, &id);
+		used = pos ? viewer_varint_get(payload + pos, plen - pos, &namelen) : 0;
+		if (!used || namelen > plen - pos - used) {
+			return -1;
+		}
+		pos += used;
+		s = find_stream(id);
+		if (!s) {
+			if (num_streams == MAX_STREAMS) {
+				return 0;
+			}
+			s = &streams[num_streams++];
+		}
+		s->id = id;
+		snprintf(s->channel, sizeof(s->channel), "%.*s", (int) namelen, payload + pos);
+		pos += namelen;
+		used = viewer_varint_get(payload + pos, plen - pos, &s->last_ms);
+		if (!used) {
+			return -1;
+		}
+		pos += used;
+		printf("\n=== %s ===", s->channel);
+		last_stream = NULL;
+		while (pos < plen && (used = viewer_record_get(payload + pos, plen - pos, &dt, &tx, &text, &tlen))) {
+			print_record(s, dt, tx, text, tlen);
+			pos += used;
+		}
+		break;
+	case VIEWER_FRAME_DELTA:
+		pos = viewer_varint_get(payload, plen, &id);
+		s = pos ? find_stream(id) : NULL;
+		if (s && viewer_record_get(payload + pos, plen - pos, &dt, &tx, &text, &tlen)) {
+			print_record(s, dt, tx, text, tlen);
+		}
+		break;
+	case VIEWER_FRAME_END:
+		s = viewer_varint_get(payload, plen, &id) ? find_stream(id) : NULL;
+		if (s) {
+			printf("\n=== %s hung up ===", s->channel);
+			remove_stream(s);
+		}
+		break;
+	case VIEWER_FRAME_RESYNC:
+		printf("\n=== Fell behind, resynchronizing ===");
+		num_streams = 0;
+		last_stream = NULL;
+		break;
+	default:
+		break;
+	}
+	fflush(stdout);
+	return 0;
+}
+
+static void show_help(void)
+{
+	printf("ttyview: watch TTY sessions served by AsTTYSpy (-v)\n");
+	printf("Usage: ttyview [options] <host:port>\n");
+	printf(" -h           Show this help\n");
+	printf(" -p <glob>    Only watch channels matching this, e.g. PJSIP/lobby-*. Default is all.\n");
+	printf(" -t           Show the time each turn started\n");
+	printf(" -z           Ask for compression\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct viewer_client *client;
+	struct pollfd pfd;
+	const unsigned char *payload;
+	const char *pattern = NULL;
+	size_t plen;
+	int c, fd, type, res, flags = 0;
+
+	while ((c = getopt(argc, argv, "?hp:tz")) != -1) {
+		switch (c) {
+		case '?':
+		case 'h':
+			show_help();
+			return 0;
+		case 'p':
+			pattern = optarg;
+			break;
+		case 't':
+			show_times = 1;
+			break;
+		case 'z':
+			flags |= VIEWER_SUBSCRIBE_DEFLATE;
+			break;
+		default:
+			fprintf(stderr, "Invalid option: %c\n", c);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		show_help();
+		return -1;
+	}
+
+	fd = connect_to(argv[optind]);
+	if (fd < 0) {
+		return -1;
+	}
+	client = viewer_client_create(fd);
+	if (!client) {
+		close(fd);
+		return -1;
+	}
+	if (viewer_client_subscribe(client, pattern, flags)) {
+		fprintf(stderr, "Failed to subscribe\n");
+		viewer_client_destroy(client);
+		return -1;
+	}
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!stop) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (viewer_client_read(client)) {
+			fprintf(stderr, "\nDisconnected\n");
+			break;
+		}
+		while ((res = viewer_client_next(client, &type, &payload, &plen)) > 0) {
+			if (handle_frame(type, payload, plen)) {
+				res = -1;
+				break;
+			}
+		}
+		if (res < 0) {
+			fprintf(stderr, "\nInvalid data from server\n");
+			break;
+		}
+	}
+
+	fprintf(stderr, "\nReceived %lu bytes\n", (unsigned long) viewer_client_bytes(client));
+	viewer_client_destroy(client);
+	return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Chrome trace-event export of hot-path spans
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+/*
+ * Each thread that records a span gets its own single-producer ring buffer,
+ * so recording a span never takes a lock (only the first span on a thread does,
+ * to register the buffer). A background thread periodically drains all the
+ * buffers and appends the spans to the output file as Chrome "complete" events.
+ * If a ring fills up before it is drained, spans are dropped (and counted),
+ * rather than blocking the thread being traced.
+ *
+ * Threads come and go (TX queues, broadcast workers, the message gateway),
+ * so when one exits, its buffer is retired, and the flush thread frees it
+ * once it has drained it for the last time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096 /* Must be a power of 2 */
+#define TRACE_ARG_LEN 48
+#define TRACE_FLUSH_INTERVAL_MS 100
+
+struct trace_span {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	char arg[TRACE_ARG_LEN];
+};
+
+struct trace_buf {
+	struct trace_buf *next;
+	long tid;
+	unsigned int head;	/* Written only by the owning thread */
+	unsigned int tail;	/* Written only by the flush thread */
+	unsigned int dropped;
+	int retired;		/* Set when the owning thread exits */
+	struct trace_span spans[TRACE_RING_SIZE];
+};
+
+int trace_enabled = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+static struct trace_buf *trace_bufs = NULL;
+static __thread struct trace_buf *thread_buf = NULL;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static unsigned int retired_dropped = 0; /* Spans dropped by buffers that have been freed */
+static pthread_t trace_thread;
+static FILE *trace_fp = NULL;
+static int trace_events = 0;
+static int trace_stopping = 0;
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*! \brief Called when a thread that recorded spans exits */
+static void trace_thread_exit(void *varg)
+{
+	struct trace_buf *buf = varg;
+
+	thread_buf = NULL; /* In case another destructor records a span after this */
+	__atomic_store_n(&buf->retired, 1, __ATOMIC_RELEASE);
+}
+
+static void trace_key_create(void)
+{
+	pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+static struct trace_buf *trace_thread_buf(void)
+{
+	struct trace_buf *buf = calloc(1, sizeof(*buf));
+
+	if (!buf) {
+		return NULL;
+	}
+	buf->tid = syscall(SYS_gettid);
+	pthread_setspecific(trace_key, buf);
+
+	pthread_mutex_lock(&trace_lock);
+	buf->next = trace_bufs;
+	trace_bufs = buf;
+	pthread_mutex_unlock(&trace_lock);
+	return buf;
+}
+
+void trace_record(const char *name, uint64_t start, const char *arg)
+{
+	struct trace_span *span;
+	unsigned int head, tail;
+
+	if (!trace_enabled) {
+		return;
+	}
+	if (!thread_buf) {
+		thread_buf = trace_thread_buf();
+		if (!thread_buf) {
+			return;
+		}
+	}
+
+	head = thread_buf->head;
+	tail = __atomic_load_n(&thread_buf->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= TRACE_RING_SIZE) {
+		thread_buf->dropped++; /* Flush thread hasn't caught up, don't wait for it. */
+		return;
+	}
+
+	span = &thread_buf->spans[head & (TRACE_RING_SIZE - 1)];
+	span->name = name;
+	span->start = start;
+	span->end = trace_now();
+	if (arg) {
+		strncpy(span->arg, arg, sizeof(span->arg) - 1);
+		span->arg[sizeof(span->arg) - 1] = '\0';
+	} else {
+		span->arg[0] = '\0';
+	}
+	__atomic_store_n(&thread_buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void trace_write_arg(const char *arg)
+{
+	/* Channel names shouldn't need any escaping, but be safe since this is JSON. */
+	for (; *arg; arg++) {
+		if (*arg == '"' || *arg == '\\') {
+			fputc('\\', trace_fp);
+			fputc(*arg, trace_fp);
+		} else if ((unsigned char) *arg < 0x20) {
+			fprintf(trace_fp, "\\u%04x", (unsigned char) *arg);
+		} else {
+			fputc(*arg, trace_fp);
+		}
+	}
+}
+
+/*! \note Must be called with trace_lock held */
+static void trace_drain(void)
+{
+	struct trace_buf *buf, **prev;
+	pid_t pid = getpid();
+
+	for (prev = &trace_bufs; (buf = *prev);) {
+		int retired = __atomic_load_n(&buf->retired, __ATOMIC_ACQUIRE); /* Before head, so a retired buffer's head is final */
+		unsigned int head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		unsigned int tail = buf->tail;
+
+		for (; tail != head; tail++) {
+			struct trace_span *span = &buf->spans[tail & (TRACE_RING_SIZE - 1)];
+			fprintf(trace_fp, "%s\n{\"name\":\"%s\",\"cat\":\"asttyspy\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f",
+				trace_events++ ? "," : "", span->name, pid, buf->tid, span->start / 1000.0, (span->end - span->start) / 1000.0);
+			if (span->arg[0]) {
+				fprintf(trace_fp, ",\"args\":{\"channel\":\"");
+				trace_write_arg(span->arg);
+				fprintf(trace_fp, "\"}");
+			}
+			fprintf(trace_fp, "}");
+		}
+		__atomic_store_n(&buf->tail, tail, __ATOMIC_RELEASE);
+		if (retired) {
+			*prev = buf->next;
+			retired_dropped += buf->dropped;
+			free(buf);
+		} else {
+			prev = &buf->next;
+		}
+	}
+	fflush(trace_fp);
+}
+
+static void *trace_flush_thread(void *varg)
+{
+	struct timespec ts;
+
+	(void) varg;
+
+	pthread_mutex_lock(&trace_lock);
+	while (!trace_stopping) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += TRACE_FLUSH_INTERVAL_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&trace_cond, &trace_lock, &ts);
+		trace_drain();
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return NULL;
+}
+
+int trace_start(const char *filename)
+{
+	trace_fp = fopen(filename, "w");
+	if (!trace_fp) {
+		fprintf(stderr, "Failed to open trace file %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	fprintf(trace_fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	pthread_once(&trace_key_once, trace_key_create);
+	if (pthread_create(&trace_thread, NULL, trace_flush_thread, NULL)) {
+		fprintf(stderr, "Failed to create trace thread\n");
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return -1;
+	}
+	trace_enabled = 1;
+	atexit(trace_stop); /* The program exits from several places, make sure the file is always complete. */
+	return 0;
+}
+
+void trace_stop(void)
+{
+	struct trace_buf *buf;
+	unsigned int dropped;
+
+	if (!trace_fp) {
+		return;
+	}
+	trace_enabled = 0;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_stopping = 1;
+	pthread_cond_signal(&trace_cond);
+	pthread_mutex_unlock(&trace_lock);
+	if (!pthread_equal(trace_thread, pthread_self())) {
+		pthread_join(trace_thread, NULL);
+	}
+
+	/* Spans that finished after the flush thread's final pass. */
+	pthread_mutex_lock(&trace_lock);
+	trace_drain();
+	dropped = retired_dropped;
+	for (buf = trace_bufs; buf; buf = buf->next) {
+		dropped += buf->dropped;
+	}
+	fprintf(trace_fp, "\n]}\n");
+	fclose(trace_fp);
+	trace_fp = NULL;
+	pthread_mutex_unlock(&trace_lock);
+
+	if (dropped) {
+		fprintf(stderr, "Trace buffers overflowed, %u spans dropped\n", dropped);
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Chrome trace-event export of hot-path spans
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdint.h>
+
+/*! \brief Nonzero while a trace is being recorded. Checked before doing any tracing work. */
+extern int trace_enabled;
+
+/*!
+ * \brief Start recording spans to a Chrome trace-event JSON file
+ * \param filename File to write. It can be opened in chrome://tracing or ui.perfetto.dev
+ * \retval 0 on success, -1 on failure
+ */
+int trace_start(const char *filename);
+
+/*! \brief Stop recording, flush all pending spans and finish the JSON file. Safe to call more than once. */
+void trace_stop(void);
+
+/*! \brief Monotonic time in nanoseconds */
+uint64_t trace_now(void);
+
+/*!
+ * \brief Record a completed span
+ * \param name Span name. Must be a string literal (only the pointer is stored).
+ * \param start Start time, as returned by trace_begin()
+ * \param arg Optional argument (e.g. channel name), or NULL. This is copied (and may be truncated).
+ */
+void trace_record(const char *name, uint64_t start, const char *arg);
+
+/*! \brief Get the start time for a span, or 0 if tracing is disabled */
+static inline uint64_t trace_begin(void)
+{
+	return trace_enabled ? trace_now() : 0;
+}
+
+/*! \brief Finish a span started with trace_begin(). No-op if tracing was disabled when the span began. */
+static inline void trace_end(const char *name, uint64_t start, const char *arg)
+{
+	if (start) {
+		trace_record(name, start, arg);
+	}
+}
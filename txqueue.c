@@ -0,0 +1,204 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Batching TX queue
+ *
+ * How long the TTY takes to send what it has been given is estimated from
+ * the Baudot codes needed (including shifts). Once it is down to
+ * TX_QUEUE_LOW_MS of text left, as much text as it can send in the next
+ * TX_QUEUE_HIGH_MS is handed over as one batch. The estimate is also
+ * used to tell when each character should have gone out, for latency.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "baudot.h"
+#include "txqueue.h"
+#include "vclock.h"
+
+#define TX_QUEUE_LOW_MS 500			/* Hand more text to the TTY when it has less than this left to send... */
+#define TX_QUEUE_HIGH_MS 2500		/* ...up to this much */
+
+struct tx_queue {
+	tx_queue_cb cb;
+	void *data;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+	char text[TX_QUEUE_LEN];
+	uint64_t added_ms[TX_QUEUE_LEN];	/*!< When each character was added */
+	size_t len;
+	int figs;							/*!< Shift the TTY will be in */
+	uint64_t busy_ms;					/*!< When the TTY should be done sending what it was given */
+	uint64_t latency_total_ms;
+	struct tx_queue_stats stats;
+};
+
+/*!
+ * \brief Take the next batch, if the TTY is ready for more
+ * \param q
+ * \param now
+ * \param[out] batch At least TX_QUEUE_LEN + 1 bytes
+ * \param[out] done_ms When the TTY should be done sending each character
+ * \param[out] added_ms When each character was added
+ * \param[out] wait Milliseconds until the next batch can be taken, or -1 if the queue is empty
+ * \return Number of characters
+ * \note Must be called with the lock held
+ */
+static size_t take_batch(struct tx_queue *q, uint64_t now, char *batch, uint64_t *done_ms, uint64_t *added_ms, int *wait)
+{
+	uint64_t busy = q->busy_ms > now ? q->busy_ms : now;
+	size_t n = 0;
+
+	if (busy - now >= TX_QUEUE_LOW_MS) {
+		*wait = q->len ? (int) (busy - now - TX_QUEUE_LOW_MS + 1) : -1;
+		return 0;
+	}
+	while (n < q->len && busy - now < TX_QUEUE_HIGH_MS) {
+		unsigned char codes[2];
+		busy += (uint64_t) (baudot_encode(&q->figs, q->text[n], codes) * BAUDOT_CODE_MS);
+		batch[n] = q->text[n];
+		done_ms[n] = busy;
+		added_ms[n] = q->added_ms[n];
+		n++;
+	}
+	batch[n] = '\0';
+	q->len -= n;
+	memmove(q->text, q->text + n, q->len);
+	memmove(q->added_ms, q->added_ms + n, q->len * sizeof(q->added_ms[0]));
+	q->busy_ms = busy;
+	*wait = q->len ? (int) (busy - now - TX_QUEUE_LOW_MS + 1) : -1;
+	return n;
+}
+
+static void *tx_queue_thread(void *varg)
+{
+	struct tx_queue *q = varg;
+	char batch[TX_QUEUE_LEN + 1];
+	uint64_t done_ms[TX_QUEUE_LEN], added_ms[TX_QUEUE_LEN];
+
+	pthread_mutex_lock(&q->lock);
+	while (!q->stop) {
+		int wait, res;
+		uint64_t now = vclock_now_ms();
+		size_t i, n = take_batch(q, now, batch, done_ms, added_ms, &wait);
+
+		if (n) {
+			/* Actions may take a while, so never hold the lock while sending */
+			pthread_mutex_unlock(&q->lock);
+			res = q->cb(batch, q->data);
+			pthread_mutex_lock(&q->lock);
+			if (res) {
+				q->stats.failed += n;
+				continue;
+			}
+			q->stats.chars += n;
+			q->stats.batches++;
+			for (i = 0; i < n; i++) {
+				uint64_t latency = done_ms[i] - added_ms[i];
+				q->latency_total_ms += latency;
+				if (latency > q->stats.latency_max_ms) {
+					q->stats.latency_max_ms = (unsigned long) latency;
+				}
+			}
+			continue;
+		}
+		vclock_wait(&q->cond, &q->lock, wait < 0 ? VCLOCK_FOREVER : now + (uint64_t) wait);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+struct tx_queue *tx_queue_create(tx_queue_cb cb, void *data)
+{
+	struct tx_queue *q = calloc(1, sizeof(*q));
+
+	if (!q) {
+		return NULL;
+	}
+	q->cb = cb;
+	q->data = data;
+	q->figs = -1;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	if (vclock_thread_create(&q->thread, tx_queue_thread, q)) {
+		fprintf(stderr, "Failed to start TX queue thread\n");
+		pthread_cond_destroy(&q->cond);
+		pthread_mutex_destroy(&q->lock);
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+void tx_queue_add(struct tx_queue *q, const char *text, size_t len)
+{
+	uint64_t now = vclock_now_ms();
+	size_t i;
+
+	pthread_mutex_lock(&q->lock);
+	for (i = 0; i < len; i++) {
+		if (text[i] == '\b') {
+			if (q->len) {
+				q->len--;
+				q->stats.erased++;
+			} else {
+				q->stats.too_late++;
+			}
+		} else if (q->len == TX_QUEUE_LEN) {
+			q->stats.overflow++;
+		} else {
+			q->text[q->len] = text[i];
+			q->added_ms[q->len++] = now;
+		}
+	}
+	vclock_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void tx_queue_stats(struct tx_queue *q, struct tx_queue_stats *stats)
+{
+	pthread_mutex_lock(&q->lock);
+	*stats = q->stats;
+	stats->latency_avg_ms = q->stats.chars ? (double) q->latency_total_ms / (double) q->stats.chars : 0;
+	stats->queued = q->len;
+	pthread_mutex_unlock(&q->lock);
+}
+
+void tx_queue_destroy(struct tx_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	vclock_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	vclock_thread_join(q->thread);
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+}
@@ -0,0 +1,74 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Batching TX queue: text waiting to be sent on a TTY
+ *
+ * Text can arrive much faster than Baudot can send it (about 6 characters per
+ * second). It waits in a bounded queue and is handed over in batches, a few
+ * words at a time, only as fast as the TTY can send it, so there is one action
+ * per batch rather than per character, and Asterisk never has much queued.
+ * Each queue has a thread, which is the only one that calls its callback,
+ * so adding text never blocks and is safe from the AMI event callback.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+
+/*! \brief Max characters waiting (about 85 seconds of Baudot) */
+#define TX_QUEUE_LEN 512
+
+struct tx_queue;
+
+/*!
+ * \brief Callback to send a batch of text
+ * \param text Null terminated
+ * \param data
+ * \retval 0 on success, -1 on failure
+ */
+typedef int (*tx_queue_cb)(const char *text, void *data);
+
+struct tx_queue_stats {
+	unsigned long chars;		/*!< Characters sent */
+	unsigned long batches;
+	unsigned long failed;		/*!< Characters in batches that failed to send */
+	unsigned long overflow;		/*!< Characters that didn't fit in the queue */
+	unsigned long erased;		/*!< Characters erased before they were sent */
+	unsigned long too_late;		/*!< Erasures of characters that had already been sent */
+	double latency_avg_ms;		/*!< From being added to when the TTY should have finished sending it */
+	unsigned long latency_max_ms;
+	size_t queued;
+};
+
+/*! \brief Create a queue, and start its thread */
+struct tx_queue *tx_queue_create(tx_queue_cb cb, void *data);
+
+/*!
+ * \brief Add text to a queue. '\b' erases the last character, if it hasn't been sent yet.
+ *        Text that doesn't fit is dropped.
+ */
+void tx_queue_add(struct tx_queue *q, const char *text, size_t len);
+
+void tx_queue_stats(struct tx_queue *q, struct tx_queue_stats *stats);
+
+/*! \brief Stop a queue's thread and destroy it. Text that hasn't been sent is discarded. */
+void tx_queue_destroy(struct tx_queue *q);
@@ -0,0 +1,390 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Clock that can be simulated, for reproducible timing
+ *
+ * While simulated, every participating thread that is waiting is on a list,
+ * with its deadline. Whichever thread makes the count of waiting threads
+ * equal to the count of participating threads advances the clock to the
+ * earliest deadline, and wakes the threads that are due. They count as busy
+ * again from that moment, not from when they get to run, so time can't move
+ * on under a thread that has been woken but hasn't been scheduled yet.
+ *
+ * Waiters live on their threads' stacks, so none can leave the list while
+ * another thread is going through it to wake them.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "vclock.h"
+
+#define VCLOCK_SIM_START_US 1000000
+
+struct vclock_waiter {
+	pthread_cond_t *cond;
+	pthread_mutex_t *lock;
+	uint64_t deadline_us;
+	int woken;			/*!< Signaled or due. No longer counted as waiting. */
+	int notify;			/*!< Due, and needs its condition broadcast */
+	struct vclock_waiter *next;
+};
+
+struct vclock_thread {
+	void *(*func)(void *);
+	void *data;
+};
+
+static int simulated = 0;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_done = PTHREAD_COND_INITIALIZER;
+static uint64_t sim_us = VCLOCK_SIM_START_US;
+static int sim_threads = 0;				/*!< Participating threads */
+static int sim_idle = 0;				/*!< Participating threads waiting, and not yet woken */
+static int sim_broadcasting = 0;		/*!< Threads waking waiters, which must stay on the list until they're done */
+static struct vclock_waiter *sim_waiters = NULL;
+static __thread int participant = 0;
+
+int vclock_simulated(void)
+{
+	return __atomic_load_n(&simulated, __ATOMIC_ACQUIRE);
+}
+
+static uint64_t real_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+uint64_t vclock_now_us(void)
+{
+	if (vclock_simulated()) {
+		return __atomic_load_n(&sim_us, __ATOMIC_ACQUIRE);
+	}
+	return real_now_us();
+}
+
+uint64_t vclock_now_ms(void)
+{
+	return vclock_now_us() / 1000;
+}
+
+time_t vclock_time(void)
+{
+	if (vclock_simulated()) {
+		return VCLOCK_SIM_EPOCH + (time_t) ((vclock_now_us() - VCLOCK_SIM_START_US) / 1000000);
+	}
+	return time(NULL);
+}
+
+/*!
+ * \brief If every participating thread is waiting, advance to the earliest deadline and wake whoever is due
+ * \param self The calling thread's waiter, if it's waiting
+ * \param held The lock the calling thread holds, if any, which is released while waking others
+ * \note Must be called with sim_lock held, which is released and reacquired if others are woken
+ */
+static void sim_advance(struct vclock_waiter *self, pthread_mutex_t *held)
+{
+	struct vclock_waiter *w, *head;
+	uint64_t next = VCLOCK_FOREVER;
+	int notify = 0;
+
+	if (sim_idle < sim_threads) {
+		return;
+	}
+	for (w = sim_waiters; w; w = w->next) {
+		if (!w->woken && w->deadline_us < next) {
+			next = w->deadline_us;
+		}
+	}
+	if (next == VCLOCK_FOREVER) {
+		return; /* Everyone is waiting for something that isn't a time */
+	}
+	if (next > sim_us) {
+		__atomic_store_n(&sim_us, next, __ATOMIC_RELEASE);
+	}
+	for (w = sim_waiters; w; w = w->next) {
+		if (!w->woken && w->deadline_us <= sim_us) {
+			w->woken = 1;
+			sim_idle--;
+			if (w != self) {
+				w->notify = 1;
+				notify = 1;
+			}
+		}
+	}
+	if (!notify) {
+		return;
+	}
+
+	/* Waiters can be added while we're doing this, but not removed */
+	sim_broadcasting++;
+	head = sim_waiters;
+	pthread_mutex_unlock(&sim_lock);
+	if (held) {
+		pthread_mutex_unlock(held);
+	}
+	for (w = head; w; w = w->next) {
+		if (w->notify) {
+			w->notify = 0;
+			pthread_mutex_lock(w->lock);
+			pthread_cond_broadcast(w->cond);
+			pthread_mutex_unlock(w->lock);
+		}
+	}
+	if (held) {
+		pthread_mutex_lock(held);
+	}
+	pthread_mutex_lock(&sim_lock);
+	if (!--sim_broadcasting) {
+		pthread_cond_broadcast(&sim_done);
+	}
+}
+
+static int sim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline_us)
+{
+	struct vclock_waiter w, **pos;
+	int res;
+
+	w.cond = cond;
+	w.lock = lock;
+	w.deadline_us = deadline_us;
+	w.woken = 0;
+	w.notify = 0;
+
+	pthread_mutex_lock(&sim_lock);
+	if (deadline_us <= sim_us) {
+		pthread_mutex_unlock(&sim_lock);
+		return ETIMEDOUT;
+	}
+	w.next = sim_waiters;
+	sim_waiters = &w;
+	sim_idle++;
+	sim_advance(&w, lock);
+	/* Whoever sets woken then takes the lock to wake us, so checking it with the lock held can't miss that */
+	while (!w.woken) {
+		pthread_mutex_unlock(&sim_lock);
+		pthread_cond_wait(cond, lock);
+		pthread_mutex_lock(&sim_lock);
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	/* Don't hold the caller's lock while waiting on sim_lock, since whoever is waking others will want it */
+	pthread_mutex_unlock(lock);
+	pthread_mutex_lock(&sim_lock);
+	while (sim_broadcasting) {
+		pthread_cond_wait(&sim_done, &sim_lock);
+	}
+	for (pos = &sim_waiters; *pos != &w; pos = &(*pos)->next);
+	*pos = w.next;
+	res = sim_us >= deadline_us ? ETIMEDOUT : 0;
+	pthread_mutex_unlock(&sim_lock);
+	pthread_mutex_lock(lock);
+	return res;
+}
+
+static int real_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline_us, uint64_t now_us)
+{
+	struct timespec ts;
+	uint64_t wait_us;
+
+	if (deadline_us == VCLOCK_FOREVER) {
+		return pthread_cond_wait(cond, lock);
+	} else if (deadline_us <= now_us) {
+		return ETIMEDOUT;
+	}
+	wait_us = deadline_us - now_us;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += (time_t) (wait_us / 1000000);
+	ts.tv_nsec += (long) (wait_us % 1000000) * 1000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(cond, lock, &ts);
+}
+
+static int wait_us(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline_us)
+{
+	uint64_t now;
+
+	if (!vclock_simulated()) {
+		return real_wait(cond, lock, deadline_us, real_now_us());
+	} else if (participant) {
+		return sim_wait(cond, lock, deadline_us);
+	}
+	/* Time doesn't wait for this thread, so just check every so often whether it has passed */
+	now = vclock_now_us();
+	if (deadline_us != VCLOCK_FOREVER && deadline_us <= now) {
+		return ETIMEDOUT;
+	}
+	real_wait(cond, lock, real_now_us() + 1000, real_now_us());
+	return deadline_us <= vclock_now_us() ? ETIMEDOUT : 0;
+}
+
+int vclock_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline_ms)
+{
+	return wait_us(cond, lock, deadline_ms == VCLOCK_FOREVER ? VCLOCK_FOREVER : deadline_ms * 1000);
+}
+
+void vclock_signal(pthread_cond_t *cond)
+{
+	struct vclock_waiter *w;
+
+	if (!vclock_simulated()) {
+		pthread_cond_signal(cond);
+		return;
+	}
+	pthread_mutex_lock(&sim_lock);
+	for (w = sim_waiters; w; w = w->next) {
+		if (w->cond == cond && !w->woken) {
+			w->woken = 1;
+			sim_idle--;
+		}
+	}
+	pthread_mutex_unlock(&sim_lock);
+	pthread_cond_broadcast(cond); /* Any of them may have been woken, so wake them all */
+}
+
+void vclock_sleep_until_us(uint64_t at_us)
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	struct timespec ts;
+
+	if (!vclock_simulated()) {
+		ts.tv_sec = (time_t) (at_us / 1000000);
+		ts.tv_nsec = (long) (at_us % 1000000) * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	while (wait_us(&cond, &lock, at_us) != ETIMEDOUT);
+	pthread_mutex_unlock(&lock);
+}
+
+void vclock_sleep_ms(unsigned int ms)
+{
+	vclock_sleep_until_us(vclock_now_us() + (uint64_t) ms * 1000);
+}
+
+int vclock_poll(struct pollfd *pfds, nfds_t nfds, int timeout)
+{
+	int res;
+
+	if (!vclock_simulated()) {
+		return poll(pfds, nfds, timeout);
+	}
+	/* Nothing outside can happen at simulated speed, so check, let the time pass, and check again */
+	res = poll(pfds, nfds, 0);
+	if (res || !timeout) {
+		return res;
+	}
+	vclock_sleep_ms(timeout < 0 ? 1000 : (unsigned int) timeout);
+	return poll(pfds, nfds, 0);
+}
+
+static void *vclock_thread_run(void *varg)
+{
+	struct vclock_thread t = *(struct vclock_thread *) varg;
+
+	free(varg);
+	participant = 1;
+	return t.func(t.data);
+}
+
+int vclock_thread_create(pthread_t *thread, void *(*func)(void *), void *data)
+{
+	struct vclock_thread *t;
+
+	if (!vclock_simulated()) {
+		return pthread_create(thread, NULL, func, data);
+	}
+	t = malloc(sizeof(*t));
+	if (!t) {
+		return -1;
+	}
+	t->func = func;
+	t->data = data;
+	/* Count it now, so time can't pass before it gets going */
+	pthread_mutex_lock(&sim_lock);
+	sim_threads++;
+	pthread_mutex_unlock(&sim_lock);
+	if (pthread_create(thread, NULL, vclock_thread_run, t)) {
+		pthread_mutex_lock(&sim_lock);
+		sim_threads--;
+		pthread_mutex_unlock(&sim_lock);
+		free(t);
+		return -1;
+	}
+	return 0;
+}
+
+int vclock_thread_join(pthread_t thread)
+{
+	int res;
+
+	if (!vclock_simulated()) {
+		return pthread_join(thread, NULL);
+	}
+	/*
+	 * A thread still counts until it's joined, even once it has exited.
+	 * If we're participating, we stop counting while joining, and take its place once it's done.
+	 */
+	if (participant) {
+		pthread_mutex_lock(&sim_lock);
+		sim_threads--;
+		sim_advance(NULL, NULL);
+		pthread_mutex_unlock(&sim_lock);
+		return pthread_join(thread, NULL);
+	}
+	res = pthread_join(thread, NULL);
+	pthread_mutex_lock(&sim_lock);
+	sim_threads--;
+	sim_advance(NULL, NULL);
+	pthread_mutex_unlock(&sim_lock);
+	return res;
+}
+
+void vclock_simulate(void)
+{
+	pthread_mutex_lock(&sim_lock);
+	__atomic_store_n(&sim_us, VCLOCK_SIM_START_US, __ATOMIC_RELEASE);
+	sim_threads = 1;
+	sim_idle = 0;
+	participant = 1;
+	__atomic_store_n(&simulated, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+void vclock_real(void)
+{
+	pthread_mutex_lock(&sim_lock);
+	__atomic_store_n(&simulated, 0, __ATOMIC_RELEASE);
+	sim_threads = 0;
+	participant = 0;
+	pthread_mutex_unlock(&sim_lock);
+}
@@ -0,0 +1,100 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Clock that can be simulated, for reproducible timing
+ *
+ * Anything that depends on the passage of time (pacing, batching windows,
+ * timeouts) gets the time, sleeps and waits on conditions through here.
+ * Normally, this is just the monotonic clock. Once simulated, time only
+ * passes when every participating thread is waiting for it: it then jumps
+ * straight to the earliest deadline, so hours of calls can be simulated
+ * in milliseconds, with the same results every time.
+ *
+ * Participating threads are the one that started the simulation, and any
+ * started with vclock_thread_create (and not yet joined). Other threads
+ * can still use the clock, but time doesn't wait for them.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define VCLOCK_FOREVER UINT64_MAX
+
+/*! \brief Wall clock time when a simulation starts, so it's the same every time */
+#define VCLOCK_SIM_EPOCH 1640995200
+
+/*! \brief Monotonic time, in microseconds */
+uint64_t vclock_now_us(void);
+
+/*! \brief Monotonic time, in milliseconds */
+uint64_t vclock_now_ms(void);
+
+/*! \brief Wall clock time, like time(NULL) */
+time_t vclock_time(void);
+
+/*! \brief Sleep until a monotonic time, in microseconds */
+void vclock_sleep_until_us(uint64_t at_us);
+
+void vclock_sleep_ms(unsigned int ms);
+
+/*!
+ * \brief Wait on a condition, until it's signaled with vclock_signal or a deadline passes
+ * \param cond
+ * \param lock Held by the caller. It may be released and reacquired even if the wait is over at once.
+ * \param deadline_ms Monotonic time, or VCLOCK_FOREVER
+ * \retval 0 if signaled (or woken spuriously), ETIMEDOUT if the deadline has passed
+ */
+int vclock_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline_ms);
+
+/*!
+ * \brief Wake everything waiting on a condition with vclock_wait
+ * \note Must be called with the condition's lock held
+ */
+void vclock_signal(pthread_cond_t *cond);
+
+/*! \brief poll(2), with the timeout in clock time */
+int vclock_poll(struct pollfd *pfds, nfds_t nfds, int timeout);
+
+/*! \brief pthread_create(3), but the thread participates in a simulation */
+int vclock_thread_create(pthread_t *thread, void *(*func)(void *), void *data);
+
+/*! \brief pthread_join(3), for a thread started with vclock_thread_create */
+int vclock_thread_join(pthread_t thread);
+
+/*!
+ * \brief Simulate time from now on
+ * \note Must be called before any other thread uses the clock, and the calling thread then drives the simulation
+ */
+void vclock_simulate(void);
+
+/*!
+ * \brief Go back to real time
+ * \note Must be called by the thread that called vclock_simulate, once every thread it started has been joined
+ */
+void vclock_real(void);
+
+/*! \retval 1 if time is simulated, 0 if not */
+int vclock_simulated(void);
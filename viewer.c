@@ -0,0 +1,1683 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Remote viewer server
+ *
+ * Publishers (the AMI event callback, and whatever sends text) only append
+ * frames to queues under viewers_lock, and poke the server thread through a pipe.
+ * The server thread is the only one that accepts, reads, writes, compresses,
+ * or disconnects viewers. It takes a viewer's whole queue at once, so the lock
+ * is never held while writing to a socket.
+ *
+ * Browsers start out as HTTP connections on a web listener. A request is
+ * answered straight into the viewer's send buffer, and either closes the
+ * connection once sent (the page, or an error), or upgrades it to a WebSocket,
+ * after which it is handled like any other viewer, except for the framing.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "viewer.h"
+#include "websocket.h"
+
+#define STREAM_BUCKETS 64
+#define VARINT_MAX 10
+#define MAX_CHANNEL 255
+
+/*! \brief Kernel send buffer per viewer. Otherwise it grows to megabytes for a viewer that isn't reading, and VIEWER_MAX_QUEUE means little. */
+#define VIEWER_SNDBUF 65536
+
+/*! \brief Largest frame the server sends */
+#define MAX_FRAME (1 + VARINT_MAX + 3 * VARINT_MAX + MAX_CHANNEL + VIEWER_HISTORY)
+
+struct vbuf {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
+
+enum viewer_transport {
+	TRANSPORT_TCP = 0,
+	TRANSPORT_HTTP,				/*!< Browser, waiting for a request */
+	TRANSPORT_WEBSOCKET,
+};
+
+struct viewer {
+	struct viewer *next;
+	unsigned int id;
+	int fd;
+	enum viewer_transport transport;
+	int close_when_sent;		/*!< Disconnect once sending is written, e.g. after an HTTP response */
+	uint64_t due_ms;			/*!< Browsers: when what is queued must be sent by, or 0 (server thread) */
+	char **watching;			/*!< Channels watched regardless of the pattern (viewers_lock) */
+	int num_watching;
+	int max_watching;
+	int subscribed;
+	int deflate;				/*!< Compressing what is sent */
+	int lagged;					/*!< Fell behind, resync once the queue is drained */
+	size_t plain;				/*!< Bytes at the start of out queued before compression was requested */
+	struct vbuf out;			/*!< Frames queued by publishers (viewers_lock) */
+	struct vbuf batch;			/*!< Frames taken from out (server thread) */
+	struct vbuf sending;		/*!< Bytes being written to the socket (server thread) */
+	size_t sent;				/*!< Bytes of sending written so far */
+	unsigned char in[VIEWER_MAX_REQUEST];
+	size_t inlen;
+	char pattern[VIEWER_MAX_REQUEST];
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+};
+
+struct stream {
+	struct stream *next;
+	uint64_t id;
+	uint64_t base_ms;			/*!< Time the first record in the history is relative to */
+	uint64_t last_ms;			/*!< Time of the last record */
+	struct viewer **subscribers;
+	int num_subscribers;
+	int max_subscribers;
+	size_t history_len;
+	unsigned char history[VIEWER_HISTORY];
+	char channel[];
+};
+
+struct listener {
+	int fd;
+	int web;
+};
+
+static pthread_mutex_t viewers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct viewer *viewers = NULL;
+static struct stream *streams[STREAM_BUCKETS];
+static struct viewer_stats stats;
+static uint64_t next_stream_id = 1;
+static unsigned int next_viewer_id = 1;
+static int running = 0;
+static int stopping = 0;
+static int wake_pending = 0;
+static struct listener listeners[VIEWER_MAX_LISTENERS];
+static int num_listeners = 0;
+static const char *web_page = NULL;
+static viewer_command_cb command_cb = NULL;
+static viewer_metrics_cb metrics_cb = NULL;
+static int wake[2] = { -1, -1 };
+static pthread_t server_thread;
+
+static size_t varint_put(unsigned char *buf, uint64_t value)
+{
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		buf[n++] = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	buf[n++] = (unsigned char) value;
+	return n;
+}
+
+size_t viewer_varint_get(const unsigned char *buf, size_t len, uint64_t *value)
+{
+	uint64_t v = 0;
+	size_t i;
+
+	for (i = 0; i < len && i < VARINT_MAX; i++) {
+		v |= (uint64_t) (buf[i] & 0x7f) << (7 * i);
+		if (!(buf[i] & 0x80)) {
+			*value = v;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+int viewer_frame_get(const unsigned char *buf, size_t len, int *type, const unsigned char **payload, size_t *plen)
+{
+	uint64_t n;
+	size_t used;
+
+	if (len < 2) {
+		return 0;
+	}
+	used = viewer_varint_get(buf + 1, len - 1, &n);
+	if (!used) {
+		return len - 1 >= VARINT_MAX ? -1 : 0;
+	} else if (n > INT_MAX - 1 - VARINT_MAX) {
+		return -1;
+	} else if (1 + used + n > len) {
+		return 0;
+	}
+	*type = buf[0];
+	*payload = buf + 1 + used;
+	*plen = (size_t) n;
+	return (int) (1 + used + n);
+}
+
+size_t viewer_frame_put(unsigned char *buf, int type, const unsigned char *payload, size_t plen)
+{
+	size_t n;
+
+	buf[0] = (unsigned char) type;
+	n = 1 + varint_put(buf + 1, plen);
+	if (plen) {
+		memcpy(buf + n, payload, plen);
+	}
+	return n + plen;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static int vbuf_reserve(struct vbuf *b, size_t size)
+{
+	unsigned char *data;
+	size_t newsize = b->size ? b->size : 1024;
+
+	if (size <= b->size) {
+		return 0;
+	}
+	while (newsize < size) {
+		newsize *= 2;
+	}
+	data = realloc(b->data, newsize);
+	if (!data) {
+		return -1;
+	}
+	b->data = data;
+	b->size = newsize;
+	return 0;
+}
+
+static int vbuf_append(struct vbuf *b, const unsigned char *data, size_t len)
+{
+	if (vbuf_reserve(b, b->len + len)) {
+		return -1;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static void vbuf_swap(struct vbuf *a, struct vbuf *b)
+{
+	struct vbuf tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/*! \note Must be called with viewers_lock held */
+static void wake_server(void)
+{
+	if (wake_pending) {
+		return;
+	}
+	wake_pending = 1;
+	if (write(wake[1], "", 1) < 0) {
+		/* Pipe is full, so the thread is already being woken up */
+	}
+}
+
+/*!
+ * \brief Queue a frame for a viewer, or mark it lagged if it is too far behind
+ * \note Must be called with viewers_lock held
+ */
+static void queue_frame(struct viewer *v, const unsigned char *frame, size_t len)
+{
+	if (v->lagged) {
+		return;
+	}
+	if (v->out.len + len > VIEWER_MAX_QUEUE || vbuf_append(&v->out, frame, len)) {
+		v->lagged = 1;
+		stats.resyncs++;
+		return;
+	}
+	stats.frames++;
+	stats.bytes_queued += len;
+}
+
+/*!
+ * \brief Queue a snapshot of a stream. Snapshots aren't subject to VIEWER_MAX_QUEUE, since they are how a viewer catches up.
+ * \note Must be called with viewers_lock held
+ */
+static void queue_snapshot(struct viewer *v, struct stream *s)
+{
+	unsigned char payload[MAX_FRAME], frame[MAX_FRAME + 1 + VARINT_MAX];
+	size_t plen, flen, namelen = strlen(s->channel);
+
+	plen = varint_put(payload, s->id);
+	plen += varint_put(payload + plen, namelen);
+	memcpy(payload + plen, s->channel, namelen);
+	plen += namelen;
+	plen += varint_put(payload + plen, s->base_ms);
+	memcpy(payload + plen, s->history, s->history_len);
+	plen += s->history_len;
+
+	flen = viewer_frame_put(frame, VIEWER_FRAME_SNAPSHOT, payload, plen);
+	if (vbuf_append(&v->out, frame, flen)) {
+		v->lagged = 1;
+		return;
+	}
+	stats.frames++;
+	stats.bytes_queued += flen;
+}
+
+static int viewer_watching(const struct viewer *v, const char *channel)
+{
+	int i;
+
+	for (i = 0; i < v->num_watching; i++) {
+		if (!strcmp(v->watching[i], channel)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int stream_matches(const struct viewer *v, const struct stream *s)
+{
+	if (v->subscribed && (!v->pattern[0] || !fnmatch(v->pattern, s->channel, 0))) {
+		return 1;
+	}
+	return v->num_watching && viewer_watching(v, s->channel) >= 0;
+}
+
+/*! \note Must be called with viewers_lock held */
+static int add_subscriber(struct stream *s, struct viewer *v)
+{
+	if (s->num_subscribers == s->max_subscribers) {
+		int max = s->max_subscribers ? 2 * s->max_subscribers : 4;
+		struct viewer **subscribers = realloc(s->subscribers, (size_t) max * sizeof(*subscribers));
+		if (!subscribers) {
+			return -1;
+		}
+		s->subscribers = subscribers;
+		s->max_subscribers = max;
+	}
+	s->subscribers[s->num_subscribers++] = v;
+	queue_snapshot(v, s);
+	return 0;
+}
+
+static int is_subscriber(const struct stream *s, const struct viewer *v)
+{
+	int i;
+
+	for (i = 0; i < s->num_subscribers; i++) {
+		if (s->subscribers[i] == v) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * \brief Remove a viewer from a stream's subscribers
+ * \retval 0 if it was one, -1 if not
+ * \note Must be called with viewers_lock held
+ */
+static int unsubscribe(struct stream *s, struct viewer *v)
+{
+	int i;
+
+	for (i = 0; i < s->num_subscribers; i++) {
+		if (s->subscribers[i] == v) {
+			s->subscribers[i] = s->subscribers[--s->num_subscribers];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*! \note Must be called with viewers_lock held */
+static void remove_subscriber(struct viewer *v)
+{
+	struct stream *s;
+	int i;
+
+	for (i = 0; i < STREAM_BUCKETS; i++) {
+		for (s = streams[i]; s; s = s->next) {
+			unsubscribe(s, v);
+		}
+	}
+}
+
+static unsigned int stream_hash(const char *channel)
+{
+	unsigned int hash = 2166136261u; /* FNV-1a */
+
+	for (; *channel; channel++) {
+		hash ^= (unsigned char) *channel;
+		hash *= 16777619u;
+	}
+	return hash % STREAM_BUCKETS;
+}
+
+/*! \note Must be called with viewers_lock held */
+static struct stream *find_stream(const char *channel, int create)
+{
+	struct stream *s;
+	struct viewer *v;
+	unsigned int bucket = stream_hash(channel);
+	size_t len = strlen(channel);
+
+	for (s = streams[bucket]; s; s = s->next) {
+		if (!strcmp(s->channel, channel)) {
+			return s;
+		}
+	}
+	if (!create || len > MAX_CHANNEL) {
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s) + len + 1);
+	if (!s) {
+		return NULL;
+	}
+	memcpy(s->channel, channel, len + 1);
+	s->id = next_stream_id++;
+	s->base_ms = s->last_ms = now_ms();
+	s->next = streams[bucket];
+	streams[bucket] = s;
+	stats.streams++;
+
+	for (v = viewers; v; v = v->next) {
+		if (stream_matches(v, s)) {
+			add_subscriber(s, v);
+		}
+	}
+	return s;
+}
+
+/*!
+ * \brief Add a record to a stream's history, dropping the oldest half if it's full
+ * \note Must be called with viewers_lock held
+ */
+static void history_add(struct stream *s, const unsigned char *record, size_t len)
+{
+	size_t pos = 0, used;
+	uint64_t dt = 0;
+
+	if (s->history_len + len > VIEWER_HISTORY) {
+		while (pos < s->history_len && (s->history_len - pos > VIEWER_HISTORY / 2 || s->history_len - pos + len > VIEWER_HISTORY)) {
+			used = viewer_varint_get(s->history + pos, s->history_len - pos, &dt);
+			if (!used || pos + used >= s->history_len) {
+				pos = s->history_len; /* Can't be parsed, so drop all of it rather than send garbage */
+				break;
+			}
+			s->base_ms += dt;
+			pos += used + 1 + (s->history[pos + used] & VIEWER_RECORD_MAX);
+		}
+		if (pos > s->history_len) {
+			pos = s->history_len; /* The last record was cut short */
+		}
+		memmove(s->history, s->history + pos, s->history_len - pos);
+		s->history_len -= pos;
+	}
+	memcpy(s->history + s->history_len, record, len);
+	s->history_len += len;
+}
+
+void viewer_open(const char *channel)
+{
+	if (!__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		return;
+	}
+	pthread_mutex_lock(&viewers_lock);
+	if (running && find_stream(channel, 1)) {
+		wake_server();
+	}
+	pthread_mutex_unlock(&viewers_lock);
+}
+
+void viewer_publish(const char *channel, int tx, const char *text, size_t len)
+{
+	unsigned char record[VARINT_MAX + 1 + VIEWER_RECORD_MAX], payload[VARINT_MAX + sizeof(record)], frame[1 + VARINT_MAX + sizeof(payload)];
+	struct stream *s;
+	uint64_t now;
+	size_t chunk, rlen, plen, flen;
+	int i;
+
+	if (!len || !__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		return;
+	}
+	now = now_ms();
+
+	pthread_mutex_lock(&viewers_lock);
+	s = running ? find_stream(channel, 1) : NULL; /* Might have stopped in the meantime */
+	if (!s) {
+		pthread_mutex_unlock(&viewers_lock);
+		return;
+	}
+	while (len) {
+		chunk = len > VIEWER_RECORD_MAX ? VIEWER_RECORD_MAX : len;
+		rlen = varint_put(record, now > s->last_ms ? now - s->last_ms : 0);
+		record[rlen++] = (unsigned char) ((tx ? VIEWER_RECORD_TX : 0) | chunk);
+		memcpy(record + rlen, text, chunk);
+		rlen += chunk;
+		if (now > s->last_ms) {
+			s->last_ms = now;
+		}
+		history_add(s, record, rlen);
+
+		/* Encoded once, however many viewers there are */
+		if (s->num_subscribers) {
+			plen = varint_put(payload, s->id);
+			memcpy(payload + plen, record, rlen);
+			plen += rlen;
+			flen = viewer_frame_put(frame, VIEWER_FRAME_DELTA, payload, plen);
+			for (i = 0; i < s->num_subscribers; i++) {
+				queue_frame(s->subscribers[i], frame, flen);
+			}
+		}
+		text += chunk;
+		len -= chunk;
+	}
+	if (s->num_subscribers) {
+		wake_server();
+	}
+	pthread_mutex_unlock(&viewers_lock);
+}
+
+/*! \note Must be called with viewers_lock held */
+static void stream_free(struct stream *s)
+{
+	stats.streams--;
+	free(s->subscribers);
+	free(s);
+}
+
+void viewer_end(const char *channel)
+{
+	unsigned char payload[VARINT_MAX], frame[1 + 2 * VARINT_MAX];
+	struct stream *s, *prev = NULL;
+	unsigned int bucket = stream_hash(channel);
+	size_t flen;
+	int i;
+
+	if (!__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		return;
+	}
+	pthread_mutex_lock(&viewers_lock);
+	for (s = running ? streams[bucket] : NULL; s; prev = s, s = s->next) {
+		if (!strcmp(s->channel, channel)) {
+			break;
+		}
+	}
+	if (!s) {
+		pthread_mutex_unlock(&viewers_lock);
+		return;
+	}
+	if (prev) {
+		prev->next = s->next;
+	} else {
+		streams[bucket] = s->next;
+	}
+	if (s->num_subscribers) {
+		flen = viewer_frame_put(frame, VIEWER_FRAME_END, payload, varint_put(payload, s->id));
+		for (i = 0; i < s->num_subscribers; i++) {
+			queue_frame(s->subscribers[i], frame, flen);
+		}
+		wake_server();
+	}
+	stream_free(s);
+	pthread_mutex_unlock(&viewers_lock);
+}
+
+void viewer_get_stats(struct viewer_stats *out)
+{
+	pthread_mutex_lock(&viewers_lock);
+	*out = stats;
+	pthread_mutex_unlock(&viewers_lock);
+}
+
+void viewer_set_command_handler(viewer_command_cb cb)
+{
+	pthread_mutex_lock(&viewers_lock);
+	command_cb = cb;
+	pthread_mutex_unlock(&viewers_lock);
+}
+
+void viewer_set_metrics_handler(viewer_metrics_cb cb)
+{
+	pthread_mutex_lock(&viewers_lock);
+	metrics_cb = cb;
+	pthread_mutex_unlock(&viewers_lock);
+}
+
+int viewer_stream_usage(const char *channel, size_t *bytes, size_t *history, int *subscribers)
+{
+	struct stream *s;
+
+	pthread_mutex_lock(&viewers_lock);
+	s = find_stream(channel, 0);
+	if (s) {
+		*bytes = sizeof(*s) + strlen(s->channel) + 1 + (size_t) s->max_subscribers * sizeof(*s->subscribers);
+		*history = s->history_len;
+		*subscribers = s->num_subscribers;
+	}
+	pthread_mutex_unlock(&viewers_lock);
+	return s ? 0 : -1;
+}
+
+/*! \note Must be called with viewers_lock held */
+static struct viewer *find_viewer(unsigned int id)
+{
+	struct viewer *v;
+
+	for (v = viewers; v; v = v->next) {
+		if (v->id == id) {
+			return v;
+		}
+	}
+	return NULL;
+}
+
+int viewer_send(unsigned int id, int type, const unsigned char *payload, size_t plen)
+{
+	struct viewer *v;
+	size_t flen;
+
+	pthread_mutex_lock(&viewers_lock);
+	v = running ? find_viewer(id) : NULL;
+	if (!v) {
+		pthread_mutex_unlock(&viewers_lock);
+		return -1;
+	}
+	/* Replies aren't subject to VIEWER_MAX_QUEUE either, since they were asked for */
+	if (!v->lagged && !vbuf_reserve(&v->out, v->out.len + 1 + VARINT_MAX + plen)) {
+		flen = viewer_frame_put(v->out.data + v->out.len, type, payload, plen);
+		v->out.len += flen;
+		stats.frames++;
+		stats.bytes_queued += flen;
+		wake_server();
+	}
+	pthread_mutex_unlock(&viewers_lock);
+	return 0;
+}
+
+int viewer_watch(unsigned int id, const char *channel, int watch)
+{
+	unsigned char payload[VARINT_MAX], frame[1 + 2 * VARINT_MAX];
+	struct viewer *v;
+	struct stream *s;
+	int i;
+
+	pthread_mutex_lock(&viewers_lock);
+	v = running ? find_viewer(id) : NULL;
+	if (!v) {
+		pthread_mutex_unlock(&viewers_lock);
+		return -1;
+	}
+	i = viewer_watching(v, channel);
+	s = find_stream(channel, 0);
+	if (watch && i < 0) {
+		if (v->num_watching == v->max_watching) {
+			int max = v->max_watching ? 2 * v->max_watching : 4;
+			char **watching = realloc(v->watching, (size_t) max * sizeof(*watching));
+			if (!watching) {
+				pthread_mutex_unlock(&viewers_lock);
+				return -1;
+			}
+			v->watching = watching;
+			v->max_watching = max;
+		}
+		v->watching[v->num_watching] = strdup(channel);
+		if (!v->watching[v->num_watching]) {
+			pthread_mutex_unlock(&viewers_lock);
+			return -1;
+		}
+		v->num_watching++;
+		if (s && !is_subscriber(s, v)) {
+			add_subscriber(s, v);
+		}
+	} else if (!watch && i >= 0) {
+		free(v->watching[i]);
+		v->watching[i] = v->watching[--v->num_watching];
+		if (s && !stream_matches(v, s) && !unsubscribe(s, v)) {
+			queue_frame(v, frame, viewer_frame_put(frame, VIEWER_FRAME_END, payload, varint_put(payload, s->id)));
+		}
+	}
+	wake_server();
+	pthread_mutex_unlock(&viewers_lock);
+	return 0;
+}
+
+/*!
+ * \brief Replace whatever a lagged viewer has queued with a fresh snapshot of every stream
+ * \note Must be called with viewers_lock held
+ */
+static void resync(struct viewer *v)
+{
+	unsigned char frame[2];
+	struct stream *s;
+	int i;
+
+	v->out.len = v->plain;
+	v->lagged = 0;
+	queue_frame(v, frame, viewer_frame_put(frame, VIEWER_FRAME_RESYNC, NULL, 0));
+	for (i = 0; i < STREAM_BUCKETS; i++) {
+		for (s = streams[i]; s; s = s->next) {
+			if (stream_matches(v, s)) {
+				queue_snapshot(v, s);
+			}
+		}
+	}
+}
+
+#ifdef HAVE_ZLIB
+/*! \brief Compress a batch (after any plain bytes) into sending, flushed so the viewer can decode all of it now */
+static int compress_batch(struct viewer *v, size_t plain)
+{
+	int res;
+
+	if (plain && vbuf_append(&v->sending, v->batch.data, plain)) {
+		return -1;
+	}
+	v->zs.next_in = v->batch.data + plain;
+	v->zs.avail_in = (uInt) (v->batch.len - plain);
+	do {
+		if (vbuf_reserve(&v->sending, v->sending.len + v->zs.avail_in + 64)) {
+			return -1;
+		}
+		v->zs.next_out = v->sending.data + v->sending.len;
+		v->zs.avail_out = (uInt) (v->sending.size - v->sending.len);
+		res = deflate(&v->zs, Z_SYNC_FLUSH);
+		v->sending.len = v->sending.size - v->zs.avail_out;
+		if (res != Z_OK && res != Z_BUF_ERROR) {
+			return -1;
+		}
+	} while (!v->zs.avail_out);
+	return 0;
+}
+#endif
+
+/*!
+ * \brief Write as much as the socket will take to a viewer
+ * \retval 0 on success, -1 if the viewer should be disconnected
+ */
+static int viewer_flush(struct viewer *v)
+{
+	ssize_t res;
+	size_t plain, written = 0;
+
+	for (;;) {
+		if (v->sent == v->sending.len) {
+			if (v->close_when_sent) {
+				return -1;
+			}
+			v->sent = v->sending.len = 0;
+			v->due_ms = 0;
+			pthread_mutex_lock(&viewers_lock);
+			if (v->lagged) {
+				resync(v);
+			}
+			vbuf_swap(&v->out, &v->batch);
+			if (v->batch.len && v->transport == TRANSPORT_WEBSOCKET) {
+				stats.messages++;
+			}
+			plain = v->plain;
+			v->plain = 0;
+			stats.bytes_sent += written;
+			written = 0;
+			pthread_mutex_unlock(&viewers_lock);
+
+			if (!v->batch.len) {
+				return 0;
+			}
+			if (v->transport == TRANSPORT_WEBSOCKET) {
+				unsigned char header[WS_MAX_HEADER];
+				size_t hlen = ws_frame_header(header, WS_OPCODE_BINARY, v->batch.len, NULL);
+				if (vbuf_append(&v->sending, header, hlen) || vbuf_append(&v->sending, v->batch.data, v->batch.len)) {
+					return -1;
+				}
+				v->batch.len = 0;
+				continue;
+			}
+#ifdef HAVE_ZLIB
+			if (v->deflate) {
+				if (compress_batch(v, plain)) {
+					return -1;
+				}
+				v->batch.len = 0;
+				continue;
+			}
+#endif
+			vbuf_swap(&v->batch, &v->sending);
+			v->batch.len = 0;
+		}
+		res = send(v->fd, v->sending.data + v->sent, v->sending.len - v->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			pthread_mutex_lock(&viewers_lock);
+			stats.bytes_sent += written;
+			pthread_mutex_unlock(&viewers_lock);
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		v->sent += (size_t) res;
+		written += (size_t) res;
+	}
+}
+
+/*! \brief Handle a SUBSCRIBE. Flags are only honored the first time. */
+static int viewer_subscribe(struct viewer *v, int flags, const unsigned char *pattern, size_t len)
+{
+	unsigned char frame[2];
+	struct stream *s;
+	int i;
+
+	pthread_mutex_lock(&viewers_lock);
+	remove_subscriber(v); /* Including watched streams, which get fresh snapshots below */
+	if (v->subscribed) {
+		queue_frame(v, frame, viewer_frame_put(frame, VIEWER_FRAME_RESYNC, NULL, 0));
+	} else if (flags & VIEWER_SUBSCRIBE_DEFLATE && v->transport == TRANSPORT_TCP) {
+#ifdef HAVE_ZLIB
+		if (deflateInit(&v->zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+			pthread_mutex_unlock(&viewers_lock);
+			return -1;
+		}
+		v->deflate = 1;
+		v->plain = v->out.len;
+#endif
+	}
+	memcpy(v->pattern, pattern, len);
+	v->pattern[len] = '\0';
+	v->subscribed = 1;
+	for (i = 0; i < STREAM_BUCKETS; i++) {
+		for (s = streams[i]; s; s = s->next) {
+			if (stream_matches(v, s) && add_subscriber(s, v)) {
+				pthread_mutex_unlock(&viewers_lock);
+				return -1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&viewers_lock);
+	return 0;
+}
+
+/*!
+ * \brief Handle the complete frames at the start of a buffer
+ * \return Bytes used, or -1 if the viewer should be disconnected
+ */
+static int handle_frames(struct viewer *v, const unsigned char *buf, size_t len)
+{
+	const unsigned char *payload;
+	viewer_command_cb cb;
+	size_t plen, pos = 0;
+	int used, type;
+
+	while ((used = viewer_frame_get(buf + pos, len - pos, &type, &payload, &plen)) > 0) {
+		if (type == VIEWER_FRAME_SUBSCRIBE) {
+			if (!plen || viewer_subscribe(v, payload[0], payload + 1, plen - 1)) {
+				return -1;
+			}
+		} else if (type >= VIEWER_FRAME_COMMAND) {
+			pthread_mutex_lock(&viewers_lock);
+			cb = command_cb;
+			pthread_mutex_unlock(&viewers_lock);
+			if (cb) {
+				cb(v->id, type, payload, plen);
+			}
+		} /* Anything else is ignored, for forward compatibility */
+		pos += (size_t) used;
+	}
+	return used < 0 ? -1 : (int) pos;
+}
+
+/*! \brief Queue the response to an HTTP request, to be sent before anything else */
+static int http_respond(struct viewer *v, const char *status, const char *headers, const char *body)
+{
+	char buf[512];
+	size_t len = body ? strlen(body) : 0;
+	int hlen;
+
+	hlen = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nServer: AsTTYSpy\r\nContent-Length: %lu\r\n%s\r\n", status, (unsigned long) len, headers);
+	if (hlen < 0 || (size_t) hlen >= sizeof(buf) || vbuf_append(&v->sending, (unsigned char *) buf, (size_t) hlen) || (len && vbuf_append(&v->sending, (const unsigned char *) body, len))) {
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Whether a WebSocket upgrade comes from a page served by us, rather than some other site the browser has open
+ * \note Browsers always send Origin with WebSocket requests, and pages can't change it or Host
+ */
+static int origin_allowed(const char *headers)
+{
+	char origin[256], host[256];
+	const char *o;
+
+	if (http_header(headers, "Origin", origin, sizeof(origin)) || http_header(headers, "Host", host, sizeof(host))) {
+		return 0;
+	}
+	if (!strncasecmp(origin, "http://", 7)) {
+		o = origin + 7;
+	} else if (!strncasecmp(origin, "https://", 8)) {
+		o = origin + 8;
+	} else {
+		return 0;
+	}
+	return !strcasecmp(o, host);
+}
+
+/*!
+ * \brief Handle the complete WebSocket messages received from a browser
+ * \retval 0 on success, -1 if the viewer should be disconnected
+ */
+static int websocket_read(struct viewer *v)
+{
+	unsigned char *payload;
+	size_t plen, pos = 0;
+	int used, fin, opcode;
+
+	while ((used = ws_frame_parse(v->in + pos, v->inlen - pos, &fin, &opcode, &payload, &plen)) > 0) {
+		if (!(v->in[pos + 1] & 0x80)) {
+			return -1; /* Clients must mask everything they send (RFC 6455 5.1) */
+		}
+		pos += (size_t) used;
+		if (opcode == WS_OPCODE_CLOSE) {
+			return -1;
+		} else if (!fin || opcode == WS_OPCODE_CONTINUATION) {
+			return -1; /* Browsers don't fragment messages this small */
+		} else if (opcode == WS_OPCODE_BINARY && handle_frames(v, payload, plen) != (int) plen) {
+			return -1; /* Each message must be whole frames */
+		} /* Text, ping, and pong are ignored */
+	}
+	v->inlen -= pos;
+	memmove(v->in, v->in + pos, v->inlen);
+	return used < 0 || v->inlen == sizeof(v->in) ? -1 : 0;
+}
+
+/*!
+ * \brief Handle an HTTP request from a browser, once all of it has been received
+ * \retval 0 on success, -1 if the viewer should be disconnected
+ */
+static int http_request(struct viewer *v)
+{
+	unsigned char payload[2 + VARINT_MAX], frame[1 + VARINT_MAX + sizeof(payload)];
+	char req[VIEWER_MAX_REQUEST + 1], key[64], accept[WS_KEY_LEN], headers[128];
+	const char *page;
+	viewer_metrics_cb mcb;
+	char *path, *end;
+	size_t plen, reqlen;
+
+	memcpy(req, v->in, v->inlen);
+	req[v->inlen] = '\0';
+	end = strstr(req, "\r\n\r\n");
+	if (!end) {
+		return v->inlen == sizeof(v->in) ? -1 : 0;
+	}
+	/* Keep anything after the request, since a client may send messages without waiting for the upgrade */
+	reqlen = (size_t) (end - req) + 4;
+	v->inlen -= reqlen;
+	memmove(v->in, v->in + reqlen, v->inlen);
+	v->close_when_sent = 1;
+	if (strncmp(req, "GET ", 4)) {
+		return http_respond(v, "405 Method Not Allowed", "Allow: GET\r\n", NULL);
+	}
+	path = req + 4;
+	end = strchr(path, ' ');
+	if (!end) {
+		return -1;
+	}
+	*end = '\0';
+	if (!strcmp(path, "/ws") && !origin_allowed(end + 1)) {
+		/* There's no authentication, so otherwise any page the operator visits could attach to calls */
+		return http_respond(v, "403 Forbidden", "Connection: close\r\n", NULL);
+	}
+	if (!strcmp(path, "/ws") && !http_header(end + 1, "Sec-WebSocket-Key", key, sizeof(key))) {
+		ws_accept_key(key, accept);
+		snprintf(headers, sizeof(headers), "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n", accept);
+		if (http_respond(v, "101 Switching Protocols", headers, NULL)) {
+			return -1;
+		}
+		v->close_when_sent = 0;
+		payload[0] = VIEWER_VERSION;
+		payload[1] = 0; /* Browsers already have compression, if they want it (TLS, or a proxy) */
+		plen = 2 + varint_put(payload + 2, now_ms());
+		pthread_mutex_lock(&viewers_lock);
+		v->transport = TRANSPORT_WEBSOCKET;
+		queue_frame(v, frame, viewer_frame_put(frame, VIEWER_FRAME_HELLO, payload, plen));
+		pthread_mutex_unlock(&viewers_lock);
+		return v->inlen ? websocket_read(v) : 0;
+	}
+	v->inlen = 0;
+	pthread_mutex_lock(&viewers_lock);
+	page = web_page;
+	mcb = metrics_cb;
+	pthread_mutex_unlock(&viewers_lock);
+	if (mcb && !strcmp(path, "/metrics")) {
+		/* Not with the lock held, since the handler may need to look at streams */
+		char *body = NULL;
+		size_t blen;
+		FILE *fp = open_memstream(&body, &blen);
+		int res;
+
+		if (!fp) {
+			return -1;
+		}
+		mcb(fp);
+		fclose(fp);
+		res = http_respond(v, "200 OK", "Content-Type: text/plain; version=0.0.4\r\nCache-Control: no-cache\r\nConnection: close\r\n", body);
+		free(body);
+		return res;
+	}
+	if (page && (!strcmp(path, "/") || !strcmp(path, "/index.html"))) {
+		return http_respond(v, "200 OK", "Content-Type: text/html; charset=utf-8\r\nCache-Control: no-cache\r\nConnection: close\r\n", page);
+	}
+	return http_respond(v, "404 Not Found", "Connection: close\r\n", NULL);
+}
+
+/*!
+ * \brief Read requests from a viewer
+ * \retval 0 on success, -1 if the viewer should be disconnected
+ */
+static int viewer_read(struct viewer *v)
+{
+	ssize_t res;
+	int used;
+
+	res = recv(v->fd, v->in + v->inlen, sizeof(v->in) - v->inlen, MSG_DONTWAIT);
+	if (res <= 0) {
+		return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+	v->inlen += (size_t) res;
+	if (v->transport == TRANSPORT_HTTP) {
+		if (v->close_when_sent) {
+			v->inlen = 0; /* Ignore anything after a request that is being answered */
+			return 0;
+		}
+		return http_request(v);
+	} else if (v->transport == TRANSPORT_WEBSOCKET) {
+		return websocket_read(v);
+	}
+	used = handle_frames(v, v->in, v->inlen);
+	if (used < 0) {
+		return -1;
+	}
+	v->inlen -= (size_t) used;
+	memmove(v->in, v->in + used, v->inlen);
+	/* A frame that doesn't fit will never be complete */
+	return v->inlen == sizeof(v->in) ? -1 : 0;
+}
+
+/*! \brief Accept a viewer. Returns -1 once there are none left to accept. */
+static int viewer_accept(const struct listener *l)
+{
+	unsigned char payload[2 + VARINT_MAX], frame[1 + VARINT_MAX + sizeof(payload)];
+	struct viewer *v;
+	size_t plen;
+	int fd, on = 1, sndbuf = VIEWER_SNDBUF;
+
+	fd = accept(l->fd, NULL, NULL);
+	if (fd < 0) {
+		return -1;
+	}
+	v = calloc(1, sizeof(*v));
+	if (!v) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); /* Deltas are tiny, and should arrive as they are typed */
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	v->fd = fd;
+	v->transport = l->web ? TRANSPORT_HTTP : TRANSPORT_TCP;
+
+	payload[0] = VIEWER_VERSION;
+#ifdef HAVE_ZLIB
+	payload[1] = VIEWER_SUBSCRIBE_DEFLATE;
+#else
+	payload[1] = 0;
+#endif
+	plen = 2 + varint_put(payload + 2, now_ms());
+
+	pthread_mutex_lock(&viewers_lock);
+	v->id = next_viewer_id++;
+	v->next = viewers;
+	viewers = v;
+	stats.viewers++;
+	if (v->transport == TRANSPORT_TCP) {
+		queue_frame(v, frame, viewer_frame_put(frame, VIEWER_FRAME_HELLO, payload, plen));
+	} /* Browsers get it once upgraded */
+	pthread_mutex_unlock(&viewers_lock);
+	return 0;
+}
+
+/*! \brief Disconnect a viewer and free it */
+static void viewer_close(struct viewer *v)
+{
+	struct viewer *cur, *prev = NULL;
+	viewer_command_cb cb;
+	int i;
+
+	pthread_mutex_lock(&viewers_lock);
+	for (cur = viewers; cur; prev = cur, cur = cur->next) {
+		if (cur == v) {
+			if (prev) {
+				prev->next = v->next;
+			} else {
+				viewers = v->next;
+			}
+			break;
+		}
+	}
+	remove_subscriber(v);
+	stats.viewers--;
+	cb = command_cb;
+	pthread_mutex_unlock(&viewers_lock);
+
+	if (cb && v->transport != TRANSPORT_HTTP) {
+		cb(v->id, 0, NULL, 0);
+	}
+	for (i = 0; i < v->num_watching; i++) {
+		free(v->watching[i]);
+	}
+	free(v->watching);
+#ifdef HAVE_ZLIB
+	if (v->deflate) {
+		deflateEnd(&v->zs);
+	}
+#endif
+	close(v->fd);
+	free(v->out.data);
+	free(v->batch.data);
+	free(v->sending.data);
+	free(v);
+}
+
+static void *server_loop(void *unused)
+{
+	struct pollfd *pfds = NULL;
+	struct viewer **polled = NULL, *v;
+	struct listener polled_listeners[VIEWER_MAX_LISTENERS];
+	uint64_t now;
+	char buf[64];
+	int i, n, nl, timeout, max = 0;
+
+	(void) unused;
+
+	for (;;) {
+		pthread_mutex_lock(&viewers_lock);
+		if (stopping) {
+			pthread_mutex_unlock(&viewers_lock);
+			break;
+		}
+		nl = num_listeners;
+		memcpy(polled_listeners, listeners, sizeof(listeners));
+		n = nl + 1 + (int) stats.viewers;
+		if (n > max) {
+			struct pollfd *newpfds = realloc(pfds, (size_t) n * sizeof(*pfds));
+			struct viewer **newpolled = newpfds ? realloc(polled, (size_t) n * sizeof(*polled)) : NULL;
+			if (newpfds) {
+				pfds = newpfds;
+			}
+			if (!newpolled) {
+				pthread_mutex_unlock(&viewers_lock);
+				fprintf(stderr, "Viewer server out of memory\n");
+				break;
+			}
+			polled = newpolled;
+			max = n;
+		}
+		for (i = 0; i < nl; i++) {
+			pfds[i].fd = listeners[i].fd;
+			pfds[i].events = POLLIN;
+		}
+		pfds[nl].fd = wake[0];
+		pfds[nl].events = POLLIN;
+		now = now_ms();
+		timeout = -1;
+		for (i = nl + 1, v = viewers; v; v = v->next, i++) {
+			pfds[i].fd = v->fd;
+			pfds[i].events = POLLIN;
+			if (v->sent < v->sending.len) {
+				pfds[i].events |= POLLOUT;
+			} else if (v->out.len || v->lagged) {
+				if (v->transport == TRANSPORT_WEBSOCKET) {
+					/* Let more pile up, to send as one message */
+					if (!v->due_ms) {
+						v->due_ms = now + VIEWER_WEB_BATCH_MS;
+					}
+					if (now < v->due_ms) {
+						if (timeout < 0 || (int) (v->due_ms - now) < timeout) {
+							timeout = (int) (v->due_ms - now);
+						}
+					} else {
+						pfds[i].events |= POLLOUT;
+					}
+				} else {
+					pfds[i].events |= POLLOUT;
+				}
+			}
+			polled[i] = v;
+		}
+		pthread_mutex_unlock(&viewers_lock);
+
+		if (poll(pfds, (nfds_t) n, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+		if (pfds[nl].revents) {
+			while (read(wake[0], buf, sizeof(buf)) > 0);
+			pthread_mutex_lock(&viewers_lock);
+			wake_pending = 0;
+			pthread_mutex_unlock(&viewers_lock);
+		}
+		for (i = nl + 1; i < n; i++) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+			if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR) && viewer_read(polled[i])) || viewer_flush(polled[i])) {
+				viewer_close(polled[i]);
+			}
+		}
+		for (i = 0; i < nl; i++) {
+			if (pfds[i].revents) {
+				while (!viewer_accept(&polled_listeners[i]));
+			}
+		}
+	}
+
+	free(pfds);
+	free(polled);
+	return NULL;
+}
+
+/*! \brief Listen on an address, starting the server if this is the first */
+static int viewer_listen(const char *addr, int port, int web)
+{
+	struct addrinfo hints, *res, *ai;
+	struct sockaddr_storage sa;
+	socklen_t salen = sizeof(sa);
+	char portstr[16];
+	int fd = -1, on = 1;
+
+	if (num_listeners == VIEWER_MAX_LISTENERS) {
+		fprintf(stderr, "Can't listen for viewers on more than %d addresses\n", VIEWER_MAX_LISTENERS);
+		return -1;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	snprintf(portstr, sizeof(portstr), "%d", port);
+	if (getaddrinfo(addr, portstr, &hints, &res)) {
+		fprintf(stderr, "Invalid viewer address: %s\n", addr);
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, SOMAXCONN)) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0 || getsockname(fd, (struct sockaddr *) &sa, &salen)) {
+		fprintf(stderr, "Failed to listen for viewers on %s port %d: %s\n", addr, port, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	port = ntohs(sa.ss_family == AF_INET6 ? ((struct sockaddr_in6 *) &sa)->sin6_port : ((struct sockaddr_in *) &sa)->sin_port);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	if (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&viewers_lock);
+		listeners[num_listeners].fd = fd;
+		listeners[num_listeners].web = web;
+		num_listeners++;
+		wake_server(); /* So it polls this one too */
+		pthread_mutex_unlock(&viewers_lock);
+		return port;
+	}
+
+	if (pipe(wake)) {
+		close(fd);
+		return -1;
+	}
+	fcntl(wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+	listeners[0].fd = fd;
+	listeners[0].web = web;
+	num_listeners = 1;
+	stopping = 0;
+	__atomic_store_n(&running, 1, __ATOMIC_RELAXED);
+	if (pthread_create(&server_thread, NULL, server_loop, NULL)) {
+		fprintf(stderr, "Failed to start viewer server thread\n");
+		__atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+		close(wake[0]);
+		close(wake[1]);
+		close(fd);
+		num_listeners = 0;
+		return -1;
+	}
+	return port;
+}
+
+int viewer_start(const char *addr, int port)
+{
+	return viewer_listen(addr, port, 0);
+}
+
+int viewer_start_web(const char *addr, int port, const char *page)
+{
+	if (page) {
+		pthread_mutex_lock(&viewers_lock);
+		web_page = page;
+		pthread_mutex_unlock(&viewers_lock);
+	}
+	return viewer_listen(addr, port, 1);
+}
+
+void viewer_stop(void)
+{
+	struct stream *s;
+	int i;
+
+	if (!__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		return;
+	}
+	__atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&viewers_lock);
+	stopping = 1;
+	wake_pending = 0;
+	wake_server();
+	pthread_mutex_unlock(&viewers_lock);
+	pthread_join(server_thread, NULL);
+
+	while (viewers) {
+		viewer_close(viewers);
+	}
+	pthread_mutex_lock(&viewers_lock);
+	for (i = 0; i < STREAM_BUCKETS; i++) {
+		while ((s = streams[i])) {
+			streams[i] = s->next;
+			stream_free(s);
+		}
+	}
+	pthread_mutex_unlock(&viewers_lock);
+
+	close(wake[0]);
+	close(wake[1]);
+	for (i = 0; i < num_listeners; i++) {
+		close(listeners[i].fd);
+	}
+	num_listeners = 0;
+	web_page = NULL;
+}
+
+size_t viewer_record_get(const unsigned char *buf, size_t len, uint64_t *dt_ms, int *tx, const unsigned char **text, size_t *tlen)
+{
+	size_t used = viewer_varint_get(buf, len, dt_ms), n;
+
+	if (!used || used >= len) {
+		return 0;
+	}
+	n = buf[used] & VIEWER_RECORD_MAX;
+	if (used + 1 + n > len) {
+		return 0;
+	}
+	*tx = buf[used] & VIEWER_RECORD_TX ? 1 : 0;
+	*text = buf + used + 1;
+	*tlen = n;
+	return used + 1 + n;
+}
+
+enum client_state {
+	CLIENT_TCP = 0,
+	CLIENT_UPGRADING,			/*!< Waiting for the response to the WebSocket upgrade */
+	CLIENT_WEBSOCKET,
+};
+
+struct viewer_client {
+	int fd;
+	enum client_state state;
+	char accept[WS_KEY_LEN];	/*!< Expected Sec-WebSocket-Accept */
+	struct vbuf raw;			/*!< WebSocket: received, not yet unframed */
+	int flags;					/*!< Flags of the first SUBSCRIBE, or -1 if not subscribed yet */
+	int server_flags;			/*!< From the HELLO, or -1 if not received yet */
+	int inflating;
+	uint64_t bytes;
+	struct vbuf buf;			/*!< Received (and decompressed) */
+	size_t pos;					/*!< Bytes of buf already returned as frames */
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+};
+
+struct viewer_client *viewer_client_create(int fd)
+{
+	struct viewer_client *c = calloc(1, sizeof(*c));
+
+	if (!c) {
+		return NULL;
+	}
+	c->fd = fd;
+	c->flags = c->server_flags = -1;
+	return c;
+}
+
+/*! \brief Send all of a buffer, blocking if needed */
+static int client_send_all(struct viewer_client *c, const unsigned char *data, size_t len)
+{
+	size_t sent = 0;
+	ssize_t res;
+
+	while (sent < len) {
+		res = send(c->fd, data + sent, len - sent, MSG_NOSIGNAL);
+		if (res < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+			return -1;
+		}
+		sent += (size_t) res;
+	}
+	return 0;
+}
+
+struct viewer_client *viewer_client_create_web(int fd, const char *host)
+{
+	struct viewer_client *c = viewer_client_create(fd);
+	char key[WS_KEY_LEN], req[512];
+	int len;
+
+	if (!c) {
+		return NULL;
+	}
+	ws_make_key(key);
+	ws_accept_key(key, c->accept);
+	c->state = CLIENT_UPGRADING;
+	len = snprintf(req, sizeof(req), "GET /ws HTTP/1.1\r\nHost: %s\r\nOrigin: http://%s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n", host, host, key);
+	if (len < 0 || (size_t) len >= sizeof(req) || client_send_all(c, (unsigned char *) req, (size_t) len)) {
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+#ifdef HAVE_ZLIB
+static int client_inflate(struct viewer_client *c, const unsigned char *data, size_t len)
+{
+	int res;
+
+	c->zs.next_in = (unsigned char *) data;
+	c->zs.avail_in = (uInt) len;
+	while (c->zs.avail_in) {
+		if (vbuf_reserve(&c->buf, c->buf.len + 4 * c->zs.avail_in + 256)) {
+			return -1;
+		}
+		c->zs.next_out = c->buf.data + c->buf.len;
+		c->zs.avail_out = (uInt) (c->buf.size - c->buf.len);
+		res = inflate(&c->zs, Z_SYNC_FLUSH);
+		c->buf.len = c->buf.size - c->zs.avail_out;
+		if (res != Z_OK) {
+			return -1;
+		}
+	}
+	return 0;
+}
+#endif
+
+/*! \brief Once both the HELLO and the first SUBSCRIBE are known, start decompressing if the server will be compressing */
+static int client_check_inflate(struct viewer_client *c)
+{
+#ifdef HAVE_ZLIB
+	unsigned char *rest;
+	size_t len;
+	int res;
+
+	if (c->inflating || c->flags < 0 || c->server_flags < 0 || !(c->flags & c->server_flags & VIEWER_SUBSCRIBE_DEFLATE)) {
+		return 0;
+	}
+	if (inflateInit(&c->zs) != Z_OK) {
+		return -1;
+	}
+	c->inflating = 1;
+	/* Anything already received after the HELLO is compressed */
+	len = c->buf.len - c->pos;
+	if (!len) {
+		return 0;
+	}
+	rest = malloc(len);
+	if (!rest) {
+		return -1;
+	}
+	memcpy(rest, c->buf.data + c->pos, len);
+	c->buf.len = c->pos;
+	res = client_inflate(c, rest, len);
+	free(rest);
+	return res;
+#else
+	(void) c;
+	return 0;
+#endif
+}
+
+int viewer_client_send(struct viewer_client *c, int type, const unsigned char *payload, size_t plen)
+{
+	unsigned char frame[WS_MAX_HEADER + VIEWER_MAX_REQUEST], mask[4];
+	size_t hlen = 0, flen;
+	int i;
+
+	if (1 + VARINT_MAX + plen > VIEWER_MAX_REQUEST) {
+		return -1;
+	}
+	if (c->state != CLIENT_TCP) {
+		/* The length of the WebSocket message depends on the frame, so encode that first */
+		flen = viewer_frame_put(frame + WS_MAX_HEADER, type, payload, plen);
+		for (i = 0; i < 4; i++) {
+			mask[i] = (unsigned char) rand();
+		}
+		hlen = ws_frame_header(frame, WS_OPCODE_BINARY, flen, mask);
+		memmove(frame + hlen, frame + WS_MAX_HEADER, flen);
+		ws_mask(frame + hlen, flen, mask);
+	} else {
+		flen = viewer_frame_put(frame, type, payload, plen);
+	}
+	return client_send_all(c, frame, hlen + flen);
+}
+
+int viewer_client_subscribe(struct viewer_client *c, const char *pattern, int flags)
+{
+	unsigned char payload[VIEWER_MAX_REQUEST];
+	size_t len = pattern ? strlen(pattern) : 0;
+
+#ifndef HAVE_ZLIB
+	flags &= ~VIEWER_SUBSCRIBE_DEFLATE;
+#endif
+	if (1 + VARINT_MAX + 1 + len > VIEWER_MAX_REQUEST) {
+		return -1;
+	}
+	payload[0] = (unsigned char) flags;
+	if (len) {
+		memcpy(payload + 1, pattern, len);
+	}
+	if (viewer_client_send(c, VIEWER_FRAME_SUBSCRIBE, payload, len + 1)) {
+		return -1;
+	}
+	if (c->flags < 0) {
+		c->flags = flags;
+	}
+	return 0;
+}
+
+static int client_received(struct viewer_client *c, const unsigned char *data, size_t len)
+{
+#ifdef HAVE_ZLIB
+	if (c->inflating) {
+		return client_inflate(c, data, len);
+	}
+#endif
+	return vbuf_append(&c->buf, data, len);
+}
+
+/*! \brief Check the response to the upgrade. \return Bytes of it, 0 if incomplete, or -1 if refused */
+static int client_upgraded(struct viewer_client *c)
+{
+	char resp[VIEWER_MAX_REQUEST + 1], accept[WS_KEY_LEN + 8];
+	size_t len = c->raw.len > VIEWER_MAX_REQUEST ? VIEWER_MAX_REQUEST : c->raw.len;
+	char *end;
+
+	memcpy(resp, c->raw.data, len);
+	resp[len] = '\0';
+	end = strstr(resp, "\r\n\r\n");
+	if (!end) {
+		return len == VIEWER_MAX_REQUEST ? -1 : 0;
+	}
+	end[4] = '\0';
+	if (strncmp(resp, "HTTP/1.1 101 ", 13) || http_header(resp, "Sec-WebSocket-Accept", accept, sizeof(accept)) || strcmp(accept, c->accept)) {
+		return -1;
+	}
+	return (int) (end + 4 - resp);
+}
+
+/*! \brief Take frames out of WebSocket messages */
+static int client_unframe(struct viewer_client *c, const unsigned char *data, size_t len)
+{
+	unsigned char *payload;
+	size_t plen, pos = 0;
+	int used, fin, opcode;
+
+	if (vbuf_append(&c->raw, data, len)) {
+		return -1;
+	}
+	if (c->state == CLIENT_UPGRADING) {
+		used = client_upgraded(c);
+		if (used <= 0) {
+			return used;
+		}
+		pos = (size_t) used;
+		c->state = CLIENT_WEBSOCKET;
+	}
+	while ((used = ws_frame_parse(c->raw.data + pos, c->raw.len - pos, &fin, &opcode, &payload, &plen)) > 0) {
+		pos += (size_t) used;
+		if (opcode == WS_OPCODE_CLOSE) {
+			return -1;
+		} else if (opcode == WS_OPCODE_BINARY && client_received(c, payload, plen)) {
+			return -1;
+		}
+	}
+	c->raw.len -= pos;
+	memmove(c->raw.data, c->raw.data + pos, c->raw.len);
+	return used < 0 ? -1 : 0;
+}
+
+int viewer_client_read(struct viewer_client *c)
+{
+	unsigned char data[16384];
+	ssize_t res;
+
+	if (client_check_inflate(c)) {
+		return -1;
+	}
+	res = recv(c->fd, data, sizeof(data), MSG_DONTWAIT);
+	if (res <= 0) {
+		return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+	c->bytes += (uint64_t) res;
+	if (c->pos) {
+		c->buf.len -= c->pos;
+		memmove(c->buf.data, c->buf.data + c->pos, c->buf.len);
+		c->pos = 0;
+	}
+	if (c->state != CLIENT_TCP) {
+		return client_unframe(c, data, (size_t) res);
+	}
+	return client_received(c, data, (size_t) res);
+}
+
+int viewer_client_next(struct viewer_client *c, int *type, const unsigned char **payload, size_t *plen)
+{
+	int used;
+
+	if (client_check_inflate(c)) {
+		return -1;
+	}
+	used = viewer_frame_get(c->buf.data + c->pos, c->buf.len - c->pos, type, payload, plen);
+	if (used <= 0) {
+		return used;
+	}
+	c->pos += (size_t) used;
+	if (*type == VIEWER_FRAME_HELLO && c->server_flags < 0) {
+		c->server_flags = *plen >= 2 ? (*payload)[1] : 0;
+	}
+	return 1;
+}
+
+uint64_t viewer_client_bytes(const struct viewer_client *c)
+{
+	return c->bytes;
+}
+
+void viewer_client_destroy(struct viewer_client *c)
+{
+#ifdef HAVE_ZLIB
+	if (c->inflating) {
+		inflateEnd(&c->zs);
+	}
+#endif
+	close(c->fd);
+	free(c->buf.data);
+	free(c->raw.data);
+	free(c);
+}
@@ -0,0 +1,270 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Remote viewer server
+ *
+ * Lets supervisors watch sessions over TCP, without an AMI login of their own.
+ * Every session is a stream. A viewer subscribes to the streams whose channel
+ * matches a glob, gets a snapshot of each (its recent history), and then a
+ * delta frame for each character (or run of characters) as it is received or sent.
+ *
+ * Framing, in both directions: a type byte, the payload length as a varint
+ * (LEB128), then the payload. Numbers in payloads are varints too.
+ *
+ * A record (one run of text) is: the time since the stream's previous record
+ * in ms, a byte with VIEWER_RECORD_TX set if it was sent (the CA) rather than
+ * received (the TTY) and the length of the text in the low 7 bits, and the text.
+ * A single character typically takes 7 bytes in a delta frame.
+ *
+ * Frames are encoded once and copied to each subscriber's queue, and a single
+ * thread writes the queues to the sockets, so publishing never waits for a viewer.
+ * A viewer that falls more than VIEWER_MAX_QUEUE behind stops getting frames;
+ * once it has caught up with what was already queued, it gets a resync
+ * (a RESYNC frame, then a fresh snapshot of every stream).
+ *
+ * Viewers can ask for compression (zlib), which is applied to each batch of
+ * frames as it is written, with a sync flush, so it costs nothing for viewers
+ * that don't ask for it and helps most with snapshots and bursts of text.
+ * If the viewer's first SUBSCRIBE asks for it and the HELLO says it is supported,
+ * everything the server sends after the HELLO is one zlib stream.
+ *
+ * The same streams can be served to browsers, on a web listener: it serves a
+ * page for GET /, and upgrades GET /ws to a WebSocket. Frames are the same,
+ * carried in binary WebSocket messages, with no compression. What is queued
+ * for a browser is sent at most every VIEWER_WEB_BATCH_MS, as one message,
+ * since a browser pays far more per message than per byte.
+ *
+ * Frames of type VIEWER_FRAME_COMMAND and up from viewers are passed to a
+ * command handler, which can reply with viewer_send() and add single channels
+ * to what a viewer gets with viewer_watch(). The web console is built this way.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define VIEWER_VERSION 1
+
+/*! \brief Recent history per stream, in bytes of records, for snapshots */
+#define VIEWER_HISTORY 4096
+
+/*! \brief Max frames waiting to be sent to a viewer, in bytes, before it must resync */
+#define VIEWER_MAX_QUEUE 65536
+
+/*! \brief Max frame a viewer can send, or HTTP request a browser can send */
+#define VIEWER_MAX_REQUEST 2048
+
+/*! \brief Most time what is queued for a browser waits, to be sent together */
+#define VIEWER_WEB_BATCH_MS 40
+
+/*! \brief Max addresses to listen on */
+#define VIEWER_MAX_LISTENERS 4
+
+enum viewer_frame_type {
+	VIEWER_FRAME_HELLO = 1,		/*!< Server: protocol version, server time (ms since the epoch) */
+	VIEWER_FRAME_SUBSCRIBE,		/*!< Viewer: flags, then a glob of channels (empty for all) */
+	VIEWER_FRAME_SNAPSHOT,		/*!< Server: stream ID, channel (length, then name), time history starts at, records */
+	VIEWER_FRAME_DELTA,			/*!< Server: stream ID, one record */
+	VIEWER_FRAME_END,			/*!< Server: stream ID. The channel hung up. */
+	VIEWER_FRAME_RESYNC,		/*!< Server: the viewer missed frames. Forget all streams, snapshots follow. */
+	VIEWER_FRAME_COMMAND = 16,	/*!< This and up are passed to the command handler, or ignored */
+};
+
+/*! \brief SUBSCRIBE flag: compress everything the server sends from now on */
+#define VIEWER_SUBSCRIBE_DEFLATE 0x01
+
+/*! \brief Record header flag: text was sent on the channel, not received */
+#define VIEWER_RECORD_TX 0x80
+
+/*! \brief Max text in a record */
+#define VIEWER_RECORD_MAX 0x7f
+
+struct viewer_stats {
+	unsigned long viewers;		/*!< Connected now */
+	unsigned long streams;
+	unsigned long frames;		/*!< Frames queued, counted once per viewer */
+	unsigned long resyncs;		/*!< Times a viewer fell behind */
+	uint64_t bytes_queued;		/*!< Before compression */
+	uint64_t bytes_sent;		/*!< After compression */
+	unsigned long messages;		/*!< WebSocket messages sent to browsers, each a batch of frames */
+};
+
+/*!
+ * \brief Start serving viewers, or listen on another address
+ * \param addr Address to listen on, e.g. 127.0.0.1 or 0.0.0.0
+ * \param port TCP port, or 0 for any
+ * \return Port listening on, or -1 on failure
+ */
+int viewer_start(const char *addr, int port);
+
+/*!
+ * \brief Start serving browsers, or listen for them on another address
+ * \param addr
+ * \param port
+ * \param page HTML served for GET /, or NULL for none. Must stay valid until viewer_stop.
+ * \return Port listening on, or -1 on failure
+ */
+int viewer_start_web(const char *addr, int port, const char *page);
+
+/*! \brief Stop serving viewers, disconnecting them all, and stop listening */
+void viewer_stop(void);
+
+/*!
+ * \brief Handles a command from a viewer
+ * \param viewer ID of the viewer
+ * \param type Frame type, or 0 if the viewer disconnected
+ * \note Called on the server thread, so it must not block
+ */
+typedef void (*viewer_command_cb)(unsigned int viewer, int type, const unsigned char *payload, size_t plen);
+
+/*! \brief Set (or with NULL, clear) the command handler */
+void viewer_set_command_handler(viewer_command_cb cb);
+
+/*!
+ * \brief Writes metrics, in the Prometheus text format, for GET /metrics on a web listener
+ * \note Called on the server thread, without any viewer locks held
+ */
+typedef void (*viewer_metrics_cb)(FILE *fp);
+
+/*! \brief Set (or with NULL, clear) the metrics handler. Without one, /metrics is not found. */
+void viewer_set_metrics_handler(viewer_metrics_cb cb);
+
+/*!
+ * \brief Send a frame to one viewer. Doesn't block.
+ * \retval 0 on success, -1 if there is no such viewer
+ */
+int viewer_send(unsigned int viewer, int type, const unsigned char *payload, size_t plen);
+
+/*!
+ * \brief Start or stop sending a viewer a channel's stream, whether or not its SUBSCRIBE matches it.
+ *        Watching sends a snapshot (if the stream exists yet), and stopping sends an END. Doesn't block.
+ * \retval 0 on success, -1 if there is no such viewer
+ */
+int viewer_watch(unsigned int viewer, const char *channel, int watch);
+
+/*! \brief A session started. Doesn't block, so safe to call from the AMI event callback. */
+void viewer_open(const char *channel);
+
+/*!
+ * \brief Text was received (tx is 0) or sent (tx is 1) on a channel. Doesn't block.
+ *        Does nothing if the server isn't running.
+ */
+void viewer_publish(const char *channel, int tx, const char *text, size_t len);
+
+/*! \brief A session ended. Doesn't block. */
+void viewer_end(const char *channel);
+
+void viewer_get_stats(struct viewer_stats *stats);
+
+/*!
+ * \brief How much a channel's stream is using
+ * \param channel
+ * \param[out] bytes Memory allocated for the stream
+ * \param[out] history Bytes of history kept for viewers that subscribe later
+ * \param[out] subscribers Viewers it is being sent to
+ * \retval 0 on success, -1 if there is no stream for the channel
+ */
+int viewer_stream_usage(const char *channel, size_t *bytes, size_t *history, int *subscribers);
+
+/*!
+ * \brief Decode a varint
+ * \return Bytes used, or 0 if incomplete or invalid
+ */
+size_t viewer_varint_get(const unsigned char *buf, size_t len, uint64_t *value);
+
+/*!
+ * \brief Get the next frame from a buffer
+ * \param buf
+ * \param len
+ * \param[out] type
+ * \param[out] payload
+ * \param[out] plen Payload length
+ * \return Bytes used by the frame, 0 if it is incomplete, or -1 if invalid
+ */
+int viewer_frame_get(const unsigned char *buf, size_t len, int *type, const unsigned char **payload, size_t *plen);
+
+/*!
+ * \brief Encode a frame
+ * \param buf At least 1 + 10 + plen bytes
+ * \param type
+ * \param payload
+ * \param plen
+ * \return Bytes used
+ */
+size_t viewer_frame_put(unsigned char *buf, int type, const unsigned char *payload, size_t plen);
+
+/*!
+ * \brief Decode a record
+ * \param buf
+ * \param len
+ * \param[out] dt_ms Time since the stream's previous record
+ * \param[out] tx 1 if the text was sent on the channel, 0 if received
+ * \param[out] text
+ * \param[out] tlen
+ * \return Bytes used, or 0 if invalid
+ */
+size_t viewer_record_get(const unsigned char *buf, size_t len, uint64_t *dt_ms, int *tx, const unsigned char **text, size_t *tlen);
+
+/*! \brief Viewer side of a connection: reads and decodes (and decompresses) what the server sends */
+struct viewer_client;
+
+/*! \brief Create a client for a connected socket, which it takes ownership of */
+struct viewer_client *viewer_client_create(int fd);
+
+/*!
+ * \brief Create a client for a socket connected to a web listener, and ask to upgrade to a WebSocket
+ * \param fd
+ * \param host Value for the Host header
+ */
+struct viewer_client *viewer_client_create_web(int fd, const char *host);
+
+/*!
+ * \brief Send a frame, e.g. a command
+ * \retval 0 on success, -1 on failure
+ */
+int viewer_client_send(struct viewer_client *c, int type, const unsigned char *payload, size_t plen);
+
+/*!
+ * \brief Subscribe to the channels matching a glob
+ * \param c
+ * \param pattern Glob, or NULL for all channels
+ * \param flags VIEWER_SUBSCRIBE_DEFLATE to ask for compression
+ * \retval 0 on success, -1 on failure
+ */
+int viewer_client_subscribe(struct viewer_client *c, const char *pattern, int flags);
+
+/*! \brief Read whatever is available from the server. \retval 0 on success, -1 if disconnected or on failure */
+int viewer_client_read(struct viewer_client *c);
+
+/*!
+ * \brief Get the next frame that has been read. The payload is valid until the next call.
+ * \return 1 if there was a frame, 0 if there isn't a complete one yet, or -1 on failure
+ */
+int viewer_client_next(struct viewer_client *c, int *type, const unsigned char **payload, size_t *plen);
+
+/*! \brief Bytes received from the server, as sent (compressed, if compressing) */
+uint64_t viewer_client_bytes(const struct viewer_client *c);
+
+/*! \brief Close the connection and free the client */
+void viewer_client_destroy(struct viewer_client *c);
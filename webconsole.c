@@ -0,0 +1,494 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Web console
+ *
+ * Commands arrive on the viewer server thread, and hangups on the AMI event
+ * callback thread, neither of which can issue actions, so both just queue
+ * them for the console thread, which handles them in order. Only the console
+ * thread touches the attached channels.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <cami/cami.h>
+#include <cami/cami_actions.h>
+
+#include "asttyspy.h"
+#include "viewer.h"
+#include "webconsole.h"
+#include "session.h"
+#include "chanmeta.h"
+#include "record.h"
+#include "txqueue.h"
+#include "macro.h"
+#include "console_html.h"
+
+/*! \brief Command type for a hangup, which isn't from an agent */
+#define CONSOLE_HANGUP -1
+
+struct console_cmd {
+	struct console_cmd *next;
+	unsigned int agent;
+	int type;					/*!< Frame type, 0 if the agent disconnected, or CONSOLE_HANGUP */
+	size_t len;
+	unsigned char payload[];
+};
+
+/*! \brief A channel at least one agent is attached to */
+struct console_channel {
+	struct console_channel *next;
+	struct tx_queue *txq;
+	unsigned int *agents;
+	int num_agents;
+	int max_agents;
+	char channel[];
+};
+
+static pthread_mutex_t console_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t console_cond = PTHREAD_COND_INITIALIZER;
+static struct console_cmd *cmd_head = NULL, *cmd_tail = NULL;
+static int console_running = 0;
+static pthread_t console_thread;
+static sem_t console_done;
+
+/* Console thread only */
+static struct ami_session *console_ami = NULL;
+static struct console_channel *channels = NULL;
+static struct macro macros[MAX_MACROS];
+static int num_macros = 0;
+
+/*! \brief Queue a command for the console thread. Doesn't block. */
+static void queue_cmd(unsigned int agent, int type, const unsigned char *payload, size_t len)
+{
+	struct console_cmd *cmd = malloc(sizeof(*cmd) + len);
+
+	if (!cmd) {
+		return;
+	}
+	cmd->next = NULL;
+	cmd->agent = agent;
+	cmd->type = type;
+	cmd->len = len;
+	if (len) {
+		memcpy(cmd->payload, payload, len);
+	}
+	pthread_mutex_lock(&console_lock);
+	if (!console_running) {
+		pthread_mutex_unlock(&console_lock);
+		free(cmd);
+		return;
+	}
+	if (cmd_tail) {
+		cmd_tail->next = cmd;
+	} else {
+		cmd_head = cmd;
+	}
+	cmd_tail = cmd;
+	pthread_cond_signal(&console_cond);
+	pthread_mutex_unlock(&console_lock);
+}
+
+/*! \brief Viewer server callback */
+static void console_command(unsigned int agent, int type, const unsigned char *payload, size_t plen)
+{
+	queue_cmd(agent, type, payload, plen);
+}
+
+void webconsole_hangup(const char *channel)
+{
+	if (__atomic_load_n(&console_running, __ATOMIC_RELAXED)) {
+		queue_cmd(0, CONSOLE_HANGUP, (const unsigned char *) channel, strlen(channel));
+	}
+}
+
+static void send_status(unsigned int agent, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+static void send_status(unsigned int agent, const char *fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len > 0) {
+		viewer_send(agent, CONSOLE_FRAME_STATUS, (unsigned char *) buf, (size_t) len < sizeof(buf) ? (size_t) len : sizeof(buf) - 1);
+	}
+}
+
+/*! \brief TX queue callback. Runs on the queue's thread, so it can issue actions. */
+static int console_send(const char *text, void *data)
+{
+	struct console_channel *c = data;
+
+	return tdd_tx(console_ami, c->channel, text);
+}
+
+static struct console_channel *find_channel(const char *channel)
+{
+	struct console_channel *c;
+
+	for (c = channels; c; c = c->next) {
+		if (!strcmp(c->channel, channel)) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static int channel_has_agent(const struct console_channel *c, unsigned int agent)
+{
+	int i;
+
+	for (i = 0; i < c->num_agents; i++) {
+		if (c->agents[i] == agent) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*! \brief Nobody is attached to a channel anymore */
+static void channel_free(struct console_channel *c, int hungup)
+{
+	struct console_channel *cur, *prev = NULL;
+
+	for (cur = channels; cur; prev = cur, cur = cur->next) {
+		if (cur == c) {
+			if (prev) {
+				prev->next = c->next;
+			} else {
+				channels = c->next;
+			}
+			break;
+		}
+	}
+	tx_queue_destroy(c->txq);
+	if (!hungup) {
+		session_unobserve(console_ami, c->channel);
+	}
+	free(c->agents);
+	free(c);
+}
+
+static void list_channels(unsigned int agent)
+{
+	struct ami_response *resp;
+	char *buf, *pos;
+	size_t size = 1;
+	int i;
+
+	resp = ami_action_show_channels(console_ami);
+	if (!resp) {
+		send_status(agent, "Failed to get channel list");
+		return;
+	}
+	/* The first and last events are the response itself and CoreShowChannelsComplete */
+	for (i = 1; i < resp->size - 1; i++) {
+		chanmeta_event(resp->events[i], "CoreShowChannel");
+		size += strlen(ami_keyvalue(resp->events[i], "Channel")) + strlen(ami_keyvalue(resp->events[i], "Duration"))
+			+ strlen(ami_keyvalue(resp->events[i], "CallerIDNum")) + strlen(ami_keyvalue(resp->events[i], "ConnectedLineNum")) + 4;
+	}
+	buf = malloc(size);
+	if (buf) {
+		for (pos = buf, *buf = '\0', i = 1; i < resp->size - 1; i++) {
+			pos += sprintf(pos, "%s\t%s\t%s\t%s\n",
+				ami_keyvalue(resp->events[i], "Channel"),
+				ami_keyvalue(resp->events[i], "Duration"),
+				ami_keyvalue(resp->events[i], "CallerIDNum"),
+				ami_keyvalue(resp->events[i], "ConnectedLineNum"));
+		}
+		viewer_send(agent, CONSOLE_FRAME_CHANNELS, (unsigned char *) buf, (size_t) (pos - buf));
+		free(buf);
+	}
+	ami_resp_free(resp);
+}
+
+static void send_macros(unsigned int agent)
+{
+	char buf[MAX_MACROS * (sizeof(struct macro) + 2)];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < num_macros; i++) {
+		len += (size_t) sprintf(buf + len, "%s\t%s\n", macros[i].label, macros[i].text);
+	}
+	viewer_send(agent, CONSOLE_FRAME_MACROS, (unsigned char *) buf, len);
+}
+
+static void attach(unsigned int agent, const char *channel)
+{
+	struct console_channel *c = find_channel(channel);
+
+	if (c && channel_has_agent(c, agent)) {
+		return;
+	}
+	/* Watch first, so the stream that observing creates has a subscriber from the start */
+	if (viewer_watch(agent, channel, 1)) {
+		return; /* Already gone */
+	}
+	if (!c) {
+		c = calloc(1, sizeof(*c) + strlen(channel) + 1);
+		if (!c) {
+			viewer_watch(agent, channel, 0);
+			return;
+		}
+		strcpy(c->channel, channel); /* Safe */
+		if (session_observe(console_ami, channel)) {
+			free(c);
+			viewer_watch(agent, channel, 0);
+			send_status(agent, "Failed to enable TTY on %s", channel);
+			return;
+		}
+		c->txq = tx_queue_create(console_send, c);
+		if (!c->txq) {
+			session_unobserve(console_ami, channel);
+			free(c);
+			viewer_watch(agent, channel, 0);
+			return;
+		}
+		c->next = channels;
+		channels = c;
+	}
+	if (c->num_agents == c->max_agents) {
+		int max = c->max_agents ? 2 * c->max_agents : 4;
+		unsigned int *agents = realloc(c->agents, (size_t) max * sizeof(*agents));
+		if (!agents) {
+			if (!c->num_agents) {
+				channel_free(c, 0);
+			}
+			viewer_watch(agent, channel, 0);
+			return;
+		}
+		c->agents = agents;
+		c->max_agents = max;
+	}
+	c->agents[c->num_agents++] = agent;
+	send_status(agent, "Attached to %s", channel);
+}
+
+static void detach(struct console_channel *c, unsigned int agent, int watch)
+{
+	int i;
+
+	for (i = 0; i < c->num_agents; i++) {
+		if (c->agents[i] == agent) {
+			c->agents[i] = c->agents[--c->num_agents];
+			break;
+		}
+	}
+	if (watch) {
+		viewer_watch(agent, c->channel, 0);
+	}
+	if (!c->num_agents) {
+		channel_free(c, 0);
+	}
+}
+
+static void send_text(unsigned int agent, const unsigned char *payload, size_t len)
+{
+	struct console_channel *c;
+	char channel[256];
+	uint64_t namelen;
+	size_t used = viewer_varint_get(payload, len, &namelen);
+
+	if (!used || namelen >= sizeof(channel) || namelen > len - used) {
+		return;
+	}
+	memcpy(channel, payload + used, namelen);
+	channel[namelen] = '\0';
+	c = find_channel(channel);
+	if (!c || !channel_has_agent(c, agent)) {
+		send_status(agent, "Not attached to %s", channel);
+		return;
+	}
+	used += namelen;
+	tx_queue_add(c->txq, (const char *) payload + used, len - used); /* Doesn't block */
+}
+
+static void handle_cmd(struct console_cmd *cmd)
+{
+	struct console_channel *c, *next;
+	char channel[256];
+	int i;
+
+	if (cmd->type == CONSOLE_FRAME_ATTACH || cmd->type == CONSOLE_FRAME_DETACH || cmd->type == CONSOLE_HANGUP) {
+		if (!cmd->len || cmd->len >= sizeof(channel)) {
+			return;
+		}
+		memcpy(channel, cmd->payload, cmd->len);
+		channel[cmd->len] = '\0';
+	}
+
+	switch (cmd->type) {
+	case 0: /* Agent disconnected */
+		for (c = channels; c; c = next) {
+			next = c->next;
+			if (channel_has_agent(c, cmd->agent)) {
+				detach(c, cmd->agent, 0);
+			}
+		}
+		break;
+	case CONSOLE_HANGUP:
+		c = find_channel(channel);
+		if (c) {
+			/* The stream has already ended (session_hangup), so this just stops watching for the name */
+			for (i = 0; i < c->num_agents; i++) {
+				viewer_watch(c->agents[i], channel, 0);
+			}
+			channel_free(c, 1);
+		}
+		break;
+	case CONSOLE_FRAME_LIST:
+		list_channels(cmd->agent);
+		send_macros(cmd->agent);
+		break;
+	case CONSOLE_FRAME_ATTACH:
+		attach(cmd->agent, channel);
+		break;
+	case CONSOLE_FRAME_DETACH:
+		c = find_channel(channel);
+		if (c && channel_has_agent(c, cmd->agent)) {
+			detach(c, cmd->agent, 1);
+		}
+		break;
+	case CONSOLE_FRAME_SEND:
+		send_text(cmd->agent, cmd->payload, cmd->len);
+		break;
+	default:
+		break;
+	}
+}
+
+static void *console_loop(void *unused)
+{
+	struct console_cmd *cmd;
+
+	(void) unused;
+
+	pthread_mutex_lock(&console_lock);
+	while (console_running) {
+		if (!cmd_head) {
+			pthread_cond_wait(&console_cond, &console_lock);
+			continue;
+		}
+		cmd = cmd_head;
+		cmd_head = cmd->next;
+		if (!cmd_head) {
+			cmd_tail = NULL;
+		}
+		pthread_mutex_unlock(&console_lock);
+		handle_cmd(cmd);
+		free(cmd);
+		pthread_mutex_lock(&console_lock);
+	}
+	pthread_mutex_unlock(&console_lock);
+	return NULL;
+}
+
+int webconsole_start(struct ami_session *ami, const char *addr, int port, const char *macro_file)
+{
+	num_macros = macros_load(macro_file, macros);
+	if (num_macros < 0) {
+		return -1;
+	}
+	console_ami = ami;
+	sem_init(&console_done, 0, 0);
+	__atomic_store_n(&console_running, 1, __ATOMIC_RELAXED);
+	if (pthread_create(&console_thread, NULL, console_loop, NULL)) {
+		fprintf(stderr, "Failed to start console thread\n");
+		__atomic_store_n(&console_running, 0, __ATOMIC_RELAXED);
+		sem_destroy(&console_done);
+		return -1;
+	}
+	viewer_set_command_handler(console_command);
+	viewer_set_metrics_handler(sessions_metrics);
+	port = viewer_start_web(addr, port, console_html);
+	if (port < 0) {
+		webconsole_stop();
+	}
+	return port;
+}
+
+static void console_signal(int num)
+{
+	(void) num;
+	sem_post(&console_done); /* Async-signal-safe */
+}
+
+void webconsole_stop(void)
+{
+	struct console_cmd *cmd;
+
+	if (!__atomic_load_n(&console_running, __ATOMIC_RELAXED)) {
+		return;
+	}
+	/* No more commands once the handler is cleared, and the console thread is the only one that touches channels */
+	viewer_set_command_handler(NULL);
+	viewer_set_metrics_handler(NULL);
+	pthread_mutex_lock(&console_lock);
+	console_running = 0;
+	pthread_cond_signal(&console_cond);
+	pthread_mutex_unlock(&console_lock);
+	pthread_join(console_thread, NULL);
+	while ((cmd = cmd_head)) {
+		cmd_head = cmd->next;
+		free(cmd);
+	}
+	cmd_tail = NULL;
+	while (channels) {
+		channel_free(channels, 0);
+	}
+	sem_destroy(&console_done);
+}
+
+int webconsole_run(struct ami_session *ami)
+{
+	signal(SIGINT, console_signal);
+	signal(SIGTERM, console_signal);
+
+	fprintf(stderr, "Web console running, press ^C to stop\n");
+	while (sem_wait(&console_done) && errno == EINTR);
+	fprintf(stderr, "\nAsTTYSpy exiting...\n");
+
+	webconsole_stop();
+	viewer_stop();
+	recorder_stop();
+	ami_disconnect(ami);
+	sessions_destroy(); /* Not until no more events can come in for them */
+	chanmeta_destroy();
+	sessions_report(stderr);
+	ami_destroy(ami);
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief Web console: the virtual TTY, for many agents at once, in a browser
+ *
+ * The page is served by the viewer server (viewer_start_web), and everything
+ * an agent's browser does goes over one WebSocket: the viewer frames for the
+ * sessions it is attached to, plus the commands below. Any number of agents
+ * can be attached to a channel; what they type is merged into one TX queue.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+enum console_frame_type {
+	CONSOLE_FRAME_LIST = VIEWER_FRAME_COMMAND,	/*!< Agent: list channels */
+	CONSOLE_FRAME_CHANNELS,		/*!< Server: one channel per line: name, duration, caller ID, connected line, tab separated */
+	CONSOLE_FRAME_MACROS,		/*!< Server: one macro per line: label, tab, text (newlines as \n) */
+	CONSOLE_FRAME_ATTACH,		/*!< Agent: channel. Enables TTY on it, and starts watching it. */
+	CONSOLE_FRAME_DETACH,		/*!< Agent: channel */
+	CONSOLE_FRAME_SEND,			/*!< Agent: channel (length, then name), then text to send. \b erases. */
+	CONSOLE_FRAME_STATUS,		/*!< Server: a message for the agent */
+};
+
+/*!
+ * \brief Start the web console
+ * \param ami
+ * \param addr Address to listen on
+ * \param port TCP port, or 0 for any
+ * \param macro_file File of macros (see macros_load), or NULL for the defaults
+ * \return Port listening on, or -1 on failure
+ */
+int webconsole_start(struct ami_session *ami, const char *addr, int port, const char *macro_file);
+
+/*! \brief Stop the web console, detaching every agent. The viewer server keeps running. */
+void webconsole_stop(void);
+
+/*! \brief A channel hung up. Doesn't block, so safe to call from the AMI event callback. */
+void webconsole_hangup(const char *channel);
+
+/*! \brief Serve the console until interrupted, then stop it and the viewer server. Disconnects and destroys the AMI session. */
+int webconsole_run(struct ami_session *ami);
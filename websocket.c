@@ -0,0 +1,283 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief WebSocket (RFC 6455) framing and handshake
+ *
+ * SHA-1 is only needed for the handshake, so it's done here (RFC 3174)
+ * rather than linking against a crypto library.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "websocket.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static const char b64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t h[5], const unsigned char *block)
+{
+	uint32_t w[80], a, b, c, d, e, f, k, tmp;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 | (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+	}
+	for (; i < 80; i++) {
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		tmp = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL32(b, 30);
+		b = a;
+		a = tmp;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+static void sha1(const unsigned char *data, size_t len, unsigned char digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	unsigned char block[64];
+	uint64_t bits = (uint64_t) len * 8;
+	size_t i, rest;
+
+	for (i = 0; i + 64 <= len; i += 64) {
+		sha1_block(h, data + i);
+	}
+	rest = len - i;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + i, rest);
+	block[rest] = 0x80;
+	if (rest >= 56) {
+		sha1_block(h, block);
+		memset(block, 0, sizeof(block));
+	}
+	for (i = 0; i < 8; i++) {
+		block[63 - i] = (unsigned char) (bits >> (8 * i));
+	}
+	sha1_block(h, block);
+	for (i = 0; i < 20; i++) {
+		digest[i] = (unsigned char) (h[i / 4] >> (24 - 8 * (i % 4)));
+	}
+}
+
+/*! \brief Base64 encode 20 or 16 bytes (a digest or a key). out must hold 4 * ceil(len / 3) + 1 bytes. */
+static void b64_encode(const unsigned char *in, size_t len, char *out)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		*out++ = b64_chars[in[i] >> 2];
+		*out++ = b64_chars[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+		*out++ = b64_chars[((in[i + 1] & 0x0f) << 2) | (in[i + 2] >> 6)];
+		*out++ = b64_chars[in[i + 2] & 0x3f];
+	}
+	if (i < len) {
+		*out++ = b64_chars[in[i] >> 2];
+		if (i + 1 < len) {
+			*out++ = b64_chars[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+			*out++ = b64_chars[(in[i + 1] & 0x0f) << 2];
+		} else {
+			*out++ = b64_chars[(in[i] & 0x03) << 4];
+			*out++ = '=';
+		}
+		*out++ = '=';
+	}
+	*out = '\0';
+}
+
+void ws_accept_key(const char *key, char *accept)
+{
+	char buf[128];
+	unsigned char digest[20];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s%s", key, WS_GUID);
+	if (len < 0 || (size_t) len >= sizeof(buf)) {
+		len = 0;
+	}
+	sha1((const unsigned char *) buf, (size_t) len, digest);
+	b64_encode(digest, sizeof(digest), accept);
+}
+
+void ws_make_key(char *key)
+{
+	static unsigned int seed = 0;
+	unsigned char nonce[16];
+	size_t i;
+
+	if (!seed) {
+		seed = (unsigned int) time(NULL) ^ (unsigned int) getpid() << 16;
+	}
+	for (i = 0; i < sizeof(nonce); i++) {
+		nonce[i] = (unsigned char) (rand_r(&seed) >> 7);
+	}
+	b64_encode(nonce, sizeof(nonce), key);
+}
+
+size_t ws_frame_header(unsigned char *buf, int opcode, size_t len, const unsigned char *mask)
+{
+	size_t n;
+	int i;
+
+	buf[0] = (unsigned char) (0x80 | opcode); /* FIN */
+	if (len < 126) {
+		buf[1] = (unsigned char) len;
+		n = 2;
+	} else if (len <= 0xffff) {
+		buf[1] = 126;
+		buf[2] = (unsigned char) (len >> 8);
+		buf[3] = (unsigned char) len;
+		n = 4;
+	} else {
+		buf[1] = 127;
+		for (i = 0; i < 8; i++) {
+			buf[2 + i] = (unsigned char) ((uint64_t) len >> (56 - 8 * i));
+		}
+		n = 10;
+	}
+	if (mask) {
+		buf[1] |= 0x80;
+		memcpy(buf + n, mask, 4);
+		n += 4;
+	}
+	return n;
+}
+
+void ws_mask(unsigned char *payload, size_t len, const unsigned char *mask)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		payload[i] ^= mask[i % 4];
+	}
+}
+
+int ws_frame_parse(unsigned char *buf, size_t len, int *fin, int *opcode, unsigned char **payload, size_t *plen)
+{
+	uint64_t n;
+	size_t hdr = 2;
+	int i, masked;
+
+	if (len < 2) {
+		return 0;
+	}
+	if (buf[0] & 0x70) {
+		return -1; /* No extensions were negotiated */
+	}
+	*fin = buf[0] & 0x80 ? 1 : 0;
+	*opcode = buf[0] & 0x0f;
+	masked = buf[1] & 0x80;
+	n = buf[1] & 0x7f;
+	if (n == 126) {
+		if (len < 4) {
+			return 0;
+		}
+		n = (uint64_t) buf[2] << 8 | buf[3];
+		hdr = 4;
+	} else if (n == 127) {
+		if (len < 10) {
+			return 0;
+		}
+		for (n = 0, i = 0; i < 8; i++) {
+			n = n << 8 | buf[2 + i];
+		}
+		hdr = 10;
+	}
+	if (n > 0x7fffffff) {
+		return -1;
+	}
+	if (masked) {
+		hdr += 4;
+	}
+	if (len < hdr + n) {
+		return 0;
+	}
+	*payload = buf + hdr;
+	*plen = (size_t) n;
+	if (masked) {
+		ws_mask(*payload, *plen, buf + hdr - 4);
+	}
+	return (int) (hdr + n);
+}
+
+int http_header(const char *msg, const char *name, char *value, size_t len)
+{
+	const char *line, *end;
+	size_t namelen = strlen(name);
+
+	for (line = strstr(msg, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+		if (strncasecmp(line + 2, name, namelen) || line[2 + namelen] != ':') {
+			continue;
+		}
+		line += 2 + namelen + 1;
+		while (*line == ' ' || *line == '\t') {
+			line++;
+		}
+		end = strstr(line, "\r\n");
+		if (!end) {
+			return -1;
+		}
+		while (end > line && isspace((unsigned char) *(end - 1))) {
+			end--;
+		}
+		snprintf(value, len, "%.*s", (int) (end - line), line);
+		return 0;
+	}
+	return -1;
+}
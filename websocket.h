@@ -0,0 +1,92 @@
+/*
+ * AsTTYSpy: Virtual TDD/TTY for Asterisk
+ *
+ * Copyright (C) 2022, Naveen Albert
+ *
+ * Naveen Albert <asterisk@phreaknet.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file
+ *
+ * \brief WebSocket (RFC 6455) framing and handshake
+ *
+ * Only what the web console needs: unfragmented binary messages,
+ * and close. Frames from clients are masked, frames from servers are not.
+ *
+ * \author Naveen Albert <asterisk@phreaknet.org>
+ */
+
+#include <stddef.h>
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xa
+
+/*! \brief Longest frame header: 2 bytes, a 64-bit length, and a mask */
+#define WS_MAX_HEADER 14
+
+/*! \brief Length of a Sec-WebSocket-Key or Sec-WebSocket-Accept value, plus a null terminator */
+#define WS_KEY_LEN 29
+
+/*!
+ * \brief Compute the Sec-WebSocket-Accept value for a Sec-WebSocket-Key
+ * \param key
+ * \param[out] accept At least WS_KEY_LEN bytes
+ */
+void ws_accept_key(const char *key, char *accept);
+
+/*!
+ * \brief Make a random Sec-WebSocket-Key
+ * \param[out] key At least WS_KEY_LEN bytes
+ */
+void ws_make_key(char *key);
+
+/*!
+ * \brief Encode a frame header
+ * \param buf At least WS_MAX_HEADER bytes
+ * \param opcode
+ * \param len Payload length
+ * \param mask Masking key (clients), or NULL for none (servers). The caller must mask the payload with ws_mask().
+ * \return Header length
+ */
+size_t ws_frame_header(unsigned char *buf, int opcode, size_t len, const unsigned char *mask);
+
+/*! \brief Mask or unmask a payload, in place */
+void ws_mask(unsigned char *payload, size_t len, const unsigned char *mask);
+
+/*!
+ * \brief Parse a frame, unmasking the payload in place if it is masked
+ * \param buf
+ * \param len
+ * \param[out] fin Whether this is the last frame of a message
+ * \param[out] opcode
+ * \param[out] payload
+ * \param[out] plen
+ * \return Bytes used by the frame, 0 if it is incomplete, or -1 if invalid
+ */
+int ws_frame_parse(unsigned char *buf, size_t len, int *fin, int *opcode, unsigned char **payload, size_t *plen);
+
+/*!
+ * \brief Find a header in an HTTP request or response
+ * \param msg Null terminated, ending with a blank line
+ * \param name Header name, without the colon
+ * \param[out] value
+ * \param len Size of value
+ * \retval 0 if found, -1 if not
+ */
+int http_header(const char *msg, const char *name, char *value, size_t len);